@@ -0,0 +1,167 @@
+#include <string.h>
+#include "baseline.h"
+
+#define OP_COUNT (STORE_KEEP + 1)
+
+enum HoleKind
+{
+    HOLE_NONE,
+    HOLE_VARIABLE, // disp32 of [rbp + disp32]
+    HOLE_IMMEDIATE, // imm32
+    HOLE_TARGET, // rel32 to a tape index
+};
+
+struct Stencil
+{
+    uint8_t size;
+    uint8_t hole_kind; // enum HoleKind
+    uint8_t hole; // Offset of the 4 patched bytes
+    uint8_t bytes[12];
+};
+
+// Second operand of binary ops is the top (eax), the first one gets popped into ecx
+static struct Stencil const STENCILS[OP_COUNT] = {
+    [PUSH] = {6, HOLE_IMMEDIATE, 2, {0x50, 0xB8}}, // push rax; mov eax, imm32
+    [POP] = {1, HOLE_NONE, 0, {0x58}}, // pop rax
+    [LOAD] = {7, HOLE_VARIABLE, 3, {0x50, 0x8B, 0x85}}, // push rax; mov eax, [rbp + disp32]
+    [STORE] = {7, HOLE_VARIABLE, 2, {0x89, 0x85, 0, 0, 0, 0, 0x58}}, // mov [rbp + disp32], eax; pop rax
+    [NOT] = {8, HOLE_NONE, 0, {0x85, 0xC0, 0x0F, 0x94, 0xC0, 0x0F, 0xB6, 0xC0}}, // test eax, eax; sete al; movzx eax, al
+    [NEG] = {2, HOLE_NONE, 0, {0xF7, 0xD8}}, // neg eax
+    [BIT_NOT] = {2, HOLE_NONE, 0, {0xF7, 0xD0}}, // not eax
+    [ADD] = {3, HOLE_NONE, 0, {0x59, 0x01, 0xC8}}, // pop rcx; add eax, ecx
+    [SUB] = {5, HOLE_NONE, 0, {0x59, 0x29, 0xC1, 0x89, 0xC8}}, // pop rcx; sub ecx, eax; mov eax, ecx
+    [MUL] = {4, HOLE_NONE, 0, {0x59, 0x0F, 0xAF, 0xC1}}, // pop rcx; imul eax, ecx
+    [DIV] = {6, HOLE_NONE, 0, {0x89, 0xC1, 0x58, 0x99, 0xF7, 0xF9}}, // mov ecx, eax; pop rax; cdq; idiv ecx
+    [REM] = {8, HOLE_NONE, 0, {0x89, 0xC1, 0x58, 0x99, 0xF7, 0xF9, 0x89, 0xD0}}, // Same, then mov eax, edx
+    [LSHIFT] = {5, HOLE_NONE, 0, {0x89, 0xC1, 0x58, 0xD3, 0xE0}}, // mov ecx, eax; pop rax; shl eax, cl
+    [RSHIFT] = {5, HOLE_NONE, 0, {0x89, 0xC1, 0x58, 0xD3, 0xF8}}, // mov ecx, eax; pop rax; sar eax, cl
+    [BIT_AND] = {3, HOLE_NONE, 0, {0x59, 0x21, 0xC8}}, // pop rcx; and eax, ecx
+    [BIT_OR] = {3, HOLE_NONE, 0, {0x59, 0x09, 0xC8}}, // pop rcx; or eax, ecx
+    [BIT_XOR] = {3, HOLE_NONE, 0, {0x59, 0x31, 0xC8}}, // pop rcx; xor eax, ecx
+    // pop rcx; cmp ecx, eax; setcc al; movzx eax, al
+    [EQ] = {9, HOLE_NONE, 0, {0x59, 0x39, 0xC1, 0x0F, 0x94, 0xC0, 0x0F, 0xB6, 0xC0}},
+    [NE] = {9, HOLE_NONE, 0, {0x59, 0x39, 0xC1, 0x0F, 0x95, 0xC0, 0x0F, 0xB6, 0xC0}},
+    [LT] = {9, HOLE_NONE, 0, {0x59, 0x39, 0xC1, 0x0F, 0x9C, 0xC0, 0x0F, 0xB6, 0xC0}},
+    [LE] = {9, HOLE_NONE, 0, {0x59, 0x39, 0xC1, 0x0F, 0x9E, 0xC0, 0x0F, 0xB6, 0xC0}},
+    [GT] = {9, HOLE_NONE, 0, {0x59, 0x39, 0xC1, 0x0F, 0x9F, 0xC0, 0x0F, 0xB6, 0xC0}},
+    [GE] = {9, HOLE_NONE, 0, {0x59, 0x39, 0xC1, 0x0F, 0x9D, 0xC0, 0x0F, 0xB6, 0xC0}},
+    [JMP] = {5, HOLE_TARGET, 1, {0xE9}}, // jmp rel32
+    [JZ] = {9, HOLE_TARGET, 5, {0x85, 0xC0, 0x58, 0x0F, 0x84}}, // test eax, eax; pop rax; jz rel32
+    [JNZ] = {9, HOLE_TARGET, 5, {0x85, 0xC0, 0x58, 0x0F, 0x85}}, // test eax, eax; pop rax; jnz rel32
+    [RET] = {2, HOLE_NONE, 0, {0xC9, 0xC3}}, // leave; ret
+    [ADD_IMM] = {5, HOLE_IMMEDIATE, 1, {0x05}}, // add eax, imm32
+    [LOAD_ADD] = {6, HOLE_VARIABLE, 2, {0x03, 0x85}}, // add eax, [rbp + disp32]
+    [STORE_KEEP] = {6, HOLE_VARIABLE, 2, {0x89, 0x85}}, // mov [rbp + disp32], eax
+};
+
+#define MAX_STENCIL_SIZE 9
+
+// push rbp; mov rbp, rsp; sub rsp, frame bytes; then the frame is zeroed
+// like the interpreter's: mov rdi, rsp; mov ecx, frame dwords; xor eax, eax; rep stosd
+static uint8_t const PROLOGUE[] = {
+    0x55, 0x48, 0x89, 0xE5, 0x48, 0x81, 0xEC, 0, 0, 0, 0,
+    0x48, 0x89, 0xE7, 0xB9, 0, 0, 0, 0, 0x31, 0xC0, 0xF3, 0xAB
+};
+#define PROLOGUE_FRAME_BYTES 7
+#define PROLOGUE_FRAME_DWORDS 15
+
+// Falling off the end returns 0: xor eax, eax; leave; ret
+static uint8_t const EPILOGUE[] = {0x31, 0xC0, 0xC9, 0xC3};
+
+static void patch(uint8_t* code, size_t offset, int32_t value)
+{
+    memcpy(&code[offset], &value, sizeof(value));
+}
+
+char* baseline_compile(struct VirtualMachineCode const* vm, struct EncodedFunction* function)
+{
+    size_t const size = vm->tape.size;
+    union Bytecode const* tape = vm->tape.data;
+    size_t const capacity = sizeof(PROLOGUE) + size * MAX_STENCIL_SIZE + sizeof(EPILOGUE);
+    uint8_t* code = cc_malloc(capacity + 1);
+    // Code offset of every tape index an op starts at, UINT32_MAX elsewhere
+    uint32_t* offsets = cc_malloc((size + 1) * sizeof(uint32_t));
+    memset(offsets, 0xFF, (size + 1) * sizeof(uint32_t));
+    // Holes of the jumps, resolved once all offsets are known
+    uint32_t* jump_holes = cc_malloc((size + 1) * sizeof(uint32_t));
+    uint32_t* jump_targets = cc_malloc((size + 1) * sizeof(uint32_t));
+    size_t jump_count = 0;
+    int32_t frame_bytes = 0;
+    char* error = NULL;
+
+    memcpy(code, PROLOGUE, sizeof(PROLOGUE));
+    size_t length = sizeof(PROLOGUE);
+    for (size_t idx = 0; idx < size && error == NULL; ++idx)
+    {
+        enum BytecodeOp const op = tape[idx].op;
+        if ((unsigned) op >= OP_COUNT || STENCILS[op].size == 0)
+        {
+            error = op == CALL ? format("calls are not supported") : format("unknown op %d at %zu", (int) op, idx);
+            break;
+        }
+        offsets[idx] = length;
+        struct Stencil const* stencil = &STENCILS[op];
+        memcpy(&code[length], stencil->bytes, stencil->size);
+        if (stencil->hole_kind != HOLE_NONE)
+        {
+            if (++idx == size)
+            {
+                error = format("missing operand at the end");
+                break;
+            }
+            int32_t const operand = tape[idx].value;
+            switch ((enum HoleKind) stencil->hole_kind)
+            {
+                case HOLE_NONE:
+                    break;
+                case HOLE_VARIABLE:
+                    if (operand < 0 || operand % sizeof(int32_t) != 0 || operand > INT32_MAX - 16)
+                    {
+                        error = format("bad variable offset %d", operand);
+                    }
+                    else if (operand + (int32_t) sizeof(int32_t) > frame_bytes) frame_bytes = operand + sizeof(int32_t);
+                    patch(code, length + stencil->hole, -operand - (int32_t) sizeof(int32_t));
+                    break;
+                case HOLE_IMMEDIATE:
+                    patch(code, length + stencil->hole, operand);
+                    break;
+                case HOLE_TARGET:
+                    jump_holes[jump_count] = length + stencil->hole;
+                    jump_targets[jump_count++] = operand;
+                    break;
+            }
+        }
+        length += stencil->size;
+    }
+    offsets[size] = length;
+    memcpy(&code[length], EPILOGUE, sizeof(EPILOGUE));
+    length += sizeof(EPILOGUE);
+
+    for (size_t jump = 0; jump < jump_count && error == NULL; ++jump)
+    {
+        uint32_t const target = jump_targets[jump];
+        if (target > size || offsets[target] == UINT32_MAX)
+        {
+            error = format("bad jump target %d", (int32_t) target);
+            break;
+        }
+        patch(code, jump_holes[jump], offsets[target] - (jump_holes[jump] + 4));
+    }
+    frame_bytes = (frame_bytes + 15) / 16 * 16;
+    patch(code, PROLOGUE_FRAME_BYTES, frame_bytes);
+    patch(code, PROLOGUE_FRAME_DWORDS, frame_bytes / sizeof(int32_t));
+
+    free(offsets);
+    free(jump_holes);
+    free(jump_targets);
+    if (error != NULL)
+    {
+        free(code);
+        return error;
+    }
+    *function = (struct EncodedFunction) {
+        .symbol = vm->symbol,
+        .code = {.data = code, .size = length, .max_capacity = capacity + 1}
+    };
+    return NULL;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include "bytecode.h"
+#include "encode.h"
+
+// Baseline tier for when compile time matters more than the code (--baseline):
+// copy-and-patch straight from the tape, in one pass and without building
+// any IR. Every op has a stencil, a fixed piece of machine code with at most
+// one hole (variable offset, immediate or jump target), which is copied out
+// and patched. Jump targets are patched at the end, once every op has its
+// place.
+//
+// The code keeps the operand stack top in eax and the rest on the machine
+// stack, variables live in the frame below rbp. The tape is trusted to keep
+// the stack balanced, as compile_to_vm does.
+
+// Returns NULL, or a message (to be freed) if the tape is malformed
+char* baseline_compile(struct VirtualMachineCode const* vm, struct EncodedFunction* function);
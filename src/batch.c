@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <string.h>
+#include "batch.h"
+#include "intern.h"
+#include "pipeline.h"
+
+struct BatchFile
+{
+    struct FileCompilation compilation;
+    char* error; // NULL if it compiled
+};
+
+static char* output_path(char const* path)
+{
+    size_t length = strlen(path);
+    if (length > 2 && strcmp(&path[length - 2], ".c") == 0) length -= 2;
+    return format("%.*s.asm", (int) length, path);
+}
+
+static void write_assembly(char const* path, struct StringArray const* assembly)
+{
+    char* output = output_path(path);
+    FILE* file = fopen(output, "w");
+    bool written = file != NULL;
+    for (size_t idx = 0; written && idx < assembly->size; ++idx)
+    {
+        written = fprintf(file, "%s\n", assembly->data[idx]) >= 0;
+    }
+    if (file != NULL && fclose(file) != 0) written = false;
+    if (!written)
+    {
+        struct ErrorCleanup cleanup = {.release = free, .context = output};
+        push_error_cleanup(&cleanup);
+        compile_error("Could not write %s", output);
+    }
+    free(output);
+}
+
+static void compile_and_write(void* context)
+{
+    struct FileCompilation* file = context;
+    compile_file(file);
+    write_assembly(file->path, &file->assembly);
+}
+
+// One file per thread already, functions of a file stay on it
+static void batch_task(void* context, size_t idx)
+{
+    struct BatchFile* file = &((struct BatchFile*) context)[idx];
+    file->compilation.arena = new_arena("ast");
+    file->error = run_guarded(compile_and_write, &file->compilation);
+    release_file_compilation(&file->compilation);
+}
+
+int run_batch(struct StringArray const* paths, struct ThreadPool* pool, bool optimize, bool mem_stats,
+    struct CompileCache* cache)
+{
+    struct BatchFile* files = cc_malloc(paths->size * sizeof(struct BatchFile));
+    for (size_t idx = 0; idx < paths->size; ++idx)
+    {
+        files[idx].compilation.path = paths->data[idx];
+        files[idx].compilation.cache = cache;
+        files[idx].compilation.optimize = optimize;
+    }
+
+    double const start = now_seconds();
+    thread_pool_for(pool, paths->size, batch_task, files);
+    double const elapsed = now_seconds() - start;
+
+    size_t failed = 0;
+    size_t bytes = 0;
+    size_t functions = 0;
+    for (size_t idx = 0; idx < paths->size; ++idx)
+    {
+        bytes += files[idx].compilation.bytes;
+        functions += files[idx].compilation.functions;
+        if (files[idx].error == NULL) continue;
+        printf("%s: %s\n", files[idx].compilation.path, files[idx].error);
+        free(files[idx].error);
+        ++failed;
+    }
+    double const megabytes = bytes / (1024.0 * 1024.0);
+    printf("Compiled %zu of %zu files (%zu functions, %.1f MB) in %.3f s on %zu threads: %.1f files/s, %.1f MB/s\n",
+        paths->size - failed, paths->size, functions, megabytes, elapsed, thread_pool_size(pool),
+        paths->size / elapsed, megabytes / elapsed);
+    if (cache != NULL) print_cache_stats(cache);
+    if (mem_stats)
+    {
+        printf("Memory statistics:\n");
+        print_arena_stats(interner_arena());
+        printf("  %zu interned symbols, %zu arena blocks reused\n", interned_count(), arena_blocks_reused());
+    }
+    free(files);
+    return failed == 0 ? 0 : 1;
+}
+
+void read_response_file(char const* path, struct StringArray* paths)
+{
+    struct SourceInput input;
+    read_input(path, &input);
+    size_t position = 0;
+    while (position < input.size)
+    {
+        while (position < input.size && is_whitespace(input.data[position])) ++position;
+        size_t const start = position;
+        while (position < input.size && !is_whitespace(input.data[position])) ++position;
+        if (position == start) continue;
+        char* entry = format("%.*s", (int) (position - start), &input.data[start]);
+        add_string(paths, entry);
+        free(entry);
+    }
+    close_input(&input);
+}
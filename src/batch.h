@@ -0,0 +1,16 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include "cache.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+// Compiles many independent inputs in one process. Files are spread over the
+// pool and share the interner and the arena block pool. `name.c` gets its
+// assembly in `name.asm`. A failing file does not stop the others, errors are
+// reported per file in input order. The cache is optional. Returns the process exit code.
+int run_batch(struct StringArray const* paths, struct ThreadPool* pool, bool optimize, bool mem_stats,
+    struct CompileCache* cache);
+
+// Adds the paths listed in a response file (separated by whitespace, no quoting)
+void read_response_file(char const* path, struct StringArray* paths);
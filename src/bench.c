@@ -0,0 +1,1364 @@
+#include <dirent.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "baseline.h"
+#include "bench.h"
+#include "bytecode.h"
+#include "flat_ast.h"
+#include "incremental.h"
+#include "interpreter.h"
+#include "jit.h"
+#include "object.h"
+#include "pipeline.h"
+#include "frontend.h"
+#include "scan.h"
+#include "server.h"
+#include "ssa.h"
+#include "utils.h"
+#include "x86.h"
+
+#define BENCH_REPETITIONS 5
+
+static void append(char* buffer, size_t* length, char const* text)
+{
+    size_t text_length = strlen(text);
+    memcpy(buffer + *length, text, text_length);
+    *length += text_length;
+}
+
+// Looks like the generated sources we care about: deep indentation, long names, comments
+static char* generate_source(size_t target_size, size_t* length)
+{
+    char* buffer = cc_malloc(target_size + 256);
+    *length = 0;
+    append(buffer, length, "int main()\n{\n");
+    for (size_t line = 0; *length < target_size; ++line)
+    {
+        char text[160];
+        switch (line % 4)
+        {
+            case 0:
+                snprintf(text, sizeof(text), "    int generated_variable_%zu = %zu;\n", line, line * 7919);
+                break;
+            case 1:
+                snprintf(text, sizeof(text), "        generated_variable_%zu = generated_variable_%zu + %zu;\n", line - 1, line - 1, line);
+                break;
+            case 2:
+                snprintf(text, sizeof(text), "    // Generated from table entry %zu, do not edit by hand\n", line);
+                break;
+            case 3:
+                snprintf(text, sizeof(text), "                                    \n");
+                break;
+        }
+        append(buffer, length, text);
+    }
+    append(buffer, length, "    return 0;\n}\n");
+    buffer[*length] = '\0';
+    return buffer;
+}
+
+static int bench_lex()
+{
+    size_t length;
+    char* source = generate_source(32 << 20, &length);
+    double const megabytes = length / (1024.0 * 1024.0);
+    printf("lex: %.1f MB of generated source, best of %d runs\n", megabytes, BENCH_REPETITIONS);
+
+    size_t expected_tokens = 0;
+    for (int mode = SCAN_SCALAR; mode <= (int) scan_detect_mode(); ++mode)
+    {
+        double best = 1e30;
+        size_t tokens = 0;
+        set_lexer_scan_mode(mode);
+        for (int run = 0; run < BENCH_REPETITIONS; ++run)
+        {
+            double start = now_seconds();
+            struct TokenStream stream = tokenize(source, length);
+            double elapsed = now_seconds() - start;
+            if (elapsed < best) best = elapsed;
+            tokens = stream.size;
+            free_token_stream(&stream);
+        }
+        if (mode == SCAN_SCALAR) expected_tokens = tokens;
+        printf("  %-8s %8.1f MB/s  %zu tokens%s\n",
+            scan_mode_name(mode), megabytes / best, tokens,
+            tokens == expected_tokens ? "" : "  MISMATCH");
+        if (tokens != expected_tokens) return 1;
+    }
+    set_lexer_scan_mode(scan_detect_mode());
+    free(source);
+    return 0;
+}
+
+static char const* const keyword_lines[] = {
+    "static const unsigned int table_%zu = sizeof(struct entry);\n",
+    "    if (x) return integer_%zu; else while (y) continue;\n",
+    "    for (register long i = %zu; i; i = i) do break; while (0);\n",
+    "typedef volatile signed short returned_%zu; extern inline void f();\n",
+    "    switch (e) { case %zu: goto done; default: break; }\n",
+};
+
+static char* generate_keyword_source(size_t target_size, size_t* length)
+{
+    size_t const line_kinds = sizeof(keyword_lines) / sizeof(char const*);
+    char* buffer = cc_malloc(target_size + 256);
+    *length = 0;
+    for (size_t line = 0; *length < target_size; ++line)
+    {
+        char text[160];
+        snprintf(text, sizeof(text), keyword_lines[line % line_kinds], line);
+        append(buffer, length, text);
+    }
+    buffer[*length] = '\0';
+    return buffer;
+}
+
+// What the lexer used to do: one comparison per known keyword
+static enum TokenType classify_keyword_linearly(char const* text, size_t length)
+{
+    static struct {
+        char const* text;
+        enum TokenType type;
+    } const keywords[] = {
+#define KEYWORD(text, token) {#text, token},
+#include "keywords.def"
+#undef KEYWORD
+    };
+    for (size_t idx = 0; idx < sizeof(keywords) / sizeof(keywords[0]); ++idx)
+    {
+        if (strlen(keywords[idx].text) == length && memcmp(keywords[idx].text, text, length) == 0)
+        {
+            return keywords[idx].type;
+        }
+    }
+    return TOK_NAME;
+}
+
+static int bench_keywords()
+{
+    size_t length;
+    char* source = generate_keyword_source(16 << 20, &length);
+    double const megabytes = length / (1024.0 * 1024.0);
+    printf("keywords: %.1f MB of keyword heavy source, best of %d runs\n", megabytes, BENCH_REPETITIONS);
+
+    double best = 1e30;
+    struct TokenStream stream = {0};
+    for (int run = 0; run < BENCH_REPETITIONS; ++run)
+    {
+        free_token_stream(&stream);
+        double start = now_seconds();
+        stream = tokenize(source, length);
+        double elapsed = now_seconds() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    printf("  lexer    %8.1f MB/s  %8.1f Mtokens/s\n", megabytes / best, stream.size / best * 1e-6);
+
+    // Classification on its own, over every identifier and keyword in the corpus
+    size_t words = 0;
+    struct StringView* word_texts = cc_malloc(stream.size * sizeof(struct StringView));
+    for (size_t idx = 0; idx < stream.size; ++idx)
+    {
+        if (is_identifier_start(source[stream.offsets[idx]])) word_texts[words++] = token_text(&stream, idx);
+    }
+    enum TokenType (*const classifiers[])(char const*, size_t) = {classify_keyword, classify_keyword_linearly};
+    char const* const classifier_names[] = {"hash", "linear"};
+    size_t checksums[2] = {0};
+    for (size_t classifier = 0; classifier < 2; ++classifier)
+    {
+        best = 1e30;
+        for (int run = 0; run < BENCH_REPETITIONS; ++run)
+        {
+            size_t checksum = 0;
+            double start = now_seconds();
+            for (size_t word = 0; word < words; ++word)
+            {
+                checksum += classifiers[classifier](word_texts[word].data, word_texts[word].length);
+            }
+            double elapsed = now_seconds() - start;
+            if (elapsed < best) best = elapsed;
+            checksums[classifier] = checksum;
+        }
+        printf("  %-8s %8.1f ns/word  (%zu words)\n", classifier_names[classifier], best / words * 1e9, words);
+    }
+    free(word_texts);
+    free_token_stream(&stream);
+    free(source);
+    if (checksums[0] != checksums[1])
+    {
+        printf("  MISMATCH between hash and linear classification\n");
+        return 1;
+    }
+    return 0;
+}
+
+// Large generated lookup tables, mostly long decimal and hex constants
+static char* generate_literal_source(size_t target_size, size_t* length)
+{
+    char* buffer = cc_malloc(target_size + 256);
+    *length = 0;
+    uint64_t state = 88172645463325252ull;
+    for (size_t line = 0; *length < target_size; ++line)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        char text[160];
+        switch (line % 4)
+        {
+            case 0:
+                snprintf(text, sizeof(text), "%llu, %llu, %llu, %llu,\n",
+                    (unsigned long long) state, (unsigned long long) (state >> 20),
+                    (unsigned long long) (state >> 40), (unsigned long long) (state & 0xFFFF));
+                break;
+            case 1:
+                snprintf(text, sizeof(text), "0x%llX, 0x%llxu, %lluull, 0%llo,\n",
+                    (unsigned long long) state, (unsigned long long) (state >> 32),
+                    (unsigned long long) (state >> 8), (unsigned long long) (state >> 50));
+                break;
+            default:
+                snprintf(text, sizeof(text), "%llu, %llu, %llu, %llu, %llu, %llu,\n",
+                    (unsigned long long) (state % 1000), (unsigned long long) (state >> 54),
+                    (unsigned long long) (state >> 33), (unsigned long long) (state % 100000),
+                    (unsigned long long) (state >> 1), (unsigned long long) (state >> 61));
+                break;
+        }
+        append(buffer, length, text);
+    }
+    buffer[*length] = '\0';
+    return buffer;
+}
+
+static int bench_literals()
+{
+    size_t length;
+    char* source = generate_literal_source(32 << 20, &length);
+    double const megabytes = length / (1024.0 * 1024.0);
+    printf("literals: %.1f MB of generated tables, best of %d runs\n", megabytes, BENCH_REPETITIONS);
+
+    double best = 1e30;
+    struct TokenStream stream = {0};
+    for (int run = 0; run < BENCH_REPETITIONS; ++run)
+    {
+        free_token_stream(&stream);
+        double start = now_seconds();
+        stream = tokenize(source, length);
+        double elapsed = now_seconds() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    size_t const literals = stream.literals.size;
+    printf("  lexer    %8.1f MB/s  %8.1f Mliterals/s\n", megabytes / best, literals / best * 1e-6);
+
+    // Literal conversion on its own, compared with strtoull (which stops at the suffix)
+    uint64_t checksums[2] = {0};
+    for (int parser = 0; parser < 2; ++parser)
+    {
+        best = 1e30;
+        for (int run = 0; run < BENCH_REPETITIONS; ++run)
+        {
+            uint64_t checksum = 0;
+            double start = now_seconds();
+            for (size_t idx = 0; idx < stream.size; ++idx)
+            {
+                if (stream.types[idx] != TOK_INT_VALUE) continue;
+                size_t const offset = stream.offsets[idx];
+                if (parser == 0)
+                {
+                    struct IntegerLiteral literal;
+                    lex_integer_literal(source, offset, offset + stream.lengths[idx], &literal);
+                    checksum += literal.value;
+                }
+                else
+                {
+                    checksum += strtoull(&source[offset], NULL, 0);
+                }
+            }
+            double elapsed = now_seconds() - start;
+            if (elapsed < best) best = elapsed;
+            checksums[parser] = checksum;
+        }
+        printf("  %-8s %8.1f ns/literal\n", parser == 0 ? "swar" : "strtoull", best / literals * 1e9);
+    }
+    free_token_stream(&stream);
+    free(source);
+    if (checksums[0] != checksums[1])
+    {
+        printf("  MISMATCH between the lexer and strtoull\n");
+        return 1;
+    }
+    return 0;
+}
+
+// One statement with a huge expression: `chain` is a flat run of mixed operators,
+// otherwise every term opens a parenthesis that is only closed at the end
+static char* generate_expression_source(size_t terms, bool nested, size_t* length)
+{
+    static char const* const operators[] = {" + ", " * ", " - ", " & ", " << ", " | ", " ^ ", " == ", " && ", " || "};
+    size_t const operator_count = sizeof(operators) / sizeof(char const*);
+    char* buffer = cc_malloc(terms * 24 + 256);
+    *length = 0;
+    append(buffer, length, "int main()\n{\n    int x = 1;\n    return ");
+    for (size_t term = 0; term < terms; ++term)
+    {
+        char operand[32];
+        if (term % 3 == 0) snprintf(operand, sizeof(operand), "%zu", term);
+        else snprintf(operand, sizeof(operand), term % 3 == 1 ? "x" : "-x");
+        char text[64];
+        snprintf(text, sizeof(text), "%s%s%s", term == 0 ? "" : operators[term % operator_count],
+            nested && term + 1 < terms ? "(" : "", operand);
+        append(buffer, length, text);
+    }
+    for (size_t term = 1; nested && term < terms; ++term) append(buffer, length, ")");
+    append(buffer, length, ";\n}\n");
+    buffer[*length] = '\0';
+    return buffer;
+}
+
+// One statement of `terms` copies of x joined by `link`, like " && " or
+// " ? x : ", every link is a branch and a join in the backend
+static char* generate_chain_source(size_t terms, char const* link, size_t* length)
+{
+    char* buffer = cc_malloc(terms * (strlen(link) + 1) + 256);
+    *length = 0;
+    append(buffer, length, "int main()\n{\n    int x = 1;\n    return x");
+    for (size_t term = 1; term < terms; ++term)
+    {
+        append(buffer, length, link);
+        append(buffer, length, "x");
+    }
+    append(buffer, length, ";\n}\n");
+    buffer[*length] = '\0';
+    return buffer;
+}
+
+// Mixed operators (`link` NULL), or a chain of one short circuiting operator
+struct ExpressionShape
+{
+    char const* name;
+    char const* link;
+    bool nested;
+    size_t terms;
+};
+
+static int bench_expressions()
+{
+    static struct ExpressionShape const shapes[] = {
+        {"chain", NULL, false, 1000000},
+        {"nested", NULL, true, 1000000},
+        {"&&", " && ", false, 100000},
+        {"||", " || ", false, 100000},
+        {"?:", " ? x : ", false, 100000},
+    };
+    printf("expressions: one expression per shape, best of %d runs\n", BENCH_REPETITIONS);
+    for (size_t shape = 0; shape < sizeof(shapes) / sizeof(struct ExpressionShape); ++shape)
+    {
+        size_t const terms = shapes[shape].terms;
+        size_t length;
+        char* source = shapes[shape].link == NULL
+            ? generate_expression_source(terms, shapes[shape].nested, &length)
+            : generate_chain_source(terms, shapes[shape].link, &length);
+        struct TokenStream tokens = tokenize(source, length);
+
+        double best_parse = 1e30;
+        double best_backend = 1e30;
+        size_t tape_size = 0;
+        for (int run = 0; run < BENCH_REPETITIONS; ++run)
+        {
+            struct Arena arena = new_arena("bench");
+            double start = now_seconds();
+            struct TranslationUnitAst* ast = parse(&tokens, &arena);
+            double parsed = now_seconds();
+            struct FlatFunction function = flatten_function(ast->functions[0]);
+            struct VirtualMachineCode vm = compile_to_vm(&function);
+            double compiled = now_seconds();
+            if (parsed - start < best_parse) best_parse = parsed - start;
+            if (compiled - parsed < best_backend) best_backend = compiled - parsed;
+            tape_size = vm.tape.size;
+            free(vm.tape.data);
+            free(vm.stack_offsets.data);
+            free_flat_function(&function);
+            arena_release(&arena);
+        }
+        printf("  %-8s %7zu terms  parse %8.1f Mterms/s  flatten + bytecode %8.1f Mterms/s  (%zu tape slots)\n",
+            shapes[shape].name, terms, terms / best_parse * 1e-6, terms / best_backend * 1e-6, tape_size);
+        free_token_stream(&tokens);
+        free(source);
+    }
+    return 0;
+}
+
+#define CONCURRENT_UNITS 4
+
+struct ConcurrentUnit
+{
+    char const* source;
+    size_t length;
+    struct Tape tape; // Result
+};
+
+// Whole pipeline on one input, with nothing shared but the interner
+static void* compile_concurrent_unit(void* argument)
+{
+    struct ConcurrentUnit* unit = argument;
+    struct TokenStream tokens = tokenize(unit->source, unit->length);
+    struct Arena arena = new_arena("bench");
+    struct TranslationUnitAst* ast = parse(&tokens, &arena);
+    struct FlatFunction function = flatten_function(ast->functions[0]);
+    struct VirtualMachineCode vm = compile_to_vm(&function);
+    unit->tape = vm.tape;
+    free(vm.stack_offsets.data);
+    free_flat_function(&function);
+    arena_release(&arena);
+    free_token_stream(&tokens);
+    return NULL;
+}
+
+static int bench_concurrent()
+{
+    size_t length;
+    char* source = generate_source(8 << 20, &length);
+    double const megabytes = length / (1024.0 * 1024.0);
+    printf("concurrent: %d units of %.1f MB on separate threads, best of %d runs\n",
+        CONCURRENT_UNITS, megabytes, BENCH_REPETITIONS);
+
+    struct ConcurrentUnit reference = {source, length, {0}};
+    double best = 1e30;
+    for (int run = 0; run < BENCH_REPETITIONS; ++run)
+    {
+        free(reference.tape.data);
+        double start = now_seconds();
+        compile_concurrent_unit(&reference);
+        double elapsed = now_seconds() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    printf("  1 thread  %8.1f MB/s\n", megabytes / best);
+
+    struct ConcurrentUnit units[CONCURRENT_UNITS];
+    int mismatches = 0;
+    best = 1e30;
+    for (int run = 0; run < BENCH_REPETITIONS; ++run)
+    {
+        pthread_t threads[CONCURRENT_UNITS];
+        double start = now_seconds();
+        for (int idx = 0; idx < CONCURRENT_UNITS; ++idx)
+        {
+            units[idx] = (struct ConcurrentUnit) {source, length, {0}};
+            pthread_create(&threads[idx], NULL, compile_concurrent_unit, &units[idx]);
+        }
+        for (int idx = 0; idx < CONCURRENT_UNITS; ++idx) pthread_join(threads[idx], NULL);
+        double elapsed = now_seconds() - start;
+        if (elapsed < best) best = elapsed;
+        for (int idx = 0; idx < CONCURRENT_UNITS; ++idx)
+        {
+            mismatches += units[idx].tape.size != reference.tape.size
+                || memcmp(units[idx].tape.data, reference.tape.data, reference.tape.size * sizeof(union Bytecode)) != 0;
+            free(units[idx].tape.data);
+        }
+    }
+    printf("  %d threads %8.1f MB/s%s\n", CONCURRENT_UNITS, CONCURRENT_UNITS * megabytes / best,
+        mismatches == 0 ? "" : "  MISMATCH");
+    free(reference.tape.data);
+    free(source);
+    return mismatches != 0;
+}
+
+static char* generate_function_source(size_t functions, size_t* length)
+{
+    char* buffer = cc_malloc(functions * 256 + 256);
+    *length = 0;
+    for (size_t function = 0; function < functions; ++function)
+    {
+        char text[256];
+        snprintf(text, sizeof(text),
+            "int generated_function_%zu()\n{\n    int a = %zu;\n    int b = a * 3 + (a << 2);\n"
+            "    a = a - b ^ %zu;\n    b = a > b ? a : b && a || -b;\n    return a + b * (a - %zu);\n}\n",
+            function, function, function * 31, function % 17);
+        append(buffer, length, text);
+    }
+    buffer[*length] = '\0';
+    return buffer;
+}
+
+static void append_tree(char* buffer, size_t* length, uint32_t* state, int depth)
+{
+    static char const* const operators[] = {" + ", " - ", " * ", " & ", " | ", " ^ "};
+    *state = *state * 1103515245u + 12345u;
+    uint32_t const choice = *state >> 16;
+    if (depth == 0 || choice % 8 == 0)
+    {
+        char const leaf[] = {"bcde"[choice / 8 % 4], '\0'};
+        append(buffer, length, leaf);
+        return;
+    }
+    append(buffer, length, "(");
+    append_tree(buffer, length, state, depth - 1);
+    append(buffer, length, operators[choice / 32 % 6]);
+    append_tree(buffer, length, state, depth - 1);
+    append(buffer, length, ")");
+}
+
+// Every function returns a random expression tree over values that stay
+// live, meant to be compiled without -O so that nothing is folded away
+static char* generate_tree_source(size_t functions, size_t* length)
+{
+    // A tree of depth 5 is at most 32 leaves, 31 operators and 31 parentheses
+    char* buffer = cc_malloc(functions * 512 + 256);
+    *length = 0;
+    uint32_t state = 1;
+    for (size_t function = 0; function < functions; ++function)
+    {
+        char text[256];
+        snprintf(text, sizeof(text), "int tree_function_%zu()\n{\n    int a = %zu;\n    int b = a * 3;\n    int c = b - a;\n"
+            "    int d = c ^ b;\n    int e = d + a;\n    return ", function, function);
+        append(buffer, length, text);
+        append_tree(buffer, length, &state, 5);
+        append(buffer, length, ";\n}\n");
+    }
+    buffer[*length] = '\0';
+    return buffer;
+}
+
+static bool same_code(struct CompiledUnit const* first, struct CompiledUnit const* second)
+{
+    if (first->function_count != second->function_count) return false;
+    for (size_t idx = 0; idx < first->function_count; ++idx)
+    {
+        struct Tape const* a = &first->code[idx].tape;
+        struct Tape const* b = &second->code[idx].tape;
+        if (a->size != b->size || memcmp(a->data, b->data, a->size * sizeof(union Bytecode)) != 0) return false;
+    }
+    return true;
+}
+
+static int bench_functions()
+{
+    size_t const functions = 50000;
+    size_t length;
+    char* source = generate_function_source(functions, &length);
+    struct TokenStream tokens = tokenize(source, length);
+    struct Arena arena = new_arena("bench");
+    struct TranslationUnitAst* ast = parse(&tokens, &arena);
+    printf("functions: backend of %zu functions, best of %d runs, %ld cores\n",
+        ast->function_count, BENCH_REPETITIONS, sysconf(_SC_NPROCESSORS_ONLN));
+
+    struct CompiledUnit reference = {0};
+    bool mismatch = false;
+    size_t const thread_counts[] = {1, 2, 4, 8};
+    for (size_t config = 0; config < sizeof(thread_counts) / sizeof(size_t); ++config)
+    {
+        struct ThreadPool* pool = new_thread_pool(thread_counts[config]);
+        double best = 1e30;
+        for (int run = 0; run < BENCH_REPETITIONS; ++run)
+        {
+            double start = now_seconds();
+            struct CompiledUnit unit = compile_unit(ast, pool, &(struct UnitOptions) {.backend = true});
+            double elapsed = now_seconds() - start;
+            if (elapsed < best) best = elapsed;
+            if (reference.function_count == 0) reference = unit;
+            else
+            {
+                mismatch |= !same_code(&reference, &unit);
+                free_compiled_unit(&unit);
+            }
+        }
+        free_thread_pool(pool);
+        printf("  -j %-5zu %8.1f Kfunctions/s%s\n", thread_counts[config], functions / best * 1e-3,
+            mismatch ? "  MISMATCH" : "");
+    }
+    free_compiled_unit(&reference);
+    arena_release(&arena);
+    free_token_stream(&tokens);
+    free(source);
+    return mismatch;
+}
+
+// A 100k line file with one function edited since the last compile
+static int bench_incremental()
+{
+    size_t const functions = 12500;
+    size_t length;
+    char* source = generate_function_source(functions, &length);
+    char* state_path = format("/tmp/real_c_compiler_bench_%d.state", (int) getpid());
+    printf("incremental: %zu functions, one edited, best of %d runs\n", functions, BENCH_REPETITIONS);
+
+    // Previous compile, writes the state
+    struct TokenStream tokens = tokenize(source, length);
+    struct Arena arena = new_arena("bench");
+    struct TranslationUnitAst* ast = parse(&tokens, &arena);
+    struct IncrementalState* state = load_incremental_state(state_path, unit_configuration(false));
+    fingerprint_functions(state, ast, &tokens);
+    struct CompiledUnit unit = compile_unit(ast, NULL, &(struct UnitOptions) {.backend = true, .incremental = state});
+    save_incremental_state(state, state_path, unit.code, unit.assembly);
+    free_incremental_state(state);
+    free_compiled_unit(&unit);
+    arena_release(&arena);
+    free_token_stream(&tokens);
+
+    // Same length edit in the middle of the file
+    char* edited = strstr(source, "int a = 6250;");
+    assert(edited != NULL);
+    edited[8] = '7';
+    tokens = tokenize(source, length);
+    ast = parse(&tokens, &arena);
+
+    double full = 1e30;
+    double incremental = 1e30;
+    struct CompiledUnit reference = {0};
+    bool mismatch = false;
+    size_t reused = 0;
+    for (int run = 0; run < BENCH_REPETITIONS; ++run)
+    {
+        double start = now_seconds();
+        struct CompiledUnit full_unit = compile_unit(ast, NULL, &(struct UnitOptions) {.backend = true});
+        double elapsed = now_seconds() - start;
+        if (elapsed < full) full = elapsed;
+        if (reference.function_count == 0) reference = full_unit;
+        else free_compiled_unit(&full_unit);
+
+        // Everything the incremental compile adds, loading and fingerprinting included
+        start = now_seconds();
+        state = load_incremental_state(state_path, unit_configuration(false));
+        fingerprint_functions(state, ast, &tokens);
+        unit = compile_unit(ast, NULL, &(struct UnitOptions) {.backend = true, .incremental = state});
+        elapsed = now_seconds() - start;
+        if (elapsed < incremental) incremental = elapsed;
+        reused = reused_function_count(state);
+        mismatch |= !same_code(&reference, &unit);
+        free_incremental_state(state);
+        free_compiled_unit(&unit);
+    }
+    mismatch |= reused != functions - 1;
+    printf("  full backend   %8.2f ms\n", full * 1e3);
+    printf("  incremental    %8.2f ms (%zu of %zu functions reused)%s\n", incremental * 1e3, reused, functions,
+        mismatch ? "  MISMATCH" : "");
+    unlink(state_path);
+    free(state_path);
+    free_compiled_unit(&reference);
+    arena_release(&arena);
+    free_token_stream(&tokens);
+    free(source);
+    return mismatch;
+}
+
+// Every generated function called over and over, the tapes as compiled and with -O
+static int bench_interpreter()
+{
+    size_t const functions = 1000;
+    size_t const passes = 500;
+    size_t length;
+    char* source = generate_function_source(functions, &length);
+    struct TokenStream tokens = tokenize(source, length);
+    struct Arena arena = new_arena("bench");
+    struct TranslationUnitAst* ast = parse(&tokens, &arena);
+    printf("interpreter: %zu functions called %zu times each, best of %d runs\n", functions, passes, BENCH_REPETITIONS);
+
+    int32_t* reference = cc_malloc(functions * sizeof(int32_t));
+    bool mismatch = false;
+    for (int optimize = 0; optimize < 2; ++optimize)
+    {
+        // -O rewrites the AST, so the plain tapes come first
+        struct CompiledUnit unit = compile_unit(ast, NULL, &(struct UnitOptions) {.optimize = optimize});
+        struct InterpretedFunction* prepared = cc_malloc(functions * sizeof(struct InterpretedFunction));
+        for (size_t idx = 0; idx < functions; ++idx)
+        {
+            char* error = prepare_function(&unit.code[idx], &prepared[idx]);
+            if (error == NULL) continue;
+            printf("  %s\n", error);
+            free(error);
+            return 1;
+        }
+        struct Interpreter interpreter = new_interpreter();
+        double best = 1e30;
+        uint64_t executed = 0;
+        for (int run = 0; run < BENCH_REPETITIONS; ++run)
+        {
+            interpreter.executed = 0;
+            double start = now_seconds();
+            for (size_t pass = 0; pass < passes; ++pass)
+            {
+                for (size_t idx = 0; idx < functions; ++idx)
+                {
+                    int32_t result;
+                    char* error = run_function(&interpreter, &prepared[idx], &result);
+                    mismatch |= error != NULL;
+                    free(error);
+                    if (!optimize) reference[idx] = result;
+                    else mismatch |= reference[idx] != result;
+                }
+            }
+            double elapsed = now_seconds() - start;
+            if (elapsed < best) best = elapsed;
+            executed = interpreter.executed;
+        }
+        printf("  %-6s %8.1f M instructions/s  %6.1f ns/call  (%.1f instructions/call)%s\n", optimize ? "-O" : "plain",
+            executed / best * 1e-6, best / (functions * passes) * 1e9, (double) executed / (functions * passes),
+            mismatch ? "  MISMATCH" : "");
+        free_interpreter(&interpreter);
+        for (size_t idx = 0; idx < functions; ++idx) free_interpreted_function(&prepared[idx]);
+        free(prepared);
+        free_compiled_unit(&unit);
+    }
+    free(reference);
+    arena_release(&arena);
+    free_token_stream(&tokens);
+    free(source);
+    return mismatch;
+}
+
+// SSA construction and verification over many small functions, from the -O tapes
+static int bench_ssa()
+{
+    size_t const functions = 50000;
+    size_t length;
+    char* source = generate_function_source(functions, &length);
+    struct TokenStream tokens = tokenize(source, length);
+    struct Arena arena = new_arena("bench");
+    struct TranslationUnitAst* ast = parse(&tokens, &arena);
+    struct CompiledUnit unit = compile_unit(ast, NULL, &(struct UnitOptions) {.optimize = true});
+    printf("ssa: %zu functions, best of %d runs\n", functions, BENCH_REPETITIONS);
+
+    struct SsaFunction* ssa = cc_malloc(functions * sizeof(struct SsaFunction));
+    double best_build = 1e30;
+    double best_verify = 1e30;
+    size_t failed = 0;
+    for (int run = 0; run < BENCH_REPETITIONS; ++run)
+    {
+        double start = now_seconds();
+        for (size_t idx = 0; idx < functions; ++idx)
+        {
+            char* error = build_ssa(&unit.code[idx], &ssa[idx]);
+            failed += error != NULL;
+            free(error);
+        }
+        double built = now_seconds();
+        for (size_t idx = 0; idx < functions; ++idx)
+        {
+            char* error = verify_ssa(&ssa[idx]);
+            failed += error != NULL;
+            free(error);
+        }
+        double verified = now_seconds();
+        if (built - start < best_build) best_build = built - start;
+        if (verified - built < best_verify) best_verify = verified - built;
+        if (run + 1 == BENCH_REPETITIONS) break;
+        for (size_t idx = 0; idx < functions; ++idx) free_ssa_function(&ssa[idx]);
+    }
+
+    size_t tape_instructions = 0;
+    size_t instructions = 0;
+    size_t phis = 0;
+    size_t blocks = 0;
+    for (size_t idx = 0; idx < functions; ++idx)
+    {
+        struct Tape const* tape = &unit.code[idx].tape;
+        for (size_t position = 0; position < tape->size; position += is_op_double_width(tape->data[position].op) ? 2 : 1)
+        {
+            ++tape_instructions;
+        }
+        instructions += ssa[idx].instructions.size;
+        blocks += ssa[idx].blocks.size;
+        for (size_t value = 0; value < ssa[idx].instructions.size; ++value) phis += ssa[idx].instructions.data[value].op == SSA_PHI;
+        free_ssa_function(&ssa[idx]);
+    }
+    printf("  build    %8.1f Kfunctions/s\n", functions / best_build * 1e-3);
+    printf("  verify   %8.1f Kfunctions/s\n", functions / best_verify * 1e-3);
+    printf("  %zu tape instructions -> %zu SSA instructions (%zu phis) in %zu blocks%s\n", tape_instructions,
+        instructions, phis, blocks, failed != 0 ? "  FAILED" : "");
+    free(ssa);
+    free_compiled_unit(&unit);
+    arena_release(&arena);
+    free_token_stream(&tokens);
+    free(source);
+    return failed != 0;
+}
+
+// Lowering with all the registers and with few enough of them to force spills
+static int bench_regalloc()
+{
+    size_t const functions = 20000;
+    size_t length;
+    char* source = generate_function_source(functions, &length);
+    struct TokenStream tokens = tokenize(source, length);
+    struct Arena arena = new_arena("bench");
+    struct TranslationUnitAst* ast = parse(&tokens, &arena);
+    struct CompiledUnit unit = compile_unit(ast, NULL, &(struct UnitOptions) {.optimize = true});
+    printf("regalloc: %zu functions, best of %d runs\n", functions, BENCH_REPETITIONS);
+
+    struct SsaFunction* ssa = cc_malloc(functions * sizeof(struct SsaFunction));
+    size_t failed = 0;
+    for (size_t idx = 0; idx < functions; ++idx)
+    {
+        char* error = build_ssa(&unit.code[idx], &ssa[idx]);
+        if (error == NULL) order_by_register_need(&ssa[idx]);
+        failed += error != NULL;
+        free(error);
+    }
+    size_t const register_counts[] = {X86_ALLOCATABLE_COUNT, 4, 2};
+    for (size_t config = 0; config < sizeof(register_counts) / sizeof(size_t) && failed == 0; ++config)
+    {
+        double best = 1e30;
+        struct AllocationStats total = {0};
+        size_t instructions = 0;
+        for (int run = 0; run < BENCH_REPETITIONS; ++run)
+        {
+            total = (struct AllocationStats) {0};
+            instructions = 0;
+            double start = now_seconds();
+            for (size_t idx = 0; idx < functions; ++idx)
+            {
+                struct MachineFunction machine = lower_function(&ssa[idx], register_counts[config]);
+                total.values += machine.allocation.values;
+                total.spilled += machine.allocation.spilled;
+                total.split += machine.allocation.split;
+                instructions += machine.code.size;
+                free_machine_function(&machine);
+            }
+            double elapsed = now_seconds() - start;
+            if (elapsed < best) best = elapsed;
+        }
+        printf("  %2zu registers %8.1f Kfunctions/s, %zu values, %zu spilled (%zu split), %zu instructions\n",
+            register_counts[config], functions / best * 1e-3, total.values, total.spilled, total.split, instructions);
+    }
+    for (size_t idx = 0; idx < functions; ++idx) free_ssa_function(&ssa[idx]);
+    free(ssa);
+    free_compiled_unit(&unit);
+    arena_release(&arena);
+    free_token_stream(&tokens);
+    free(source);
+
+    // A single function with a block per term, liveness has to grow with the
+    // live sets and not with blocks * values
+    size_t const terms = 100000;
+    static char const* const links[] = {" && ", " ? x : "};
+    for (size_t shape = 0; shape < sizeof(links) / sizeof(char const*) && failed == 0; ++shape)
+    {
+        source = generate_chain_source(terms, links[shape], &length);
+        tokens = tokenize(source, length);
+        arena = new_arena("bench");
+        ast = parse(&tokens, &arena);
+        unit = compile_unit(ast, NULL, &(struct UnitOptions) {0});
+        struct SsaFunction chain;
+        char* error = build_ssa(&unit.code[0], &chain);
+        failed += error != NULL;
+        free(error);
+        if (error == NULL)
+        {
+            order_by_register_need(&chain);
+            double best = 1e30;
+            for (int run = 0; run < BENCH_REPETITIONS; ++run)
+            {
+                double start = now_seconds();
+                struct MachineFunction machine = lower_function(&chain, X86_ALLOCATABLE_COUNT);
+                double elapsed = now_seconds() - start;
+                if (elapsed < best) best = elapsed;
+                free_machine_function(&machine);
+            }
+            printf("  %zu term %s chain %8.1f ms for %zu blocks\n", terms, shape == 0 ? "&&" : "?:", best * 1e3,
+                chain.blocks.size);
+            free_ssa_function(&chain);
+        }
+        free_compiled_unit(&unit);
+        arena_release(&arena);
+        free_token_stream(&tokens);
+        free(source);
+    }
+    if (failed != 0) printf("  FAILED\n");
+    return failed != 0;
+}
+
+// Expression trees lowered in the order of the tape and in Sethi-Ullman order
+static int bench_order()
+{
+    size_t const functions = 20000;
+    size_t length;
+    char* source = generate_tree_source(functions, &length);
+    struct TokenStream tokens = tokenize(source, length);
+    struct Arena arena = new_arena("bench");
+    struct TranslationUnitAst* ast = parse(&tokens, &arena);
+    struct CompiledUnit unit = compile_unit(ast, NULL, &(struct UnitOptions) {0});
+    printf("order: %zu expression trees of depth 5, in tape order and by register need\n", functions);
+
+    struct SsaFunction* ssa[2] = {
+        cc_malloc(functions * sizeof(struct SsaFunction)),
+        cc_malloc(functions * sizeof(struct SsaFunction))
+    };
+    size_t failed = 0;
+    for (size_t idx = 0; idx < functions; ++idx)
+    {
+        for (int ordered = 0; ordered < 2; ++ordered)
+        {
+            char* error = build_ssa(&unit.code[idx], &ssa[ordered][idx]);
+            failed += error != NULL;
+            free(error);
+        }
+    }
+    double const start = now_seconds();
+    for (size_t idx = 0; idx < functions && failed == 0; ++idx) order_by_register_need(&ssa[1][idx]);
+    double const elapsed = now_seconds() - start;
+    for (size_t idx = 0; idx < functions && failed == 0; ++idx)
+    {
+        // The new order has to stay a valid SSA function
+        char* error = verify_ssa(&ssa[1][idx]);
+        failed += error != NULL;
+        free(error);
+    }
+    if (failed == 0) printf("  ordering %8.1f Kfunctions/s\n", functions / elapsed * 1e-3);
+    size_t const register_counts[] = {2, 3, 4, 6};
+    for (size_t config = 0; config < sizeof(register_counts) / sizeof(size_t) && failed == 0; ++config)
+    {
+        size_t spilled[2] = {0, 0};
+        size_t instructions[2] = {0, 0};
+        for (int ordered = 0; ordered < 2; ++ordered)
+        {
+            for (size_t idx = 0; idx < functions; ++idx)
+            {
+                struct MachineFunction machine = lower_function(&ssa[ordered][idx], register_counts[config]);
+                spilled[ordered] += machine.allocation.spilled;
+                instructions[ordered] += machine.code.size;
+                free_machine_function(&machine);
+            }
+        }
+        printf("  %2zu registers  tape order %7zu spilled %8zu instructions  by need %7zu spilled %8zu instructions\n",
+            register_counts[config], spilled[0], instructions[0], spilled[1], instructions[1]);
+    }
+    if (failed != 0) printf("  FAILED\n");
+    for (size_t idx = 0; idx < functions; ++idx)
+    {
+        free_ssa_function(&ssa[0][idx]);
+        free_ssa_function(&ssa[1][idx]);
+    }
+    free(ssa[0]);
+    free(ssa[1]);
+    free_compiled_unit(&unit);
+    arena_release(&arena);
+    free_token_stream(&tokens);
+    free(source);
+    return failed != 0;
+}
+
+static bool write_assembly_file(char const* path, struct StringArray const* assembly, size_t* bytes)
+{
+    FILE* file = fopen(path, "w");
+    bool written = file != NULL;
+    *bytes = 0;
+    for (size_t idx = 0; written && idx < assembly->size; ++idx)
+    {
+        int length = fprintf(file, "%s\n", assembly->data[idx]);
+        written = length >= 0;
+        *bytes += length;
+    }
+    if (file != NULL && fclose(file) != 0) written = false;
+    return written;
+}
+
+static bool write_object(char const* path, struct ByteArray const* object)
+{
+    FILE* file = fopen(path, "wb");
+    bool written = file != NULL && fwrite(object->data, 1, object->size, file) == object->size;
+    if (file != NULL && fclose(file) != 0) written = false;
+    return written;
+}
+
+// Source to an object file on disk, through NASM text or encoded directly (-c)
+static int bench_object()
+{
+    size_t const functions = 20000;
+    size_t length;
+    char* source = generate_function_source(functions, &length);
+    char* assembly_path = format("/tmp/real_c_compiler_bench_%d.asm", (int) getpid());
+    char* object_path = format("/tmp/real_c_compiler_bench_%d.o", (int) getpid());
+    char* nasm_command = format("nasm -felf64 -o %s %s", object_path, assembly_path);
+    bool const have_nasm = system("command -v nasm > /dev/null 2>&1") == 0;
+    printf("object: %zu functions to an object file, best of %d runs\n", functions, BENCH_REPETITIONS);
+
+    double best_text = 1e30;
+    double best_assembler = 1e30;
+    double best_direct = 1e30;
+    size_t text_bytes = 0;
+    size_t object_bytes = 0;
+    bool failed = false;
+    for (int run = 0; run < BENCH_REPETITIONS; ++run)
+    {
+        double start = now_seconds();
+        struct TokenStream tokens = tokenize(source, length);
+        struct Arena arena = new_arena("bench");
+        struct TranslationUnitAst* ast = parse(&tokens, &arena);
+        struct CompiledUnit unit = compile_unit(ast, NULL, &(struct UnitOptions) {.optimize = true, .backend = true});
+        struct StringArray assembly = codegen(unit.assembly, unit.function_count);
+        failed |= !write_assembly_file(assembly_path, &assembly, &text_bytes);
+        free_string_array(&assembly);
+        free_compiled_unit(&unit);
+        arena_release(&arena);
+        free_token_stream(&tokens);
+        double texted = now_seconds();
+        if (have_nasm) failed |= system(nasm_command) != 0;
+        double assembled = now_seconds();
+
+        tokens = tokenize(source, length);
+        ast = parse(&tokens, &arena);
+        unit = compile_unit(ast, NULL, &(struct UnitOptions) {.optimize = true, .backend = true, .object_code = true});
+        struct ByteArray object = write_elf_object(unit.machine_code, unit.function_count);
+        failed |= !write_object(object_path, &object);
+        object_bytes = object.size;
+        free(object.data);
+        free_compiled_unit(&unit);
+        arena_release(&arena);
+        free_token_stream(&tokens);
+        double end = now_seconds();
+
+        if (texted - start < best_text) best_text = texted - start;
+        if (assembled - texted < best_assembler) best_assembler = assembled - texted;
+        if (end - assembled < best_direct) best_direct = end - assembled;
+    }
+    printf("  assembly text  %8.2f ms (%zu bytes)\n", best_text * 1e3, text_bytes);
+    if (have_nasm) printf("    + nasm       %8.2f ms\n", best_assembler * 1e3);
+    else printf("    + nasm       not installed, not measured\n");
+    printf("  direct -c      %8.2f ms (%zu bytes of ELF)%s\n", best_direct * 1e3, object_bytes, failed ? "  FAILED" : "");
+    unlink(assembly_path);
+    unlink(object_path);
+    free(nasm_command);
+    free(object_path);
+    free(assembly_path);
+    free(source);
+    return failed;
+}
+
+// Every generated function mapped and called in process (--run), checked
+// against the interpreter
+static int bench_jit()
+{
+    size_t const functions = 1000;
+    size_t const passes = 500;
+    size_t length;
+    char* source = generate_function_source(functions, &length);
+    struct TokenStream tokens = tokenize(source, length);
+    struct Arena arena = new_arena("bench");
+    struct TranslationUnitAst* ast = parse(&tokens, &arena);
+    struct CompiledUnit unit = compile_unit(ast, NULL, &(struct UnitOptions) {.backend = true, .object_code = true});
+    printf("jit: %zu functions called %zu times each, best of %d runs\n", functions, passes, BENCH_REPETITIONS);
+
+    int32_t* reference = cc_malloc(functions * sizeof(int32_t));
+    bool mismatch = false;
+    struct Interpreter interpreter = new_interpreter();
+    for (size_t idx = 0; idx < functions; ++idx)
+    {
+        struct InterpretedFunction prepared;
+        char* error = prepare_function(&unit.code[idx], &prepared);
+        if (error == NULL) error = run_function(&interpreter, &prepared, &reference[idx]);
+        mismatch |= error != NULL;
+        free(error);
+        free_interpreted_function(&prepared);
+    }
+    free_interpreter(&interpreter);
+
+    struct JitModule module = {0};
+    double best_load = 1e30;
+    double best_calls = 1e30;
+    size_t code_bytes = 0;
+    for (size_t idx = 0; idx < functions; ++idx) code_bytes += unit.machine_code[idx].code.size;
+    for (int run = 0; run < BENCH_REPETITIONS && !mismatch; ++run)
+    {
+        double start = now_seconds();
+        char* error = load_jit_module(unit.machine_code, functions, &module);
+        double loaded = now_seconds();
+        if (error != NULL)
+        {
+            printf("  %s\n", error);
+            free(error);
+            mismatch = true;
+            break;
+        }
+        for (size_t pass = 0; pass < passes; ++pass)
+        {
+            for (size_t idx = 0; idx < functions; ++idx)
+            {
+                int32_t result = 0;
+                mismatch |= !call_jit_function(&module, unit.code[idx].symbol, &result) || result != reference[idx];
+            }
+        }
+        double end = now_seconds();
+        free_jit_module(&module);
+        if (loaded - start < best_load) best_load = loaded - start;
+        if (end - loaded < best_calls) best_calls = end - loaded;
+    }
+    printf("  load   %8.3f ms for %zu bytes of code\n", best_load * 1e3, code_bytes);
+    printf("  calls  %8.1f ns/call%s\n", best_calls / (functions * passes) * 1e9, mismatch ? "  MISMATCH" : "");
+    free(reference);
+    free_compiled_unit(&unit);
+    arena_release(&arena);
+    free_token_stream(&tokens);
+    free(source);
+    return mismatch;
+}
+
+// Machine code from the same tapes, copy-and-patch against SSA, register
+// allocation and encoding. The first functions are run to check both.
+static int bench_baseline()
+{
+    size_t const functions = 50000;
+    size_t const checked = 1000;
+    size_t length;
+    char* source = generate_function_source(functions, &length);
+    struct TokenStream tokens = tokenize(source, length);
+    struct Arena arena = new_arena("bench");
+    struct TranslationUnitAst* ast = parse(&tokens, &arena);
+    struct CompiledUnit unit = compile_unit(ast, NULL, &(struct UnitOptions) {0});
+    printf("baseline: %zu functions to machine code, best of %d runs\n", functions, BENCH_REPETITIONS);
+
+    size_t tape_ops = 0;
+    for (size_t idx = 0; idx < functions; ++idx)
+    {
+        struct Tape const* tape = &unit.code[idx].tape;
+        for (size_t position = 0; position < tape->size; position += is_op_double_width(tape->data[position].op) ? 2 : 1)
+        {
+            ++tape_ops;
+        }
+    }
+    struct EncodedFunction* encoded[2] = {
+        cc_malloc(functions * sizeof(struct EncodedFunction)),
+        cc_malloc(functions * sizeof(struct EncodedFunction))
+    };
+    bool failed = false;
+    for (int tier = 0; tier < 2; ++tier)
+    {
+        double best = 1e30;
+        for (int run = 0; run < BENCH_REPETITIONS; ++run)
+        {
+            if (run != 0)
+            {
+                for (size_t idx = 0; idx < functions; ++idx) free_encoded_function(&encoded[tier][idx]);
+            }
+            double start = now_seconds();
+            for (size_t idx = 0; idx < functions; ++idx)
+            {
+                if (tier == 0)
+                {
+                    char* error = baseline_compile(&unit.code[idx], &encoded[tier][idx]);
+                    failed |= error != NULL;
+                    free(error);
+                    continue;
+                }
+                struct MachineFunction machine = codegen_function(&unit.code[idx]);
+                encoded[tier][idx] = encode_function(&machine);
+                free_machine_function(&machine);
+            }
+            double elapsed = now_seconds() - start;
+            if (elapsed < best) best = elapsed;
+        }
+        size_t code_bytes = 0;
+        for (size_t idx = 0; idx < functions; ++idx) code_bytes += encoded[tier][idx].code.size;
+        printf("  %-10s %8.1f M ops/s  %8.1f Kfunctions/s  %zu bytes of code\n", tier == 0 ? "baseline" : "optimizing",
+            tape_ops / best * 1e-6, functions / best * 1e-3, code_bytes);
+    }
+
+    struct Interpreter interpreter = new_interpreter();
+    struct JitModule modules[2];
+    int loaded = 0;
+    for (; loaded < 2 && !failed; ++loaded)
+    {
+        char* error = load_jit_module(encoded[loaded], checked, &modules[loaded]);
+        failed |= error != NULL;
+        free(error);
+    }
+    for (size_t idx = 0; idx < checked && !failed; ++idx)
+    {
+        struct InterpretedFunction prepared;
+        int32_t expected = 0;
+        char* error = prepare_function(&unit.code[idx], &prepared);
+        if (error == NULL) error = run_function(&interpreter, &prepared, &expected);
+        failed |= error != NULL;
+        free(error);
+        free_interpreted_function(&prepared);
+        for (int tier = 0; tier < 2; ++tier)
+        {
+            int32_t result = 0;
+            failed |= !call_jit_function(&modules[tier], unit.code[idx].symbol, &result) || result != expected;
+        }
+    }
+    for (int tier = 0; tier < loaded; ++tier) free_jit_module(&modules[tier]);
+    printf("  %zu tape ops, first %zu functions checked against the interpreter%s\n", tape_ops, checked,
+        failed ? "  FAILED" : "");
+    free_interpreter(&interpreter);
+    for (int tier = 0; tier < 2; ++tier)
+    {
+        for (size_t idx = 0; idx < functions; ++idx) free_encoded_function(&encoded[tier][idx]);
+        free(encoded[tier]);
+    }
+    free_compiled_unit(&unit);
+    arena_release(&arena);
+    free_token_stream(&tokens);
+    free(source);
+    return failed;
+}
+
+// Resident memory and open descriptors of a process, from /proc
+static bool process_usage(pid_t pid, size_t* resident_kb, size_t* fds)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/statm", (int) pid);
+    FILE* file = fopen(path, "r");
+    size_t pages = 0;
+    bool const read = file != NULL && fscanf(file, "%*s %zu", &pages) == 1;
+    if (file != NULL) fclose(file);
+    *resident_kb = pages * (sysconf(_SC_PAGESIZE) / 1024);
+    snprintf(path, sizeof(path), "/proc/%d/fd", (int) pid);
+    DIR* directory = opendir(path);
+    if (directory == NULL) return false;
+    *fds = 0;
+    for (struct dirent* item; (item = readdir(directory)) != NULL;) *fds += item->d_name[0] != '.';
+    closedir(directory);
+    return read;
+}
+
+// A compile server (--server) in a child process, fed with requests that
+// fail in the lexer, the parser or the bytecode compiler after everything
+// before the error was built. Whatever a failing request allocated or opened
+// has to be released, so the server's memory and descriptors stay flat.
+static int bench_server()
+{
+    size_t const functions = 1000;
+    size_t const rounds = 50;
+    struct
+    {
+        char const* name;
+        char const* last_function;
+        int status; // Expected
+    } const kinds[] = {
+        {"undefined variable", "int broken()\n{\n    return missing;\n}\n", 1},
+        {"parse error", "int broken()\n{\n    return (1 + ;\n}\n", 1},
+        {"bad literal", "int broken()\n{\n    return 99999999999999999999999;\n}\n", 1},
+        {"redefinition", "int generated_function_0()\n{\n    return 0;\n}\n", 1},
+        {"no error", "", 0},
+    };
+    size_t const kind_count = sizeof(kinds) / sizeof(kinds[0]);
+    char* directory = format("/tmp/real_c_compiler_bench_%d", (int) getpid());
+    char* socket_path = format("%s/server.sock", directory);
+    char* paths[sizeof(kinds) / sizeof(kinds[0])];
+    bool failed = mkdir(directory, 0700) != 0;
+    size_t length;
+    char* source = generate_function_source(functions, &length);
+    for (size_t kind = 0; kind < kind_count; ++kind)
+    {
+        paths[kind] = format("%s/%zu.c", directory, kind);
+        FILE* file = fopen(paths[kind], "w");
+        failed |= file == NULL || fprintf(file, "%s%s", source, kinds[kind].last_function) < 0;
+        if (file != NULL) failed |= fclose(file) != 0;
+    }
+    printf("server: requests of %zu functions, the last one with an error, %zu rounds\n", functions, rounds);
+
+    // "Listening on" is printed once the socket takes connections
+    int ready[2];
+    failed |= pipe(ready) != 0;
+    fflush(stdout);
+    pid_t const server = failed ? -1 : fork();
+    if (server == 0)
+    {
+        dup2(ready[1], STDOUT_FILENO);
+        close(ready[0]);
+        close(ready[1]);
+        exit(run_server(socket_path, 2, NULL));
+    }
+    char line[256];
+    failed |= server < 0 || read(ready[0], line, sizeof(line)) <= 0;
+
+    double elapsed[sizeof(kinds) / sizeof(kinds[0])] = {0};
+    size_t resident[2] = {0, 0};
+    size_t fds[2] = {0, 0};
+    // The first round warms up the interner, the arena block pool and malloc
+    for (size_t round = 0; round <= rounds && !failed; ++round)
+    {
+        if (round == 1) failed |= !process_usage(server, &resident[0], &fds[0]);
+        for (size_t kind = 0; kind < kind_count && !failed; ++kind)
+        {
+            double const start = now_seconds();
+            char* reply = NULL;
+            failed |= send_request(socket_path, 1, &paths[kind], &reply) != kinds[kind].status;
+            elapsed[kind] += now_seconds() - start;
+            free(reply);
+        }
+    }
+    failed |= !failed && !process_usage(server, &resident[1], &fds[1]);
+    if (server > 0)
+    {
+        char* reply = NULL;
+        send_request(socket_path, 1, (char*[]) {"--shutdown"}, &reply);
+        free(reply);
+        waitpid(server, NULL, 0);
+    }
+    close(ready[0]);
+    close(ready[1]);
+
+    for (size_t kind = 0; kind < kind_count && !failed; ++kind)
+    {
+        printf("  %-20s %8.1f requests/s\n", kinds[kind].name, (rounds + 1) / elapsed[kind]);
+    }
+    // malloc fragments a bit over the server's threads, a leak of what a
+    // request built adds about a megabyte per request here. Not meaningful
+    // under AddressSanitizer, its quarantine holds on to freed memory.
+    bool const flat = fds[1] <= fds[0] && resident[1] < resident[0] * 2;
+    if (!failed)
+    {
+        printf("  server after warm up %6.1f MB, %zu fds, after %zu more requests %6.1f MB, %zu fds%s\n",
+            resident[0] / 1024.0, fds[0], rounds * kind_count, resident[1] / 1024.0, fds[1], flat ? "" : "  LEAKED");
+    }
+    failed |= !flat;
+    if (failed) printf("  FAILED\n");
+    for (size_t kind = 0; kind < kind_count; ++kind)
+    {
+        unlink(paths[kind]);
+        free(paths[kind]);
+    }
+    rmdir(directory);
+    free(source);
+    free(socket_path);
+    free(directory);
+    return failed;
+}
+
+struct Benchmark
+{
+    char const* name;
+    int (*run)();
+};
+
+static struct Benchmark const benchmarks[] = {
+    {"lex", bench_lex},
+    {"keywords", bench_keywords},
+    {"literals", bench_literals},
+    {"expressions", bench_expressions},
+    {"concurrent", bench_concurrent},
+    {"functions", bench_functions},
+    {"incremental", bench_incremental},
+    {"interpreter", bench_interpreter},
+    {"ssa", bench_ssa},
+    {"regalloc", bench_regalloc},
+    {"order", bench_order},
+    {"object", bench_object},
+    {"jit", bench_jit},
+    {"baseline", bench_baseline},
+    {"server", bench_server},
+};
+
+int run_benchmark(char const* name)
+{
+    size_t const benchmark_count = sizeof(benchmarks) / sizeof(struct Benchmark);
+    for (size_t idx = 0; idx < benchmark_count; ++idx)
+    {
+        if (strcmp(name, "all") == 0 || strcmp(name, benchmarks[idx].name) == 0)
+        {
+            int result = benchmarks[idx].run();
+            if (result != 0 || strcmp(name, "all") != 0) return result;
+        }
+    }
+    if (strcmp(name, "all") == 0) return 0;
+
+    printf("Unknown benchmark: %s, available:", name);
+    for (size_t idx = 0; idx < benchmark_count; ++idx) printf(" %s", benchmarks[idx].name);
+    printf(" all\n");
+    return 1;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+// Built-in micro benchmarks, run with `compiler --bench <name>`.
+// Inputs are generated in memory, so no corpus files are needed.
+// Returns the process exit code.
+int run_benchmark(char const* name);
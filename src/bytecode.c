@@ -1,5 +1,7 @@
 #include <stdio.h>
+#include <string.h>
 #include "bytecode.h"
+#include "intern.h"
 
 
 IMPLEMENT_NEW_DYN_ARRAY(Tape, union Bytecode, new_tape, add_to_tape);
@@ -13,6 +15,8 @@ static char const* op_to_string(enum BytecodeOp op)
         case LOAD: return "LOAD";
         case STORE: return "STORE";
         case NOT: return "NOT";
+        case NEG: return "NEG";
+        case BIT_NOT: return "BIT_NOT";
         case ADD: return "ADD";
         case SUB: return "SUB";
         case MUL: return "MUL";
@@ -20,20 +24,51 @@ static char const* op_to_string(enum BytecodeOp op)
         case REM: return "REM";
         case LSHIFT: return "LSHIFT";
         case RSHIFT: return "RSHIFT";
+        case BIT_AND: return "BIT_AND";
+        case BIT_OR: return "BIT_OR";
+        case BIT_XOR: return "BIT_XOR";
+        case EQ: return "EQ";
+        case NE: return "NE";
+        case LT: return "LT";
+        case LE: return "LE";
+        case GT: return "GT";
+        case GE: return "GE";
+        case JMP: return "JMP";
+        case JZ: return "JZ";
+        case JNZ: return "JNZ";
         case CALL: return "CALL";
         case RET: return "RET";
+        case ADD_IMM: return "ADD_IMM";
+        case LOAD_ADD: return "LOAD_ADD";
+        case STORE_KEEP: return "STORE_KEEP";
     }
     return "<UNDEFINED>";
 }
 
-static bool is_op_double_width(enum BytecodeOp op)
+bool is_op_double_width(enum BytecodeOp op)
 {
-    return op == LOAD || op == STORE || op == PUSH;
+    return op == LOAD || op == STORE || op == PUSH || op == JMP || op == JZ || op == JNZ
+        || op == ADD_IMM || op == LOAD_ADD || op == STORE_KEEP;
+}
+
+struct StackEffect op_stack_effect(enum BytecodeOp op)
+{
+    switch (op)
+    {
+        case PUSH: case LOAD: return (struct StackEffect) {0, 1};
+        case POP: case STORE: case JZ: case JNZ: case RET: return (struct StackEffect) {1, 0};
+        case NOT: case NEG: case BIT_NOT: case ADD_IMM: case LOAD_ADD: case STORE_KEEP: return (struct StackEffect) {1, 1};
+        case ADD: case SUB: case MUL: case DIV: case REM: case LSHIFT: case RSHIFT: case BIT_AND: case BIT_OR:
+        case BIT_XOR: case EQ: case NE: case LT: case LE: case GT: case GE:
+            return (struct StackEffect) {2, 1};
+        case JMP: case CALL: break;
+    }
+    return (struct StackEffect) {0, 0};
 }
 
 void print_tape(struct VirtualMachineCode const* vm)
 {
-    printf("%s:\n", vm->symbol);
+    printf("%s:\n", symbol_name(vm->symbol));
     for (size_t idx = 0; idx < vm->tape.size; ++idx)
     {
         union Bytecode byte = vm->tape.data[idx];
@@ -60,109 +95,260 @@ static void push_constant(struct VirtualMachineCode* vm, int value)
     add_to_tape(&vm->tape, &code);
 }
 
-static void compile_expression(struct VirtualMachineCode* vm, struct ExpressionNode const* expr);
-
-static void compile_binary_expression(struct VirtualMachineCode* vm, struct BinaryExpression const* expr)
+static int32_t find_variable(struct VirtualMachineCode* vm, uint32_t name)
 {
-    switch (expr->op)
+    int32_t* var = hashmap_find(&vm->stack_offsets, name);
+    if (var == NULL)
     {
-        case BIN_ADD:
-            compile_expression(vm, expr->left);
-            compile_expression(vm, expr->right);
-            push_ins(vm, ADD);
-            break;
+        compile_error("Usage of undefined variable: %s", symbol_name(name));
     }
+    return *var;
 }
 
-static void compile_expression(struct VirtualMachineCode* vm, struct ExpressionNode const* expr)
+static enum BytecodeOp const BINARY_OPS[] = {
+    [BIN_MUL] = MUL,
+    [BIN_DIV] = DIV,
+    [BIN_REM] = REM,
+    [BIN_ADD] = ADD,
+    [BIN_SUB] = SUB,
+    [BIN_LSHIFT] = LSHIFT,
+    [BIN_RSHIFT] = RSHIFT,
+    [BIN_LESS] = LT,
+    [BIN_LESS_EQ] = LE,
+    [BIN_GREATER] = GT,
+    [BIN_GREATER_EQ] = GE,
+    [BIN_EQ] = EQ,
+    [BIN_NOT_EQ] = NE,
+    [BIN_BIT_AND] = BIT_AND,
+    [BIN_BIT_XOR] = BIT_XOR,
+    [BIN_BIT_OR] = BIT_OR,
+};
+
+static enum BytecodeOp const UNARY_OPS[] = {
+    [UNARY_MINUS] = NEG,
+    [UNARY_NOT] = NOT,
+    [UNARY_BIT_NOT] = BIT_NOT,
+};
+
+// Emits a jump with a target to be patched, returns the target's position
+static uint32_t push_jump(struct VirtualMachineCode* vm, enum BytecodeOp op)
 {
-    switch (expr->type) 
+    push_ins(vm, op);
+    push_constant(vm, -1);
+    return vm->tape.size - 1;
+}
+
+static void patch_jump(struct VirtualMachineCode* vm, uint32_t target_position)
+{
+    vm->tape.data[target_position].value = vm->tape.size;
+}
+
+static bool is_short_circuit(struct FlatExpression const* expr)
+{
+    return expr->type == EXPR_BIN && (expr->op == BIN_LOGICAL_AND || expr->op == BIN_LOGICAL_OR);
+}
+
+// Scratch space of the expression compiler, indexed relative to the expression
+// start. Reused by every expression of a function.
+struct ExpressionScratch
+{
+    uint32_t* parents;
+    uint32_t* jumps;
+    size_t capacity;
+};
+
+static void ensure_scratch(struct ExpressionScratch* scratch, size_t count)
+{
+    if (count <= scratch->capacity) return;
+    scratch->capacity = count * 2;
+    scratch->parents = realloc(scratch->parents, scratch->capacity * sizeof(uint32_t));
+    scratch->jumps = realloc(scratch->jumps, scratch->capacity * sizeof(uint32_t));
+    assert(scratch->parents && scratch->jumps);
+}
+
+// Nodes are in post-order, so a left to right walk over the range already
+// is the stack machine evaluation order. The only exception are && || and ?:,
+// which need a jump right after some of their operands. The parent comes after
+// the operand, so those operands are found up front.
+static void compile_expression(struct VirtualMachineCode* vm, struct ExpressionScratch* scratch,
+    struct FlatFunction const* function, struct FlatStatement const* stmt)
+{
+    struct FlatExpression const* nodes = function->expressions.data;
+    uint32_t const first = stmt->first;
+    bool has_jumps = false;
+    for (uint32_t idx = first; idx <= stmt->root && !has_jumps; ++idx)
+    {
+        has_jumps = is_short_circuit(&nodes[idx]) || nodes[idx].type == EXPR_CONDITIONAL;
+    }
+    if (has_jumps)
     {
-        case EXPR_CONSTANT:
-            push_ins(vm, PUSH);
-            push_constant(vm, expr->as.simple->value);
-            break;
-        case EXPR_VARIABLE:;
-            int32_t* var = hashmap_find(&vm->stack_offsets, expr->as.simple->name);
-            if (var == NULL)
+        ensure_scratch(scratch, stmt->root - first + 1);
+        memset(scratch->parents, 0xFF, (stmt->root - first + 1) * sizeof(uint32_t));
+        for (uint32_t idx = first; idx <= stmt->root; ++idx)
+        {
+            if (is_short_circuit(&nodes[idx])) scratch->parents[nodes[idx].left - first] = idx;
+            if (nodes[idx].type == EXPR_CONDITIONAL)
             {
-                printf("Usage of undefined variable: %s\n", expr->as.simple->name);
-                exit(1);
+                scratch->parents[nodes[idx].operand - first] = idx;
+                scratch->parents[nodes[idx].left - first] = idx;
             }
-            push_ins(vm, LOAD);
-            push_constant(vm, *var);
-            break;
-        case EXPR_BIN:
-            compile_binary_expression(vm, expr->as.bin);
-            break;
+        }
     }
-}
 
-static void compile_assignment(struct VirtualMachineCode* vm, struct VariableAssignment const* assign)
-{
-    int32_t* var = hashmap_find(&vm->stack_offsets, assign->name->name);
-    if (var == NULL)
+    for (uint32_t idx = first; idx <= stmt->root; ++idx)
     {
-        printf("Usage of undefined variable: %s\n", assign->name->name);
-        exit(1);
+        struct FlatExpression const* expr = &nodes[idx];
+        switch (expr->type)
+        {
+            case EXPR_CONSTANT:
+                push_ins(vm, PUSH);
+                // Only int is supported, wraps like a conversion
+                push_constant(vm, (int) function->constants.data[expr->operand]);
+                break;
+            case EXPR_VARIABLE:
+                push_ins(vm, LOAD);
+                push_constant(vm, find_variable(vm, expr->operand));
+                break;
+            case EXPR_UNARY:
+                if (expr->op != UNARY_PLUS) push_ins(vm, UNARY_OPS[expr->op]);
+                break;
+            case EXPR_BIN:
+                if (!is_short_circuit(expr))
+                {
+                    push_ins(vm, BINARY_OPS[expr->op]);
+                    break;
+                }
+                // left JZ false; right JZ false; PUSH 1; JMP end; false: PUSH 0; end:
+                // || is the same with JNZ and swapped constants
+                bool const is_and = expr->op == BIN_LOGICAL_AND;
+                uint32_t const right_jump = push_jump(vm, is_and ? JZ : JNZ);
+                push_ins(vm, PUSH);
+                push_constant(vm, is_and ? 1 : 0);
+                uint32_t const end_jump = push_jump(vm, JMP);
+                patch_jump(vm, scratch->jumps[expr->left - first]);
+                patch_jump(vm, right_jump);
+                push_ins(vm, PUSH);
+                push_constant(vm, is_and ? 0 : 1);
+                patch_jump(vm, end_jump);
+                break;
+            case EXPR_CONDITIONAL:
+                // condition JZ else; if_true JMP end; else: if_false end:
+                patch_jump(vm, scratch->jumps[expr->left - first]);
+                break;
+        }
+
+        uint32_t const parent_idx = has_jumps ? scratch->parents[idx - first] : FLAT_NONE;
+        if (parent_idx == FLAT_NONE) continue;
+        struct FlatExpression const* parent = &nodes[parent_idx];
+        if (parent->type == EXPR_BIN)
+        {
+            scratch->jumps[idx - first] = push_jump(vm, parent->op == BIN_LOGICAL_AND ? JZ : JNZ);
+        }
+        else if (idx == parent->operand)
+        {
+            scratch->jumps[idx - first] = push_jump(vm, JZ);
+        }
+        else
+        {
+            scratch->jumps[idx - first] = push_jump(vm, JMP);
+            patch_jump(vm, scratch->jumps[parent->operand - first]);
+        }
     }
-    compile_expression(vm, assign->value);
+}
+
+static void compile_assignment(struct VirtualMachineCode* vm, struct ExpressionScratch* scratch,
+    struct FlatFunction const* function, struct FlatStatement const* assign)
+{
+    int32_t offset = find_variable(vm, assign->name);
+    compile_expression(vm, scratch, function, assign);
     push_ins(vm, STORE);
-    push_constant(vm, *var);
+    push_constant(vm, offset);
 }
 
-static void compile_var_definition(struct VirtualMachineCode* vm, struct DefineVariable const* def)
+static void compile_var_definition(struct VirtualMachineCode* vm, struct ExpressionScratch* scratch,
+    struct FlatFunction const* function, struct FlatStatement const* def)
 {
-    int32_t* elem = hashmap_find(&vm->stack_offsets, def->name->name);
+    int32_t* elem = hashmap_find(&vm->stack_offsets, def->name);
     if (elem != NULL)
     {
-        printf("Variable shadowing is not supported yet\n");
-        exit(1);
+        compile_error("Variable shadowing is not supported yet");
     }
 
     size_t var_offset = vm->current_offset;
-    hashmap_insert(&vm->stack_offsets, def->name->name, vm->current_offset);
+    hashmap_insert(&vm->stack_offsets, def->name, vm->current_offset);
     vm->current_offset += get_type_size(def->type);
-    if (def->has_inital_value)
+    if (def->root != FLAT_NONE)
     {
-        compile_expression(vm, def->value);
+        compile_expression(vm, scratch, function, def);
         push_ins(vm, STORE);
         push_constant(vm, var_offset);
     }
 }
 
-static void compile_return(struct VirtualMachineCode* vm, struct ReturnNode const* ret)
+static void compile_return(struct VirtualMachineCode* vm, struct ExpressionScratch* scratch,
+    struct FlatFunction const* function, struct FlatStatement const* ret)
 {
-    compile_expression(vm, ret->value);
+    compile_expression(vm, scratch, function, ret);
     push_ins(vm, RET);
 }
 
-struct VirtualMachineCode compile_to_vm(struct FunctionAst const* ast)
+// Everything compile_to_vm owns, released if a compile_error stops it
+struct VmCompilation
+{
+    struct VirtualMachineCode vm;
+    struct ExpressionScratch scratch;
+};
+
+static void release_vm_compilation(void* context)
+{
+    struct VmCompilation* compilation = context;
+    free_vm_code(&compilation->vm);
+    free(compilation->scratch.parents);
+    free(compilation->scratch.jumps);
+}
+
+struct VirtualMachineCode compile_to_vm(struct FlatFunction const* function)
 {
-    struct VirtualMachineCode vm = {
-        .symbol = ast->name->name,
-        .tape = new_tape(),
-        .current_offset = 0,
-        .stack_offsets = new_hashmap(),
-        .current_stack_offset = 0
+    struct VmCompilation compilation = {
+        .vm = {
+            .symbol = function->name,
+            .tape = new_tape(),
+            .current_offset = 0,
+            .stack_offsets = new_hashmap(),
+            .current_stack_offset = 0
+        }
     };
-    assert(ast->return_type == TYPE_INT && "Supported only INTs");
+    struct VirtualMachineCode* vm = &compilation.vm;
+    struct ExpressionScratch* scratch = &compilation.scratch;
+    assert(function->return_type == TYPE_INT && "Supported only INTs");
+    struct ErrorCleanup cleanup = {.release = release_vm_compilation, .context = &compilation};
+    push_error_cleanup(&cleanup);
     
-    for (size_t stmt_idx = 0; stmt_idx < ast->statement_count; ++stmt_idx)
+    for (size_t stmt_idx = 0; stmt_idx < function->statements.size; ++stmt_idx)
     {
-        struct StatementAst const* stmt = ast->statements[stmt_idx];
+        struct FlatStatement const* stmt = &function->statements.data[stmt_idx];
         switch(stmt->tag)
         {
             case TAG_DEFINITION:
-                compile_var_definition(&vm, &stmt->as.definition);
+                compile_var_definition(vm, scratch, function, stmt);
                 break;
             case TAG_ASSIGMENT:
-                compile_assignment(&vm, &stmt->as.assignement);
+                compile_assignment(vm, scratch, function, stmt);
                 break;
             case TAG_RETURN:
-                compile_return(&vm, &stmt->as.ret);
+                compile_return(vm, scratch, function, stmt);
                 break;
         }
     }
-    return vm;
+    pop_error_cleanup(&cleanup);
+    free(scratch->parents);
+    free(scratch->jumps);
+    return compilation.vm;
+}
+
+void free_vm_code(struct VirtualMachineCode* vm)
+{
+    free(vm->tape.data);
+    free(vm->stack_offsets.data);
+    *vm = (struct VirtualMachineCode) {0};
 }
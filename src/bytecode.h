@@ -1,7 +1,7 @@
 #pragma once
 #include <stdbool.h>
 #include "utils.h"
-#include "frontend.h"
+#include "flat_ast.h"
 
 enum BytecodeOp
 {
@@ -13,6 +13,8 @@ enum BytecodeOp
     // Data transformation
     // Consume first element and:
     NOT, // logical negation 
+    NEG, // arithmetic negation
+    BIT_NOT, // bitwise complement
     // Consume top 2 stack elements and:
     ADD, // adds
     SUB, // subtracts
@@ -21,16 +23,26 @@ enum BytecodeOp
     REM, // calculates modulo of first by second
     LSHIFT, // shifts first number left by second
     RSHIFT, // shifts first number right by second
-        //  Not supported yet instructions
-    // Flow
-    // CMP, 
-    // JMP,
-    // JE,
-    // JNE,
-    // JG,
-    // JL,
+    BIT_AND,
+    BIT_OR,
+    BIT_XOR,
+    // Compare first with second, push 1 or 0
+    EQ,
+    NE,
+    LT,
+    LE,
+    GT,
+    GE,
+    // Flow, target tape index as next instruction
+    JMP,
+    JZ, // Consumes the condition
+    JNZ, // Consumes the condition
     CALL,
-    RET
+    RET,
+    // Superinstructions, only made by the peephole pass (see peephole.h)
+    ADD_IMM, // Adds the next value to the top of the stack
+    LOAD_ADD, // Adds the variable at the next value to the top of the stack
+    STORE_KEEP, // STORE that leaves the value on the stack
 };
 
 union Bytecode
@@ -43,7 +55,7 @@ DEFINE_NEW_DYN_ARRAY(Tape, union Bytecode, new_tape, add_to_tape);
 
 struct VirtualMachineCode
 {
-    const char* symbol;
+    uint32_t symbol; // Interned function name
     struct Tape tape; 
     size_t current_stack_offset;
     int32_t current_offset;
@@ -51,5 +63,16 @@ struct VirtualMachineCode
     struct HashMap stack_offsets;
 };
 
-struct VirtualMachineCode compile_to_vm(struct FunctionAst const* ast);
+// Operand stack slots an instruction consumes and produces, CALL is {0, 0}
+struct StackEffect
+{
+    uint8_t pops;
+    uint8_t pushes;
+};
+
+// Followed by an operand on the tape
+bool is_op_double_width(enum BytecodeOp op);
+struct StackEffect op_stack_effect(enum BytecodeOp op);
+struct VirtualMachineCode compile_to_vm(struct FlatFunction const* function);
+void free_vm_code(struct VirtualMachineCode* vm);
 void print_tape(struct VirtualMachineCode const* vm);
@@ -0,0 +1,248 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "cache.h"
+#include "sha256.h"
+
+#define ENTRY_SUFFIX ".asm"
+#define TEMPORARY_SUFFIX ".tmp"
+// First line of an entry, a nasm comment followed by the assembly lines
+#define ENTRY_HEADER "; %zu functions\n"
+// A temporary file this old belongs to a writer that died before its rename,
+// a live writer is done within milliseconds
+#define STALE_TEMPORARY_SECONDS (60 * 60)
+// Eviction goes a bit below the limit, so it does not run again on the next store
+#define EVICTION_TARGET(limit) ((limit) / 10 * 9)
+
+struct CompileCache
+{
+    char* directory;
+    size_t size_limit;
+    atomic_size_t size; // Of all entries, as of the last scan plus our own stores
+    pthread_mutex_t eviction_lock;
+    atomic_size_t hits;
+    atomic_size_t misses;
+    atomic_size_t stores;
+    atomic_size_t evictions;
+    atomic_size_t temporary_count; // Makes temporary names unique within the process
+};
+
+struct CacheEntry
+{
+    char* path;
+    size_t size;
+    struct timespec used;
+};
+
+DEFINE_NEW_DYN_ARRAY(CacheEntryArray, struct CacheEntry, new_cache_entry_array, add_cache_entry)
+IMPLEMENT_NEW_DYN_ARRAY(CacheEntryArray, struct CacheEntry, new_cache_entry_array, add_cache_entry)
+
+static bool is_entry_name(char const* name)
+{
+    size_t const length = strlen(name);
+    return length == 64 + strlen(ENTRY_SUFFIX) && strcmp(&name[64], ENTRY_SUFFIX) == 0;
+}
+
+// <entry name>.<pid>.<count>.tmp, see cache_store
+static bool is_temporary_name(char const* name)
+{
+    size_t const length = strlen(name);
+    size_t const prefix = 64 + strlen(ENTRY_SUFFIX);
+    return length > prefix + strlen(TEMPORARY_SUFFIX) && name[prefix] == '.'
+        && strncmp(&name[64], ENTRY_SUFFIX, strlen(ENTRY_SUFFIX)) == 0
+        && strcmp(&name[length - strlen(TEMPORARY_SUFFIX)], TEMPORARY_SUFFIX) == 0;
+}
+
+// All entries of the directory, their total size in `total`. Stale temporary
+// files are removed on the way, nothing else would ever delete them.
+static struct CacheEntryArray list_entries(struct CompileCache const* cache, size_t* total)
+{
+    struct CacheEntryArray entries = new_cache_entry_array();
+    *total = 0;
+    DIR* directory = opendir(cache->directory);
+    if (directory == NULL) return entries;
+    time_t const now = time(NULL);
+    struct dirent* item;
+    while ((item = readdir(directory)) != NULL)
+    {
+        bool const temporary = is_temporary_name(item->d_name);
+        if (!temporary && !is_entry_name(item->d_name)) continue;
+        struct CacheEntry entry = {.path = format("%s/%s", cache->directory, item->d_name)};
+        struct stat status;
+        if (stat(entry.path, &status) != 0)
+        {
+            // Evicted (or renamed into place) by someone else meanwhile
+            free(entry.path);
+            continue;
+        }
+        if (temporary)
+        {
+            if (now - status.st_mtim.tv_sec > STALE_TEMPORARY_SECONDS) unlink(entry.path);
+            free(entry.path);
+            continue;
+        }
+        entry.size = status.st_size;
+        entry.used = status.st_mtim;
+        *total += entry.size;
+        add_cache_entry(&entries, &entry);
+    }
+    closedir(directory);
+    return entries;
+}
+
+static void free_entries(struct CacheEntryArray* entries)
+{
+    for (size_t idx = 0; idx < entries->size; ++idx) free(entries->data[idx].path);
+    free(entries->data);
+}
+
+static int compare_by_use(void const* left, void const* right)
+{
+    struct timespec const* a = &((struct CacheEntry const*) left)->used;
+    struct timespec const* b = &((struct CacheEntry const*) right)->used;
+    if (a->tv_sec != b->tv_sec) return a->tv_sec < b->tv_sec ? -1 : 1;
+    return a->tv_nsec < b->tv_nsec ? -1 : a->tv_nsec > b->tv_nsec;
+}
+
+// Least recently used first, other processes may be storing and evicting too
+static void evict(struct CompileCache* cache)
+{
+    pthread_mutex_lock(&cache->eviction_lock);
+    size_t total;
+    struct CacheEntryArray entries = list_entries(cache, &total);
+    if (total > cache->size_limit)
+    {
+        qsort(entries.data, entries.size, sizeof(struct CacheEntry), compare_by_use);
+        for (size_t idx = 0; idx < entries.size && total > EVICTION_TARGET(cache->size_limit); ++idx)
+        {
+            if (unlink(entries.data[idx].path) != 0) continue;
+            total -= entries.data[idx].size;
+            atomic_fetch_add(&cache->evictions, 1);
+        }
+    }
+    atomic_store(&cache->size, total);
+    free_entries(&entries);
+    pthread_mutex_unlock(&cache->eviction_lock);
+}
+
+struct CompileCache* open_cache(char const* directory, size_t size_limit)
+{
+    if (mkdir(directory, 0777) != 0 && errno != EEXIST)
+    {
+        printf("Could not create the cache directory %s: %s\n", directory, strerror(errno));
+        exit(1);
+    }
+    struct CompileCache* cache = cc_malloc(sizeof(struct CompileCache));
+    cache->directory = strdup(directory);
+    cache->size_limit = size_limit;
+    pthread_mutex_init(&cache->eviction_lock, NULL);
+    evict(cache);
+    return cache;
+}
+
+void close_cache(struct CompileCache* cache)
+{
+    pthread_mutex_destroy(&cache->eviction_lock);
+    free(cache->directory);
+    free(cache);
+}
+
+struct CacheKey cache_key(char const* configuration, char const* source, size_t size)
+{
+    // Lengths keep the fields from running into each other
+    struct Sha256 hash = sha256_begin();
+    // Any rebuild of the compiler starts from an empty cache, which is cheaper
+    // than hunting for stale entries after a backend change
+    char const* build = compiler_build();
+    uint64_t const lengths[3] = {strlen(build), strlen(configuration), size};
+    sha256_update(&hash, lengths, sizeof(lengths));
+    sha256_update(&hash, build, lengths[0]);
+    sha256_update(&hash, configuration, lengths[1]);
+    sha256_update(&hash, source, size);
+    struct CacheKey key;
+    sha256_finish(&hash, key.digest);
+    return key;
+}
+
+static char* entry_path(struct CompileCache const* cache, struct CacheKey const* key)
+{
+    char hex[65];
+    for (int idx = 0; idx < 32; ++idx) sprintf(&hex[idx * 2], "%02x", key->digest[idx]);
+    return format("%s/%s" ENTRY_SUFFIX, cache->directory, hex);
+}
+
+bool cache_load(struct CompileCache* cache, struct CacheKey const* key, struct StringArray* assembly, size_t* functions)
+{
+    char* path = entry_path(cache, key);
+    int fd = open(path, O_RDONLY);
+    struct stat status;
+    bool const hit = fd >= 0 && fstat(fd, &status) == 0;
+    char* text = hit ? cc_malloc(status.st_size + 1) : NULL;
+    bool loaded = hit && read(fd, text, status.st_size) == status.st_size;
+    if (fd >= 0) close(fd);
+    char* lines = loaded ? strchr(text, '\n') : NULL;
+    loaded = lines != NULL && sscanf(text, ENTRY_HEADER, functions) == 1;
+    if (loaded)
+    {
+        // Most recently used now, for eviction
+        utimensat(AT_FDCWD, path, NULL, 0);
+        for (char* line = lines + 1; *line != '\0';)
+        {
+            char* end = strchr(line, '\n');
+            if (end != NULL) *end = '\0';
+            add_string(assembly, line);
+            if (end == NULL) break;
+            line = end + 1;
+        }
+    }
+    atomic_fetch_add(loaded ? &cache->hits : &cache->misses, 1);
+    free(text);
+    free(path);
+    return loaded;
+}
+
+void cache_store(struct CompileCache* cache, struct CacheKey const* key, struct StringArray const* assembly,
+    size_t functions)
+{
+    char* path = entry_path(cache, key);
+    char* temporary = format("%s.%d.%zu" TEMPORARY_SUFFIX, path, (int) getpid(), atomic_fetch_add(&cache->temporary_count, 1));
+    FILE* file = fopen(temporary, "w");
+    int const header = file != NULL ? fprintf(file, ENTRY_HEADER, functions) : -1;
+    bool written = header >= 0;
+    size_t size = header;
+    for (size_t idx = 0; written && idx < assembly->size; ++idx)
+    {
+        int const length = fprintf(file, "%s\n", assembly->data[idx]);
+        written = length >= 0;
+        size += length;
+    }
+    if (file != NULL && fclose(file) != 0) written = false;
+    // Readers see either no entry or a complete one
+    if (written && rename(temporary, path) == 0)
+    {
+        atomic_fetch_add(&cache->stores, 1);
+        if (atomic_fetch_add(&cache->size, size) + size > cache->size_limit) evict(cache);
+    }
+    else
+    {
+        unlink(temporary);
+    }
+    free(temporary);
+    free(path);
+}
+
+void print_cache_stats(struct CompileCache* cache)
+{
+    size_t const hits = atomic_load(&cache->hits);
+    size_t const lookups = hits + atomic_load(&cache->misses);
+    printf("Cache %s: %zu hits, %zu misses (%.1f%% hit rate), %zu stored, %zu evicted, %zu of %zu bytes used\n",
+        cache->directory, hits, lookups - hits, lookups == 0 ? 0.0 : 100.0 * hits / lookups,
+        atomic_load(&cache->stores), atomic_load(&cache->evictions), atomic_load(&cache->size), cache->size_limit);
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "utils.h"
+
+// On-disk cache of compiled assembly, content addressed: the key is the
+// SHA-256 of the compiler build, the flags that change the output and the
+// source bytes, so a hit is always valid and nothing has to be invalidated.
+// Entries are written to a temporary file and renamed into place, so any
+// number of threads and processes can share a directory. A hit refreshes the
+// entry's modification time and the oldest entries are removed first when the
+// directory grows over its size limit.
+struct CompileCache;
+
+struct CacheKey
+{
+    uint8_t digest[32];
+};
+
+// Creates the directory if needed, exits with an error message if it can't
+struct CompileCache* open_cache(char const* directory, size_t size_limit);
+void close_cache(struct CompileCache* cache);
+
+// `configuration` describes the flags that change the output
+struct CacheKey cache_key(char const* configuration, char const* source, size_t size);
+// Adds the cached lines to `assembly` on a hit, `functions` is the count they
+// were stored with
+bool cache_load(struct CompileCache* cache, struct CacheKey const* key, struct StringArray* assembly, size_t* functions);
+// Failing to write only costs a future hit, it is not an error
+void cache_store(struct CompileCache* cache, struct CacheKey const* key, struct StringArray const* assembly,
+    size_t functions);
+void print_cache_stats(struct CompileCache* cache);
@@ -1,26 +1,24 @@
 #include <stdio.h>
 #include <string.h>
-#include <string.h>
+#include "batch.h"
+#include "bench.h"
+#include "cache.h"
+#include "input.h"
+#include "intern.h"
+#include "interpreter.h"
+#include "jit.h"
+#include "object.h"
 #include "utils.h"
 #include "x86.h"
 #include "bytecode.h"
+#include "flat_ast.h"
+#include "incremental.h"
+#include "pipeline.h"
+#include "server.h"
+#include "ssa.h"
+#include "thread_pool.h"
 
 
-static char const* read_file(const char* filename)
-{
-    FILE* file = fopen(filename, "r");
-    assert(file);
-    
-    fseek(file, 0, SEEK_END);
-    long file_sz = ftell(file);
-    rewind(file);
-    char* file_content = cc_malloc(file_sz + 1);
-    file_content[file_sz] = '\0';
-    fread(file_content, 1, file_sz, file);
-    fclose(file);
-    return file_content;
-}
-
 // SSA as simplification:
 // I want to introduce a intermediate representation very early, since
 // a) as a way to decrease the number of types of operations
@@ -48,15 +46,48 @@ struct InputFlags
 {
     bool show_tokens;  
     bool show_ast;
+    bool show_flat_ast;
+    bool show_ssa;
+    bool dump_peephole; // Tapes before and after, with -O
     bool print_asm;
+    bool regalloc_stats; // Per function
+    bool object_file; // -c, written next to the source
+    bool baseline; // Copy-and-patch tier for -c and --run
+    bool mem_stats;
+    bool optimize;
+    bool interpret; // Run main instead of printing the tapes
+    bool run; // Same, as machine code in this process
     char const* filename;
+    char const* benchmark;
+    size_t jobs; // Backend threads
+    // More than one input (or a response file) switches to batch mode
+    struct StringArray inputs;
+    bool batch;
+    char const* server_socket; // --server
+    // --client: everything after the socket path is sent as the request
+    char const* client_socket;
+    int client_argc;
+    char** client_argv;
+    char const* cache_directory; // Batch and server mode only
+    size_t cache_size; // In MB, 0 for DEFAULT_CACHE_SIZE
+    char const* incremental_state; // Single file mode only
 };
 
+#define DEFAULT_CACHE_SIZE 256 // MB
+
+static enum ScanMode parse_scan_mode(char const* name)
+{
+    for (int mode = SCAN_SCALAR; mode <= SCAN_AVX2; ++mode)
+    {
+        if (strcmp(scan_mode_name(mode), name) == 0) return mode;
+    }
+    printf("Unknown scan mode: %s (expected scalar, sse2 or avx2)\n", name);
+    exit(1);
+}
+
 struct InputFlags handle_arguments(int argc, char** argv)
 {
-    struct InputFlags flags = {0};
-    assert(argc >= 2 && "Missing input file");
-    flags.filename = argv[1];
+    struct InputFlags flags = {.jobs = 1, .inputs = new_string_array()};
 
     for (int arg_idx = 1; arg_idx < argc; ++arg_idx)
     {
@@ -68,19 +99,362 @@ struct InputFlags handle_arguments(int argc, char** argv)
         {
             flags.show_ast = true;
         } 
+        else if (strcmp(argv[arg_idx], "--flat-ast") == 0)
+        {
+            flags.show_flat_ast = true;
+        }
+        else if (strcmp(argv[arg_idx], "--ssa") == 0)
+        {
+            flags.show_ssa = true;
+        }
+        else if (strcmp(argv[arg_idx], "-S") == 0)
+        {
+            flags.print_asm = true;
+        }
+        else if (strcmp(argv[arg_idx], "-c") == 0)
+        {
+            flags.object_file = true;
+        }
+        else if (strcmp(argv[arg_idx], "--baseline") == 0)
+        {
+            flags.baseline = true;
+        }
+        else if (strcmp(argv[arg_idx], "--regalloc-stats") == 0)
+        {
+            flags.regalloc_stats = true;
+        }
+        else if (strcmp(argv[arg_idx], "--dump-peephole") == 0)
+        {
+            flags.dump_peephole = true;
+        }
+        else if (strcmp(argv[arg_idx], "-O") == 0)
+        {
+            flags.optimize = true;
+        }
+        else if (strcmp(argv[arg_idx], "--interpret") == 0)
+        {
+            flags.interpret = true;
+        }
+        else if (strcmp(argv[arg_idx], "--run") == 0)
+        {
+            flags.run = true;
+        }
+        else if (strcmp(argv[arg_idx], "--mem-stats") == 0)
+        {
+            flags.mem_stats = true;
+        }
+        else if (strcmp(argv[arg_idx], "--bench") == 0 && arg_idx + 1 < argc)
+        {
+            flags.benchmark = argv[++arg_idx];
+        }
+        else if (strncmp(argv[arg_idx], "-j", 2) == 0)
+        {
+            // -j N or -jN
+            char const* count = argv[arg_idx][2] != '\0' ? &argv[arg_idx][2] : arg_idx + 1 < argc ? argv[++arg_idx] : "";
+            char* end;
+            long jobs = strtol(count, &end, 10);
+            if (*count == '\0' || *end != '\0' || jobs < 1 || jobs > 1024)
+            {
+                printf("Invalid thread count for -j: %s\n", count);
+                exit(1);
+            }
+            flags.jobs = jobs;
+        }
+        else if (strcmp(argv[arg_idx], "--scan") == 0 && arg_idx + 1 < argc)
+        {
+            set_lexer_scan_mode(parse_scan_mode(argv[++arg_idx]));
+        }
+        else if (strcmp(argv[arg_idx], "--server") == 0 && arg_idx + 1 < argc)
+        {
+            flags.server_socket = argv[++arg_idx];
+        }
+        else if (strcmp(argv[arg_idx], "--cache") == 0 && arg_idx + 1 < argc)
+        {
+            flags.cache_directory = argv[++arg_idx];
+        }
+        else if (strcmp(argv[arg_idx], "--cache-size") == 0 && arg_idx + 1 < argc)
+        {
+            // In MB
+            char* end;
+            long size = strtol(argv[++arg_idx], &end, 10);
+            if (*argv[arg_idx] == '\0' || *end != '\0' || size < 1)
+            {
+                printf("Invalid cache size: %s\n", argv[arg_idx]);
+                exit(1);
+            }
+            flags.cache_size = size;
+        }
+        else if (strcmp(argv[arg_idx], "--incremental") == 0 && arg_idx + 1 < argc)
+        {
+            flags.incremental_state = argv[++arg_idx];
+        }
+        else if (strcmp(argv[arg_idx], "--client") == 0 && arg_idx + 1 < argc)
+        {
+            flags.client_socket = argv[++arg_idx];
+            flags.client_argc = argc - arg_idx - 1;
+            flags.client_argv = &argv[arg_idx + 1];
+            break;
+        }
+        else if (argv[arg_idx][0] == '@')
+        {
+            read_response_file(&argv[arg_idx][1], &flags.inputs);
+            flags.batch = true;
+        }
+        else
+        {
+            add_string(&flags.inputs, argv[arg_idx]);
+        }
     }
+    flags.batch |= flags.inputs.size > 1;
+    if (flags.inputs.size != 0) flags.filename = flags.inputs.data[0];
+    if ((flags.object_file || flags.run) && (flags.batch || flags.print_asm || flags.incremental_state != NULL))
+    {
+        printf("-c and --run take a single file and can not be combined with -S or --incremental\n");
+        exit(1);
+    }
+    if (flags.batch && (flags.print_asm || flags.interpret))
+    {
+        printf("-S and --interpret take a single file, batch mode writes name.asm for every input\n");
+        exit(1);
+    }
+    // Single file mode prints the intermediate stages, which are not cached
+    if ((flags.cache_directory != NULL || flags.cache_size != 0) && !flags.batch && flags.server_socket == NULL)
+    {
+        printf("--cache and --cache-size only apply to batch mode and --server\n");
+        exit(1);
+    }
+    if (flags.cache_size != 0 && flags.cache_directory == NULL)
+    {
+        printf("--cache-size needs --cache\n");
+        exit(1);
+    }
+    if (flags.baseline && !flags.object_file && !flags.run)
+    {
+        printf("--baseline only makes machine code, for -c or --run\n");
+        exit(1);
+    }
+    assert((flags.filename != NULL || flags.benchmark != NULL || flags.server_socket != NULL || flags.client_socket != NULL)
+        && "Missing input file");
     return flags;
 }
 
+static void print_function_ssa(struct VirtualMachineCode const* vm)
+{
+    struct SsaFunction function;
+    char* error = build_ssa(vm, &function);
+    if (error == NULL) error = verify_ssa(&function);
+    if (error != NULL)
+    {
+        printf("%s\n", error);
+        exit(1);
+    }
+    print_ssa(&function);
+    free_ssa_function(&function);
+}
+
+// Exit code is main's return value
+static int interpret_main(struct CompiledUnit const* unit)
+{
+    for (size_t idx = 0; idx < unit->function_count; ++idx)
+    {
+        if (strcmp(symbol_name(unit->code[idx].symbol), "main") != 0) continue;
+        struct InterpretedFunction function;
+        char* error = prepare_function(&unit->code[idx], &function);
+        struct Interpreter interpreter = new_interpreter();
+        int32_t result = 0;
+        if (error == NULL) error = run_function(&interpreter, &function, &result);
+        free_interpreter(&interpreter);
+        free_interpreted_function(&function);
+        if (error != NULL)
+        {
+            printf("%s\n", error);
+            free(error);
+            return 1;
+        }
+        return result;
+    }
+    printf("No main function to interpret\n");
+    return 1;
+}
+
+// Exit code is main's return value
+static int run_main(struct CompiledUnit const* unit)
+{
+    struct JitModule module;
+    char* error = load_jit_module(unit->machine_code, unit->function_count, &module);
+    if (error != NULL)
+    {
+        printf("%s\n", error);
+        free(error);
+        return 1;
+    }
+    int32_t result = 0;
+    bool found = call_jit_function(&module, intern((struct StringView) {"main", 4}), &result);
+    free_jit_module(&module);
+    if (!found)
+    {
+        printf("No main function to run\n");
+        return 1;
+    }
+    return result;
+}
+
+// foo.c -> foo.o, 0 on success
+static int write_object_file(char const* source_path, struct CompiledUnit const* unit)
+{
+    size_t length = strlen(source_path);
+    if (length > 2 && strcmp(&source_path[length - 2], ".c") == 0) length -= 2;
+    char* path = format("%.*s.o", (int) length, source_path);
+    struct ByteArray object = write_elf_object(unit->machine_code, unit->function_count);
+    FILE* file = fopen(path, "wb");
+    bool written = file != NULL && fwrite(object.data, 1, object.size, file) == object.size;
+    if (file != NULL && fclose(file) != 0) written = false;
+    if (!written) printf("Could not write %s\n", path);
+    free(object.data);
+    free(path);
+    return written ? 0 : 1;
+}
+
 int main(int argc, char* argv[])
 {
     struct InputFlags options = handle_arguments(argc, argv);
-    const char* file_contents = read_file(options.filename);
-    struct FunctionAst* ast = produce_ast(file_contents);
-    
-    struct VirtualMachineCode tape = compile_to_vm(ast);
-    print_tape(&tape);
-    struct StringArray assembly = codegen(&tape);
-    UNUSED(assembly);
-}
+    if (options.benchmark != NULL)
+    {
+        return run_benchmark(options.benchmark);
+    }
+    if (options.client_socket != NULL)
+    {
+        return run_client(options.client_socket, options.client_argc, options.client_argv);
+    }
+    struct CompileCache* cache = NULL;
+    if (options.cache_directory != NULL)
+    {
+        size_t const megabytes = options.cache_size != 0 ? options.cache_size : DEFAULT_CACHE_SIZE;
+        cache = open_cache(options.cache_directory, megabytes * 1024 * 1024);
+    }
+    if (options.server_socket != NULL)
+    {
+        int result = run_server(options.server_socket, options.jobs, cache);
+        if (cache != NULL) close_cache(cache);
+        return result;
+    }
+    if (options.batch)
+    {
+        struct ThreadPool* pool = new_thread_pool(options.jobs);
+        int result = run_batch(&options.inputs, pool, options.optimize, options.mem_stats, cache);
+        free_thread_pool(pool);
+        if (cache != NULL) close_cache(cache);
+        return result;
+    }
+    struct SourceInput input;
+    struct TokenStream tokens;
+    tokenize_input(options.filename, &input, &tokens);
+    if (options.show_tokens)
+    {
+        list_tokens(&tokens);
+    }
+    struct Arena ast_arena = new_arena("ast");
+    struct TranslationUnitAst* ast = parse(&tokens, &ast_arena);
+    struct IncrementalState* incremental = NULL;
+    if (options.incremental_state != NULL)
+    {
+        incremental = load_incremental_state(options.incremental_state, unit_configuration(options.optimize));
+        fingerprint_functions(incremental, ast, &tokens);
+    }
+    // The AST only holds symbols and values
+    free_token_stream(&tokens);
+    close_input(&input);
+    if (options.show_ast)
+    {
+        print_ast(ast);
+    }
+    struct ThreadPool* pool = new_thread_pool(options.jobs);
+    struct UnitOptions unit_options = {
+        .keep_flat = options.show_flat_ast,
+        .keep_raw_tapes = options.dump_peephole,
+        .optimize = options.optimize,
+        // The tapes (and --ssa) are printed without it
+        .backend = options.print_asm || options.object_file || options.run || options.regalloc_stats
+            || options.incremental_state != NULL,
+        .object_code = options.object_file || options.run,
+        .baseline = options.baseline,
+        .incremental = incremental
+    };
+    struct CompiledUnit unit = compile_unit(ast, pool, &unit_options);
+    free_thread_pool(pool);
+    if (options.optimize)
+    {
+        printf("Optimizer eliminated %zu of %zu expression nodes\n", unit.optimization.eliminated_nodes,
+            unit.optimization.expression_nodes);
+        struct PeepholeStats const* peephole = &unit.peephole;
+        printf("Peephole shrank the tapes from %zu to %zu words, %zu to %zu instructions (%zu superinstructions)\n",
+            peephole->words_before, peephole->words_after, peephole->instructions_before,
+            peephole->instructions_after, peephole->superinstructions);
+    }
+    if (incremental != NULL)
+    {
+        printf("Reused %zu of %zu functions from %s\n", reused_function_count(incremental), unit.function_count,
+            options.incremental_state);
+        save_incremental_state(incremental, options.incremental_state, unit.code, unit.assembly);
+        free_incremental_state(incremental);
+    }
+    if (options.mem_stats)
+    {
+        printf("Memory statistics:\n");
+        print_arena_stats(&ast_arena);
+        print_arena_stats(interner_arena());
+    }
+    // Nothing references the AST after the backend
+    arena_release(&ast_arena);
+    if (options.interpret)
+    {
+        int result = interpret_main(&unit);
+        free_compiled_unit(&unit);
+        return result;
+    }
+    if (options.run)
+    {
+        int result = run_main(&unit);
+        free_compiled_unit(&unit);
+        return result;
+    }
 
+    // Output in source order, whichever thread compiled the function
+    for (size_t idx = 0; idx < unit.function_count; ++idx)
+    {
+        if (options.show_flat_ast)
+        {
+            print_flat_function(&unit.flat[idx]);
+        }
+        // Reused functions (--incremental) were not compiled this time
+        if (options.dump_peephole && unit.raw_tapes[idx].data != NULL)
+        {
+            printf("Before peephole:\n");
+            print_tape(&(struct VirtualMachineCode) {.symbol = unit.code[idx].symbol, .tape = unit.raw_tapes[idx]});
+            printf("After peephole:\n");
+        }
+        print_tape(&unit.code[idx]);
+        if (options.show_ssa)
+        {
+            print_function_ssa(&unit.code[idx]);
+        }
+        if (options.regalloc_stats)
+        {
+            struct AllocationStats const* stats = &unit.allocation[idx];
+            printf("Registers for %s: %zu values in %zu registers, %zu spilled (%zu split)\n",
+                symbol_name(unit.code[idx].symbol), stats->values, stats->registers, stats->spilled, stats->split);
+        }
+    }
+    if (options.object_file)
+    {
+        int result = write_object_file(options.filename, &unit);
+        free_compiled_unit(&unit);
+        return result;
+    }
+    if (options.print_asm)
+    {
+        struct StringArray assembly = codegen(unit.assembly, unit.function_count);
+        for (size_t idx = 0; idx < assembly.size; ++idx) printf("%s\n", assembly.data[idx]);
+        free_string_array(&assembly);
+    }
+}
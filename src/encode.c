@@ -0,0 +1,365 @@
+#include <string.h>
+#include "encode.h"
+
+IMPLEMENT_NEW_DYN_ARRAY(ByteArray, uint8_t, new_byte_array, add_byte);
+IMPLEMENT_NEW_DYN_ARRAY(Relocations, struct Relocation, new_relocations, add_relocation);
+
+// Longest instructions this encoder produces are mov dword [rbp - disp32], imm32
+// and imul r32, dword [rbp - disp32], imm32
+#define MAX_INSTRUCTION_LENGTH 11
+
+struct Encoding
+{
+    uint8_t bytes[MAX_INSTRUCTION_LENGTH + 1];
+    size_t length;
+};
+
+static uint8_t const CONDITION_CODES[] = {
+    [CC_E] = 0x4, [CC_NE] = 0x5, [CC_L] = 0xC, [CC_LE] = 0xE, [CC_G] = 0xF, [CC_GE] = 0xD
+};
+
+// Opcode extension of the immediate forms (0x81, 0x83), the register forms
+// are at 8 times that
+static uint8_t const ALU_EXTENSIONS[] = {
+    [X86_ADD] = 0, [X86_OR] = 1, [X86_AND] = 4, [X86_SUB] = 5, [X86_XOR] = 6, [X86_CMP] = 7
+};
+
+static bool fits_in_byte(int32_t value)
+{
+    return value >= INT8_MIN && value <= INT8_MAX;
+}
+
+static void put(struct Encoding* encoding, uint8_t byte)
+{
+    assert(encoding->length < MAX_INSTRUCTION_LENGTH);
+    encoding->bytes[encoding->length++] = byte;
+}
+
+static void put_u32(struct Encoding* encoding, int32_t value)
+{
+    for (int shift = 0; shift < 32; shift += 8) put(encoding, (uint32_t) value >> shift);
+}
+
+// ModRM, SIB and displacement of [base + index * scale + disp]
+static void put_address(struct Encoding* encoding, uint8_t reg, struct X86Operand address)
+{
+    uint8_t const scale = __builtin_ctz(address.scale) << 6;
+    if (address.base == NO_REGISTER)
+    {
+        // No base means a 32 bit displacement
+        put(encoding, 0x04 | (reg & 7) << 3);
+        put(encoding, scale | (address.index & 7) << 3 | 5);
+        put_u32(encoding, address.value);
+        return;
+    }
+    // rbp and r13 as the base always take a displacement
+    uint8_t mod = 0x80;
+    if (address.value == 0 && (address.base & 7) != RBP) mod = 0x00;
+    else if (fits_in_byte(address.value)) mod = 0x40;
+    // rsp and r12 as the base need a SIB
+    if (address.index == NO_REGISTER && (address.base & 7) != RSP) put(encoding, mod | (reg & 7) << 3 | (address.base & 7));
+    else
+    {
+        uint8_t const index = address.index != NO_REGISTER ? address.index : RSP;
+        put(encoding, mod | (reg & 7) << 3 | 4);
+        put(encoding, scale | (index & 7) << 3 | (address.base & 7));
+    }
+    if (mod == 0x40) put(encoding, address.value);
+    if (mod == 0x80) put_u32(encoding, address.value);
+}
+
+// REX if anything needs it, then the opcode, ModRM and the displacement.
+// `rm` is a register, a frame slot or an address, `reg` a register or an
+// opcode extension. spl, bpl, sil and dil only exist with a REX prefix.
+static void put_modrm(struct Encoding* encoding, bool wide, bool byte_rm, uint8_t const* opcode, size_t opcode_length,
+    uint8_t reg, struct X86Operand rm)
+{
+    bool const rm_register = rm.kind == X86_REGISTER;
+    bool const has_base = rm.kind == X86_ADDRESS && rm.base != NO_REGISTER;
+    bool const has_index = rm.kind == X86_ADDRESS && rm.index != NO_REGISTER;
+    uint8_t const rex = 0x40 | wide << 3 | (reg >> 3) << 2 | (has_index ? rm.index >> 3 : 0) << 1
+        | (rm_register ? rm.value >> 3 : has_base ? rm.base >> 3 : 0);
+    if (rex != 0x40 || (byte_rm && rm_register && rm.value >= RSP)) put(encoding, rex);
+    for (size_t idx = 0; idx < opcode_length; ++idx) put(encoding, opcode[idx]);
+    if (rm_register)
+    {
+        put(encoding, 0xC0 | (reg & 7) << 3 | (rm.value & 7));
+        return;
+    }
+    if (rm.kind == X86_ADDRESS)
+    {
+        put_address(encoding, reg, rm);
+        return;
+    }
+    // [rbp + disp], rbp as the base always takes a displacement
+    assert(rm.kind == X86_FRAME);
+    int32_t const displacement = -rm.value;
+    if (fits_in_byte(displacement))
+    {
+        put(encoding, 0x45 | (reg & 7) << 3);
+        put(encoding, displacement);
+        return;
+    }
+    put(encoding, 0x85 | (reg & 7) << 3);
+    put_u32(encoding, displacement);
+}
+
+static void put_op(struct Encoding* encoding, bool wide, uint8_t opcode, uint8_t reg, struct X86Operand rm)
+{
+    put_modrm(encoding, wide, false, &opcode, 1, reg, rm);
+}
+
+// Opcode + register number, with REX.B for the upper registers
+static void put_short_form(struct Encoding* encoding, uint8_t opcode, uint8_t reg)
+{
+    if (reg >= R8) put(encoding, 0x41);
+    put(encoding, opcode + (reg & 7));
+}
+
+static void encode_alu(struct Encoding* encoding, struct X86Instruction const* instruction)
+{
+    struct X86Operand const destination = instruction->destination;
+    struct X86Operand const source = instruction->source;
+    uint8_t const extension = ALU_EXTENSIONS[instruction->op];
+    if (source.kind == X86_IMMEDIATE)
+    {
+        if (fits_in_byte(source.value))
+        {
+            put_op(encoding, instruction->wide, 0x83, extension, destination);
+            put(encoding, source.value);
+            return;
+        }
+        if (destination.kind == X86_REGISTER && destination.value == RAX)
+        {
+            // Accumulator form, one byte shorter
+            if (instruction->wide) put(encoding, 0x48);
+            put(encoding, extension * 8 + 5);
+        }
+        else put_op(encoding, instruction->wide, 0x81, extension, destination);
+        put_u32(encoding, source.value);
+        return;
+    }
+    if (source.kind == X86_REGISTER) put_op(encoding, instruction->wide, extension * 8 + 1, source.value, destination);
+    else put_op(encoding, instruction->wide, extension * 8 + 3, destination.value, source);
+}
+
+// By cl, by 1 (its own opcode) or by an imm8
+static void encode_shift(struct Encoding* encoding, struct X86Instruction const* instruction)
+{
+    uint8_t const extension = instruction->op == X86_SHL ? 4 : 7;
+    if (instruction->source.kind != X86_IMMEDIATE) put_op(encoding, instruction->wide, 0xD3, extension, instruction->destination);
+    else if (instruction->source.value == 1) put_op(encoding, instruction->wide, 0xD1, extension, instruction->destination);
+    else
+    {
+        put_op(encoding, instruction->wide, 0xC1, extension, instruction->destination);
+        put(encoding, instruction->source.value);
+    }
+}
+
+static void encode_mov(struct Encoding* encoding, struct X86Instruction const* instruction)
+{
+    struct X86Operand const destination = instruction->destination;
+    struct X86Operand const source = instruction->source;
+    if (source.kind == X86_IMMEDIATE)
+    {
+        assert(!instruction->wide);
+        if (destination.kind == X86_REGISTER) put_short_form(encoding, 0xB8, destination.value);
+        else put_op(encoding, false, 0xC7, 0, destination);
+        put_u32(encoding, source.value);
+    }
+    else if (source.kind == X86_REGISTER) put_op(encoding, instruction->wide, 0x89, source.value, destination);
+    else put_op(encoding, instruction->wide, 0x8B, destination.value, source);
+}
+
+// Everything but jumps, which depend on the layout
+static void encode_instruction(struct Encoding* encoding, struct X86Instruction const* instruction)
+{
+    encoding->length = 0;
+    struct X86Operand const destination = instruction->destination;
+    struct X86Operand const source = instruction->source;
+    switch ((enum X86Op) instruction->op)
+    {
+        case X86_MOV:
+            encode_mov(encoding, instruction);
+            break;
+        case X86_ADD:
+        case X86_SUB:
+        case X86_AND:
+        case X86_OR:
+        case X86_XOR:
+        case X86_CMP:
+            encode_alu(encoding, instruction);
+            break;
+        case X86_IMUL:
+            put_modrm(encoding, instruction->wide, false, (uint8_t const[]) {0x0F, 0xAF}, 2, destination.value, source);
+            break;
+        case X86_IMUL_IMMEDIATE:
+            if (fits_in_byte(instruction->immediate))
+            {
+                put_op(encoding, instruction->wide, 0x6B, destination.value, source);
+                put(encoding, instruction->immediate);
+            }
+            else
+            {
+                put_op(encoding, instruction->wide, 0x69, destination.value, source);
+                put_u32(encoding, instruction->immediate);
+            }
+            break;
+        case X86_LEA:
+            put_op(encoding, instruction->wide, 0x8D, destination.value, source);
+            break;
+        case X86_TEST:
+            put_op(encoding, instruction->wide, 0x85, source.value, destination);
+            break;
+        case X86_NEG:
+            put_op(encoding, instruction->wide, 0xF7, 3, destination);
+            break;
+        case X86_NOT:
+            put_op(encoding, instruction->wide, 0xF7, 2, destination);
+            break;
+        case X86_IDIV:
+            put_op(encoding, instruction->wide, 0xF7, 7, destination);
+            break;
+        case X86_SHL:
+        case X86_SAR:
+            encode_shift(encoding, instruction);
+            break;
+        case X86_CDQ:
+            put(encoding, 0x99);
+            break;
+        case X86_SETCC:
+            put_modrm(encoding, false, true, (uint8_t const[]) {0x0F, 0x90 + CONDITION_CODES[instruction->condition]}, 2, 0,
+                destination);
+            break;
+        case X86_MOVZX:
+            put_modrm(encoding, false, true, (uint8_t const[]) {0x0F, 0xB6}, 2, destination.value, source);
+            break;
+        case X86_PUSH:
+            put_short_form(encoding, 0x50, destination.value);
+            break;
+        case X86_POP:
+            put_short_form(encoding, 0x58, destination.value);
+            break;
+        case X86_RET:
+            put(encoding, 0xC3);
+            break;
+        case X86_JMP:
+        case X86_JCC:
+        case X86_LABEL_HERE:
+            assert(false && "Laid out by encode_function");
+            break;
+    }
+}
+
+static bool is_jump(struct X86Instruction const* instruction)
+{
+    return instruction->op == X86_JMP || instruction->op == X86_JCC;
+}
+
+static size_t jump_length(struct X86Instruction const* instruction, bool is_short)
+{
+    if (is_short) return 2;
+    return instruction->op == X86_JMP ? 5 : 6;
+}
+
+void append_bytes(struct ByteArray* bytes, void const* data, size_t size)
+{
+    if (bytes->size + size >= bytes->max_capacity)
+    {
+        bytes->max_capacity = (bytes->size + size) * 2 + 16;
+        bytes->data = realloc(bytes->data, bytes->max_capacity);
+        assert(bytes->data);
+    }
+    memcpy(&bytes->data[bytes->size], data, size);
+    bytes->size += size;
+}
+
+struct EncodedFunction encode_function(struct MachineFunction const* function)
+{
+    size_t const count = function->code.size;
+    struct X86Instruction const* code = function->code.data;
+    uint32_t* offsets = cc_malloc((count + 1) * sizeof(uint32_t));
+    uint32_t* labels = cc_malloc((function->label_count + 1) * sizeof(uint32_t));
+    uint8_t* lengths = cc_malloc(count + 1);
+    bool* long_jumps = cc_malloc(count + 1);
+    struct Encoding encoding;
+    for (size_t idx = 0; idx < count; ++idx)
+    {
+        if (is_jump(&code[idx])) lengths[idx] = jump_length(&code[idx], true);
+        else if (code[idx].op != X86_LABEL_HERE)
+        {
+            encode_instruction(&encoding, &code[idx]);
+            lengths[idx] = encoding.length;
+        }
+    }
+
+    // Growing a jump only moves code apart, so this settles
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        uint32_t offset = 0;
+        for (size_t idx = 0; idx < count; ++idx)
+        {
+            offsets[idx] = offset;
+            if (code[idx].op == X86_LABEL_HERE) labels[code[idx].destination.value] = offset;
+            offset += lengths[idx];
+        }
+        offsets[count] = offset;
+        for (size_t idx = 0; idx < count; ++idx)
+        {
+            if (!is_jump(&code[idx]) || long_jumps[idx]) continue;
+            int64_t const displacement = (int64_t) labels[code[idx].destination.value] - offsets[idx + 1];
+            if (fits_in_byte(displacement)) continue;
+            long_jumps[idx] = true;
+            lengths[idx] = jump_length(&code[idx], false);
+            changed = true;
+        }
+    }
+
+    struct EncodedFunction encoded = {
+        .symbol = function->symbol,
+        .code = {.data = cc_malloc(offsets[count] + 1), .max_capacity = offsets[count] + 1}
+    };
+    for (size_t idx = 0; idx < count; ++idx)
+    {
+        struct X86Instruction const* instruction = &code[idx];
+        if (instruction->op == X86_LABEL_HERE) continue;
+        if (!is_jump(instruction)) encode_instruction(&encoding, instruction);
+        else
+        {
+            encoding.length = 0;
+            int32_t const displacement = labels[instruction->destination.value] - offsets[idx + 1];
+            uint8_t const condition = CONDITION_CODES[instruction->condition];
+            if (!long_jumps[idx])
+            {
+                put(&encoding, instruction->op == X86_JMP ? 0xEB : 0x70 + condition);
+                put(&encoding, displacement);
+            }
+            else
+            {
+                if (instruction->op == X86_JMP) put(&encoding, 0xE9);
+                else
+                {
+                    put(&encoding, 0x0F);
+                    put(&encoding, 0x80 + condition);
+                }
+                put_u32(&encoding, displacement);
+            }
+        }
+        append_bytes(&encoded.code, encoding.bytes, encoding.length);
+    }
+    assert(encoded.code.size == offsets[count]);
+    free(offsets);
+    free(labels);
+    free(lengths);
+    free(long_jumps);
+    return encoded;
+}
+
+void free_encoded_function(struct EncodedFunction* function)
+{
+    free(function->code.data);
+    free(function->relocations.data);
+    *function = (struct EncodedFunction) {0};
+}
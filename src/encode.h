@@ -0,0 +1,31 @@
+#pragma once
+#include "x86.h"
+
+// Machine code straight from the lowered instructions, without going through
+// assembly text. Jumps are relaxed: they start out short (rel8) and only the
+// ones whose target ends up out of reach get the rel32 form, other choices
+// (imm8 forms, disp8 frame accesses) follow what assemblers pick as well.
+
+DEFINE_NEW_DYN_ARRAY(ByteArray, uint8_t, new_byte_array, add_byte);
+
+// Reference to a symbol the linker fills in, for rel32 operands of calls
+struct Relocation
+{
+    uint32_t offset; // Of the patched bytes, from the start of the function
+    uint32_t symbol; // Interned name
+    uint32_t type; // R_X86_64_*
+    int32_t addend;
+};
+
+DEFINE_NEW_DYN_ARRAY(Relocations, struct Relocation, new_relocations, add_relocation);
+
+struct EncodedFunction
+{
+    uint32_t symbol;
+    struct ByteArray code;
+    struct Relocations relocations; // None yet, nothing is called
+};
+
+void append_bytes(struct ByteArray* bytes, void const* data, size_t size);
+struct EncodedFunction encode_function(struct MachineFunction const* function);
+void free_encoded_function(struct EncodedFunction* function);
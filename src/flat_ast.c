@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include "flat_ast.h"
+#include "intern.h"
+
+IMPLEMENT_NEW_DYN_ARRAY(FlatExpressions, struct FlatExpression, new_flat_expressions, add_flat_expression);
+IMPLEMENT_NEW_DYN_ARRAY(FlatConstants, int64_t, new_flat_constants, add_flat_constant);
+IMPLEMENT_NEW_DYN_ARRAY(FlatStatements, struct FlatStatement, new_flat_statements, add_flat_statement);
+
+struct FlattenFrame
+{
+    struct ExpressionNode const* node;
+    bool children_done;
+};
+
+DEFINE_NEW_DYN_ARRAY(FlattenStack, struct FlattenFrame, new_flatten_stack, push_flatten_frame);
+IMPLEMENT_NEW_DYN_ARRAY(FlattenStack, struct FlattenFrame, new_flatten_stack, push_flatten_frame);
+DEFINE_NEW_DYN_ARRAY(IndexStack, uint32_t, new_index_stack, push_index);
+IMPLEMENT_NEW_DYN_ARRAY(IndexStack, uint32_t, new_index_stack, push_index);
+
+static uint32_t emit(struct FlatFunction* function, struct FlatExpression const* node)
+{
+    add_flat_expression(&function->expressions, node);
+    return function->expressions.size - 1;
+}
+
+// Iterative post-order walk, expression depth is not limited by the C stack.
+// `roots` holds the emitted indices of finished subtrees.
+static uint32_t flatten_expression(struct FlatFunction* function, struct ExpressionNode const* root,
+    struct FlattenStack* stack, struct IndexStack* roots)
+{
+    push_flatten_frame(stack, &(struct FlattenFrame) {root, false});
+    while (stack->size != 0)
+    {
+        struct FlattenFrame frame = stack->data[--stack->size];
+        struct ExpressionNode const* node = frame.node;
+        struct FlatExpression flat = {.type = node->type, .left = FLAT_NONE, .right = FLAT_NONE};
+        switch (node->type)
+        {
+            case EXPR_CONSTANT:
+                flat.operand = function->constants.size;
+                add_flat_constant(&function->constants, &node->as.value);
+                break;
+            case EXPR_VARIABLE:
+                flat.operand = node->as.name;
+                break;
+            case EXPR_BIN:
+                if (!frame.children_done)
+                {
+                    push_flatten_frame(stack, &(struct FlattenFrame) {node, true});
+                    push_flatten_frame(stack, &(struct FlattenFrame) {node->as.bin->right, false});
+                    push_flatten_frame(stack, &(struct FlattenFrame) {node->as.bin->left, false});
+                    continue;
+                }
+                flat.op = node->as.bin->op;
+                flat.right = roots->data[--roots->size];
+                flat.left = roots->data[--roots->size];
+                break;
+            case EXPR_UNARY:
+                if (!frame.children_done)
+                {
+                    push_flatten_frame(stack, &(struct FlattenFrame) {node, true});
+                    push_flatten_frame(stack, &(struct FlattenFrame) {node->as.unary->operand, false});
+                    continue;
+                }
+                flat.op = node->as.unary->op;
+                flat.left = roots->data[--roots->size];
+                break;
+            case EXPR_CONDITIONAL:
+                if (!frame.children_done)
+                {
+                    push_flatten_frame(stack, &(struct FlattenFrame) {node, true});
+                    push_flatten_frame(stack, &(struct FlattenFrame) {node->as.conditional->if_false, false});
+                    push_flatten_frame(stack, &(struct FlattenFrame) {node->as.conditional->if_true, false});
+                    push_flatten_frame(stack, &(struct FlattenFrame) {node->as.conditional->condition, false});
+                    continue;
+                }
+                flat.right = roots->data[--roots->size];
+                flat.left = roots->data[--roots->size];
+                flat.operand = roots->data[--roots->size];
+                break;
+        }
+        uint32_t index = emit(function, &flat);
+        push_index(roots, &index);
+    }
+    assert(roots->size == 1);
+    roots->size = 0;
+    return function->expressions.size - 1;
+}
+
+struct FlatFunction flatten_function(struct FunctionAst const* ast)
+{
+    struct FlatFunction function = {
+        .name = ast->name,
+        .return_type = ast->return_type,
+        .expressions = new_flat_expressions(),
+        .constants = new_flat_constants(),
+        .statements = new_flat_statements()
+    };
+    struct FlattenStack stack = new_flatten_stack();
+    struct IndexStack roots = new_index_stack();
+
+    for (size_t idx = 0; idx < ast->statement_count; ++idx)
+    {
+        struct StatementAst const* stmt = ast->statements[idx];
+        struct FlatStatement flat = {.tag = stmt->tag, .first = FLAT_NONE, .root = FLAT_NONE};
+        struct ExpressionNode const* value = NULL;
+        switch (stmt->tag)
+        {
+            case TAG_DEFINITION:
+                flat.name = stmt->as.definition.name;
+                flat.type = stmt->as.definition.type;
+                if (stmt->as.definition.has_inital_value) value = stmt->as.definition.value;
+                break;
+            case TAG_ASSIGMENT:
+                flat.name = stmt->as.assignement.name;
+                value = stmt->as.assignement.value;
+                break;
+            case TAG_RETURN:
+                value = stmt->as.ret.value;
+                break;
+        }
+        if (value != NULL)
+        {
+            flat.first = function.expressions.size;
+            flat.root = flatten_expression(&function, value, &stack, &roots);
+        }
+        add_flat_statement(&function.statements, &flat);
+    }
+    free(stack.data);
+    free(roots.data);
+    return function;
+}
+
+void free_flat_function(struct FlatFunction* function)
+{
+    free(function->expressions.data);
+    free(function->constants.data);
+    free(function->statements.data);
+    *function = (struct FlatFunction) {0};
+}
+
+static char const* const STATEMENT_REPR[] = {
+    [TAG_DEFINITION] = "define",
+    [TAG_ASSIGMENT] = "assign",
+    [TAG_RETURN] = "return",
+};
+
+void print_flat_function(struct FlatFunction const* function)
+{
+    printf("\nFlat AST of %s\n\n", symbol_name(function->name));
+    for (size_t idx = 0; idx < function->statements.size; ++idx)
+    {
+        struct FlatStatement const* stmt = &function->statements.data[idx];
+        printf("statement %zu: %s", idx, STATEMENT_REPR[stmt->tag]);
+        if (stmt->tag != TAG_RETURN) printf(" %s", symbol_name(stmt->name));
+        if (stmt->root != FLAT_NONE) printf(" = [%u..%u]", stmt->first, stmt->root);
+        printf("\n");
+    }
+    for (size_t idx = 0; idx < function->expressions.size; ++idx)
+    {
+        struct FlatExpression const* node = &function->expressions.data[idx];
+        printf("%6zu: ", idx);
+        switch (node->type)
+        {
+            case EXPR_CONSTANT:
+                printf("constant %lld\n", (long long) function->constants.data[node->operand]);
+                break;
+            case EXPR_VARIABLE:
+                printf("variable %s\n", symbol_name(node->operand));
+                break;
+            case EXPR_BIN:
+                printf("%s %u %u\n", binary_op_name(node->op), node->left, node->right);
+                break;
+            case EXPR_UNARY:
+                printf("unary %s %u\n", unary_op_name(node->op), node->left);
+                break;
+            case EXPR_CONDITIONAL:
+                printf("? %u %u %u\n", node->operand, node->left, node->right);
+                break;
+        }
+    }
+}
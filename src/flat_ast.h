@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+#include "frontend.h"
+#include "utils.h"
+
+// Pointer free AST: nodes live in typed arrays and refer to each other with
+// 32 bit indices. Expressions are stored in post-order, so children always
+// come before their parent and every subtree is a contiguous range that ends
+// at its root. Walking an expression is a linear loop, and the whole function
+// can be copied or written out with memcpy.
+
+#define FLAT_NONE UINT32_MAX
+
+struct FlatExpression
+{
+    uint8_t type; // enum AstExpressionType
+    uint8_t op; // enum BinaryOp or enum UnaryOp
+    // Children, the last one is always the previous node:
+    // EXPR_BIN: left, right
+    // EXPR_UNARY: left
+    // EXPR_CONDITIONAL: operand (condition), left (if true), right (if false)
+    uint32_t left;
+    uint32_t right;
+    // EXPR_VARIABLE: symbol, EXPR_CONSTANT: index into constants
+    uint32_t operand;
+};
+
+struct FlatStatement
+{
+    uint8_t tag; // enum StatementTag
+    uint8_t type; // enum ValueType, TAG_DEFINITION only
+    uint32_t name; // Symbol of the defined/assigned variable
+    // Expression range [first, root], FLAT_NONE for definitions without a value
+    uint32_t first;
+    uint32_t root;
+};
+
+DEFINE_NEW_DYN_ARRAY(FlatExpressions, struct FlatExpression, new_flat_expressions, add_flat_expression);
+DEFINE_NEW_DYN_ARRAY(FlatConstants, int64_t, new_flat_constants, add_flat_constant);
+DEFINE_NEW_DYN_ARRAY(FlatStatements, struct FlatStatement, new_flat_statements, add_flat_statement);
+
+struct FlatFunction
+{
+    uint32_t name;
+    enum ValueType return_type;
+    struct FlatExpressions expressions;
+    struct FlatConstants constants;
+    struct FlatStatements statements;
+};
+
+// The pointer AST is not needed afterwards
+struct FlatFunction flatten_function(struct FunctionAst const* ast);
+void free_flat_function(struct FlatFunction* function);
+void print_flat_function(struct FlatFunction const* function);
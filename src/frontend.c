@@ -1,396 +1,1015 @@
-#include <ctype.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
 #include "frontend.h"
+#include "intern.h"
+#include "keyword_hash.h"
+#include "scan.h"
 #include "utils.h"
 
-static char const* token_to_string(struct Token const* token)
+IMPLEMENT_NEW_DYN_ARRAY(LiteralTable, struct IntegerLiteral, new_literal_table, add_literal);
+
+struct StringView token_text(struct TokenStream const* stream, size_t idx)
+{
+    return (struct StringView) {
+        .data = stream->source + stream->offsets[idx],
+        .length = stream->lengths[idx]
+    };
+}
+
+struct IntegerLiteral const* token_literal(struct TokenStream const* stream, size_t idx)
+{
+    assert(stream->types[idx] == TOK_INT_VALUE);
+    return &stream->literals.data[stream->payloads[idx]];
+}
+
+uint32_t token_symbol(struct TokenStream const* stream, size_t idx)
 {
-    switch(token->type) 
+    assert(stream->types[idx] == TOK_NAME);
+    return stream->payloads[idx];
+}
+
+// Big enough for any spelling, long names and literals are cut short
+#define TOKEN_STRING_SIZE 256
+
+// Names and literals are formatted into `buffer`, so nothing has to be freed
+// (compile_error does not come back to free it)
+static char const* token_to_string(struct TokenStream const* stream, size_t idx, char buffer[TOKEN_STRING_SIZE])
+{
+    switch((enum TokenType) stream->types[idx]) 
     {
         case TOK_INVALID: return "INVALID TOKEN";
-        case TOK_INT: return "int";
-        case TOK_INT_VALUE: return format("%d", token->value);
-        case TOK_RETURN: return "return";
+        case TOK_INT_VALUE:
+            snprintf(buffer, TOKEN_STRING_SIZE, "%llu", (unsigned long long) token_literal(stream, idx)->value);
+            return buffer;
         case TOK_PLUS: return "+";
+        case TOK_MINUS: return "-";
+        case TOK_STAR: return "*";
+        case TOK_SLASH: return "/";
+        case TOK_PERCENT: return "%";
+        case TOK_LSHIFT: return "<<";
+        case TOK_RSHIFT: return ">>";
+        case TOK_LESS: return "<";
+        case TOK_LESS_EQ: return "<=";
+        case TOK_GREATER: return ">";
+        case TOK_GREATER_EQ: return ">=";
+        case TOK_EQ_EQ: return "==";
+        case TOK_NOT_EQ: return "!=";
+        case TOK_AMPERSAND: return "&";
+        case TOK_CARET: return "^";
+        case TOK_PIPE: return "|";
+        case TOK_AND_AND: return "&&";
+        case TOK_OR_OR: return "||";
+        case TOK_BANG: return "!";
+        case TOK_TILDE: return "~";
+        case TOK_INCREMENT: return "++";
+        case TOK_DECREMENT: return "--";
+        case TOK_QUESTION: return "?";
+        case TOK_COLON: return ":";
         case TOK_LEFT_PAREN: return "(";
         case TOK_RIGHT_PAREN: return ")";
         case TOK_LEFT_BRACE: return "{";
         case TOK_RIGHT_BRACE: return "}";
         case TOK_EQ: return "=";
         case TOK_SEMICOLON: return ";";
-        case TOK_NAME: return format("Name: %s", token->name);
+        case TOK_NAME:
+            snprintf(buffer, TOKEN_STRING_SIZE, "Name: %s", symbol_name(token_symbol(stream, idx)));
+            return buffer;
+#define KEYWORD(text, token) case token: return #text;
+#include "keywords.def"
+#undef KEYWORD
     }
     return "Invalid token";
 }
 
+// Process wide default, every token stream picks it up when it is created
+static _Atomic(struct Scanner const*) default_scanner = NULL;
+
+void set_lexer_scan_mode(enum ScanMode mode)
+{
+    atomic_store(&default_scanner, get_scanner(mode));
+}
+
+static struct Scanner const* get_default_scanner()
+{
+    struct Scanner const* scanner = atomic_load(&default_scanner);
+    if (scanner != NULL) return scanner;
+    set_lexer_scan_mode(scan_detect_mode());
+    return atomic_load(&default_scanner);
+}
+
+static struct TokenStream new_token_stream(char const* source, size_t capacity)
+{
+    return (struct TokenStream) {
+        .source = source,
+        .scanner = get_default_scanner(),
+        .size = 0,
+        .capacity = capacity,
+        .types = cc_malloc(capacity * sizeof(uint8_t)),
+        .offsets = cc_malloc(capacity * sizeof(uint32_t)),
+        .lengths = cc_malloc(capacity * sizeof(uint32_t)),
+        .payloads = cc_malloc(capacity * sizeof(uint32_t)),
+        .literals = new_literal_table()
+    };
+}
+
+static void grow_token_stream(struct TokenStream* stream)
+{
+    stream->capacity *= 2;
+    stream->types = realloc(stream->types, stream->capacity * sizeof(uint8_t));
+    stream->offsets = realloc(stream->offsets, stream->capacity * sizeof(uint32_t));
+    stream->lengths = realloc(stream->lengths, stream->capacity * sizeof(uint32_t));
+    stream->payloads = realloc(stream->payloads, stream->capacity * sizeof(uint32_t));
+    assert(stream->types && stream->offsets && stream->lengths && stream->payloads);
+}
+
+static void push_token(struct TokenStream* stream, enum TokenType type, size_t offset, size_t length)
+{
+    if (stream->size == stream->capacity) grow_token_stream(stream);
+    stream->types[stream->size] = type;
+    stream->offsets[stream->size] = offset;
+    stream->lengths[stream->size] = length;
+    stream->payloads[stream->size] = 0;
+    ++stream->size;
+}
 
-static struct Token new_token(enum TokenType type)
+void free_token_stream(struct TokenStream* stream)
 {
-    return (struct Token) {type, 0, 0};
+    free(stream->types);
+    free(stream->offsets);
+    free(stream->lengths);
+    free(stream->payloads);
+    free(stream->literals.data);
+    *stream = (struct TokenStream) {0};
 }
 
 struct KeywordMapElem 
 {
     char const* string;
+    size_t length;
     enum TokenType type;
 };
 
-static struct KeywordMapElem keywords_or_builtin_types[] = {
-    {"int", TOK_INT},
-    {"return", TOK_RETURN},
-};
+// Generated at build time from keywords.def
+#include "keyword_table.h"
 
-static struct Token lex_keyword(char const* input_stream, size_t* position)
+enum TokenType classify_keyword(char const* text, size_t length)
+{
+    if (length < KEYWORD_MIN_LENGTH || length > KEYWORD_MAX_LENGTH) return TOK_NAME;
+    uint32_t slot = keyword_hash(text, length, KEYWORD_HASH_SEED, KEYWORD_HASH_BITS);
+    struct KeywordMapElem const* keyword = &keyword_table[slot];
+    if (keyword->length == length && memcmp(keyword->string, text, length) == 0)
+    {
+        return keyword->type;
+    }
+    return TOK_NAME;
+}
+
+static enum TokenType lex_keyword(struct Scanner const* scanner, char const* input_stream, size_t* position, size_t end)
 {
     size_t start_pos = *position;
-    while (isalnum(input_stream[*position])) ++(*position);
-    size_t const map_elem_count = sizeof(keywords_or_builtin_types) / sizeof(struct KeywordMapElem);
-    
-    struct Token token = new_token(TOK_NAME);
+    *position = scanner->identifier(input_stream, *position, end);
+    return classify_keyword(&input_stream[start_pos], *position - start_pos);
+}
 
-    size_t keyword_size = *position - start_pos;
-    --(*position);
-    for (size_t index = 0; index < map_elem_count; ++index)
+// Operators and punctuation, longest match first. Sets the token length.
+static enum TokenType lex_punctuation(char const* text, size_t position, size_t end, size_t* length)
+{
+    char const next = position + 1 < end ? text[position + 1] : 0;
+    *length = 2;
+    switch (text[position])
     {
-        if (strncmp(keywords_or_builtin_types[index].string, &input_stream[start_pos], keyword_size) == 0)
-        {
-            token.type = keywords_or_builtin_types[index].type;
+        case '<':
+            if (next == '<') return TOK_LSHIFT;
+            if (next == '=') return TOK_LESS_EQ;
+            break;
+        case '>':
+            if (next == '>') return TOK_RSHIFT;
+            if (next == '=') return TOK_GREATER_EQ;
             break;
+        case '+': if (next == '+') return TOK_INCREMENT; break;
+        case '-': if (next == '-') return TOK_DECREMENT; break;
+        case '=': if (next == '=') return TOK_EQ_EQ; break;
+        case '!': if (next == '=') return TOK_NOT_EQ; break;
+        case '&': if (next == '&') return TOK_AND_AND; break;
+        case '|': if (next == '|') return TOK_OR_OR; break;
+    }
+
+    *length = 1;
+    switch (text[position])
+    {
+        case '(': return TOK_LEFT_PAREN;
+        case ')': return TOK_RIGHT_PAREN;
+        case '+': return TOK_PLUS;
+        case '-': return TOK_MINUS;
+        case '*': return TOK_STAR;
+        case '/': return TOK_SLASH;
+        case '%': return TOK_PERCENT;
+        case '<': return TOK_LESS;
+        case '>': return TOK_GREATER;
+        case '&': return TOK_AMPERSAND;
+        case '^': return TOK_CARET;
+        case '|': return TOK_PIPE;
+        case '!': return TOK_BANG;
+        case '~': return TOK_TILDE;
+        case '?': return TOK_QUESTION;
+        case ':': return TOK_COLON;
+        case ';': return TOK_SEMICOLON;
+        case '=': return TOK_EQ;
+        case '{': return TOK_LEFT_BRACE;
+        case '}': return TOK_RIGHT_BRACE;
+        default: return TOK_INVALID;
+    }
+}
+
+// Whether 8 bytes are all ASCII digits: high nibbles are 3, and stay 3 after adding 6
+static bool is_eight_digits(uint64_t chunk)
+{
+    return ((chunk & 0xF0F0F0F0F0F0F0F0ull) | (((chunk + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4))
+        == 0x3333333333333333ull;
+}
+
+// 8 ASCII digits to their value at once (SWAR, little endian): neighbouring
+// digits are merged pairwise into 2, then 4, then 8 digit numbers
+static uint64_t parse_eight_digits(uint64_t chunk)
+{
+    chunk = ((chunk & 0x0F0F0F0F0F0F0F0Full) * 2561) >> 8;
+    chunk = ((chunk & 0x00FF00FF00FF00FFull) * 6553601) >> 16;
+    return ((chunk & 0x0000FFFF0000FFFFull) * 42949672960001ull) >> 32;
+}
+
+static int digit_value(char character)
+{
+    if (character >= '0' && character <= '9') return character - '0';
+    if (character >= 'a' && character <= 'f') return character - 'a' + 10;
+    if (character >= 'A' && character <= 'F') return character - 'A' + 10;
+    return 16;
+}
+
+static size_t word_end(char const* text, size_t position, size_t end)
+{
+    while (position < end && is_identifier_char(text[position])) ++position;
+    return position;
+}
+
+static void literal_error(char const* text, size_t start, size_t end, char const* reason)
+{
+    compile_error("Invalid integer literal %.*s: %s", (int) (word_end(text, start, end) - start), &text[start], reason);
+}
+
+static size_t lex_decimal_digits(char const* text, size_t start, size_t end, uint64_t* value)
+{
+    // The first digit is never 0 (that is an octal literal), so up to 19 digits
+    // always fit into 64 bits and only the 20th one needs a check.
+    // Two 8 digit chunks at most, the rest goes digit by digit.
+    uint64_t result = 0;
+    size_t position = start;
+    for (int chunk_idx = 0; chunk_idx < 2 && position + 8 <= end; ++chunk_idx)
+    {
+        uint64_t chunk;
+        memcpy(&chunk, &text[position], sizeof(chunk));
+        if (!is_eight_digits(chunk)) break;
+        result = result * 100000000 + parse_eight_digits(chunk);
+        position += 8;
+    }
+    for (; position < end && text[position] >= '0' && text[position] <= '9'; ++position)
+    {
+        if (position - start >= 19
+            && (__builtin_mul_overflow(result, 10, &result) || __builtin_add_overflow(result, text[position] - '0', &result)))
+        {
+            literal_error(text, start, end, "does not fit into 64 bits");
         }
+        if (position - start < 19) result = result * 10 + (text[position] - '0');
     }
+    *value = result;
+    return position;
+}
 
-    if (token.type == TOK_NAME)
+static size_t lex_radix_digits(char const* text, size_t start, size_t position, size_t end, unsigned radix, uint64_t* value)
+{
+    unsigned const bits_per_digit = radix == 16 ? 4 : radix == 8 ? 3 : 1;
+    uint64_t result = 0;
+    for (; position < end; ++position)
     {
-        token.name = cc_malloc(keyword_size + 1);
-        memcpy(token.name, &input_stream[start_pos], keyword_size);
+        int digit = digit_value(text[position]);
+        if (digit >= (int) radix) break;
+        if (result >> (64 - bits_per_digit) != 0)
+        {
+            literal_error(text, start, end, "does not fit into 64 bits");
+        }
+        result = result << bits_per_digit | digit;
     }
+    *value = result;
+    return position;
+}
 
-    return token;
+size_t lex_integer_literal(char const* text, size_t position, size_t end, struct IntegerLiteral* literal)
+{
+    size_t const start = position;
+    *literal = (struct IntegerLiteral) {0};
+
+    char const prefix = position + 1 < end && text[position] == '0' ? text[position + 1] : 0;
+    if (prefix == 'x' || prefix == 'X' || prefix == 'b' || prefix == 'B')
+    {
+        unsigned radix = prefix == 'x' || prefix == 'X' ? 16 : 2;
+        size_t digits_start = position + 2;
+        position = lex_radix_digits(text, start, digits_start, end, radix, &literal->value);
+        if (position == digits_start) literal_error(text, start, end, "missing digits after the prefix");
+    }
+    else if (text[position] == '0')
+    {
+        position = lex_radix_digits(text, start, position, end, 8, &literal->value);
+    }
+    else
+    {
+        position = lex_decimal_digits(text, position, end, &literal->value);
+    }
+
+    // Suffix: u, l, ll in either order, any case (but not lL)
+    while (position < end && is_identifier_char(text[position]))
+    {
+        char const suffix = text[position];
+        if ((suffix == 'u' || suffix == 'U') && !literal->is_unsigned)
+        {
+            literal->is_unsigned = true;
+            ++position;
+        }
+        else if ((suffix == 'l' || suffix == 'L') && literal->long_count == 0)
+        {
+            bool const is_long_long = position + 1 < end && text[position + 1] == suffix;
+            literal->long_count = is_long_long ? 2 : 1;
+            position += literal->long_count;
+        }
+        else
+        {
+            literal_error(text, start, end, "invalid digit or suffix");
+        }
+    }
+    return position;
 }
 
-static struct Token* lex(char const* input_stream, size_t* token_count)
+// Single pass over [positon, total_length) of the source, tokens only reference it through offsets
+static void lex(struct TokenStream* stream, size_t positon, size_t total_length)
 {
-    // TODO: DYNARRAY
-    struct Token* tokens = cc_malloc(100 * sizeof(struct Token));
-    size_t positon = 0;
-    size_t total_length = strlen(input_stream);
-    assert(total_length > 0);
+    char const* input_stream = stream->source;
+    struct Scanner const* scanner = stream->scanner;
+    struct InternCache symbols = {0};
 
     while (positon < total_length)
     {
-        if (isspace(input_stream[positon]))
+        if (is_whitespace(input_stream[positon]))
         {
-            ++positon;
+            positon = scanner->whitespace(input_stream, positon, total_length);
             continue;
         }
-    
-        if (isalpha(input_stream[positon]))
+
+        if (input_stream[positon] == '/' && positon + 1 < total_length && input_stream[positon + 1] == '/')
         {
-            tokens[*token_count] = lex_keyword(input_stream, &positon);
-            goto NEW_TOK_END;
+            positon = scanner->line_end(input_stream, positon + 2, total_length);
+            continue;
         }
 
-        if (isdigit(input_stream[positon]))
+        size_t const start_positon = positon;
+        if (is_identifier_start(input_stream[positon]))
         {
-            size_t const start_positon = positon;
-            while(isdigit(input_stream[positon++]));
-            size_t const length = positon - start_positon + 1;
-            char* tmp = cc_malloc(length + 1);
-            memcpy(tmp, &input_stream[start_positon], length);
-            struct Token* current_token = &tokens[*token_count];
-            current_token->type = TOK_INT_VALUE;
-            current_token->value = strtod(&input_stream[start_positon], &tmp);
-            // TODO temp fix
-            --positon;
-            ++(*token_count);
+            enum TokenType type = lex_keyword(scanner, input_stream, &positon, total_length);
+            push_token(stream, type, start_positon, positon - start_positon);
+            if (type == TOK_NAME)
+            {
+                stream->payloads[stream->size - 1] = intern_cached(&symbols, token_text(stream, stream->size - 1));
+            }
             continue;
         }
 
-        struct Token* current_token = &tokens[*token_count];
-        switch (input_stream[positon])
+        if (is_digit(input_stream[positon]))
         {
-            case '(':
-                current_token->type = TOK_LEFT_PAREN;
-                goto NEW_TOK_END;
-            case ')':
-                current_token->type = TOK_RIGHT_PAREN;
-                goto NEW_TOK_END;
-            case '+':
-                current_token->type = TOK_PLUS;
-                goto NEW_TOK_END;
-            case ';':
-                current_token->type = TOK_SEMICOLON;
-                goto NEW_TOK_END;
-            case '=':
-                current_token->type = TOK_EQ;
-                goto NEW_TOK_END;
-            case '{':
-                current_token->type = TOK_LEFT_BRACE;
-                goto NEW_TOK_END;
-            case '}':
-                current_token->type = TOK_RIGHT_BRACE;
-                goto NEW_TOK_END;
-            default:
-                current_token->type = TOK_INVALID;
-                goto NEW_TOK_END;
+            struct IntegerLiteral literal;
+            positon = lex_integer_literal(input_stream, positon, total_length, &literal);
+            push_token(stream, TOK_INT_VALUE, start_positon, positon - start_positon);
+            stream->payloads[stream->size - 1] = stream->literals.size;
+            add_literal(&stream->literals, &literal);
+            continue;
         }
 
-NEW_TOK_END:
-        ++positon;
-        ++(*token_count);
+        size_t length;
+        enum TokenType type = lex_punctuation(input_stream, positon, total_length, &length);
+        push_token(stream, type, start_positon, length);
+        positon += length;
     }
+}
 
-    assert(*token_count < 100);
-    return tokens;
+struct TokenStream begin_tokenize(char const* source, size_t expected_length)
+{
+    // Rough guess of the token density, so that usually no regrowth is needed
+    return new_token_stream(source, expected_length / 4 + 16);
+}
+
+void tokenize_range(struct TokenStream* stream, size_t start, size_t end)
+{
+    assert(end <= UINT32_MAX && "Token offsets are 32 bit");
+    lex(stream, start, end);
+}
+
+struct TokenStream tokenize(char const* text, size_t length)
+{
+    struct TokenStream stream = begin_tokenize(text, length);
+    tokenize_range(&stream, 0, length);
+    return stream;
 }
 
+// Pending operators of the expression parser
+struct StackedOperator
+{
+    enum OperatorKind
+    {
+        OPERATOR_BINARY,
+        OPERATOR_UNARY,
+        OPERATOR_CONDITIONAL, // After the ':' of ?:
+        OPERATOR_PAREN, // Barrier, nothing is reduced past it
+        OPERATOR_QUESTION, // Barrier until the matching ':'
+    } kind;
+    uint8_t op; // enum BinaryOp or enum UnaryOp
+    uint8_t precedence;
+};
+
+DEFINE_NEW_DYN_ARRAY(OperatorStack, struct StackedOperator, new_operator_stack, push_operator);
+IMPLEMENT_NEW_DYN_ARRAY(OperatorStack, struct StackedOperator, new_operator_stack, push_operator);
+DEFINE_NEW_DYN_ARRAY(OperandStack, struct ExpressionNode*, new_operand_stack, push_operand);
+IMPLEMENT_NEW_DYN_ARRAY(OperandStack, struct ExpressionNode*, new_operand_stack, push_operand);
+
+// Everything the parser needs, one per parse() call so that several
+// inputs can be parsed at the same time
 struct Parser 
 {
-    size_t token_count;
-    struct Token* tokens; 
+    struct TokenStream const* tokens;
     size_t current_position;
-} parser;
+    struct Arena* arena; // Every AST node lives here
+    // Reused by every expression
+    struct OperatorStack operators;
+    struct OperandStack operands;
+    struct HashMap defined_functions; // Name -> index, for redefinitions
+};
+
+#define NEW_NODE(TYPE) ((TYPE*) arena_alloc(parser->arena, sizeof(TYPE)))
 
 
-static struct Token* current_token()
+static enum TokenType current_token_type(struct Parser* parser)
 {
-    return &parser.tokens[parser.current_position];
+    if (parser->current_position >= parser->tokens->size) return TOK_INVALID;
+    return parser->tokens->types[parser->current_position];
 }
 
 
-static void progress_tokens()
+static void progress_tokens(struct Parser* parser)
 {
-    ++parser.current_position;
-    assert(parser.current_position <= parser.token_count);
+    ++parser->current_position;
+    assert(parser->current_position <= parser->tokens->size);
 }
 
-static struct Token* consume_token()
+static size_t consume_token(struct Parser* parser)
 {
-    struct Token* token = current_token();
-    progress_tokens();
+    size_t token = parser->current_position;
+    progress_tokens(parser);
     return token;
 }
 
-static void consume_expected(enum TokenType expected)
+static void consume_expected(struct Parser* parser, enum TokenType expected)
 {
-    struct Token* token = current_token();
-    if(token->type != expected) 
+    enum TokenType type = current_token_type(parser);
+    if(type != expected) 
     {
-        printf(
-            "Token: %s, expected type: %d, but got %d\n",
-            token_to_string(token),
-            expected, token->type);
-        exit(1);
+        char buffer[TOKEN_STRING_SIZE];
+        compile_error(
+            "Token: %s, expected type: %d, but got %d",
+            parser->current_position < parser->tokens->size
+                ? token_to_string(parser->tokens, parser->current_position, buffer)
+                : "<END OF INPUT>",
+            expected, type);
     }
-    progress_tokens();
+    progress_tokens(parser);
 }
 
-static struct Token* get_expected(enum TokenType expected)
+static size_t get_expected(struct Parser* parser, enum TokenType expected)
 {
-    consume_expected(expected);
-    return &parser.tokens[parser.current_position - 1];
+    consume_expected(parser, expected);
+    return parser->current_position - 1;
 }
 
-static bool get_if_expected(enum TokenType expected, struct Token** res_token)
+static bool get_if_expected(struct Parser* parser, enum TokenType expected, size_t* res_token)
 {
-    if (current_token()->type != expected) return false;
+    if (current_token_type(parser) != expected) return false;
     assert(res_token != NULL);
-    *res_token = consume_token();
+    *res_token = consume_token(parser);
     return true;
 }
 
-bool consume_if_expected(enum TokenType expected)
+bool consume_if_expected(struct Parser* parser, enum TokenType expected)
 {
-    struct Token* token;
-    return get_if_expected(expected, &token);
+    size_t token;
+    return get_if_expected(parser, expected, &token);
 }
 
-enum ValueType parse_type()
+enum ValueType parse_type(struct Parser* parser)
 {
-    consume_expected(TOK_INT);
+    consume_expected(parser, TOK_INT);
     return TYPE_INT;
 }
 
 
-struct ExpressionNode* parse_simple_expression()
+// Binding power of C operators, higher binds tighter. 0 for tokens that are not binary operators.
+enum
+{
+    PRECEDENCE_NONE,
+    PRECEDENCE_CONDITIONAL = 3,
+    PRECEDENCE_LOGICAL_OR,
+    PRECEDENCE_LOGICAL_AND,
+    PRECEDENCE_BIT_OR,
+    PRECEDENCE_BIT_XOR,
+    PRECEDENCE_BIT_AND,
+    PRECEDENCE_EQUALITY,
+    PRECEDENCE_RELATIONAL,
+    PRECEDENCE_SHIFT,
+    PRECEDENCE_ADDITIVE,
+    PRECEDENCE_MULTIPLICATIVE,
+    PRECEDENCE_UNARY,
+};
+
+static uint8_t binary_precedence(enum TokenType type, enum BinaryOp* op)
+{
+    switch (type)
+    {
+        case TOK_STAR: *op = BIN_MUL; return PRECEDENCE_MULTIPLICATIVE;
+        case TOK_SLASH: *op = BIN_DIV; return PRECEDENCE_MULTIPLICATIVE;
+        case TOK_PERCENT: *op = BIN_REM; return PRECEDENCE_MULTIPLICATIVE;
+        case TOK_PLUS: *op = BIN_ADD; return PRECEDENCE_ADDITIVE;
+        case TOK_MINUS: *op = BIN_SUB; return PRECEDENCE_ADDITIVE;
+        case TOK_LSHIFT: *op = BIN_LSHIFT; return PRECEDENCE_SHIFT;
+        case TOK_RSHIFT: *op = BIN_RSHIFT; return PRECEDENCE_SHIFT;
+        case TOK_LESS: *op = BIN_LESS; return PRECEDENCE_RELATIONAL;
+        case TOK_LESS_EQ: *op = BIN_LESS_EQ; return PRECEDENCE_RELATIONAL;
+        case TOK_GREATER: *op = BIN_GREATER; return PRECEDENCE_RELATIONAL;
+        case TOK_GREATER_EQ: *op = BIN_GREATER_EQ; return PRECEDENCE_RELATIONAL;
+        case TOK_EQ_EQ: *op = BIN_EQ; return PRECEDENCE_EQUALITY;
+        case TOK_NOT_EQ: *op = BIN_NOT_EQ; return PRECEDENCE_EQUALITY;
+        case TOK_AMPERSAND: *op = BIN_BIT_AND; return PRECEDENCE_BIT_AND;
+        case TOK_CARET: *op = BIN_BIT_XOR; return PRECEDENCE_BIT_XOR;
+        case TOK_PIPE: *op = BIN_BIT_OR; return PRECEDENCE_BIT_OR;
+        case TOK_AND_AND: *op = BIN_LOGICAL_AND; return PRECEDENCE_LOGICAL_AND;
+        case TOK_OR_OR: *op = BIN_LOGICAL_OR; return PRECEDENCE_LOGICAL_OR;
+        default: return PRECEDENCE_NONE;
+    }
+}
+
+static bool get_unary_op(enum TokenType type, enum UnaryOp* op)
+{
+    switch (type)
+    {
+        case TOK_PLUS: *op = UNARY_PLUS; return true;
+        case TOK_MINUS: *op = UNARY_MINUS; return true;
+        case TOK_BANG: *op = UNARY_NOT; return true;
+        case TOK_TILDE: *op = UNARY_BIT_NOT; return true;
+        default: return false;
+    }
+}
+
+static struct ExpressionNode* pop_operand(struct Parser* parser)
+{
+    assert(parser->operands.size != 0);
+    return parser->operands.data[--parser->operands.size];
+}
+
+// Builds the node of the topmost operator from the topmost operands
+static void reduce_operator(struct Parser* parser)
+{
+    struct StackedOperator top = parser->operators.data[--parser->operators.size];
+    struct ExpressionNode* expr = NEW_NODE(struct ExpressionNode);
+    switch (top.kind)
+    {
+        case OPERATOR_BINARY:
+            expr->type = EXPR_BIN;
+            expr->as.bin = NEW_NODE(struct BinaryExpression);
+            expr->as.bin->op = top.op;
+            expr->as.bin->right = pop_operand(parser);
+            expr->as.bin->left = pop_operand(parser);
+            break;
+        case OPERATOR_UNARY:
+            expr->type = EXPR_UNARY;
+            expr->as.unary = NEW_NODE(struct UnaryExpression);
+            expr->as.unary->op = top.op;
+            expr->as.unary->operand = pop_operand(parser);
+            break;
+        case OPERATOR_CONDITIONAL:
+            expr->type = EXPR_CONDITIONAL;
+            expr->as.conditional = NEW_NODE(struct ConditionalExpression);
+            expr->as.conditional->if_false = pop_operand(parser);
+            expr->as.conditional->if_true = pop_operand(parser);
+            expr->as.conditional->condition = pop_operand(parser);
+            break;
+        case OPERATOR_PAREN:
+        case OPERATOR_QUESTION:
+            assert(false && "Barriers are never reduced");
+    }
+    push_operand(&parser->operands, &expr);
+}
+
+// Reduces everything that binds tighter than `precedence` (or as tight, for
+// left associative operators). Stops at barriers, they have precedence 0.
+static void reduce_operators(struct Parser* parser, uint8_t precedence, bool right_associative)
+{
+    while (parser->operators.size != 0)
+    {
+        struct StackedOperator const* top = &parser->operators.data[parser->operators.size - 1];
+        if (top->precedence < precedence || (top->precedence == precedence && right_associative)) break;
+        reduce_operator(parser);
+    }
+}
+
+static enum OperatorKind top_operator_kind(struct Parser* parser)
 {
-    struct ExpressionNode* expr = cc_malloc(sizeof(struct ExpressionNode));
-    struct Token* matched;
-    if (get_if_expected(TOK_NAME, &matched))
+    assert(parser->operators.size != 0);
+    return parser->operators.data[parser->operators.size - 1].kind;
+}
+
+static struct ExpressionNode* parse_operand(struct Parser* parser)
+{
+    struct ExpressionNode* expr = NEW_NODE(struct ExpressionNode);
+    size_t matched;
+    if (get_if_expected(parser, TOK_NAME, &matched))
     {
         expr->type = EXPR_VARIABLE;
+        expr->as.name = token_symbol(parser->tokens, matched);
     } 
-    else if (get_if_expected(TOK_INT_VALUE, &matched))
+    else if (get_if_expected(parser, TOK_INT_VALUE, &matched))
     {
         expr->type = EXPR_CONSTANT;
+        expr->as.value = token_literal(parser->tokens, matched)->value;
+    }
+    else
+    {
+        consume_expected(parser, TOK_NAME); // Reports the error
     }
-    assert(matched != NULL);
-    expr->as.simple = matched;
     return expr;
 }
 
-struct ExpressionNode* parse_binary_expression()
+// Operator precedence parsing with explicit stacks instead of one C call per
+// operand or nesting level, so generated expressions with huge chains or deep
+// parentheses can not overflow the stack. Binary operators are left
+// associative, unary and ?: are right associative.
+struct ExpressionNode* parse_expression(struct Parser* parser)
 {
-    struct ExpressionNode* simple_expression = parse_simple_expression();
-    if (consume_if_expected(TOK_PLUS))  // Binary operators: +
+    size_t const operators_base = parser->operators.size;
+    size_t const operands_base = parser->operands.size;
+    size_t open_parens = 0;
+    size_t open_questions = 0;
+    bool expect_operand = true;
+    for (;;)
     {
-        struct BinaryExpression* binary_expr = cc_malloc(sizeof(struct BinaryExpression));
-        binary_expr->op = BIN_ADD;
-        binary_expr->left = simple_expression;
-        binary_expr->right = parse_binary_expression();
+        enum TokenType const type = current_token_type(parser);
+        if (expect_operand)
+        {
+            enum UnaryOp unary;
+            if (get_unary_op(type, &unary))
+            {
+                struct StackedOperator op = {OPERATOR_UNARY, unary, PRECEDENCE_UNARY};
+                push_operator(&parser->operators, &op);
+            }
+            else if (type == TOK_LEFT_PAREN)
+            {
+                struct StackedOperator op = {OPERATOR_PAREN, 0, PRECEDENCE_NONE};
+                push_operator(&parser->operators, &op);
+                ++open_parens;
+            }
+            else
+            {
+                struct ExpressionNode* operand = parse_operand(parser);
+                push_operand(&parser->operands, &operand);
+                expect_operand = false;
+                continue;
+            }
+            progress_tokens(parser);
+            continue;
+        }
 
-        struct ExpressionNode* binar_but_expression = cc_malloc(sizeof(struct ExpressionNode));
-        binar_but_expression->type = EXPR_BIN;
-        binar_but_expression->as.bin = binary_expr;
-        return binar_but_expression;
+        enum BinaryOp binary;
+        uint8_t const precedence = binary_precedence(type, &binary);
+        if (precedence != PRECEDENCE_NONE)
+        {
+            reduce_operators(parser, precedence, false);
+            struct StackedOperator op = {OPERATOR_BINARY, binary, precedence};
+            push_operator(&parser->operators, &op);
+            expect_operand = true;
+        }
+        else if (type == TOK_QUESTION)
+        {
+            reduce_operators(parser, PRECEDENCE_CONDITIONAL, true);
+            struct StackedOperator op = {OPERATOR_QUESTION, 0, PRECEDENCE_NONE};
+            push_operator(&parser->operators, &op);
+            ++open_questions;
+            expect_operand = true;
+        }
+        else if (type == TOK_COLON && open_questions != 0)
+        {
+            reduce_operators(parser, PRECEDENCE_CONDITIONAL - 1, false);
+            if (top_operator_kind(parser) != OPERATOR_QUESTION) consume_expected(parser, TOK_RIGHT_PAREN); // Reports the error
+            parser->operators.data[parser->operators.size - 1] =
+                (struct StackedOperator) {OPERATOR_CONDITIONAL, 0, PRECEDENCE_CONDITIONAL};
+            --open_questions;
+            expect_operand = true;
+        }
+        else if (type == TOK_RIGHT_PAREN && open_parens != 0)
+        {
+            reduce_operators(parser, PRECEDENCE_CONDITIONAL - 1, false);
+            if (top_operator_kind(parser) != OPERATOR_PAREN) consume_expected(parser, TOK_COLON); // Reports the error
+            --parser->operators.size;
+            --open_parens;
+        }
+        else
+        {
+            break; // Not part of the expression anymore
+        }
+        progress_tokens(parser);
     }
-    return simple_expression;
-}
 
-struct ExpressionNode* parse_expression()
-{
-    struct ExpressionNode* expr = parse_binary_expression(); // Highest level of expressions in grammar
-    return expr;
+    if (open_questions != 0) consume_expected(parser, TOK_COLON);
+    if (open_parens != 0) consume_expected(parser, TOK_RIGHT_PAREN);
+    reduce_operators(parser, PRECEDENCE_CONDITIONAL, false);
+    assert(parser->operators.size == operators_base && parser->operands.size == operands_base + 1);
+    return pop_operand(parser);
 }
 
-struct StatementAst* parse_statement()
+struct StatementAst* parse_statement(struct Parser* parser)
 {
     //  For now a statement is either:
     //  a) variable declaration (begins with type)
     //  b) value assignement (begins with name)
     //  c) return value (begins with return)
-    struct StatementAst* statement = cc_malloc(sizeof(struct StatementAst));
-    struct Token* matched = NULL;
-    if (get_if_expected(TOK_INT, &matched)) 
+    struct StatementAst* statement = NEW_NODE(struct StatementAst);
+    size_t matched;
+    if (get_if_expected(parser, TOK_INT, &matched)) 
     {
         statement->tag = TAG_DEFINITION;
 
-        struct Token* name = get_expected(TOK_NAME);
-        statement->as.definition.name = name;
+        size_t name = get_expected(parser, TOK_NAME);
+        statement->as.definition.name = token_symbol(parser->tokens, name);
         statement->as.definition.type = TYPE_INT;
-        if (consume_if_expected(TOK_EQ))
+        if (consume_if_expected(parser, TOK_EQ))
         {
             statement->as.definition.has_inital_value = true;
-            statement->as.definition.value = parse_expression();
+            statement->as.definition.value = parse_expression(parser);
         } 
         else 
         {
             statement->as.definition.has_inital_value = false;
         }
     } 
-    else if (get_if_expected(TOK_NAME, &matched)) 
+    else if (get_if_expected(parser, TOK_NAME, &matched)) 
     {
-        consume_expected(TOK_EQ);
+        consume_expected(parser, TOK_EQ);
         statement->tag = TAG_ASSIGMENT; 
-        statement->as.assignement.name = matched;
-        statement->as.assignement.value = parse_expression();
+        statement->as.assignement.name = token_symbol(parser->tokens, matched);
+        statement->as.assignement.value = parse_expression(parser);
     }
-    else if (get_if_expected(TOK_RETURN, &matched)) 
+    else if (get_if_expected(parser, TOK_RETURN, &matched)) 
     {
         statement->tag = TAG_RETURN;
-        statement->as.ret.value = parse_expression();
+        statement->as.ret.value = parse_expression(parser);
+    }
+    else
+    {
+        consume_expected(parser, TOK_RETURN); // Reports the error
     }
-    assert(matched != NULL);
-    consume_expected(TOK_SEMICOLON);
+    consume_expected(parser, TOK_SEMICOLON);
     return statement;
 }
 
-static struct FunctionAst* parse_function()
+static struct FunctionAst* parse_function(struct Parser* parser)
 {
-    struct FunctionAst* function = cc_malloc(sizeof(struct FunctionAst));
-    function->return_type = parse_type();
-    function->name = get_expected(TOK_NAME);
-    consume_expected(TOK_LEFT_PAREN);
-    consume_expected(TOK_RIGHT_PAREN);
-    consume_expected(TOK_LEFT_BRACE);
-    function->statements = cc_malloc(100 * sizeof(struct StatementAst));
-    while (!consume_if_expected(TOK_RIGHT_BRACE) || parser.current_position < parser.token_count)
+    struct FunctionAst* function = NEW_NODE(struct FunctionAst);
+    function->first_token = parser->current_position;
+    function->return_type = parse_type(parser);
+    function->name = token_symbol(parser->tokens, get_expected(parser, TOK_NAME));
+    consume_expected(parser, TOK_LEFT_PAREN);
+    consume_expected(parser, TOK_RIGHT_PAREN);
+    consume_expected(parser, TOK_LEFT_BRACE);
+    size_t capacity = 16;
+    function->statements = arena_alloc(parser->arena, capacity * sizeof(struct StatementAst*));
+    while (!consume_if_expected(parser, TOK_RIGHT_BRACE))
     {
-        function->statements[function->statement_count] = parse_statement();
+        if (function->statement_count == capacity)
+        {
+            function->statements = arena_grow(parser->arena, function->statements,
+                capacity * sizeof(struct StatementAst*), 2 * capacity * sizeof(struct StatementAst*));
+            capacity *= 2;
+        }
+        function->statements[function->statement_count] = parse_statement(parser);
         ++function->statement_count;
-        assert(function->statement_count < 100);
     }
+    function->token_count = parser->current_position - function->first_token;
     return function;
 }
 
 
-static struct FunctionAst* parse(struct Token* tokens, size_t token_count)
+// A sequence of function definitions
+static struct TranslationUnitAst* parse_translation_unit(struct Parser* parser)
 {
-    parser.current_position = 0;
-    parser.tokens = tokens;
-    parser.token_count = token_count;
-    return parse_function();
+    struct TranslationUnitAst* unit = NEW_NODE(struct TranslationUnitAst);
+    size_t capacity = 16;
+    unit->functions = arena_alloc(parser->arena, capacity * sizeof(struct FunctionAst*));
+    while (parser->current_position < parser->tokens->size)
+    {
+        if (unit->function_count == capacity)
+        {
+            unit->functions = arena_grow(parser->arena, unit->functions,
+                capacity * sizeof(struct FunctionAst*), 2 * capacity * sizeof(struct FunctionAst*));
+            capacity *= 2;
+        }
+        struct FunctionAst* function = parse_function(parser);
+        if (hashmap_find(&parser->defined_functions, function->name) != NULL)
+        {
+            compile_error("Redefinition of function: %s", symbol_name(function->name));
+        }
+        hashmap_insert(&parser->defined_functions, function->name, unit->function_count);
+        unit->functions[unit->function_count] = function;
+        ++unit->function_count;
+    }
+    return unit;
+}
+
+static void free_parser(void* context)
+{
+    struct Parser* parser = context;
+    free(parser->operators.data);
+    free(parser->operands.data);
+    free(parser->defined_functions.data);
+}
+
+struct TranslationUnitAst* parse(struct TokenStream const* tokens, struct Arena* arena)
+{
+    struct Parser parser = {
+        .tokens = tokens,
+        .current_position = 0,
+        .arena = arena,
+        .operators = new_operator_stack(),
+        .operands = new_operand_stack(),
+        .defined_functions = new_hashmap()
+    };
+    // The AST itself is in the caller's arena
+    struct ErrorCleanup cleanup = {.release = free_parser, .context = &parser};
+    push_error_cleanup(&cleanup);
+    struct TranslationUnitAst* unit = parse_translation_unit(&parser);
+    pop_error_cleanup(&cleanup);
+    free_parser(&parser);
+    return unit;
 }
 
 
-struct FunctionAst* produce_ast(char const* text)
+struct TranslationUnitAst* produce_ast(char const* text, size_t length, struct Arena* arena)
 {
     assert(text != NULL);
-    size_t token_count = 0;
-    struct Token* tokens = lex(text, &token_count);
-    assert(token_count != 0);
+    struct TokenStream tokens = tokenize(text, length);
+    assert(tokens.size != 0);
     // TODO List tokens
 
 
-    struct FunctionAst* ast = parse(tokens, token_count);
+    struct TranslationUnitAst* ast = parse(&tokens, arena);
     // print_ast(ast);
+    // The AST only holds symbols and values, neither the tokens nor the text are needed anymore
+    free_token_stream(&tokens);
     return ast;
 }
 
+// In chunks, deep expressions need long runs of them
 static void print_depth_indicators(size_t depth)
 {
-    for (size_t depth_idx = 0; depth_idx < depth; ++depth_idx)
+    static char const dashes[] = "----------------------------------------------------------------";
+    for (size_t written = 0; written < depth; written += sizeof(dashes) - 1)
     {
-        printf("-");
+        size_t const chunk = depth - written < sizeof(dashes) - 1 ? depth - written : sizeof(dashes) - 1;
+        fwrite(dashes, 1, chunk, stdout);
     }
     printf(" ");
 }
 
 
-static void print_ast_expression(struct ExpressionNode const* expr, size_t depth);
-
+static char const* const OPERATOR_REPR[] = {
+    [BIN_MUL] = "*",
+    [BIN_DIV] = "/",
+    [BIN_REM] = "%",
+    [BIN_ADD] = "+",
+    [BIN_SUB] = "-",
+    [BIN_LSHIFT] = "<<",
+    [BIN_RSHIFT] = ">>",
+    [BIN_LESS] = "<",
+    [BIN_LESS_EQ] = "<=",
+    [BIN_GREATER] = ">",
+    [BIN_GREATER_EQ] = ">=",
+    [BIN_EQ] = "==",
+    [BIN_NOT_EQ] = "!=",
+    [BIN_BIT_AND] = "&",
+    [BIN_BIT_XOR] = "^",
+    [BIN_BIT_OR] = "|",
+    [BIN_LOGICAL_AND] = "&&",
+    [BIN_LOGICAL_OR] = "||",
+};
 
-static char const* OPERATOR_REPR[] = {
-    [BIN_ADD] = "+"
+static char const* const UNARY_OPERATOR_REPR[] = {
+    [UNARY_PLUS] = "+",
+    [UNARY_MINUS] = "-",
+    [UNARY_NOT] = "!",
+    [UNARY_BIT_NOT] = "~",
 };
 
-static void print_binary_expr(struct BinaryExpression* binary_expr, size_t depth)
+char const* binary_op_name(enum BinaryOp op)
 {
-    printf("Binary expression, operator: %s\n", OPERATOR_REPR[binary_expr->op]);
-
-    print_depth_indicators(depth + 1);
-    printf("Left:\n");
-    print_depth_indicators(depth + 2);
-    print_ast_expression(binary_expr->left, depth + 1);
+    return OPERATOR_REPR[op];
+}
 
-    print_depth_indicators(depth + 1);
-    printf("Right:\n");
-    print_depth_indicators(depth + 2);
-    print_ast_expression(binary_expr->right, depth + 1);
+char const* unary_op_name(enum UnaryOp op)
+{
+    return UNARY_OPERATOR_REPR[op];
 }
 
-static void print_ast_expression(struct ExpressionNode const* expr, size_t depth)
+// A subexpression waiting to be printed, under its label
+struct PendingExpression
 {
-    switch (expr->type) 
+    char const* label; // NULL for the expression itself
+    struct ExpressionNode const* expr;
+    size_t depth;
+};
+
+DEFINE_NEW_DYN_ARRAY(PendingExpressions, struct PendingExpression, new_pending_expressions, push_pending_expression);
+IMPLEMENT_NEW_DYN_ARRAY(PendingExpressions, struct PendingExpression, new_pending_expressions, push_pending_expression);
+
+// Children are pushed last to first so that they are printed in order
+static void push_children(struct PendingExpressions* pending, struct ExpressionNode const* expr, size_t depth)
+{
+    struct PendingExpression children[3];
+    size_t count = 0;
+    switch (expr->type)
     {
         case EXPR_VARIABLE:
-            printf("Variable: %s\n", expr->as.simple->name);
-            break;
         case EXPR_CONSTANT:
-            printf("Constant: %d\n", expr->as.simple->value);
             break;
         case EXPR_BIN:
-            print_binary_expr(expr->as.bin, depth);
+            children[count++] = (struct PendingExpression) {"Left", expr->as.bin->left, depth};
+            children[count++] = (struct PendingExpression) {"Right", expr->as.bin->right, depth};
+            break;
+        case EXPR_UNARY:
+            children[count++] = (struct PendingExpression) {"Operand", expr->as.unary->operand, depth};
+            break;
+        case EXPR_CONDITIONAL:
+            children[count++] = (struct PendingExpression) {"Condition", expr->as.conditional->condition, depth};
+            children[count++] = (struct PendingExpression) {"If true", expr->as.conditional->if_true, depth};
+            children[count++] = (struct PendingExpression) {"If false", expr->as.conditional->if_false, depth};
             break;
     }
+    while (count != 0) push_pending_expression(pending, &children[--count]);
+}
+
+// Explicit stack instead of recursion, the parser accepts nesting far deeper
+// than the C stack could print
+static void print_ast_expression(struct ExpressionNode const* expr, size_t depth)
+{
+    struct PendingExpressions pending = new_pending_expressions();
+    push_pending_expression(&pending, &(struct PendingExpression) {NULL, expr, depth});
+    while (pending.size != 0)
+    {
+        struct PendingExpression const item = pending.data[--pending.size];
+        if (item.label)
+        {
+            print_depth_indicators(item.depth + 1);
+            printf("%s:\n", item.label);
+            print_depth_indicators(item.depth + 2);
+        }
+        size_t const child_depth = item.label ? item.depth + 1 : item.depth;
+        switch (item.expr->type)
+        {
+            case EXPR_VARIABLE:
+                printf("Variable: %s\n", symbol_name(item.expr->as.name));
+                break;
+            case EXPR_CONSTANT:
+                printf("Constant: %lld\n", (long long) item.expr->as.value);
+                break;
+            case EXPR_BIN:
+                printf("Binary expression, operator: %s\n", OPERATOR_REPR[item.expr->as.bin->op]);
+                break;
+            case EXPR_UNARY:
+                printf("Unary expression, operator: %s\n", UNARY_OPERATOR_REPR[item.expr->as.unary->op]);
+                break;
+            case EXPR_CONDITIONAL:
+                printf("Conditional expression\n");
+                break;
+        }
+        push_children(&pending, item.expr, child_depth);
+    }
+    free(pending.data);
 }
 
 
 static void print_variable_definition(struct DefineVariable const* definition, size_t depth)
 {
-    printf("New variable: %s, type: %d\n", definition->name->name, definition->type);
+    printf("New variable: %s, type: %d\n", symbol_name(definition->name), definition->type);
     if (definition->has_inital_value)
     {
         print_depth_indicators(depth + 1);
@@ -402,7 +1021,7 @@ static void print_variable_definition(struct DefineVariable const* definition, s
 
 static void print_variable_assignment(struct VariableAssignment const* assignement, size_t depth)
 {
-    printf("Assigning to variable: %s\n", assignement->name->name);
+    printf("Assigning to variable: %s\n", symbol_name(assignement->name));
     if (assignement->value->type)
     {
         print_depth_indicators(depth + 1);
@@ -420,7 +1039,7 @@ static void print_variable_return(struct ReturnNode const* ret, size_t depth)
 static void print_function_ast(struct FunctionAst const* ast)
 {
     size_t depth = 0;
-    printf("Function %s:\n", ast->name->name);
+    printf("Function %s:\n", symbol_name(ast->name));
     ++depth;
     for (size_t idx = 0; idx < ast->statement_count; ++idx)
     {
@@ -442,17 +1061,21 @@ static void print_function_ast(struct FunctionAst const* ast)
     }
 }
 
-void print_ast(struct FunctionAst const* ast)
+void print_ast(struct TranslationUnitAst const* ast)
 {
     printf("\nPrinting debug AST representation\n\n");
-    print_function_ast(ast);
+    for (size_t idx = 0; idx < ast->function_count; ++idx)
+    {
+        print_function_ast(ast->functions[idx]);
+    }
 }
 
-void list_tokens(struct Token const* tokens, size_t token_count)
+void list_tokens(struct TokenStream const* stream)
 {
-    for (size_t idx = 0; idx < token_count; ++idx) 
+    for (size_t idx = 0; idx < stream->size; ++idx) 
     {
-        printf("Token: %s\n", token_to_string(&tokens[idx]));
+        char buffer[TOKEN_STRING_SIZE];
+        printf("Token: %s\n", token_to_string(stream, idx, buffer));
     }
 }
 
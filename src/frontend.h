@@ -1,30 +1,94 @@
 #pragma once
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <stdint.h>
+#include "scan.h"
+#include "utils.h"
 
 enum TokenType {
     TOK_INVALID = 0,
-    TOK_INT,
     TOK_INT_VALUE,
-    TOK_RETURN,
+    // Operators
     TOK_PLUS,
+    TOK_MINUS,
+    TOK_STAR,
+    TOK_SLASH,
+    TOK_PERCENT,
+    TOK_LSHIFT,
+    TOK_RSHIFT,
+    TOK_LESS,
+    TOK_LESS_EQ,
+    TOK_GREATER,
+    TOK_GREATER_EQ,
+    TOK_EQ_EQ,
+    TOK_NOT_EQ,
+    TOK_AMPERSAND,
+    TOK_CARET,
+    TOK_PIPE,
+    TOK_AND_AND,
+    TOK_OR_OR,
+    TOK_BANG,
+    TOK_TILDE,
+    TOK_INCREMENT, // Lexed for maximal munch, not parsed yet
+    TOK_DECREMENT,
+    TOK_QUESTION,
+    TOK_COLON,
+    // Punctuation
     TOK_LEFT_PAREN,
     TOK_RIGHT_PAREN,
     TOK_LEFT_BRACE,
     TOK_RIGHT_BRACE,
     TOK_EQ,
     TOK_SEMICOLON,
-    TOK_NAME
+    TOK_NAME,
+    // Keywords, TOK_INT, TOK_RETURN, ...
+#define KEYWORD(text, token) token,
+#include "keywords.def"
+#undef KEYWORD
 };
 
-struct Token 
+// TOK_NAME if the identifier is not a keyword
+enum TokenType classify_keyword(char const* text, size_t length);
+
+struct IntegerLiteral
+{
+    uint64_t value;
+    bool is_unsigned; // u suffix
+    uint8_t long_count; // l or ll suffix
+};
+
+DEFINE_NEW_DYN_ARRAY(LiteralTable, struct IntegerLiteral, new_literal_table, add_literal);
+
+// Structure of arrays, token `idx` is described by types[idx], offsets[idx], ...
+// Token text is never copied, offsets and lengths point into `source`.
+struct TokenStream
 {
-    enum TokenType type;
-    char* name;
-    int value;
+    char const* source;
+    struct Scanner const* scanner; // The default one at creation time
+    size_t size;
+    size_t capacity;
+    uint8_t* types; // enum TokenType
+    uint32_t* offsets;
+    uint32_t* lengths;
+    // TOK_INT_VALUE: index into `literals`
+    // TOK_NAME: interned symbol
+    uint32_t* payloads;
+    struct LiteralTable literals;
 };
 
+struct TokenStream tokenize(char const* text, size_t length);
+// Incremental lexing, for input that arrives in pieces. No token may cross `end`,
+// so it should be a line boundary. stream->source has to be updated by the
+// caller if the buffer moves, offsets stay valid.
+struct TokenStream begin_tokenize(char const* source, size_t expected_length);
+void tokenize_range(struct TokenStream* stream, size_t start, size_t end);
+void free_token_stream(struct TokenStream* stream);
+struct StringView token_text(struct TokenStream const* stream, size_t idx);
+struct IntegerLiteral const* token_literal(struct TokenStream const* stream, size_t idx);
+uint32_t token_symbol(struct TokenStream const* stream, size_t idx);
+
 enum ValueType 
 {
     TYPE_INT,
@@ -37,6 +101,8 @@ static inline size_t get_type_size(enum ValueType type)
 }
 
 struct BinaryExpression;
+struct UnaryExpression;
+struct ConditionalExpression;
 
 struct ExpressionNode 
 {
@@ -45,10 +111,15 @@ struct ExpressionNode
         EXPR_VARIABLE,
         EXPR_CONSTANT,
         EXPR_BIN,
+        EXPR_UNARY,
+        EXPR_CONDITIONAL, // ?:
     } type;
     union {
         struct BinaryExpression* bin;
-        struct Token* simple;
+        struct UnaryExpression* unary;
+        struct ConditionalExpression* conditional;
+        uint32_t name; // EXPR_VARIABLE, interned
+        int64_t value; // EXPR_CONSTANT
     } as;
 };
 
@@ -56,12 +127,48 @@ struct BinaryExpression
 {
     enum BinaryOp 
     {
-        BIN_ADD
+        BIN_MUL,
+        BIN_DIV,
+        BIN_REM,
+        BIN_ADD,
+        BIN_SUB,
+        BIN_LSHIFT,
+        BIN_RSHIFT,
+        BIN_LESS,
+        BIN_LESS_EQ,
+        BIN_GREATER,
+        BIN_GREATER_EQ,
+        BIN_EQ,
+        BIN_NOT_EQ,
+        BIN_BIT_AND,
+        BIN_BIT_XOR,
+        BIN_BIT_OR,
+        BIN_LOGICAL_AND, // Short circuits
+        BIN_LOGICAL_OR, // Short circuits
     } op;
     struct ExpressionNode* left; 
     struct ExpressionNode* right; 
 };
 
+struct UnaryExpression
+{
+    enum UnaryOp
+    {
+        UNARY_PLUS,
+        UNARY_MINUS,
+        UNARY_NOT, // !
+        UNARY_BIT_NOT, // ~
+    } op;
+    struct ExpressionNode* operand;
+};
+
+struct ConditionalExpression
+{
+    struct ExpressionNode* condition;
+    struct ExpressionNode* if_true;
+    struct ExpressionNode* if_false;
+};
+
 struct ReturnNode 
 {
     struct ExpressionNode* value;   
@@ -69,13 +176,13 @@ struct ReturnNode
 
 struct VariableAssignment 
 {
-    struct Token* name;
+    uint32_t name;
     struct ExpressionNode* value;
 };
 
 struct DefineVariable 
 {
-    struct Token* name;
+    uint32_t name;
     enum ValueType type;
     bool has_inital_value; 
     struct ExpressionNode* value;
@@ -98,12 +205,33 @@ struct StatementAst
 
 struct FunctionAst {
     enum ValueType return_type;
-    struct Token* name;    
+    uint32_t name;
+    // Tokens of the whole definition
+    uint32_t first_token;
+    uint32_t token_count;
     // Body
     struct StatementAst** statements;
     size_t statement_count;
 };
 
-struct FunctionAst* produce_ast(char const* text);
-void print_ast(struct FunctionAst const* ast);
-void list_tokens(struct Token const* tokens, size_t token_count);
+struct TranslationUnitAst
+{
+    // In source order
+    struct FunctionAst** functions;
+    size_t function_count;
+};
+
+// The whole AST is allocated from `arena`, it is freed by releasing the arena
+struct TranslationUnitAst* produce_ast(char const* text, size_t length, struct Arena* arena);
+struct TranslationUnitAst* parse(struct TokenStream const* tokens, struct Arena* arena);
+void print_ast(struct TranslationUnitAst const* ast);
+// Source spelling, e.g. "<<"
+char const* binary_op_name(enum BinaryOp op);
+char const* unary_op_name(enum UnaryOp op);
+void list_tokens(struct TokenStream const* stream);
+// Decimal, 0x hex, 0 octal and 0b binary literals with u/l/ll suffixes.
+// Returns the end of the literal, exits on malformed or too large literals.
+size_t lex_integer_literal(char const* text, size_t position, size_t end, struct IntegerLiteral* literal);
+// Defaults to the best mode supported by the CPU, affects token streams created afterwards
+void set_lexer_scan_mode(enum ScanMode mode);
+
@@ -0,0 +1,303 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "incremental.h"
+
+// State file, integers in host byte order:
+//   magic, build id and configuration (u32 length + bytes), u32 function count, then per function
+//   16 byte fingerprint, u32 tape size + tape, u32 line count + lines
+//   (u32 length + bytes, null terminated)
+static char const state_magic[8] = "RCCINC2";
+
+struct Fingerprint
+{
+    uint64_t digest[2];
+};
+
+struct StoredFunction
+{
+    struct Fingerprint fingerprint;
+    uint32_t tape_size;
+    char const* tape; // Unaligned, into `contents`
+    uint32_t line_count;
+    char const* lines;
+};
+
+DEFINE_NEW_DYN_ARRAY(StoredFunctionArray, struct StoredFunction, new_stored_function_array, add_stored_function)
+IMPLEMENT_NEW_DYN_ARRAY(StoredFunctionArray, struct StoredFunction, new_stored_function_array, add_stored_function)
+
+struct IncrementalState
+{
+    char* configuration;
+    // Previous compile
+    char* contents;
+    struct StoredFunctionArray stored;
+    struct HashMap by_fingerprint; // Index into `stored`
+    // This compile
+    struct Fingerprint* fingerprints;
+    size_t function_count;
+    atomic_size_t reused;
+};
+
+struct Reader
+{
+    char const* data;
+    size_t size;
+    size_t position;
+    bool valid;
+};
+
+static char const* read_bytes(struct Reader* reader, size_t size)
+{
+    if (!reader->valid || size > reader->size - reader->position)
+    {
+        reader->valid = false;
+        return NULL;
+    }
+    char const* bytes = &reader->data[reader->position];
+    reader->position += size;
+    return bytes;
+}
+
+static uint32_t read_u32(struct Reader* reader)
+{
+    uint32_t value = 0;
+    char const* bytes = read_bytes(reader, sizeof(value));
+    if (bytes != NULL) memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+static bool read_expected_string(struct Reader* reader, char const* expected)
+{
+    uint32_t const length = read_u32(reader);
+    char const* text = read_bytes(reader, length);
+    return text != NULL && length == strlen(expected) && memcmp(text, expected, length) == 0;
+}
+
+static void skip_lines(struct Reader* reader, uint32_t count)
+{
+    for (uint32_t idx = 0; idx < count && reader->valid; ++idx)
+    {
+        uint32_t const length = read_u32(reader);
+        char const* line = read_bytes(reader, length);
+        if (line != NULL && (length == 0 || line[length - 1] != '\0')) reader->valid = false;
+    }
+}
+
+// Hash map keys can't be 0
+static uint32_t fingerprint_key(struct Fingerprint const* fingerprint)
+{
+    uint32_t const key = (uint32_t) fingerprint->digest[0];
+    return key != 0 ? key : 1;
+}
+
+static bool same_fingerprint(struct Fingerprint const* left, struct Fingerprint const* right)
+{
+    return left->digest[0] == right->digest[0] && left->digest[1] == right->digest[1];
+}
+
+// Two multiply-xorshift lanes, 128 bits in total. Not cryptographic (neither
+// are the fingerprints of other incremental compilers), but accidental
+// collisions are out of the question and it costs much less than the backend.
+static inline void mix(struct Fingerprint* fingerprint, uint64_t word)
+{
+    fingerprint->digest[0] = (fingerprint->digest[0] ^ word) * 0x9e3779b97f4a7c15ull;
+    fingerprint->digest[0] ^= fingerprint->digest[0] >> 29;
+    fingerprint->digest[1] = (fingerprint->digest[1] ^ (word << 32 | word >> 32)) * 0xc2b2ae3d27d4eb4full;
+    fingerprint->digest[1] ^= fingerprint->digest[1] >> 31;
+}
+
+static struct Fingerprint fingerprint_tokens(struct TokenStream const* tokens, size_t first, size_t count)
+{
+    struct Fingerprint fingerprint = {{0x243f6a8885a308d3ull, 0x13198a2e03707344ull}};
+    for (size_t idx = first; idx < first + count; ++idx)
+    {
+        // Every other token type has one spelling
+        enum TokenType const type = tokens->types[idx];
+        if (type != TOK_NAME && type != TOK_INT_VALUE)
+        {
+            mix(&fingerprint, type);
+            continue;
+        }
+        struct StringView text = token_text(tokens, idx);
+        mix(&fingerprint, type | (uint64_t) text.length << 8);
+        size_t position = 0;
+        for (; position + 8 <= text.length; position += 8)
+        {
+            uint64_t word;
+            memcpy(&word, &text.data[position], sizeof(word));
+            mix(&fingerprint, word);
+        }
+        if (position == text.length) continue;
+        uint64_t tail = 0;
+        memcpy(&tail, &text.data[position], text.length - position);
+        mix(&fingerprint, tail);
+    }
+    mix(&fingerprint, count);
+    return fingerprint;
+}
+
+static char* read_whole_file(char const* path, size_t* size)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+    char* contents = NULL;
+    if (fseek(file, 0, SEEK_END) == 0)
+    {
+        long const length = ftell(file);
+        contents = length >= 0 ? cc_malloc(length + 1) : NULL;
+        if (contents != NULL && (fseek(file, 0, SEEK_SET) != 0 || fread(contents, 1, length, file) != (size_t) length))
+        {
+            free(contents);
+            contents = NULL;
+        }
+        *size = length;
+    }
+    fclose(file);
+    return contents;
+}
+
+static void parse_state(struct IncrementalState* state, size_t size)
+{
+    struct Reader reader = {.data = state->contents, .size = size, .valid = true};
+    char const* magic = read_bytes(&reader, sizeof(state_magic));
+    if (magic == NULL || memcmp(magic, state_magic, sizeof(state_magic)) != 0
+        || !read_expected_string(&reader, compiler_build()) || !read_expected_string(&reader, state->configuration))
+    {
+        return;
+    }
+    uint32_t const count = read_u32(&reader);
+    for (uint32_t idx = 0; idx < count && reader.valid; ++idx)
+    {
+        struct StoredFunction function = {0};
+        char const* digest = read_bytes(&reader, sizeof(struct Fingerprint));
+        if (digest != NULL) memcpy(&function.fingerprint, digest, sizeof(struct Fingerprint));
+        function.tape_size = read_u32(&reader);
+        function.tape = read_bytes(&reader, (size_t) function.tape_size * sizeof(union Bytecode));
+        function.line_count = read_u32(&reader);
+        function.lines = reader.valid ? &reader.data[reader.position] : NULL;
+        skip_lines(&reader, function.line_count);
+        if (reader.valid) add_stored_function(&state->stored, &function);
+    }
+    // Half a file is as good as nothing
+    if (!reader.valid) state->stored.size = 0;
+    for (size_t idx = 0; idx < state->stored.size; ++idx)
+    {
+        uint32_t const key = fingerprint_key(&state->stored.data[idx].fingerprint);
+        if (hashmap_find(&state->by_fingerprint, key) == NULL) hashmap_insert(&state->by_fingerprint, key, idx);
+    }
+}
+
+struct IncrementalState* load_incremental_state(char const* path, char const* configuration)
+{
+    struct IncrementalState* state = cc_malloc(sizeof(struct IncrementalState));
+    state->configuration = strdup(configuration);
+    state->stored = new_stored_function_array();
+    state->by_fingerprint = new_hashmap();
+    size_t size = 0;
+    state->contents = read_whole_file(path, &size);
+    if (state->contents != NULL) parse_state(state, size);
+    return state;
+}
+
+void free_incremental_state(struct IncrementalState* state)
+{
+    free(state->configuration);
+    free(state->contents);
+    free(state->stored.data);
+    free(state->by_fingerprint.data);
+    free(state->fingerprints);
+    free(state);
+}
+
+void fingerprint_functions(struct IncrementalState* state, struct TranslationUnitAst const* ast,
+    struct TokenStream const* tokens)
+{
+    state->function_count = ast->function_count;
+    state->fingerprints = cc_malloc(ast->function_count * sizeof(struct Fingerprint));
+    for (size_t function = 0; function < ast->function_count; ++function)
+    {
+        struct FunctionAst const* definition = ast->functions[function];
+        state->fingerprints[function] = fingerprint_tokens(tokens, definition->first_token, definition->token_count);
+    }
+}
+
+bool reuse_function(struct IncrementalState* state, size_t function, uint32_t symbol,
+    struct VirtualMachineCode* code, struct StringArray* assembly)
+{
+    struct Fingerprint const* fingerprint = &state->fingerprints[function];
+    int32_t const* found = hashmap_find(&state->by_fingerprint, fingerprint_key(fingerprint));
+    if (found == NULL) return false;
+    struct StoredFunction const* stored = &state->stored.data[*found];
+    if (!same_fingerprint(&stored->fingerprint, fingerprint)) return false;
+
+    *code = (struct VirtualMachineCode) {
+        .symbol = symbol,
+        .tape = {
+            .data = cc_malloc((stored->tape_size + 1) * sizeof(union Bytecode)),
+            .size = stored->tape_size,
+            .max_capacity = stored->tape_size + 1
+        }
+    };
+    memcpy(code->tape.data, stored->tape, stored->tape_size * sizeof(union Bytecode));
+    *assembly = new_string_array();
+    char const* line = stored->lines;
+    for (uint32_t idx = 0; idx < stored->line_count; ++idx)
+    {
+        uint32_t length;
+        memcpy(&length, line, sizeof(length));
+        add_string(assembly, line + sizeof(length));
+        line += sizeof(length) + length;
+    }
+    atomic_fetch_add(&state->reused, 1);
+    return true;
+}
+
+size_t reused_function_count(struct IncrementalState const* state)
+{
+    return atomic_load(&state->reused);
+}
+
+static bool write_u32(FILE* file, uint32_t value)
+{
+    return fwrite(&value, sizeof(value), 1, file) == 1;
+}
+
+static bool write_string(FILE* file, char const* text)
+{
+    size_t const length = strlen(text);
+    return write_u32(file, length) && fwrite(text, 1, length, file) == length;
+}
+
+void save_incremental_state(struct IncrementalState const* state, char const* path,
+    struct VirtualMachineCode const* code, struct StringArray const* assembly)
+{
+    char* temporary = format("%s.%d.tmp", path, (int) getpid());
+    FILE* file = fopen(temporary, "wb");
+    bool written = file != NULL
+        && fwrite(state_magic, sizeof(state_magic), 1, file) == 1
+        && write_string(file, compiler_build()) && write_string(file, state->configuration)
+        && write_u32(file, state->function_count);
+    for (size_t function = 0; written && function < state->function_count; ++function)
+    {
+        struct Tape const* tape = &code[function].tape;
+        written = fwrite(&state->fingerprints[function], sizeof(struct Fingerprint), 1, file) == 1
+            && write_u32(file, tape->size)
+            && fwrite(tape->data, sizeof(union Bytecode), tape->size, file) == tape->size
+            && write_u32(file, assembly[function].size);
+        for (size_t idx = 0; written && idx < assembly[function].size; ++idx)
+        {
+            size_t const length = strlen(assembly[function].data[idx]) + 1;
+            written = write_u32(file, length) && fwrite(assembly[function].data[idx], length, 1, file) == 1;
+        }
+    }
+    if (file != NULL && fclose(file) != 0) written = false;
+    // A damaged state file would only cost a full compile, but keep the old one then
+    if (!written || rename(temporary, path) != 0)
+    {
+        printf("Could not write the incremental state %s\n", path);
+        unlink(temporary);
+    }
+    free(temporary);
+}
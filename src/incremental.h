@@ -0,0 +1,28 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include "bytecode.h"
+#include "frontend.h"
+
+// Backend results of the previous compile of a file, so only the functions
+// that changed since then go through flattening, bytecode and codegen again.
+// A function is recognized by a 128 bit fingerprint of its tokens, so edits
+// elsewhere, moving it around and changing whitespace or comments keep it.
+// The state file is only valid for the build of the compiler that wrote it,
+// with the same configuration (see unit_configuration).
+struct IncrementalState;
+
+// A missing, damaged or outdated state file gives an empty state
+struct IncrementalState* load_incremental_state(char const* path, char const* configuration);
+void free_incremental_state(struct IncrementalState* state);
+// Has to be called before the tokens are gone, functions are then addressed by index
+void fingerprint_functions(struct IncrementalState* state, struct TranslationUnitAst const* ast,
+    struct TokenStream const* tokens);
+// Fills in the tape and assembly of the function if it did not change, can be
+// called from several threads at once
+bool reuse_function(struct IncrementalState* state, size_t function, uint32_t symbol,
+    struct VirtualMachineCode* code, struct StringArray* assembly);
+size_t reused_function_count(struct IncrementalState const* state);
+// Replaces the state file with the results of this compile
+void save_incremental_state(struct IncrementalState const* state, char const* path,
+    struct VirtualMachineCode const* code, struct StringArray const* assembly);
@@ -0,0 +1,137 @@
+#define _GNU_SOURCE // memrchr
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "input.h"
+#include "utils.h"
+
+#define READ_CHUNK_SIZE (64 * 1024)
+
+static int open_path(char const* path)
+{
+    if (strcmp(path, "-") == 0) return STDIN_FILENO;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        compile_error("Could not open %s: %s", path, strerror(errno));
+    }
+    return fd;
+}
+
+// Returns false if the file can not be mapped (not a regular file, empty, ...)
+static bool map_file(int fd, struct SourceInput* input)
+{
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0) return false;
+
+    void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) return false;
+    madvise(data, info.st_size, MADV_SEQUENTIAL);
+    *input = (struct SourceInput) {
+        .data = data,
+        .size = info.st_size,
+        .mapped = true
+    };
+    return true;
+}
+
+// Streams the fd into a growing buffer. With a token stream, every complete
+// line is lexed right after it was read. The fd and the buffer are in `input`
+// all along, so that close_input releases them after a compile_error.
+static void read_chunks(int fd, char const* path, struct SourceInput* input, struct TokenStream* tokens)
+{
+    size_t capacity = READ_CHUNK_SIZE;
+    char* buffer = cc_malloc(capacity);
+    size_t size = 0;
+    size_t lexed = 0;
+    *input = (struct SourceInput) {
+        .data = buffer,
+        .size = 0,
+        .mapped = false,
+        .fd = fd
+    };
+    while (true)
+    {
+        if (capacity - size < READ_CHUNK_SIZE)
+        {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+            assert(buffer);
+            input->data = buffer;
+        }
+        ssize_t count = read(fd, buffer + size, capacity - size);
+        if (count < 0 && errno == EINTR) continue;
+        if (count < 0)
+        {
+            compile_error("Could not read %s: %s", path, strerror(errno));
+        }
+        if (count == 0) break;
+        size += count;
+        input->size = size;
+
+        if (tokens != NULL)
+        {
+            char const* last_newline = memrchr(buffer + lexed, '\n', size - lexed);
+            if (last_newline == NULL) continue;
+            tokens->source = buffer;
+            size_t line_end = last_newline - buffer + 1;
+            tokenize_range(tokens, lexed, line_end);
+            lexed = line_end;
+        }
+    }
+    if (fd != STDIN_FILENO) close(fd);
+    input->fd = STDIN_FILENO;
+    if (tokens != NULL)
+    {
+        tokens->source = buffer;
+        tokenize_range(tokens, lexed, size);
+    }
+}
+
+static void load_input(char const* path, struct SourceInput* input, struct TokenStream* tokens)
+{
+    int fd = open_path(path);
+    if (map_file(fd, input))
+    {
+        // The mapping keeps the file alive
+        if (fd != STDIN_FILENO) close(fd);
+        if (tokens != NULL)
+        {
+            *tokens = begin_tokenize(input->data, input->size);
+            tokenize_range(tokens, 0, input->size);
+        }
+    }
+    else
+    {
+        if (tokens != NULL) *tokens = begin_tokenize(NULL, READ_CHUNK_SIZE);
+        read_chunks(fd, path, input, tokens);
+    }
+}
+
+void tokenize_input(char const* path, struct SourceInput* input, struct TokenStream* tokens)
+{
+    load_input(path, input, tokens);
+}
+
+void read_input(char const* path, struct SourceInput* input)
+{
+    load_input(path, input, NULL);
+}
+
+void close_input(struct SourceInput* input)
+{
+    if (input->fd != STDIN_FILENO) close(input->fd);
+    if (input->mapped)
+    {
+        munmap(input->data, input->size);
+    }
+    else
+    {
+        free(input->data);
+    }
+    *input = (struct SourceInput) {0};
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include "frontend.h"
+
+// Source text of one translation unit.
+// Regular files are mmap'd: no copy, pages are faulted in as the lexer walks them.
+// Pipes and terminals (and "-" for stdin) are read in chunks into a growing buffer.
+struct SourceInput
+{
+    char* data;
+    size_t size;
+    bool mapped; // munmap instead of free
+    int fd; // Only open while streaming, stdin (0) is never closed
+};
+
+// Reads the whole input and lexes it on the way, streamed input is tokenized
+// line by line as chunks arrive instead of after the last read.
+// Exits with an error message if the file can not be read. `input` and
+// `tokens` are filled in as soon as they hold anything, so close_input and
+// free_token_stream release them (zeroed ones too) after a compile_error
+// stopped the reading or the lexer (see run_guarded).
+void tokenize_input(char const* path, struct SourceInput* input, struct TokenStream* tokens);
+void read_input(char const* path, struct SourceInput* input);
+void close_input(struct SourceInput* input);
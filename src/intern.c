@@ -0,0 +1,169 @@
+#include <pthread.h>
+#include <string.h>
+#include "intern.h"
+
+// Per symbol data lives in segments that double in size and never move.
+// Segment k holds 2^(k + FIRST_SEGMENT_BITS) symbols.
+#define FIRST_SEGMENT_BITS 9
+#define SEGMENT_COUNT (32 - FIRST_SEGMENT_BITS)
+
+struct SymbolInfo
+{
+    char const* name;
+    uint32_t length;
+    uint32_t hash;
+};
+
+// Inserts are serialized by the lock. Lookups of an existing symbol do not
+// lock: whoever holds a symbol got it from intern() (or from a thread that
+// did), so its entry was written before, and the entry never moves.
+static struct InternTable
+{
+    pthread_mutex_t lock;
+    // Open addressing over symbols, 0 marks an empty slot
+    uint32_t* slots;
+    size_t slot_capacity;
+    struct SymbolInfo* segments[SEGMENT_COUNT];
+    size_t count;
+    // Strings are copied into arena blocks, which never move
+    struct Arena names_arena;
+} interner = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static unsigned symbol_segment(uint32_t symbol, size_t* index_in_segment)
+{
+    uint64_t const biased = (uint64_t) symbol + (1u << FIRST_SEGMENT_BITS);
+    unsigned const segment = 63 - __builtin_clzll(biased) - FIRST_SEGMENT_BITS;
+    *index_in_segment = biased - (1ull << (segment + FIRST_SEGMENT_BITS));
+    return segment;
+}
+
+static struct SymbolInfo* symbol_info(uint32_t symbol)
+{
+    size_t index;
+    unsigned const segment = symbol_segment(symbol, &index);
+    return &interner.segments[segment][index];
+}
+
+static void init_interner()
+{
+    interner.slot_capacity = 1024;
+    interner.slots = cc_malloc(interner.slot_capacity * sizeof(uint32_t));
+    interner.count = 1; // Skip the reserved symbol 0
+    interner.names_arena = new_arena("symbols");
+}
+
+static char const* copy_name(struct StringView text)
+{
+    char* name = arena_alloc(&interner.names_arena, text.length + 1);
+    memcpy(name, text.data, text.length);
+    return name; // Arena memory is zeroed, so it is already terminated
+}
+
+static void grow_slots()
+{
+    size_t new_capacity = interner.slot_capacity * 2;
+    uint32_t* new_slots = cc_malloc(new_capacity * sizeof(uint32_t));
+    for (size_t symbol = 1; symbol < interner.count; ++symbol)
+    {
+        size_t index = symbol_info(symbol)->hash & (new_capacity - 1);
+        while (new_slots[index] != 0) index = (index + 1) & (new_capacity - 1);
+        new_slots[index] = symbol;
+    }
+    free(interner.slots);
+    interner.slots = new_slots;
+    interner.slot_capacity = new_capacity;
+}
+
+static uint32_t add_symbol(struct StringView text, uint32_t hash, size_t slot)
+{
+    assert(interner.count <= UINT32_MAX && "Out of symbols");
+    uint32_t symbol = interner.count++;
+    size_t index;
+    unsigned const segment = symbol_segment(symbol, &index);
+    if (interner.segments[segment] == NULL)
+    {
+        interner.segments[segment] = cc_malloc(sizeof(struct SymbolInfo) << (segment + FIRST_SEGMENT_BITS));
+    }
+    *symbol_info(symbol) = (struct SymbolInfo) {copy_name(text), text.length, hash};
+    interner.slots[slot] = symbol;
+    // Keep the load factor under 1/2
+    if (interner.count * 2 > interner.slot_capacity) grow_slots();
+    return symbol;
+}
+
+uint32_t intern_hashed(struct StringView text, uint32_t hash)
+{
+    pthread_mutex_lock(&interner.lock);
+    if (interner.slots == NULL) init_interner();
+
+    size_t index = hash & (interner.slot_capacity - 1);
+    uint32_t symbol;
+    while ((symbol = interner.slots[index]) != 0)
+    {
+        struct SymbolInfo const* info = symbol_info(symbol);
+        if (info->hash == hash && info->length == text.length && memcmp(info->name, text.data, text.length) == 0)
+        {
+            break;
+        }
+        index = (index + 1) & (interner.slot_capacity - 1);
+    }
+    if (symbol == 0) symbol = add_symbol(text, hash, index);
+    pthread_mutex_unlock(&interner.lock);
+    return symbol;
+}
+
+uint32_t intern(struct StringView text)
+{
+    return intern_hashed(text, hash_bytes(text.data, text.length));
+}
+
+uint32_t intern_cached(struct InternCache* cache, struct StringView text)
+{
+    uint32_t const hash = hash_bytes(text.data, text.length);
+    uint32_t* entry = &cache->symbols[hash & (INTERN_CACHE_SIZE - 1)];
+    if (*entry != 0)
+    {
+        struct SymbolInfo const* info = symbol_info(*entry);
+        if (info->hash == hash && info->length == text.length && memcmp(info->name, text.data, text.length) == 0)
+        {
+            return *entry;
+        }
+    }
+    *entry = intern_hashed(text, hash);
+    return *entry;
+}
+
+char const* symbol_name(uint32_t symbol)
+{
+    assert(symbol != 0);
+    return symbol_info(symbol)->name;
+}
+
+struct StringView symbol_text(uint32_t symbol)
+{
+    assert(symbol != 0);
+    struct SymbolInfo const* info = symbol_info(symbol);
+    return (struct StringView) {info->name, info->length};
+}
+
+uint32_t symbol_hash(uint32_t symbol)
+{
+    assert(symbol != 0);
+    return symbol_info(symbol)->hash;
+}
+
+struct Arena const* interner_arena()
+{
+    pthread_mutex_lock(&interner.lock);
+    if (interner.slots == NULL) init_interner();
+    pthread_mutex_unlock(&interner.lock);
+    return &interner.names_arena;
+}
+
+size_t interned_count()
+{
+    pthread_mutex_lock(&interner.lock);
+    size_t count = interner.count == 0 ? 0 : interner.count - 1;
+    pthread_mutex_unlock(&interner.lock);
+    return count;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <stdint.h>
+#include "utils.h"
+
+// Global identifier table. Every distinct identifier gets a small integer
+// symbol, so the rest of the compiler compares and hashes integers instead of
+// strings. The text is copied once, symbols stay valid for the whole run.
+// Symbol 0 is never handed out and can be used as "no symbol".
+// Shared by all threads: intern() takes a lock, looking up a symbol does not.
+
+uint32_t intern(struct StringView text);
+// Same as intern, for callers that already have hash_bytes() of the text
+uint32_t intern_hashed(struct StringView text, uint32_t hash);
+
+// Private front of the shared table for one lexing thread. Identifiers repeat a
+// lot, so most of them are found here without taking the lock. Zero initialize.
+#define INTERN_CACHE_SIZE 512
+struct InternCache
+{
+    uint32_t symbols[INTERN_CACHE_SIZE];
+};
+uint32_t intern_cached(struct InternCache* cache, struct StringView text);
+
+// Null terminated
+char const* symbol_name(uint32_t symbol);
+struct StringView symbol_text(uint32_t symbol);
+uint32_t symbol_hash(uint32_t symbol);
+size_t interned_count();
+// Holds the symbol names, for --mem-stats
+struct Arena const* interner_arena();
@@ -0,0 +1,299 @@
+#include <string.h>
+#include "interpreter.h"
+#include "intern.h"
+
+struct ThreadedInstruction
+{
+    void const* handler;
+    // Variable index for LOAD/STORE/LOAD_ADD/STORE_KEEP, instruction index for jumps
+    int32_t operand;
+};
+
+#define OP_COUNT (STORE_KEEP + 1)
+// Handler of the instruction after the last one, for tapes that end without RET
+#define END_OF_CODE OP_COUNT
+
+static bool is_jump(enum BytecodeOp op)
+{
+    return op == JMP || op == JZ || op == JNZ;
+}
+
+static bool uses_variable(enum BytecodeOp op)
+{
+    return op == LOAD || op == STORE || op == LOAD_ADD || op == STORE_KEEP;
+}
+
+static int32_t wrapping_add(int32_t left, int32_t right)
+{
+    return (int32_t) ((uint32_t) left + (uint32_t) right);
+}
+
+// With `handlers` it only hands out the handler table, for prepare_function
+static char* execute(struct Interpreter* interpreter, struct InterpretedFunction const* function, int32_t* result,
+    void const* const** handlers)
+{
+    static void const* const labels[OP_COUNT + 1] = {
+        [PUSH] = &&push, [POP] = &&pop, [LOAD] = &&load, [STORE] = &&store,
+        [NOT] = &&not, [NEG] = &&neg, [BIT_NOT] = &&bit_not,
+        [ADD] = &&add, [SUB] = &&sub, [MUL] = &&mul, [DIV] = &&div, [REM] = &&rem,
+        [LSHIFT] = &&lshift, [RSHIFT] = &&rshift, [BIT_AND] = &&bit_and, [BIT_OR] = &&bit_or, [BIT_XOR] = &&bit_xor,
+        [EQ] = &&eq, [NE] = &&ne, [LT] = &&lt, [LE] = &&le, [GT] = &&gt, [GE] = &&ge,
+        [JMP] = &&jmp, [JZ] = &&jz, [JNZ] = &&jnz, [CALL] = &&call, [RET] = &&ret,
+        [ADD_IMM] = &&add_imm, [LOAD_ADD] = &&load_add, [STORE_KEEP] = &&store_keep,
+        [END_OF_CODE] = &&end_of_code,
+    };
+    if (handlers != NULL)
+    {
+        *handlers = labels;
+        return NULL;
+    }
+
+    struct ThreadedInstruction const* const code = function->code;
+    struct ThreadedInstruction const* ip = code;
+    int32_t* const frame = interpreter->frame;
+    int32_t* sp = interpreter->stack; // One past the top
+    uint64_t executed = 0;
+    int32_t value = 0;
+    char* error = NULL;
+    memset(frame, 0, function->frame_size * sizeof(int32_t));
+
+#define DISPATCH() do { ++executed; goto *ip->handler; } while (0)
+#define NEXT() do { ++ip; DISPATCH(); } while (0)
+#define BINARY(LABEL, EXPRESSION) \
+    LABEL: \
+    { \
+        int32_t const right = *--sp; \
+        int32_t const left = sp[-1]; \
+        sp[-1] = (EXPRESSION); \
+        NEXT(); \
+    }
+
+    DISPATCH();
+push:
+    *sp++ = ip->operand;
+    NEXT();
+pop:
+    --sp;
+    NEXT();
+load:
+    *sp++ = frame[ip->operand];
+    NEXT();
+store:
+    frame[ip->operand] = *--sp;
+    NEXT();
+not:
+    sp[-1] = !sp[-1];
+    NEXT();
+neg:
+    sp[-1] = (int32_t) -(uint32_t) sp[-1];
+    NEXT();
+bit_not:
+    sp[-1] = ~sp[-1];
+    NEXT();
+BINARY(add, wrapping_add(left, right))
+BINARY(sub, (int32_t) ((uint32_t) left - (uint32_t) right))
+BINARY(mul, (int32_t) ((uint32_t) left * (uint32_t) right))
+// Traps like idiv does
+#define DIVISION(LABEL, OPERATOR) \
+    LABEL: \
+    { \
+        int32_t const right = *--sp; \
+        int32_t const left = sp[-1]; \
+        if (right == 0) error = format("Division by zero"); \
+        else if (left == INT32_MIN && right == -1) error = format("Division overflow"); \
+        if (error != NULL) goto done; \
+        sp[-1] = left OPERATOR right; \
+        NEXT(); \
+    }
+DIVISION(div, /)
+DIVISION(rem, %)
+// Shift counts are masked like shl/sar do
+BINARY(lshift, (int32_t) ((uint32_t) left << (right & 31)))
+BINARY(rshift, left >> (right & 31))
+BINARY(bit_and, left & right)
+BINARY(bit_or, left | right)
+BINARY(bit_xor, left ^ right)
+BINARY(eq, left == right)
+BINARY(ne, left != right)
+BINARY(lt, left < right)
+BINARY(le, left <= right)
+BINARY(gt, left > right)
+BINARY(ge, left >= right)
+jmp:
+    ip = &code[ip->operand];
+    DISPATCH();
+jz:
+    ip = *--sp == 0 ? &code[ip->operand] : ip + 1;
+    DISPATCH();
+jnz:
+    ip = *--sp != 0 ? &code[ip->operand] : ip + 1;
+    DISPATCH();
+call:
+    // Rejected by prepare_function
+    error = format("Calls are not supported by the interpreter");
+    goto done;
+ret:
+    value = sp[-1];
+    goto done;
+add_imm:
+    sp[-1] = wrapping_add(sp[-1], ip->operand);
+    NEXT();
+load_add:
+    sp[-1] = wrapping_add(sp[-1], frame[ip->operand]);
+    NEXT();
+store_keep:
+    frame[ip->operand] = sp[-1];
+    NEXT();
+end_of_code:
+    // Not an instruction
+    --executed;
+done:
+#undef BINARY
+#undef DIVISION
+#undef NEXT
+#undef DISPATCH
+    interpreter->executed += executed;
+    *result = value;
+    return error;
+}
+
+// Stack depth before every instruction, the deepest one in `stack_size`.
+// Returns false if an instruction could find too few operands or two paths
+// meet with different depths.
+static bool check_stack(struct VirtualMachineCode const* vm, uint32_t const* instruction_starts, size_t count,
+    struct ThreadedInstruction const* code, size_t* stack_size)
+{
+    int32_t* depths = cc_malloc((count + 1) * sizeof(int32_t));
+    uint32_t* pending = cc_malloc((count + 1) * sizeof(uint32_t));
+    for (size_t idx = 0; idx <= count; ++idx) depths[idx] = -1;
+    size_t pending_count = 0;
+    depths[0] = 0;
+    pending[pending_count++] = 0;
+    bool valid = true;
+    *stack_size = 1;
+    while (pending_count != 0 && valid)
+    {
+        uint32_t const idx = pending[--pending_count];
+        if (idx == count) continue;
+        enum BytecodeOp const op = vm->tape.data[instruction_starts[idx]].op;
+        struct StackEffect const effect = op_stack_effect(op);
+        int32_t const depth = depths[idx] - effect.pops + effect.pushes;
+        valid = depths[idx] >= effect.pops;
+        if ((size_t) depth > *stack_size) *stack_size = depth;
+
+        uint32_t successors[2];
+        size_t successor_count = 0;
+        if (op != JMP && op != RET) successors[successor_count++] = idx + 1;
+        if (is_jump(op)) successors[successor_count++] = code[idx].operand;
+        for (size_t successor = 0; successor < successor_count && valid; ++successor)
+        {
+            uint32_t const next = successors[successor];
+            if (depths[next] == -1)
+            {
+                depths[next] = depth;
+                pending[pending_count++] = next;
+            }
+            valid = depths[next] == depth;
+        }
+    }
+    free(depths);
+    free(pending);
+    return valid;
+}
+
+char* prepare_function(struct VirtualMachineCode const* vm, struct InterpretedFunction* function)
+{
+    void const* const* handlers;
+    execute(NULL, NULL, NULL, &handlers);
+    size_t const size = vm->tape.size;
+    union Bytecode const* tape = vm->tape.data;
+
+    // Tape position -> instruction index, UINT32_MAX inside an instruction
+    uint32_t* instruction_index = cc_malloc((size + 1) * sizeof(uint32_t));
+    uint32_t* instruction_starts = cc_malloc((size + 1) * sizeof(uint32_t));
+    memset(instruction_index, 0xFF, (size + 1) * sizeof(uint32_t));
+    size_t count = 0;
+    char* error = NULL;
+    for (size_t idx = 0; idx < size && error == NULL; ++idx)
+    {
+        enum BytecodeOp const op = tape[idx].op;
+        if ((unsigned) op >= OP_COUNT) error = format("unknown op %d at %zu", (int) op, idx);
+        else if (op == CALL) error = format("calls are not supported");
+        else if (is_op_double_width(op) && ++idx == size) error = format("missing operand at the end");
+        instruction_index[idx - is_op_double_width(op)] = count;
+        instruction_starts[count++] = idx - is_op_double_width(op);
+    }
+    instruction_index[size] = count;
+
+    *function = (struct InterpretedFunction) {
+        .symbol = vm->symbol,
+        .code = cc_malloc((count + 1) * sizeof(struct ThreadedInstruction))
+    };
+    for (size_t idx = 0; idx < count && error == NULL; ++idx)
+    {
+        enum BytecodeOp const op = tape[instruction_starts[idx]].op;
+        int32_t operand = is_op_double_width(op) ? tape[instruction_starts[idx] + 1].value : 0;
+        if (uses_variable(op))
+        {
+            if (operand < 0 || operand % sizeof(int32_t) != 0) error = format("bad variable offset %d", operand);
+            operand /= (int32_t) sizeof(int32_t);
+            if ((size_t) operand >= function->frame_size) function->frame_size = operand + 1;
+        }
+        if (is_jump(op))
+        {
+            if (operand < 0 || (size_t) operand > size || instruction_index[operand] == UINT32_MAX)
+            {
+                error = format("bad jump target %d", operand);
+                break;
+            }
+            operand = instruction_index[operand];
+        }
+        function->code[idx] = (struct ThreadedInstruction) {handlers[op], operand};
+    }
+    function->code[count].handler = handlers[END_OF_CODE];
+    if (error == NULL && !check_stack(vm, instruction_starts, count, function->code, &function->stack_size))
+    {
+        error = format("unbalanced operand stack");
+    }
+    free(instruction_index);
+    free(instruction_starts);
+    if (error == NULL) return NULL;
+
+    char* message = format("Can not interpret %s: %s", symbol_name(vm->symbol), error);
+    free(error);
+    free_interpreted_function(function);
+    return message;
+}
+
+void free_interpreted_function(struct InterpretedFunction* function)
+{
+    free(function->code);
+    *function = (struct InterpretedFunction) {0};
+}
+
+struct Interpreter new_interpreter()
+{
+    return (struct Interpreter) {0};
+}
+
+void free_interpreter(struct Interpreter* interpreter)
+{
+    free(interpreter->stack);
+    free(interpreter->frame);
+    *interpreter = new_interpreter();
+}
+
+static void reserve(int32_t** memory, size_t* capacity, size_t count)
+{
+    if (count <= *capacity) return;
+    free(*memory);
+    *capacity = count * 2;
+    *memory = cc_malloc(*capacity * sizeof(int32_t));
+}
+
+char* run_function(struct Interpreter* interpreter, struct InterpretedFunction const* function, int32_t* result)
+{
+    reserve(&interpreter->stack, &interpreter->stack_capacity, function->stack_size);
+    reserve(&interpreter->frame, &interpreter->frame_capacity, function->frame_size + 1);
+    return execute(interpreter, function, result, NULL);
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "bytecode.h"
+
+// Runs tapes in process, a quick execution tier that does not need an
+// assembler and a linker. Tapes are checked and translated once (prepare),
+// then the dispatch loop jumps straight from one instruction's handler to the
+// next (computed goto, direct threading) and does no bounds checks: the
+// operand stack depth and frame size are known up front.
+struct ThreadedInstruction;
+
+struct InterpretedFunction
+{
+    uint32_t symbol;
+    struct ThreadedInstruction* code;
+    size_t stack_size; // Deepest the operand stack gets
+    size_t frame_size; // In variables
+};
+
+// Operand stack and frame memory, grown to the largest function run so far
+// and reused afterwards
+struct Interpreter
+{
+    int32_t* stack;
+    size_t stack_capacity;
+    int32_t* frame;
+    size_t frame_capacity;
+    uint64_t executed; // Instructions, over all runs
+};
+
+// Returns NULL, or a message (to be freed) if the tape is malformed
+char* prepare_function(struct VirtualMachineCode const* vm, struct InterpretedFunction* function);
+void free_interpreted_function(struct InterpretedFunction* function);
+
+struct Interpreter new_interpreter();
+void free_interpreter(struct Interpreter* interpreter);
+// Returns NULL and the function's return value in `result` (0 if it ends without RET),
+// or a message (to be freed) for run time errors like division by zero
+char* run_function(struct Interpreter* interpreter, struct InterpretedFunction const* function, int32_t* result);
@@ -0,0 +1,74 @@
+#include <elf.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "intern.h"
+#include "jit.h"
+
+char* load_jit_module(struct EncodedFunction const* functions, size_t function_count, struct JitModule* module)
+{
+    *module = (struct JitModule) {.offsets = new_hashmap()};
+    size_t size = 0;
+    for (size_t idx = 0; idx < function_count; ++idx)
+    {
+        if (hashmap_find(&module->offsets, functions[idx].symbol) == NULL)
+        {
+            hashmap_insert(&module->offsets, functions[idx].symbol, size);
+        }
+        size += functions[idx].code.size;
+    }
+    size_t const page = sysconf(_SC_PAGESIZE);
+    module->mapped_size = (size + page) / page * page;
+    void* memory = mmap(NULL, module->mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        free(module->offsets.data);
+        *module = (struct JitModule) {0};
+        return format("Could not map %zu bytes: %s", size, strerror(errno));
+    }
+    module->memory = memory;
+    size_t offset = 0;
+    for (size_t idx = 0; idx < function_count; ++idx)
+    {
+        memcpy(&module->memory[offset], functions[idx].code.data, functions[idx].code.size);
+        // Calls between the functions, the only references there are to resolve
+        for (size_t reloc = 0; reloc < functions[idx].relocations.size; ++reloc)
+        {
+            struct Relocation const* relocation = &functions[idx].relocations.data[reloc];
+            int32_t const* target = hashmap_find(&module->offsets, relocation->symbol);
+            if (target == NULL || (relocation->type != R_X86_64_PC32 && relocation->type != R_X86_64_PLT32))
+            {
+                char* error = format("Can not resolve %s", symbol_name(relocation->symbol));
+                free_jit_module(module);
+                return error;
+            }
+            int32_t const value = *target + relocation->addend - (int32_t) (offset + relocation->offset);
+            memcpy(&module->memory[offset + relocation->offset], &value, sizeof(value));
+        }
+        offset += functions[idx].code.size;
+    }
+    if (mprotect(module->memory, module->mapped_size, PROT_READ | PROT_EXEC) != 0)
+    {
+        char* error = format("Could not make the code executable: %s", strerror(errno));
+        free_jit_module(module);
+        return error;
+    }
+    return NULL;
+}
+
+bool call_jit_function(struct JitModule* module, uint32_t symbol, int32_t* result)
+{
+    int32_t const* offset = hashmap_find(&module->offsets, symbol);
+    if (offset == NULL) return false;
+    int32_t (*function)(void) = (int32_t (*)(void)) (module->memory + *offset);
+    *result = function();
+    return true;
+}
+
+void free_jit_module(struct JitModule* module)
+{
+    if (module->memory != NULL) munmap(module->memory, module->mapped_size);
+    free(module->offsets.data);
+    *module = (struct JitModule) {0};
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include "encode.h"
+
+// Machine code of a unit mapped executable in this process (--run). The code
+// is copied into fresh pages, which are made read only and executable before
+// anything runs. Functions take no arguments and return an int, as compiled.
+struct JitModule
+{
+    uint8_t* memory;
+    size_t mapped_size;
+    struct HashMap offsets; // Interned name to the start of the function
+};
+
+// Returns NULL, or a message (to be freed)
+char* load_jit_module(struct EncodedFunction const* functions, size_t function_count, struct JitModule* module);
+// False if the module has no function with that name
+bool call_jit_function(struct JitModule* module, uint32_t symbol, int32_t* result);
+void free_jit_module(struct JitModule* module);
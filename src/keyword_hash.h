@@ -0,0 +1,19 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Shared by the lexer and tools/keyword_gen.c, which searches for a seed that
+// makes this hash collision free over src/keywords.def
+#define KEYWORD_MIN_LENGTH 2
+#define KEYWORD_MAX_LENGTH 14
+
+// Only valid for KEYWORD_MIN_LENGTH <= length, looks at the first two bytes,
+// the last byte and the length
+static inline uint32_t keyword_hash(char const* text, size_t length, uint32_t seed, unsigned bits)
+{
+    uint32_t key = (uint32_t) (uint8_t) text[0]
+        | (uint32_t) (uint8_t) text[1] << 8
+        | (uint32_t) (uint8_t) text[length - 1] << 16
+        | (uint32_t) length << 24;
+    return (key * seed) >> (32 - bits);
+}
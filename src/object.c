@@ -0,0 +1,181 @@
+#include <elf.h>
+#include <string.h>
+#include "intern.h"
+#include "object.h"
+
+enum ObjectSection
+{
+    SECTION_NULL,
+    SECTION_TEXT,
+    SECTION_RELA_TEXT,
+    SECTION_SYMTAB,
+    SECTION_STRTAB,
+    SECTION_SHSTRTAB,
+    SECTION_NOTE_STACK, // Empty, asks for a non executable stack
+    SECTION_COUNT
+};
+
+static char const* const SECTION_NAMES[] = {
+    "", ".text", ".rela.text", ".symtab", ".strtab", ".shstrtab", ".note.GNU-stack"
+};
+
+static void align_bytes(struct ByteArray* bytes, size_t alignment)
+{
+    static uint8_t const zeros[16] = {0};
+    append_bytes(bytes, zeros, (alignment - bytes->size % alignment) % alignment);
+}
+
+static uint32_t add_name(struct ByteArray* table, char const* name)
+{
+    uint32_t const offset = table->size;
+    append_bytes(table, name, strlen(name) + 1);
+    return offset;
+}
+
+struct SymbolTable
+{
+    struct ByteArray entries; // Elf64_Sym
+    struct ByteArray names;
+    struct HashMap indices; // Interned name to entry
+};
+
+static void add_symbol(struct SymbolTable* table, uint32_t symbol, unsigned char info, uint16_t section, uint64_t value,
+    uint64_t size)
+{
+    Elf64_Sym entry = {
+        .st_name = symbol != 0 ? add_name(&table->names, symbol_name(symbol)) : 0,
+        .st_info = info,
+        .st_shndx = section,
+        .st_value = value,
+        .st_size = size
+    };
+    if (symbol != 0) hashmap_insert(&table->indices, symbol, table->entries.size / sizeof(Elf64_Sym));
+    append_bytes(&table->entries, &entry, sizeof(entry));
+}
+
+struct ByteArray write_elf_object(struct EncodedFunction const* functions, size_t function_count)
+{
+    uint32_t const main_symbol = intern((struct StringView) {"main", 4});
+    uint64_t* function_offsets = cc_malloc((function_count + 1) * sizeof(uint64_t));
+    struct ByteArray text = new_byte_array();
+    for (size_t idx = 0; idx < function_count; ++idx)
+    {
+        function_offsets[idx] = text.size;
+        append_bytes(&text, functions[idx].code.data, functions[idx].code.size);
+    }
+
+    // Locals have to come before the globals
+    struct SymbolTable symbols = {.entries = new_byte_array(), .names = new_byte_array(), .indices = new_hashmap()};
+    add_name(&symbols.names, "");
+    add_symbol(&symbols, 0, ELF64_ST_INFO(STB_LOCAL, STT_NOTYPE), SHN_UNDEF, 0, 0);
+    add_symbol(&symbols, 0, ELF64_ST_INFO(STB_LOCAL, STT_SECTION), SECTION_TEXT, 0, 0);
+    for (size_t idx = 0; idx < function_count; ++idx)
+    {
+        if (functions[idx].symbol == main_symbol) continue;
+        add_symbol(&symbols, functions[idx].symbol, ELF64_ST_INFO(STB_LOCAL, STT_FUNC), SECTION_TEXT, function_offsets[idx],
+            functions[idx].code.size);
+    }
+    uint32_t const first_global = symbols.entries.size / sizeof(Elf64_Sym);
+    for (size_t idx = 0; idx < function_count; ++idx)
+    {
+        if (functions[idx].symbol != main_symbol) continue;
+        add_symbol(&symbols, main_symbol, ELF64_ST_INFO(STB_GLOBAL, STT_FUNC), SECTION_TEXT, function_offsets[idx],
+            functions[idx].code.size);
+    }
+    struct ByteArray relocations = new_byte_array();
+    for (size_t idx = 0; idx < function_count; ++idx)
+    {
+        for (size_t reloc = 0; reloc < functions[idx].relocations.size; ++reloc)
+        {
+            struct Relocation const* relocation = &functions[idx].relocations.data[reloc];
+            if (hashmap_find(&symbols.indices, relocation->symbol) == NULL)
+            {
+                add_symbol(&symbols, relocation->symbol, ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE), SHN_UNDEF, 0, 0);
+            }
+            Elf64_Rela entry = {
+                .r_offset = function_offsets[idx] + relocation->offset,
+                .r_info = ELF64_R_INFO(*hashmap_find(&symbols.indices, relocation->symbol), relocation->type),
+                .r_addend = relocation->addend
+            };
+            append_bytes(&relocations, &entry, sizeof(entry));
+        }
+    }
+
+    // Header, then the section contents, then the section headers
+    struct ByteArray object = new_byte_array();
+    Elf64_Shdr sections[SECTION_COUNT] = {0};
+    struct ByteArray section_names = new_byte_array();
+    for (size_t section = 0; section < SECTION_COUNT; ++section)
+    {
+        sections[section].sh_name = add_name(&section_names, SECTION_NAMES[section]);
+    }
+    struct ByteArray const* contents[SECTION_COUNT] = {
+        [SECTION_TEXT] = &text,
+        [SECTION_RELA_TEXT] = &relocations,
+        [SECTION_SYMTAB] = &symbols.entries,
+        [SECTION_STRTAB] = &symbols.names,
+        [SECTION_SHSTRTAB] = &section_names
+    };
+    sections[SECTION_TEXT] = (Elf64_Shdr) {
+        .sh_name = sections[SECTION_TEXT].sh_name,
+        .sh_type = SHT_PROGBITS,
+        .sh_flags = SHF_ALLOC | SHF_EXECINSTR,
+        .sh_addralign = 16
+    };
+    sections[SECTION_RELA_TEXT] = (Elf64_Shdr) {
+        .sh_name = sections[SECTION_RELA_TEXT].sh_name,
+        .sh_type = SHT_RELA,
+        .sh_flags = SHF_INFO_LINK,
+        .sh_link = SECTION_SYMTAB,
+        .sh_info = SECTION_TEXT,
+        .sh_addralign = 8,
+        .sh_entsize = sizeof(Elf64_Rela)
+    };
+    sections[SECTION_SYMTAB] = (Elf64_Shdr) {
+        .sh_name = sections[SECTION_SYMTAB].sh_name,
+        .sh_type = SHT_SYMTAB,
+        .sh_link = SECTION_STRTAB,
+        .sh_info = first_global,
+        .sh_addralign = 8,
+        .sh_entsize = sizeof(Elf64_Sym)
+    };
+    sections[SECTION_STRTAB].sh_type = SHT_STRTAB;
+    sections[SECTION_STRTAB].sh_addralign = 1;
+    sections[SECTION_SHSTRTAB].sh_type = SHT_STRTAB;
+    sections[SECTION_SHSTRTAB].sh_addralign = 1;
+    sections[SECTION_NOTE_STACK].sh_type = SHT_PROGBITS;
+    sections[SECTION_NOTE_STACK].sh_addralign = 1;
+
+    append_bytes(&object, &(Elf64_Ehdr) {0}, sizeof(Elf64_Ehdr));
+    for (size_t section = 1; section < SECTION_COUNT; ++section)
+    {
+        align_bytes(&object, sections[section].sh_addralign);
+        sections[section].sh_offset = object.size;
+        if (contents[section] == NULL) continue;
+        sections[section].sh_size = contents[section]->size;
+        append_bytes(&object, contents[section]->data, contents[section]->size);
+    }
+    align_bytes(&object, 8);
+    Elf64_Ehdr header = {
+        .e_ident = {ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3, ELFCLASS64, ELFDATA2LSB, EV_CURRENT, ELFOSABI_SYSV},
+        .e_type = ET_REL,
+        .e_machine = EM_X86_64,
+        .e_version = EV_CURRENT,
+        .e_shoff = object.size,
+        .e_ehsize = sizeof(Elf64_Ehdr),
+        .e_shentsize = sizeof(Elf64_Shdr),
+        .e_shnum = SECTION_COUNT,
+        .e_shstrndx = SECTION_SHSTRTAB
+    };
+    memcpy(object.data, &header, sizeof(header));
+    append_bytes(&object, sections, sizeof(sections));
+
+    free(function_offsets);
+    free(text.data);
+    free(relocations.data);
+    free(symbols.entries.data);
+    free(symbols.names.data);
+    free(symbols.indices.data);
+    free(section_names.data);
+    return object;
+}
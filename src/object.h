@@ -0,0 +1,8 @@
+#pragma once
+#include "encode.h"
+
+// ELF64 relocatable object for x86-64: the functions back to back in .text,
+// like the assembly output, main global and the others local. Symbols that
+// relocations reference but no function defines are left undefined for the
+// linker.
+struct ByteArray write_elf_object(struct EncodedFunction const* functions, size_t function_count);
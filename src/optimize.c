@@ -0,0 +1,385 @@
+#include "optimize.h"
+
+struct OptimizeFrame
+{
+    struct ExpressionNode* node;
+    bool children_done;
+};
+
+DEFINE_NEW_DYN_ARRAY(OptimizeStack, struct OptimizeFrame, new_optimize_stack, push_optimize_frame);
+IMPLEMENT_NEW_DYN_ARRAY(OptimizeStack, struct OptimizeFrame, new_optimize_stack, push_optimize_frame);
+
+// The backend truncates constants to int when it pushes them
+static int32_t constant_value(struct ExpressionNode const* node)
+{
+    return (int32_t) node->as.value;
+}
+
+static bool is_constant(struct ExpressionNode const* node)
+{
+    return node->type == EXPR_CONSTANT;
+}
+
+static void make_constant(struct ExpressionNode* node, int32_t value)
+{
+    node->type = EXPR_CONSTANT;
+    node->as.value = value;
+}
+
+// Through unsigned, signed overflow would be undefined in here as well
+static int32_t wrap(uint32_t value)
+{
+    return (int32_t) value;
+}
+
+// False if the result is only known at run time
+static bool fold_binary(enum BinaryOp op, int32_t left, int32_t right, int32_t* result)
+{
+    switch (op)
+    {
+        case BIN_MUL: *result = wrap((uint32_t) left * (uint32_t) right); return true;
+        case BIN_DIV:
+        case BIN_REM:
+            if (right == 0 || (left == INT32_MIN && right == -1)) return false;
+            *result = op == BIN_DIV ? left / right : left % right;
+            return true;
+        case BIN_ADD: *result = wrap((uint32_t) left + (uint32_t) right); return true;
+        case BIN_SUB: *result = wrap((uint32_t) left - (uint32_t) right); return true;
+        case BIN_LSHIFT:
+        case BIN_RSHIFT:
+            if (right < 0 || right >= 32) return false;
+            *result = op == BIN_LSHIFT ? wrap((uint32_t) left << right) : left >> right;
+            return true;
+        case BIN_LESS: *result = left < right; return true;
+        case BIN_LESS_EQ: *result = left <= right; return true;
+        case BIN_GREATER: *result = left > right; return true;
+        case BIN_GREATER_EQ: *result = left >= right; return true;
+        case BIN_EQ: *result = left == right; return true;
+        case BIN_NOT_EQ: *result = left != right; return true;
+        case BIN_BIT_AND: *result = left & right; return true;
+        case BIN_BIT_XOR: *result = left ^ right; return true;
+        case BIN_BIT_OR: *result = left | right; return true;
+        case BIN_LOGICAL_AND: *result = left && right; return true;
+        case BIN_LOGICAL_OR: *result = left || right; return true;
+    }
+    return false;
+}
+
+static bool is_commutative(enum BinaryOp op)
+{
+    return op == BIN_MUL || op == BIN_ADD || op == BIN_EQ || op == BIN_NOT_EQ
+        || op == BIN_BIT_AND || op == BIN_BIT_XOR || op == BIN_BIT_OR;
+}
+
+// (x op c1) op c2 -> x op (c1 op c2)
+static bool is_reassociable(enum BinaryOp op)
+{
+    return op == BIN_MUL || op == BIN_BIT_AND || op == BIN_BIT_XOR || op == BIN_BIT_OR;
+}
+
+// !(a < b) -> a >= b and so on
+static bool invert_comparison(enum BinaryOp op, enum BinaryOp* inverted)
+{
+    switch (op)
+    {
+        case BIN_LESS: *inverted = BIN_GREATER_EQ; return true;
+        case BIN_LESS_EQ: *inverted = BIN_GREATER; return true;
+        case BIN_GREATER: *inverted = BIN_LESS_EQ; return true;
+        case BIN_GREATER_EQ: *inverted = BIN_LESS; return true;
+        case BIN_EQ: *inverted = BIN_NOT_EQ; return true;
+        case BIN_NOT_EQ: *inverted = BIN_EQ; return true;
+        default: return false;
+    }
+}
+
+// Always 0 or 1
+static bool is_truth_value(struct ExpressionNode const* node)
+{
+    enum BinaryOp unused;
+    if (node->type == EXPR_UNARY) return node->as.unary->op == UNARY_NOT;
+    if (node->type != EXPR_BIN) return false;
+    return invert_comparison(node->as.bin->op, &unused)
+        || node->as.bin->op == BIN_LOGICAL_AND || node->as.bin->op == BIN_LOGICAL_OR;
+}
+
+// x + c and x - c, as x plus an addend
+static bool split_addend(struct ExpressionNode const* node, struct ExpressionNode** rest, int32_t* addend)
+{
+    if (node->type != EXPR_BIN || !is_constant(node->as.bin->right)) return false;
+    if (node->as.bin->op != BIN_ADD && node->as.bin->op != BIN_SUB) return false;
+    *rest = node->as.bin->left;
+    int32_t const value = constant_value(node->as.bin->right);
+    *addend = node->as.bin->op == BIN_ADD ? value : wrap(-(uint32_t) value);
+    return true;
+}
+
+// Written as x - c when that reads better, it costs the same
+static void set_addend(struct ExpressionNode* node, int32_t addend)
+{
+    bool const subtract = addend < 0 && addend != INT32_MIN;
+    node->as.bin->op = subtract ? BIN_SUB : BIN_ADD;
+    make_constant(node->as.bin->right, subtract ? -addend : addend);
+}
+
+static void simplify_binary(struct ExpressionNode* node)
+{
+    struct BinaryExpression* bin = node->as.bin;
+    int32_t folded;
+    if (is_constant(bin->left) && is_constant(bin->right)
+        && fold_binary(bin->op, constant_value(bin->left), constant_value(bin->right), &folded))
+    {
+        make_constant(node, folded);
+        return;
+    }
+
+    // Short circuits with one constant side, the other one has no side effects
+    if (bin->op == BIN_LOGICAL_AND || bin->op == BIN_LOGICAL_OR)
+    {
+        bool const constant_left = is_constant(bin->left);
+        struct ExpressionNode* constant = constant_left ? bin->left : bin->right;
+        if (!is_constant(constant)) return;
+        // Decides the result: 0 && x, x && 0, 1 || x, x || 1
+        if ((constant_value(constant) != 0) == (bin->op == BIN_LOGICAL_OR))
+        {
+            make_constant(node, bin->op == BIN_LOGICAL_OR);
+            return;
+        }
+        // Does not matter: the result is x as a truth value, no jumps needed
+        bin->op = BIN_NOT_EQ;
+        if (constant_left)
+        {
+            bin->left = bin->right;
+            bin->right = constant;
+        }
+        make_constant(constant, 0);
+        if (is_truth_value(bin->left)) *node = *bin->left;
+        return;
+    }
+
+    if (is_constant(bin->left) && !is_constant(bin->right) && is_commutative(bin->op))
+    {
+        struct ExpressionNode* constant = bin->left;
+        bin->left = bin->right;
+        bin->right = constant;
+    }
+    if (!is_constant(bin->right)) return;
+    int32_t const value = constant_value(bin->right);
+    enum BinaryOp inverted;
+
+    // x + c - d + e... collapse into one addend
+    struct ExpressionNode* rest;
+    int32_t addend;
+    if (split_addend(node, &rest, &addend))
+    {
+        int32_t inner_addend;
+        struct ExpressionNode* inner_rest;
+        if (split_addend(rest, &inner_rest, &inner_addend))
+        {
+            bin->left = inner_rest;
+            addend = wrap((uint32_t) addend + (uint32_t) inner_addend);
+        }
+        if (addend == 0) *node = *bin->left;
+        else set_addend(node, addend);
+        return;
+    }
+    if (is_reassociable(bin->op) && bin->left->type == EXPR_BIN && bin->left->as.bin->op == bin->op
+        && is_constant(bin->left->as.bin->right))
+    {
+        fold_binary(bin->op, constant_value(bin->left->as.bin->right), value, &folded);
+        make_constant(bin->right, folded);
+        bin->left = bin->left->as.bin->left;
+        // The combined constant may be an identity now
+        simplify_binary(node);
+        return;
+    }
+
+    switch (bin->op)
+    {
+        case BIN_MUL:
+            if (value == 1) *node = *bin->left;
+            else if (value == 0) make_constant(node, 0);
+            break;
+        case BIN_DIV:
+            if (value == 1) *node = *bin->left;
+            break;
+        case BIN_REM:
+            if (value == 1 || value == -1) make_constant(node, 0);
+            break;
+        case BIN_LSHIFT:
+        case BIN_RSHIFT:
+        case BIN_BIT_XOR:
+            if (value == 0) *node = *bin->left;
+            break;
+        case BIN_BIT_AND:
+            if (value == -1) *node = *bin->left;
+            else if (value == 0) make_constant(node, 0);
+            break;
+        case BIN_BIT_OR:
+            if (value == 0) *node = *bin->left;
+            else if (value == -1) make_constant(node, -1);
+            break;
+        case BIN_NOT_EQ:
+            // (a < b) != 0 -> a < b
+            if (value == 0 && is_truth_value(bin->left)) *node = *bin->left;
+            break;
+        case BIN_EQ:
+            // (a < b) == 0 -> a >= b
+            if (value == 0 && bin->left->type == EXPR_BIN && invert_comparison(bin->left->as.bin->op, &inverted))
+            {
+                bin->left->as.bin->op = inverted;
+                *node = *bin->left;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void simplify_unary(struct ExpressionNode* node)
+{
+    struct UnaryExpression* unary = node->as.unary;
+    struct ExpressionNode* operand = unary->operand;
+    if (is_constant(operand))
+    {
+        int32_t const value = constant_value(operand);
+        switch (unary->op)
+        {
+            case UNARY_PLUS: make_constant(node, value); break;
+            case UNARY_MINUS: make_constant(node, wrap(-(uint32_t) value)); break;
+            case UNARY_NOT: make_constant(node, !value); break;
+            case UNARY_BIT_NOT: make_constant(node, ~value); break;
+        }
+        return;
+    }
+    enum BinaryOp inverted;
+    if (unary->op == UNARY_PLUS)
+    {
+        *node = *operand;
+    }
+    else if ((unary->op == UNARY_MINUS || unary->op == UNARY_BIT_NOT)
+        && operand->type == EXPR_UNARY && operand->as.unary->op == unary->op)
+    {
+        *node = *operand->as.unary->operand;
+    }
+    else if (unary->op == UNARY_NOT && operand->type == EXPR_BIN && invert_comparison(operand->as.bin->op, &inverted))
+    {
+        operand->as.bin->op = inverted;
+        *node = *operand;
+    }
+}
+
+static void simplify_conditional(struct ExpressionNode* node)
+{
+    struct ConditionalExpression* conditional = node->as.conditional;
+    if (!is_constant(conditional->condition)) return;
+    *node = constant_value(conditional->condition) != 0 ? *conditional->if_true : *conditional->if_false;
+}
+
+// Same iterative post-order walk as flattening, a node is simplified after its
+// children. Returns the number of nodes visited.
+static size_t optimize_expression(struct ExpressionNode* root, struct OptimizeStack* stack)
+{
+    size_t visited = 0;
+    push_optimize_frame(stack, &(struct OptimizeFrame) {root, false});
+    while (stack->size != 0)
+    {
+        struct OptimizeFrame frame = stack->data[--stack->size];
+        struct ExpressionNode* node = frame.node;
+        if (!frame.children_done) ++visited;
+        switch (node->type)
+        {
+            case EXPR_CONSTANT:
+            case EXPR_VARIABLE:
+                break;
+            case EXPR_BIN:
+                if (!frame.children_done)
+                {
+                    push_optimize_frame(stack, &(struct OptimizeFrame) {node, true});
+                    push_optimize_frame(stack, &(struct OptimizeFrame) {node->as.bin->right, false});
+                    push_optimize_frame(stack, &(struct OptimizeFrame) {node->as.bin->left, false});
+                    continue;
+                }
+                simplify_binary(node);
+                break;
+            case EXPR_UNARY:
+                if (!frame.children_done)
+                {
+                    push_optimize_frame(stack, &(struct OptimizeFrame) {node, true});
+                    push_optimize_frame(stack, &(struct OptimizeFrame) {node->as.unary->operand, false});
+                    continue;
+                }
+                simplify_unary(node);
+                break;
+            case EXPR_CONDITIONAL:
+                if (!frame.children_done)
+                {
+                    push_optimize_frame(stack, &(struct OptimizeFrame) {node, true});
+                    push_optimize_frame(stack, &(struct OptimizeFrame) {node->as.conditional->if_false, false});
+                    push_optimize_frame(stack, &(struct OptimizeFrame) {node->as.conditional->if_true, false});
+                    push_optimize_frame(stack, &(struct OptimizeFrame) {node->as.conditional->condition, false});
+                    continue;
+                }
+                simplify_conditional(node);
+                break;
+        }
+    }
+    return visited;
+}
+
+static size_t count_nodes(struct ExpressionNode* root, struct OptimizeStack* stack)
+{
+    size_t count = 0;
+    push_optimize_frame(stack, &(struct OptimizeFrame) {root, false});
+    while (stack->size != 0)
+    {
+        struct ExpressionNode* node = stack->data[--stack->size].node;
+        ++count;
+        switch (node->type)
+        {
+            case EXPR_CONSTANT:
+            case EXPR_VARIABLE:
+                break;
+            case EXPR_BIN:
+                push_optimize_frame(stack, &(struct OptimizeFrame) {node->as.bin->right, false});
+                push_optimize_frame(stack, &(struct OptimizeFrame) {node->as.bin->left, false});
+                break;
+            case EXPR_UNARY:
+                push_optimize_frame(stack, &(struct OptimizeFrame) {node->as.unary->operand, false});
+                break;
+            case EXPR_CONDITIONAL:
+                push_optimize_frame(stack, &(struct OptimizeFrame) {node->as.conditional->if_false, false});
+                push_optimize_frame(stack, &(struct OptimizeFrame) {node->as.conditional->if_true, false});
+                push_optimize_frame(stack, &(struct OptimizeFrame) {node->as.conditional->condition, false});
+                break;
+        }
+    }
+    return count;
+}
+
+static struct ExpressionNode* statement_expression(struct StatementAst* statement)
+{
+    switch (statement->tag)
+    {
+        case TAG_DEFINITION:
+            return statement->as.definition.has_inital_value ? statement->as.definition.value : NULL;
+        case TAG_ASSIGMENT: return statement->as.assignement.value;
+        case TAG_RETURN: return statement->as.ret.value;
+    }
+    return NULL;
+}
+
+struct OptimizationStats optimize_function(struct FunctionAst* function)
+{
+    struct OptimizationStats stats = {0};
+    struct OptimizeStack stack = new_optimize_stack();
+    for (size_t idx = 0; idx < function->statement_count; ++idx)
+    {
+        struct ExpressionNode* root = statement_expression(function->statements[idx]);
+        if (root == NULL) continue;
+        size_t const before = optimize_expression(root, &stack);
+        stats.expression_nodes += before;
+        stats.eliminated_nodes += before - count_nodes(root, &stack);
+    }
+    free(stack.data);
+    return stats;
+}
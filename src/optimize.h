@@ -0,0 +1,19 @@
+#pragma once
+#include <stddef.h>
+#include "frontend.h"
+
+// AST level simplification, run on every function before it is flattened:
+// - constant subtrees are folded
+// - algebraic identities: x + 0, x * 1, x * 0, x & -1, x | 0, x << 0, ...
+// - constant chains are reassociated: (x + 1) + 2 -> x + 3, (x * 2) * 3 -> x * 6
+// - constants go to the right of commutative operators, so 1 + x + 2 folds too
+// Arithmetic wraps like the 32 bit int the backend computes in. Expressions
+// have no side effects, but anything that may trap (division by zero,
+// INT_MIN / -1) or has no defined value (oversized shifts) is left for run time.
+struct OptimizationStats
+{
+    size_t expression_nodes; // Before the pass
+    size_t eliminated_nodes;
+};
+
+struct OptimizationStats optimize_function(struct FunctionAst* function);
@@ -0,0 +1,142 @@
+#include <string.h>
+#include "peephole.h"
+
+static bool is_jump(enum BytecodeOp op)
+{
+    return op == JMP || op == JZ || op == JNZ;
+}
+
+static bool is_superinstruction(enum BytecodeOp op)
+{
+    return op == ADD_IMM || op == LOAD_ADD || op == STORE_KEEP;
+}
+
+static size_t instruction_width(enum BytecodeOp op)
+{
+    return is_op_double_width(op) ? 2 : 1;
+}
+
+struct Rewrite
+{
+    union Bytecode* tape;
+    size_t size;
+    size_t last; // Start of the last instruction written, SIZE_MAX if none
+};
+
+static void emit(struct Rewrite* rewrite, enum BytecodeOp op, int32_t operand)
+{
+    rewrite->last = rewrite->size;
+    rewrite->tape[rewrite->size++].op = op;
+    if (is_op_double_width(op)) rewrite->tape[rewrite->size++].value = operand;
+}
+
+// `mergeable`: nothing jumps between the previous instruction and this one
+static void emit_add_immediate(struct Rewrite* rewrite, int32_t addend, bool mergeable)
+{
+    if (mergeable && rewrite->last != SIZE_MAX && rewrite->tape[rewrite->last].op == ADD_IMM)
+    {
+        // Wraps like the ADDs it replaces
+        uint32_t const sum = (uint32_t) rewrite->tape[rewrite->last + 1].value + (uint32_t) addend;
+        rewrite->tape[rewrite->last + 1].value = (int32_t) sum;
+        if (sum == 0)
+        {
+            // The previous ADD_IMM may be a jump target, its position then
+            // holds whatever comes next, which is what that jump should reach
+            rewrite->size = rewrite->last;
+            rewrite->last = SIZE_MAX;
+        }
+        return;
+    }
+    if (addend != 0) emit(rewrite, ADD_IMM, addend);
+}
+
+static size_t count_instructions(struct Tape const* tape, size_t* superinstructions)
+{
+    size_t count = 0;
+    for (size_t idx = 0; idx < tape->size; idx += instruction_width(tape->data[idx].op))
+    {
+        if (superinstructions != NULL) *superinstructions += is_superinstruction(tape->data[idx].op);
+        ++count;
+    }
+    return count;
+}
+
+// One pass over the tape, returns false if nothing changed
+static bool rewrite_tape(struct Tape* tape)
+{
+    size_t const size = tape->size;
+    union Bytecode const* code = tape->data;
+    // Indexed by tape position, the end of the tape can be a target too
+    bool* targets = cc_malloc(size + 1);
+    uint32_t* moved = cc_malloc((size + 1) * sizeof(uint32_t));
+    for (size_t idx = 0; idx < size; idx += instruction_width(code[idx].op))
+    {
+        if (is_jump(code[idx].op)) targets[code[idx + 1].value] = true;
+    }
+
+    // Fusing never makes the tape longer
+    struct Rewrite rewrite = {.tape = cc_malloc((size + 1) * sizeof(union Bytecode)), .last = SIZE_MAX};
+    for (size_t idx = 0; idx < size;)
+    {
+        moved[idx] = rewrite.size;
+        enum BytecodeOp const op = code[idx].op;
+        int32_t const operand = is_op_double_width(op) ? code[idx + 1].value : 0;
+        size_t const next = idx + instruction_width(op);
+        if (next < size && !targets[next])
+        {
+            enum BytecodeOp const next_op = code[next].op;
+            bool const same_variable = is_op_double_width(next_op) && code[next + 1].value == operand;
+            size_t const after = next + instruction_width(next_op);
+            if (op == STORE && next_op == LOAD && same_variable)
+            {
+                emit(&rewrite, STORE_KEEP, operand);
+                idx = after;
+                continue;
+            }
+            if (op == LOAD && next_op == STORE && same_variable)
+            {
+                // A jump to the removed pair lands after the last instruction, keep that one as it is
+                rewrite.last = SIZE_MAX;
+                idx = after;
+                continue;
+            }
+            if (op == PUSH && (next_op == ADD || next_op == SUB))
+            {
+                int32_t const addend = next_op == ADD ? operand : (int32_t) -(uint32_t) operand;
+                emit_add_immediate(&rewrite, addend, !targets[idx]);
+                idx = after;
+                continue;
+            }
+            if (op == LOAD && next_op == ADD)
+            {
+                emit(&rewrite, LOAD_ADD, operand);
+                idx = after;
+                continue;
+            }
+        }
+        emit(&rewrite, op, operand);
+        idx = next;
+    }
+    moved[size] = rewrite.size;
+
+    for (size_t idx = 0; idx < rewrite.size; idx += instruction_width(rewrite.tape[idx].op))
+    {
+        if (is_jump(rewrite.tape[idx].op)) rewrite.tape[idx + 1].value = moved[rewrite.tape[idx + 1].value];
+    }
+    free(targets);
+    free(moved);
+    bool const changed = rewrite.size != size || memcmp(rewrite.tape, code, size * sizeof(union Bytecode)) != 0;
+    free(tape->data);
+    *tape = (struct Tape) {.data = rewrite.tape, .size = rewrite.size, .max_capacity = size + 1};
+    return changed;
+}
+
+struct PeepholeStats peephole_optimize(struct Tape* tape)
+{
+    struct PeepholeStats stats = {.words_before = tape->size, .instructions_before = count_instructions(tape, NULL)};
+    // Removing a pair makes its neighbours adjacent, which may allow more
+    while (rewrite_tape(tape)) {}
+    stats.words_after = tape->size;
+    stats.instructions_after = count_instructions(tape, &stats.superinstructions);
+    return stats;
+}
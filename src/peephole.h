@@ -0,0 +1,22 @@
+#pragma once
+#include <stddef.h>
+#include "bytecode.h"
+
+// Rewrites a finished tape with a window of two instructions:
+//   STORE x; LOAD x  -> STORE_KEEP x
+//   LOAD x; STORE x  -> (nothing)
+//   PUSH c; ADD      -> ADD_IMM c (and PUSH c; SUB -> ADD_IMM -c)
+//   ADD_IMM c; ADD_IMM d -> ADD_IMM c + d, ADD_IMM 0 -> (nothing)
+//   LOAD x; ADD      -> LOAD_ADD x
+// Pairs that a jump lands in the middle of are left alone, jump targets are
+// moved to the new positions.
+struct PeepholeStats
+{
+    size_t words_before; // Tape size, operands included
+    size_t words_after;
+    size_t instructions_before;
+    size_t instructions_after;
+    size_t superinstructions; // In the new tape
+};
+
+struct PeepholeStats peephole_optimize(struct Tape* tape);
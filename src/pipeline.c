@@ -0,0 +1,194 @@
+#include <string.h>
+#include "baseline.h"
+#include "pipeline.h"
+#include "encode.h"
+#include "x86.h"
+
+struct UnitJob
+{
+    struct TranslationUnitAst* ast;
+    struct CompiledUnit* unit;
+    struct UnitOptions const* options;
+    // Per function, summed up at the end
+    struct OptimizationStats* optimization;
+    struct PeepholeStats* peephole;
+};
+
+static void compile_function_task(void* context, size_t idx)
+{
+    struct UnitJob* job = context;
+    struct UnitOptions const* options = job->options;
+    struct FunctionAst* function = job->ast->functions[idx];
+    if (options->incremental != NULL
+        && reuse_function(options->incremental, idx, function->name, &job->unit->code[idx], &job->unit->assembly[idx]))
+    {
+        // Only wanted for printing
+        if (options->keep_flat) job->unit->flat[idx] = flatten_function(function);
+        return;
+    }
+    if (options->optimize) job->optimization[idx] = optimize_function(function);
+    // In the unit right away, so that it is released after a compile_error
+    job->unit->flat[idx] = flatten_function(function);
+    job->unit->code[idx] = compile_to_vm(&job->unit->flat[idx]);
+    if (options->optimize)
+    {
+        if (options->keep_raw_tapes)
+        {
+            struct Tape const* tape = &job->unit->code[idx].tape;
+            job->unit->raw_tapes[idx] = (struct Tape) {
+                .data = cc_malloc((tape->size + 1) * sizeof(union Bytecode)),
+                .size = tape->size,
+                .max_capacity = tape->size + 1
+            };
+            memcpy(job->unit->raw_tapes[idx].data, tape->data, tape->size * sizeof(union Bytecode));
+        }
+        job->peephole[idx] = peephole_optimize(&job->unit->code[idx].tape);
+    }
+    if (options->baseline)
+    {
+        char* error = baseline_compile(&job->unit->code[idx], &job->unit->machine_code[idx]);
+        if (error != NULL)
+        {
+            struct ErrorCleanup cleanup = {.release = free, .context = error};
+            push_error_cleanup(&cleanup);
+            compile_error("%s", error);
+        }
+    }
+    else if (options->backend)
+    {
+        struct MachineFunction machine = codegen_function(&job->unit->code[idx]);
+        job->unit->allocation[idx] = machine.allocation;
+        if (options->object_code) job->unit->machine_code[idx] = encode_function(&machine);
+        else job->unit->assembly[idx] = print_machine_function(&machine);
+        free_machine_function(&machine);
+    }
+    if (!options->keep_flat) free_flat_function(&job->unit->flat[idx]);
+}
+
+// What compile_unit has built so far, when a compile_error stops it
+static void release_unit_job(void* context)
+{
+    struct UnitJob* job = context;
+    free_compiled_unit(job->unit);
+    free(job->optimization);
+    free(job->peephole);
+}
+
+struct CompiledUnit compile_unit(struct TranslationUnitAst* ast, struct ThreadPool* pool, struct UnitOptions const* options)
+{
+    // Persisted state only holds assembly
+    assert(!options->object_code || options->incremental == NULL);
+    assert(options->backend || (!options->object_code && options->incremental == NULL));
+    assert(!options->baseline || options->object_code);
+    size_t const count = ast->function_count;
+    struct CompiledUnit unit = {
+        .function_count = count,
+        .flat = cc_malloc(count * sizeof(struct FlatFunction)),
+        .code = cc_malloc(count * sizeof(struct VirtualMachineCode)),
+        .assembly = cc_malloc(count * sizeof(struct StringArray)),
+        .allocation = cc_malloc(count * sizeof(struct AllocationStats)),
+        .machine_code = cc_malloc(count * sizeof(struct EncodedFunction)),
+        .raw_tapes = cc_malloc(count * sizeof(struct Tape))
+    };
+    struct UnitJob job = {
+        .ast = ast,
+        .unit = &unit,
+        .options = options,
+        .optimization = cc_malloc(count * sizeof(struct OptimizationStats)),
+        .peephole = cc_malloc(count * sizeof(struct PeepholeStats))
+    };
+    struct ErrorCleanup cleanup = {.release = release_unit_job, .context = &job};
+    push_error_cleanup(&cleanup);
+    if (pool == NULL)
+    {
+        for (size_t idx = 0; idx < count; ++idx) compile_function_task(&job, idx);
+    }
+    else
+    {
+        thread_pool_for(pool, count, compile_function_task, &job);
+    }
+    pop_error_cleanup(&cleanup);
+    for (size_t idx = 0; idx < count; ++idx)
+    {
+        unit.optimization.expression_nodes += job.optimization[idx].expression_nodes;
+        unit.optimization.eliminated_nodes += job.optimization[idx].eliminated_nodes;
+        unit.peephole.words_before += job.peephole[idx].words_before;
+        unit.peephole.words_after += job.peephole[idx].words_after;
+        unit.peephole.instructions_before += job.peephole[idx].instructions_before;
+        unit.peephole.instructions_after += job.peephole[idx].instructions_after;
+        unit.peephole.superinstructions += job.peephole[idx].superinstructions;
+    }
+    free(job.optimization);
+    free(job.peephole);
+    return unit;
+}
+
+void free_compiled_unit(struct CompiledUnit* unit)
+{
+    for (size_t idx = 0; idx < unit->function_count; ++idx)
+    {
+        free_flat_function(&unit->flat[idx]);
+        free_vm_code(&unit->code[idx]);
+        free_string_array(&unit->assembly[idx]);
+        free_encoded_function(&unit->machine_code[idx]);
+        free(unit->raw_tapes[idx].data);
+    }
+    free(unit->raw_tapes);
+    free(unit->flat);
+    free(unit->code);
+    free(unit->assembly);
+    free(unit->allocation);
+    free(unit->machine_code);
+    *unit = (struct CompiledUnit) {0};
+}
+
+char const* unit_configuration(bool optimize)
+{
+    return optimize ? "x86-64 nasm linear-scan -O" : "x86-64 nasm linear-scan";
+}
+
+void compile_file(void* context)
+{
+    struct FileCompilation* file = context;
+    struct CacheKey key;
+    if (file->cache != NULL)
+    {
+        // The key needs all the bytes up front, so no lexing while reading here
+        read_input(file->path, &file->input);
+        file->bytes = file->input.size;
+        key = cache_key(unit_configuration(file->optimize), file->input.data, file->input.size);
+        file->assembly = new_string_array();
+        if (cache_load(file->cache, &key, &file->assembly, &file->functions))
+        {
+            file->cached = true;
+            close_input(&file->input);
+            return;
+        }
+        free_string_array(&file->assembly);
+        file->tokens = begin_tokenize(file->input.data, file->input.size);
+        tokenize_range(&file->tokens, 0, file->input.size);
+    }
+    else
+    {
+        tokenize_input(file->path, &file->input, &file->tokens);
+        file->bytes = file->input.size;
+    }
+    struct TranslationUnitAst* ast = parse(&file->tokens, &file->arena);
+    free_token_stream(&file->tokens);
+    close_input(&file->input);
+
+    struct CompiledUnit unit = compile_unit(ast, NULL, &(struct UnitOptions) {.optimize = file->optimize, .backend = true});
+    file->functions = unit.function_count;
+    arena_release(&file->arena);
+    file->assembly = codegen(unit.assembly, unit.function_count);
+    free_compiled_unit(&unit);
+    if (file->cache != NULL) cache_store(file->cache, &key, &file->assembly, file->functions);
+}
+
+void release_file_compilation(struct FileCompilation* file)
+{
+    free_token_stream(&file->tokens);
+    close_input(&file->input);
+    arena_release(&file->arena);
+    if (file->assembly.data != NULL) free_string_array(&file->assembly);
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <stdbool.h>
+#include "bytecode.h"
+#include "cache.h"
+#include "encode.h"
+#include "flat_ast.h"
+#include "frontend.h"
+#include "incremental.h"
+#include "input.h"
+#include "optimize.h"
+#include "peephole.h"
+#include "regalloc.h"
+#include "thread_pool.h"
+
+// Backend results of a translation unit, indexed by function in source order
+struct CompiledUnit
+{
+    size_t function_count;
+    struct FlatFunction* flat; // Only kept if asked for (--flat-ast), empty otherwise
+    struct VirtualMachineCode* code;
+    struct StringArray* assembly; // Only with UnitOptions.backend and without object_code, empty otherwise
+    struct EncodedFunction* machine_code; // Only with UnitOptions.object_code, empty otherwise
+    struct AllocationStats* allocation; // Zero without the backend and for reused functions (--incremental)
+    struct Tape* raw_tapes; // Before the peephole pass, only kept if asked for, empty otherwise
+    // Summed over the functions
+    struct OptimizationStats optimization;
+    struct PeepholeStats peephole;
+};
+
+// Stages of compile_unit besides the plain pipeline
+struct UnitOptions
+{
+    bool keep_flat; // For printing (--flat-ast)
+    bool optimize; // AST simplification and the peephole pass (-O)
+    bool keep_raw_tapes; // For printing (--dump-peephole)
+    bool backend; // x86 code of every function, otherwise compile_unit stops at the tapes
+    bool object_code; // Machine code instead of assembly (-c), needs `backend`, not with `incremental`
+    bool baseline; // That machine code from the copy-and-patch tier (--baseline)
+    struct IncrementalState* incremental; // Optional, unchanged functions are taken from it, needs `backend`
+};
+
+// Runs optimization, flattening, bytecode generation, the peephole pass and
+// (with UnitOptions.backend) x86 emission of every function on the pool (or inline if it is NULL). Functions
+// are independent, each one is only touched by its own task.
+struct CompiledUnit compile_unit(struct TranslationUnitAst* ast, struct ThreadPool* pool, struct UnitOptions const* options);
+void free_compiled_unit(struct CompiledUnit* unit);
+// Describes the options that change the produced code, for persisted results
+char const* unit_configuration(bool optimize);
+
+// Whole pipeline for one source file, its functions compiled on the calling
+// thread. Fill in `path`, run compile_file (directly or through run_guarded),
+// then release_file_compilation, which also cleans up after an error.
+// With a cache, identical sources skip the whole pipeline.
+struct FileCompilation
+{
+    char const* path;
+    struct CompileCache* cache; // Optional
+    bool optimize;
+    struct StringArray assembly; // Result
+    bool cached; // Assembly came from the cache
+    size_t bytes;
+    size_t functions;
+    // Owned while compiling
+    struct SourceInput input;
+    struct TokenStream tokens;
+    struct Arena arena;
+};
+
+void compile_file(void* compilation);
+void release_file_compilation(struct FileCompilation* compilation);
@@ -0,0 +1,350 @@
+#include <string.h>
+#include "regalloc.h"
+
+// Positions where every value is read, sorted, value `v` has
+// positions[offsets[v]] up to positions[offsets[v + 1]]
+struct UseLists
+{
+    uint32_t* offsets;
+    uint32_t* positions;
+};
+
+// Whether `value` needs operand `operand` in its location
+static bool reads_operand(struct AllocationHints const* hints, uint32_t value, size_t operand)
+{
+    return hints == NULL || !((hints->inline_operands[value] >> operand) & 1);
+}
+
+// Whether a phi operand or a return value is read from its location
+static bool reads_value(struct SsaFunction const* function, struct AllocationHints const* hints, uint32_t value)
+{
+    return hints == NULL || !hints->inline_constants || function->instructions.data[value].op != SSA_CONST;
+}
+
+static bool reads_terminator_value(struct SsaFunction const* function, struct AllocationHints const* hints,
+    struct SsaBlock const* block)
+{
+    if (block->value == SSA_NONE) return false;
+    return block->terminator != SSA_RETURN || reads_value(function, hints, block->value);
+}
+
+static void number_positions(struct SsaFunction const* function, struct AllocationHints const* hints,
+    struct Allocation* allocation)
+{
+    uint32_t position = 0;
+    for (size_t block = 0; block < function->blocks.size; ++block)
+    {
+        struct SsaBlock const* current = &function->blocks.data[block];
+        allocation->block_starts[block] = position;
+        position += 2;
+        for (uint32_t value = current->first_instruction; value < current->first_instruction + current->instruction_count; ++value)
+        {
+            if (function->instructions.data[value].op == SSA_PHI)
+            {
+                allocation->positions[value] = allocation->block_starts[block];
+                continue;
+            }
+            allocation->positions[value] = position;
+            position += 2;
+        }
+        allocation->block_ends[block] = position;
+        position += 2;
+    }
+    for (size_t value = 0; hints != NULL && value < function->instructions.size; ++value)
+    {
+        if (hints->roots[value] != SSA_NONE) allocation->positions[value] = allocation->positions[hints->roots[value]];
+    }
+}
+
+// Calls visit(uses, value, position) for every read of a value from its location
+#define FOR_EACH_USE(function, hints, allocation, visit, uses) \
+    for (size_t block = 0; block < (function)->blocks.size; ++block) \
+    { \
+        struct SsaBlock const* current = &(function)->blocks.data[block]; \
+        for (uint32_t value = current->first_instruction; value < current->first_instruction + current->instruction_count; ++value) \
+        { \
+            struct SsaInstruction const* instruction = &(function)->instructions.data[value]; \
+            for (size_t operand = 0; operand < ssa_operand_count(instruction->op); ++operand) \
+            { \
+                if (!reads_operand(hints, value, operand)) continue; \
+                visit(uses, instruction->operands[operand], (allocation)->positions[value]); \
+            } \
+            for (size_t edge = 0; instruction->op == SSA_PHI && edge < current->predecessor_count; ++edge) \
+            { \
+                uint32_t const predecessor = (function)->predecessors.data[current->first_predecessor + edge]; \
+                uint32_t const source = (function)->phi_operands.data[instruction->constant + edge]; \
+                if (reads_value(function, hints, source)) visit(uses, source, (allocation)->block_ends[predecessor]); \
+            } \
+        } \
+        if (reads_terminator_value(function, hints, current)) visit(uses, current->value, (allocation)->block_ends[block]); \
+    }
+
+#define COUNT_USE(uses, value, position) ((void) (position), ++(uses)->offsets[(value) + 1])
+#define ADD_USE(uses, value, position) (uses)->positions[(uses)->offsets[(value)]++] = (position)
+
+static struct UseLists collect_uses(struct SsaFunction const* function, struct AllocationHints const* hints,
+    struct Allocation const* allocation)
+{
+    size_t const count = function->instructions.size;
+    struct UseLists uses = {.offsets = cc_malloc((count + 1) * sizeof(uint32_t))};
+    FOR_EACH_USE(function, hints, allocation, COUNT_USE, &uses);
+    for (size_t value = 0; value < count; ++value) uses.offsets[value + 1] += uses.offsets[value];
+    uses.positions = cc_malloc((uses.offsets[count] + 1) * sizeof(uint32_t));
+    // Filling moves every offset to the start of the next list
+    FOR_EACH_USE(function, hints, allocation, ADD_USE, &uses);
+    memmove(&uses.offsets[1], uses.offsets, count * sizeof(uint32_t));
+    uses.offsets[0] = 0;
+    // Reads through back edges come out of order
+    for (size_t value = 0; value < count; ++value)
+    {
+        uint32_t* list = &uses.positions[uses.offsets[value]];
+        size_t const length = uses.offsets[value + 1] - uses.offsets[value];
+        for (size_t idx = 1; idx < length; ++idx)
+        {
+            uint32_t const position = list[idx];
+            size_t insert = idx;
+            for (; insert > 0 && list[insert - 1] > position; --insert) list[insert] = list[insert - 1];
+            list[insert] = position;
+        }
+    }
+    return uses;
+}
+
+#undef COUNT_USE
+#undef ADD_USE
+#undef FOR_EACH_USE
+
+// A value that is live at the start of a block
+struct LiveIn
+{
+    uint32_t block;
+    uint32_t value;
+};
+
+DEFINE_NEW_DYN_ARRAY(LiveIns, struct LiveIn, new_live_ins, push_live_in);
+IMPLEMENT_NEW_DYN_ARRAY(LiveIns, struct LiveIn, new_live_ins, push_live_in);
+
+// Block holding a linear position, positions grow from block to block
+static uint32_t block_at(struct Allocation const* allocation, size_t block_count, uint32_t position)
+{
+    size_t low = 0;
+    size_t high = block_count;
+    while (high - low > 1)
+    {
+        size_t const middle = low + (high - low) / 2;
+        if (allocation->block_starts[middle] <= position) low = middle;
+        else high = middle;
+    }
+    return low;
+}
+
+// From every read of a value, walks the predecessors backwards up to its
+// definition, so the work and memory grow with the live sets rather than
+// with blocks * values as data flow over bit sets does. Stretches `ends` over
+// the blocks a value is live out of.
+static void compute_liveness(struct SsaFunction const* function, struct UseLists const* uses,
+    struct Allocation* allocation, uint32_t* ends)
+{
+    size_t const count = function->instructions.size;
+    size_t const block_count = function->blocks.size;
+    // Per block, the last value found live at its start
+    uint32_t* visited = cc_malloc((block_count + 1) * sizeof(uint32_t));
+    memset(visited, 0xFF, block_count * sizeof(uint32_t));
+    uint32_t* worklist = cc_malloc((block_count + 1) * sizeof(uint32_t));
+    struct LiveIns live = new_live_ins();
+    uint32_t definition = 0;
+    for (uint32_t value = 0; value < count; ++value)
+    {
+        struct SsaBlock const* blocks = function->blocks.data;
+        while (blocks[definition].first_instruction + blocks[definition].instruction_count <= value) ++definition;
+        size_t pending = 0;
+        for (uint32_t idx = uses->offsets[value]; idx < uses->offsets[value + 1]; ++idx)
+        {
+            uint32_t const block = block_at(allocation, block_count, uses->positions[idx]);
+            if (block == definition || visited[block] == value) continue;
+            visited[block] = value;
+            worklist[pending++] = block;
+        }
+        while (pending != 0)
+        {
+            uint32_t const block = worklist[--pending];
+            push_live_in(&live, &(struct LiveIn) {block, value});
+            for (size_t edge = 0; edge < blocks[block].predecessor_count; ++edge)
+            {
+                uint32_t const predecessor = function->predecessors.data[blocks[block].first_predecessor + edge];
+                if (ends[value] < allocation->block_ends[predecessor]) ends[value] = allocation->block_ends[predecessor];
+                if (predecessor == definition || visited[predecessor] == value) continue;
+                visited[predecessor] = value;
+                worklist[pending++] = predecessor;
+            }
+        }
+    }
+
+    // Grouped by block, values stay in ascending order
+    uint32_t* offsets = cc_malloc((block_count + 1) * sizeof(uint32_t));
+    for (size_t idx = 0; idx < live.size; ++idx) ++offsets[live.data[idx].block + 1];
+    for (size_t block = 0; block < block_count; ++block) offsets[block + 1] += offsets[block];
+    allocation->live_in = cc_malloc((live.size + 1) * sizeof(uint32_t));
+    // Filling moves every offset to the start of the next block
+    for (size_t idx = 0; idx < live.size; ++idx) allocation->live_in[offsets[live.data[idx].block]++] = live.data[idx].value;
+    memmove(&offsets[1], offsets, block_count * sizeof(uint32_t));
+    offsets[0] = 0;
+    allocation->live_in_offsets = offsets;
+    free(live.data);
+    free(worklist);
+    free(visited);
+}
+
+// First read of `value` at or after `position`, UINT32_MAX if there is none
+static uint32_t next_use(struct UseLists const* uses, uint32_t value, uint32_t position)
+{
+    for (uint32_t idx = uses->offsets[value]; idx < uses->offsets[value + 1]; ++idx)
+    {
+        if (uses->positions[idx] >= position) return uses->positions[idx];
+    }
+    return UINT32_MAX;
+}
+
+static void spill(struct Allocation* allocation, uint32_t value, uint32_t position)
+{
+    allocation->spill_positions[value] = position;
+    allocation->slots[value] = allocation->slot_count++;
+    ++allocation->stats.spilled;
+    if (position <= allocation->positions[value]) allocation->registers[value] = NO_REGISTER;
+    else ++allocation->stats.split;
+}
+
+struct Allocation allocate_registers(struct SsaFunction const* function, struct AllocationHints const* hints,
+    uint8_t const* registers, size_t register_count)
+{
+    size_t const count = function->instructions.size;
+    size_t const block_count = function->blocks.size;
+    struct Allocation allocation = {
+        .block_starts = cc_malloc(block_count * sizeof(uint32_t)),
+        .block_ends = cc_malloc(block_count * sizeof(uint32_t)),
+        .positions = cc_malloc((count + 1) * sizeof(uint32_t)),
+        .registers = cc_malloc(count + 1),
+        .spill_positions = cc_malloc((count + 1) * sizeof(uint32_t)),
+        .slots = cc_malloc((count + 1) * sizeof(uint32_t))
+    };
+    memset(allocation.registers, NO_REGISTER, count);
+    memset(allocation.spill_positions, 0xFF, count * sizeof(uint32_t));
+    memset(allocation.slots, 0xFF, count * sizeof(uint32_t));
+    number_positions(function, hints, &allocation);
+    struct UseLists uses = collect_uses(function, hints, &allocation);
+
+    // Intervals, conservatively one piece from the definition to the last use
+    uint32_t* ends = cc_malloc((count + 1) * sizeof(uint32_t));
+    for (size_t value = 0; value < count; ++value)
+    {
+        ends[value] = allocation.positions[value];
+        if (uses.offsets[value + 1] != uses.offsets[value]) ends[value] = uses.positions[uses.offsets[value + 1] - 1];
+    }
+    compute_liveness(function, &uses, &allocation, ends);
+
+    // Values are numbered in block order with phis first, so they already
+    // are sorted by the start of their interval
+    uint32_t* active = cc_malloc((register_count + 1) * sizeof(uint32_t));
+    size_t active_count = 0;
+    uint32_t free_registers = 0;
+    for (size_t idx = 0; idx < register_count; ++idx) free_registers |= 1u << registers[idx];
+    for (uint32_t value = 0; value < count; ++value)
+    {
+        uint8_t const op = function->instructions.data[value].op;
+        // Division stays for its trap
+        if (uses.offsets[value + 1] == uses.offsets[value] && op != SSA_DIV && op != SSA_REM) continue;
+        ++allocation.stats.values;
+        uint32_t const start = allocation.positions[value];
+        // An operand that dies here can share its register with the result
+        for (size_t idx = 0; idx < active_count;)
+        {
+            if (ends[active[idx]] > start)
+            {
+                ++idx;
+                continue;
+            }
+            free_registers |= 1u << allocation.registers[active[idx]];
+            active[idx] = active[--active_count];
+        }
+
+        uint8_t chosen = NO_REGISTER;
+        for (size_t idx = 0; idx < register_count && chosen == NO_REGISTER; ++idx)
+        {
+            if (free_registers & (1u << registers[idx])) chosen = registers[idx];
+        }
+        if (chosen != NO_REGISTER)
+        {
+            free_registers &= ~(1u << chosen);
+            allocation.registers[value] = chosen;
+            active[active_count++] = value;
+            continue;
+        }
+
+        // Whoever is needed last goes to memory
+        size_t victim = active_count;
+        uint32_t furthest = next_use(&uses, value, start + 1);
+        for (size_t idx = 0; idx < active_count; ++idx)
+        {
+            uint32_t const use = next_use(&uses, active[idx], start);
+            if (use > furthest)
+            {
+                furthest = use;
+                victim = idx;
+            }
+        }
+        if (victim == active_count)
+        {
+            spill(&allocation, value, start);
+            continue;
+        }
+        allocation.registers[value] = allocation.registers[active[victim]];
+        spill(&allocation, active[victim], start);
+        active[victim] = value;
+    }
+    for (size_t value = 0; value < count; ++value)
+    {
+        if (allocation.registers[value] != NO_REGISTER) allocation.used_registers |= 1u << allocation.registers[value];
+    }
+    allocation.stats.registers = __builtin_popcount(allocation.used_registers);
+    free(active);
+    free(ends);
+    free(uses.offsets);
+    free(uses.positions);
+    return allocation;
+}
+
+void free_allocation(struct Allocation* allocation)
+{
+    free(allocation->block_starts);
+    free(allocation->block_ends);
+    free(allocation->positions);
+    free(allocation->registers);
+    free(allocation->spill_positions);
+    free(allocation->slots);
+    free(allocation->live_in_offsets);
+    free(allocation->live_in);
+    *allocation = (struct Allocation) {0};
+}
+
+uint8_t register_at(struct Allocation const* allocation, uint32_t value, uint32_t position)
+{
+    return position < allocation->spill_positions[value] ? allocation->registers[value] : NO_REGISTER;
+}
+
+bool is_live_in(struct Allocation const* allocation, uint32_t block, uint32_t value)
+{
+    uint32_t low = allocation->live_in_offsets[block];
+    uint32_t high = allocation->live_in_offsets[block + 1];
+    while (low < high)
+    {
+        uint32_t const middle = low + (high - low) / 2;
+        if (allocation->live_in[middle] < value) low = middle + 1;
+        else high = middle;
+    }
+    return low < allocation->live_in_offsets[block + 1] && allocation->live_in[low] == value;
+}
+
+bool needs_location(struct Allocation const* allocation, uint32_t value)
+{
+    return allocation->registers[value] != NO_REGISTER || allocation->slots[value] != SSA_NONE;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "ssa.h"
+
+// Linear scan register allocation (Poletto and Sarkar) over the values of an
+// SSA function. Blocks are laid out in their order and every value gets one
+// interval from its definition to its last use, stretched over the blocks it
+// is live out of, so loops keep their values for the whole loop.
+//
+// When the registers run out, the value whose next use is furthest away is
+// split: it keeps its register up to that point and lives in a stack slot
+// from there on. The slot is written right after the definition, so it is up
+// to date wherever the value is. Values that are spilled before they got a
+// register only ever live in their slot.
+
+#define NO_REGISTER UINT8_MAX
+
+struct AllocationStats
+{
+    size_t values; // That need a location
+    size_t registers; // Different ones used
+    size_t spilled; // Spent some or all of their lifetime in a stack slot
+    size_t split; // Of the spilled ones, started out in a register
+};
+
+struct Allocation
+{
+    // Linear positions: every block has a start (where its phis are defined),
+    // its other instructions and an end (where the terminator reads its operands)
+    uint32_t* block_starts;
+    uint32_t* block_ends;
+    uint32_t* positions; // Per value
+    // Per value, neither a register nor a slot for values nobody needs
+    uint8_t* registers;
+    uint32_t* spill_positions; // From there on the value is in its slot, SSA_NONE if never
+    uint32_t* slots; // SSA_NONE without one
+    size_t slot_count;
+    uint32_t used_registers; // Bit mask
+    // Per block, the sorted values live at its start (phis not included): block
+    // `b` has live_in[live_in_offsets[b]] up to live_in[live_in_offsets[b + 1]]
+    uint32_t* live_in_offsets;
+    uint32_t* live_in;
+    struct AllocationStats stats;
+};
+
+// Reads that instruction selection builds into the instructions, they do not
+// keep a value in a location
+struct AllocationHints
+{
+    // Per value, bit per operand that is an immediate or computed by the same
+    // instruction, rather than read from the operand's location
+    uint8_t const* inline_operands;
+    // Per value, the value whose instruction computes it as part of its own,
+    // or SSA_NONE. Its operands are read at the position of that instruction.
+    uint32_t const* roots;
+    // Constants are moved into phis and return values as immediates
+    bool inline_constants;
+};
+
+// `registers` in order of preference, `hints` may be NULL
+struct Allocation allocate_registers(struct SsaFunction const* function, struct AllocationHints const* hints,
+    uint8_t const* registers, size_t register_count);
+void free_allocation(struct Allocation* allocation);
+// Register holding `value` at `position`, NO_REGISTER if it is in its slot
+uint8_t register_at(struct Allocation const* allocation, uint32_t value, uint32_t position);
+bool is_live_in(struct Allocation const* allocation, uint32_t block, uint32_t value);
+bool needs_location(struct Allocation const* allocation, uint32_t value);
@@ -0,0 +1,181 @@
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_HAS_X86 1
+#else
+#define SCAN_HAS_X86 0
+#endif
+
+static size_t scalar_whitespace(char const* text, size_t position, size_t end)
+{
+    while (position < end && is_whitespace(text[position])) ++position;
+    return position;
+}
+
+static size_t scalar_identifier(char const* text, size_t position, size_t end)
+{
+    while (position < end && is_identifier_char(text[position])) ++position;
+    return position;
+}
+
+static size_t scalar_digits(char const* text, size_t position, size_t end)
+{
+    while (position < end && text[position] >= '0' && text[position] <= '9') ++position;
+    return position;
+}
+
+static size_t scalar_line_end(char const* text, size_t position, size_t end)
+{
+    while (position < end && text[position] != '\n') ++position;
+    return position;
+}
+
+#if SCAN_HAS_X86
+
+// All the class checks boil down to "byte - low <= width" done as an unsigned
+// compare: min(x, width) == x
+
+static inline __m128i sse2_in_range(__m128i chunk, char low, char width)
+{
+    __m128i shifted = _mm_sub_epi8(chunk, _mm_set1_epi8(low));
+    return _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(width)), shifted);
+}
+
+static inline __m128i sse2_whitespace_mask(__m128i chunk)
+{
+    __m128i space = _mm_cmpeq_epi8(chunk, _mm_set1_epi8(' '));
+    return _mm_or_si128(space, sse2_in_range(chunk, '\t', '\r' - '\t'));
+}
+
+static inline __m128i sse2_identifier_mask(__m128i chunk)
+{
+    __m128i lower = _mm_or_si128(chunk, _mm_set1_epi8(0x20));
+    __m128i alpha = sse2_in_range(lower, 'a', 'z' - 'a');
+    __m128i digit = sse2_in_range(chunk, '0', 9);
+    __m128i underscore = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('_'));
+    return _mm_or_si128(_mm_or_si128(alpha, digit), underscore);
+}
+
+static inline __m128i sse2_digit_mask(__m128i chunk)
+{
+    return sse2_in_range(chunk, '0', 9);
+}
+
+static inline __m128i sse2_not_newline_mask(__m128i chunk)
+{
+    __m128i newline = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n'));
+    return _mm_xor_si128(newline, _mm_set1_epi8((char) 0xFF));
+}
+
+#define DEFINE_SSE2_SCANNER(NAME, MASK_FUNC, SCALAR_FUNC) \
+static size_t NAME(char const* text, size_t position, size_t end) \
+{ \
+    while (position + 16 <= end) \
+    { \
+        __m128i chunk = _mm_loadu_si128((__m128i const*) (text + position)); \
+        unsigned stop = (unsigned) _mm_movemask_epi8(MASK_FUNC(chunk)) ^ 0xFFFFu; \
+        if (stop != 0) return position + __builtin_ctz(stop); \
+        position += 16; \
+    } \
+    return SCALAR_FUNC(text, position, end); \
+}
+
+DEFINE_SSE2_SCANNER(sse2_whitespace, sse2_whitespace_mask, scalar_whitespace)
+DEFINE_SSE2_SCANNER(sse2_identifier, sse2_identifier_mask, scalar_identifier)
+DEFINE_SSE2_SCANNER(sse2_digits, sse2_digit_mask, scalar_digits)
+DEFINE_SSE2_SCANNER(sse2_line_end, sse2_not_newline_mask, scalar_line_end)
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256i avx2_in_range(__m256i chunk, char low, char width)
+{
+    __m256i shifted = _mm256_sub_epi8(chunk, _mm256_set1_epi8(low));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(width)), shifted);
+}
+
+AVX2 static inline __m256i avx2_whitespace_mask(__m256i chunk)
+{
+    __m256i space = _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(' '));
+    return _mm256_or_si256(space, avx2_in_range(chunk, '\t', '\r' - '\t'));
+}
+
+AVX2 static inline __m256i avx2_identifier_mask(__m256i chunk)
+{
+    __m256i lower = _mm256_or_si256(chunk, _mm256_set1_epi8(0x20));
+    __m256i alpha = avx2_in_range(lower, 'a', 'z' - 'a');
+    __m256i digit = avx2_in_range(chunk, '0', 9);
+    __m256i underscore = _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('_'));
+    return _mm256_or_si256(_mm256_or_si256(alpha, digit), underscore);
+}
+
+AVX2 static inline __m256i avx2_digit_mask(__m256i chunk)
+{
+    return avx2_in_range(chunk, '0', 9);
+}
+
+AVX2 static inline __m256i avx2_not_newline_mask(__m256i chunk)
+{
+    __m256i newline = _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\n'));
+    return _mm256_xor_si256(newline, _mm256_set1_epi8((char) 0xFF));
+}
+
+// The tail (< 32 bytes) is handed to the SSE2 version, which in turn falls back to scalar.
+// The upper halves have to be cleared before that, the compiler does not do it
+// for the tail call and mixing dirty AVX state with SSE code is very slow.
+#define DEFINE_AVX2_SCANNER(NAME, MASK_FUNC, TAIL_FUNC) \
+AVX2 static size_t NAME(char const* text, size_t position, size_t end) \
+{ \
+    if (position + 32 > end) return TAIL_FUNC(text, position, end); \
+    while (position + 32 <= end) \
+    { \
+        __m256i chunk = _mm256_loadu_si256((__m256i const*) (text + position)); \
+        unsigned stop = ~(unsigned) _mm256_movemask_epi8(MASK_FUNC(chunk)); \
+        if (stop != 0) return position + __builtin_ctz(stop); \
+        position += 32; \
+    } \
+    _mm256_zeroupper(); \
+    return TAIL_FUNC(text, position, end); \
+}
+
+DEFINE_AVX2_SCANNER(avx2_whitespace, avx2_whitespace_mask, sse2_whitespace)
+DEFINE_AVX2_SCANNER(avx2_identifier, avx2_identifier_mask, sse2_identifier)
+DEFINE_AVX2_SCANNER(avx2_digits, avx2_digit_mask, sse2_digits)
+DEFINE_AVX2_SCANNER(avx2_line_end, avx2_not_newline_mask, sse2_line_end)
+
+#endif
+
+static struct Scanner const scanners[] = {
+    [SCAN_SCALAR] = {SCAN_SCALAR, scalar_whitespace, scalar_identifier, scalar_digits, scalar_line_end},
+#if SCAN_HAS_X86
+    [SCAN_SSE2] = {SCAN_SSE2, sse2_whitespace, sse2_identifier, sse2_digits, sse2_line_end},
+    [SCAN_AVX2] = {SCAN_AVX2, avx2_whitespace, avx2_identifier, avx2_digits, avx2_line_end},
+#endif
+};
+
+enum ScanMode scan_detect_mode(void)
+{
+#if SCAN_HAS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SCAN_AVX2;
+    if (__builtin_cpu_supports("sse2")) return SCAN_SSE2;
+#endif
+    return SCAN_SCALAR;
+}
+
+struct Scanner const* get_scanner(enum ScanMode mode)
+{
+    if (mode > scan_detect_mode()) mode = scan_detect_mode();
+    return &scanners[mode];
+}
+
+char const* scan_mode_name(enum ScanMode mode)
+{
+    switch (mode)
+    {
+        case SCAN_SCALAR: return "scalar";
+        case SCAN_SSE2: return "sse2";
+        case SCAN_AVX2: return "avx2";
+    }
+    return "<UNDEFINED>";
+}
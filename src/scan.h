@@ -0,0 +1,50 @@
+#pragma once
+#include <stddef.h>
+
+// Character class scanners used by the lexer. Each one starts at `position`
+// and returns the first position in [position, end) that does NOT belong to
+// the class (or `end`). Vector versions classify 16/32 bytes per step and
+// never read past `end`, so the input does not need any padding.
+
+enum ScanMode
+{
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2,
+};
+
+struct Scanner
+{
+    enum ScanMode mode;
+    size_t (*whitespace)(char const* text, size_t position, size_t end);
+    size_t (*identifier)(char const* text, size_t position, size_t end);
+    size_t (*digits)(char const* text, size_t position, size_t end);
+    // Returns position of the next '\n' (used to skip // comments)
+    size_t (*line_end)(char const* text, size_t position, size_t end);
+};
+
+// Best mode supported by the running CPU
+enum ScanMode scan_detect_mode(void);
+struct Scanner const* get_scanner(enum ScanMode mode);
+char const* scan_mode_name(enum ScanMode mode);
+
+static inline int is_identifier_start(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+// Range checks instead of <ctype.h>, which is undefined for negative chars (bytes >= 0x80)
+static inline int is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static inline int is_identifier_char(char c)
+{
+    return is_identifier_start(c) || is_digit(c);
+}
+
+static inline int is_whitespace(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
@@ -0,0 +1,351 @@
+#include <string.h>
+#include "select.h"
+
+// Most values an address tile covers besides its root
+#define MAX_FOLDED 6
+// Most ways to cover one subtree that are looked at
+#define MAX_MATCHES 8
+// Rough latencies, lea with all three components is slower on most cores
+#define LEA_COST 1
+#define COMPLEX_LEA_COST 2
+
+// One way to cover a subtree with (part of) an address
+struct AddressMatch
+{
+    uint32_t terms[2];
+    uint8_t scales[2];
+    size_t term_count;
+    uint32_t displacement; // Wraps around like the arithmetic it replaces
+    uint32_t folded[MAX_FOLDED];
+    size_t folded_count;
+    uint32_t cost; // Of the folded values and the root as instructions of their own
+};
+
+struct Matcher
+{
+    struct SsaFunction const* function;
+    uint32_t const* use_counts;
+    uint32_t block; // Of the root
+};
+
+static bool is_constant(struct SsaFunction const* function, uint32_t value)
+{
+    return function->instructions.data[value].op == SSA_CONST;
+}
+
+static uint32_t* count_uses(struct SsaFunction const* function)
+{
+    uint32_t* counts = cc_malloc((function->instructions.size + 1) * sizeof(uint32_t));
+    for (size_t value = 0; value < function->instructions.size; ++value)
+    {
+        struct SsaInstruction const* instruction = &function->instructions.data[value];
+        for (size_t operand = 0; operand < ssa_operand_count(instruction->op); ++operand) ++counts[instruction->operands[operand]];
+    }
+    for (size_t idx = 0; idx < function->phi_operands.size; ++idx) ++counts[function->phi_operands.data[idx]];
+    for (size_t block = 0; block < function->blocks.size; ++block)
+    {
+        if (function->blocks.data[block].value != SSA_NONE) ++counts[function->blocks.data[block].value];
+    }
+    return counts;
+}
+
+// Constants on the right go into the instruction, on the left only if the
+// operands can be swapped
+static void select_immediates(struct SsaFunction const* function, struct Selection* selection)
+{
+    for (uint32_t value = 0; value < function->instructions.size; ++value)
+    {
+        struct SsaInstruction const* instruction = &function->instructions.data[value];
+        switch ((enum SsaOp) instruction->op)
+        {
+            case SSA_ADD:
+            case SSA_MUL:
+            case SSA_BIT_AND:
+            case SSA_BIT_OR:
+            case SSA_BIT_XOR:
+            case SSA_EQ:
+            case SSA_NE:
+            case SSA_LT:
+            case SSA_LE:
+            case SSA_GT:
+            case SSA_GE:
+                if (is_constant(function, instruction->operands[1])) selection->inline_operands[value] = 1 << 1;
+                else if (is_constant(function, instruction->operands[0])) selection->inline_operands[value] = 1 << 0;
+                break;
+            case SSA_SUB:
+            case SSA_LSHIFT:
+            case SSA_RSHIFT:
+                if (is_constant(function, instruction->operands[1])) selection->inline_operands[value] = 1 << 1;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// x * 2, 4, 8 and x << 1, 2, 3 are an index with a scale, x * 3, 5, 9 is
+// x + x * 2, 4, 8
+static bool match_scaled(struct SsaFunction const* function, uint32_t value, uint32_t* operand, uint8_t* scale)
+{
+    struct SsaInstruction const* instruction = &function->instructions.data[value];
+    for (size_t side = 0; side < 2 && instruction->op == SSA_MUL; ++side)
+    {
+        uint32_t const factor = instruction->operands[side];
+        if (!is_constant(function, factor)) continue;
+        int32_t const constant = function->instructions.data[factor].constant;
+        if (constant < 2 || constant > 9 || (constant & (constant - 1) & (constant - 2)) != 0) continue;
+        *operand = instruction->operands[1 - side];
+        *scale = constant;
+        return true;
+    }
+    if (instruction->op != SSA_LSHIFT || !is_constant(function, instruction->operands[1])) return false;
+    int32_t const count = function->instructions.data[instruction->operands[1]].constant & 31;
+    if (count < 1 || count > 3) return false;
+    *operand = instruction->operands[0];
+    *scale = 1 << count;
+    return true;
+}
+
+// Shifts for multiplications by powers of two, imul for the others
+static uint32_t instruction_cost(struct SsaFunction const* function, uint32_t value)
+{
+    struct SsaInstruction const* instruction = &function->instructions.data[value];
+    if (instruction->op != SSA_MUL) return 1;
+    for (size_t side = 0; side < 2; ++side)
+    {
+        uint32_t const factor = instruction->operands[side];
+        uint32_t const constant = function->instructions.data[factor].constant;
+        if (is_constant(function, factor) && constant != 0 && (constant & (constant - 1)) == 0) return 1;
+    }
+    return 3;
+}
+
+static bool add_term(struct AddressMatch* match, uint32_t value, uint8_t scale)
+{
+    // At most a base and an index, and only one of them scaled
+    if (match->term_count == 2 || (match->term_count == 1 && scale != 1 && match->scales[0] != 1)) return false;
+    match->terms[match->term_count] = value;
+    match->scales[match->term_count++] = scale;
+    return true;
+}
+
+// `value` * `scale` computed on its own, or a constant
+static struct AddressMatch leaf_match(struct SsaFunction const* function, uint32_t value, uint8_t scale)
+{
+    struct AddressMatch match = {0};
+    if (is_constant(function, value)) match.displacement = (uint32_t) function->instructions.data[value].constant * scale;
+    else if (scale == 3 || scale == 5 || scale == 9)
+    {
+        add_term(&match, value, 1);
+        add_term(&match, value, scale - 1);
+    }
+    else add_term(&match, value, scale);
+    return match;
+}
+
+// Both operands of an add in one address
+static bool merge_matches(struct AddressMatch* merged, struct AddressMatch const* left, struct AddressMatch const* right)
+{
+    if (left->folded_count + right->folded_count > MAX_FOLDED) return false;
+    *merged = *left;
+    merged->displacement += right->displacement;
+    merged->cost += right->cost;
+    memcpy(&merged->folded[merged->folded_count], right->folded, right->folded_count * sizeof(uint32_t));
+    merged->folded_count += right->folded_count;
+    for (size_t idx = 0; idx < right->term_count; ++idx)
+    {
+        if (!add_term(merged, right->terms[idx], right->scales[idx])) return false;
+    }
+    return true;
+}
+
+static size_t match_subtree(struct Matcher const* matcher, uint32_t value, size_t depth, struct AddressMatch* matches);
+
+// Up to `capacity` ways to cover `value` and some of its operands, the
+// instruction of `value` is counted but `value` is not in `folded`
+static size_t match_node(struct Matcher const* matcher, uint32_t value, size_t depth, struct AddressMatch* matches,
+    size_t capacity)
+{
+    struct SsaFunction const* function = matcher->function;
+    struct SsaInstruction const* instruction = &function->instructions.data[value];
+    uint32_t const cost = instruction_cost(function, value);
+    struct AddressMatch lefts[MAX_MATCHES];
+    struct AddressMatch rights[MAX_MATCHES];
+    size_t count = 0;
+    uint32_t operand;
+    uint8_t scale;
+    switch ((enum SsaOp) instruction->op)
+    {
+        case SSA_ADD:
+        {
+            size_t const left_count = match_subtree(matcher, instruction->operands[0], depth + 1, lefts);
+            size_t const right_count = match_subtree(matcher, instruction->operands[1], depth + 1, rights);
+            for (size_t left = 0; left < left_count; ++left)
+            {
+                for (size_t right = 0; right < right_count && count < capacity; ++right)
+                {
+                    if (!merge_matches(&matches[count], &lefts[left], &rights[right])) continue;
+                    matches[count++].cost += cost;
+                }
+            }
+            return count;
+        }
+        case SSA_SUB:
+            if (!is_constant(function, instruction->operands[1])) return 0;
+            count = match_subtree(matcher, instruction->operands[0], depth + 1, lefts);
+            if (count > capacity) count = capacity;
+            for (size_t idx = 0; idx < count; ++idx)
+            {
+                matches[idx] = lefts[idx];
+                matches[idx].displacement -= (uint32_t) function->instructions.data[instruction->operands[1]].constant;
+                matches[idx].cost += cost;
+            }
+            return count;
+        case SSA_MUL:
+        case SSA_LSHIFT:
+            if (capacity == 0 || !match_scaled(function, value, &operand, &scale)) return 0;
+            matches[0] = leaf_match(function, operand, scale);
+            matches[0].cost += cost;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// `value` as a term, and if it is a subtree of the root the ways to fold it
+static size_t match_subtree(struct Matcher const* matcher, uint32_t value, size_t depth, struct AddressMatch* matches)
+{
+    struct SsaInstruction const* instruction = &matcher->function->instructions.data[value];
+    matches[0] = leaf_match(matcher->function, value, 1);
+    bool const subtree = matcher->use_counts[value] == 1 && instruction->block == matcher->block;
+    if (!subtree || depth == MAX_FOLDED || instruction->op == SSA_CONST) return 1;
+    size_t const folds = match_node(matcher, value, depth, &matches[1], MAX_MATCHES - 1);
+    size_t count = 1;
+    for (size_t idx = 1; idx <= folds && count < MAX_MATCHES; ++idx)
+    {
+        if (matches[idx].folded_count == MAX_FOLDED) continue;
+        matches[count] = matches[idx];
+        matches[count].folded[matches[count].folded_count++] = value;
+        ++count;
+    }
+    return count;
+}
+
+static struct AddressTile address_tile(struct AddressMatch const* match)
+{
+    struct AddressTile tile = {SSA_NONE, SSA_NONE, 1, (int32_t) match->displacement};
+    size_t const scaled = match->term_count == 2 && match->scales[0] != 1 ? 0 : 1;
+    if (match->term_count == 2)
+    {
+        tile.base = match->terms[1 - scaled];
+        tile.index = match->terms[scaled];
+        tile.scale = match->scales[scaled];
+    }
+    else if (match->scales[0] == 1) tile.base = match->terms[0];
+    else if (match->scales[0] == 2)
+    {
+        // x + x is shorter than x * 2, which needs a 32 bit displacement
+        tile.base = match->terms[0];
+        tile.index = match->terms[0];
+    }
+    else
+    {
+        tile.index = match->terms[0];
+        tile.scale = match->scales[0];
+    }
+    return tile;
+}
+
+// Marks what the tile at `value` reads without a location: constants and the
+// values it folds
+static void mark_inline_operands(struct SsaFunction const* function, struct Selection* selection, uint32_t value)
+{
+    struct SsaInstruction const* instruction = &function->instructions.data[value];
+    selection->inline_operands[value] = 0;
+    for (size_t operand = 0; operand < ssa_operand_count(instruction->op); ++operand)
+    {
+        uint32_t const source = instruction->operands[operand];
+        if (is_constant(function, source) || selection->tiles[source] == TILE_FOLDED)
+        {
+            selection->inline_operands[value] |= 1 << operand;
+        }
+    }
+}
+
+// Users come after their operands, so going backwards every tree is seen
+// from its root first and takes the cheapest tiling
+static void select_addresses(struct SsaFunction const* function, struct Selection* selection)
+{
+    uint32_t* use_counts = count_uses(function);
+    struct AddressMatch matches[MAX_MATCHES];
+    for (uint32_t value = function->instructions.size; value-- > 0;)
+    {
+        uint8_t const op = function->instructions.data[value].op;
+        if (selection->tiles[value] == TILE_FOLDED || (op != SSA_ADD && op != SSA_SUB && op != SSA_MUL)) continue;
+        struct Matcher const matcher = {function, use_counts, function->instructions.data[value].block};
+        size_t const count = match_node(&matcher, value, 0, matches, MAX_MATCHES);
+        struct AddressMatch const* best = NULL;
+        int32_t best_saving = 0;
+        for (size_t idx = 0; idx < count; ++idx)
+        {
+            struct AddressMatch const* match = &matches[idx];
+            if (match->term_count == 0) continue;
+            size_t const components = match->term_count + (match->displacement != 0);
+            int32_t const saving = (int32_t) match->cost - (components < 3 ? LEA_COST : COMPLEX_LEA_COST);
+            // A tie is only worth it if it saves instructions, a lone add is
+            // left to the lowering, which knows the registers
+            if (saving < 0 || (saving == 0 && match->folded_count == 0)) continue;
+            bool const better = best == NULL || saving > best_saving
+                || (saving == best_saving && match->folded_count > best->folded_count);
+            if (!better) continue;
+            best = match;
+            best_saving = saving;
+        }
+        if (best == NULL) continue;
+
+        selection->tiles[value] = TILE_ADDRESS;
+        selection->addresses[value] = address_tile(best);
+        for (size_t idx = 0; idx < best->folded_count; ++idx)
+        {
+            selection->tiles[best->folded[idx]] = TILE_FOLDED;
+            selection->roots[best->folded[idx]] = value;
+        }
+        mark_inline_operands(function, selection, value);
+        for (size_t idx = 0; idx < best->folded_count; ++idx) mark_inline_operands(function, selection, best->folded[idx]);
+    }
+    free(use_counts);
+}
+
+struct Selection select_tiles(struct SsaFunction const* function)
+{
+    size_t const count = function->instructions.size;
+    struct Selection selection = {
+        .tiles = cc_malloc(count + 1),
+        .addresses = cc_malloc((count + 1) * sizeof(struct AddressTile)),
+        .inline_operands = cc_malloc(count + 1),
+        .roots = cc_malloc((count + 1) * sizeof(uint32_t))
+    };
+    memset(selection.roots, 0xFF, count * sizeof(uint32_t));
+    select_immediates(function, &selection);
+    select_addresses(function, &selection);
+    return selection;
+}
+
+void free_selection(struct Selection* selection)
+{
+    free(selection->tiles);
+    free(selection->addresses);
+    free(selection->inline_operands);
+    free(selection->roots);
+    *selection = (struct Selection) {0};
+}
+
+struct AllocationHints selection_hints(struct Selection const* selection)
+{
+    return (struct AllocationHints) {selection->inline_operands, selection->roots, true};
+}
+
+bool is_inline_operand(struct Selection const* selection, uint32_t value, size_t operand)
+{
+    return (selection->inline_operands[value] >> operand) & 1;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include "regalloc.h"
+#include "ssa.h"
+
+// Instruction selection for x86-64 by tiling the expression trees of an SSA
+// function, before registers are allocated. A value with a single use in the
+// same block is a subtree of its user, constants are leaves that every user
+// may copy. Tiles:
+//  - immediates: a constant operand of add, sub, imul, the bitwise ops,
+//    shifts and compares is built into the instruction, a constant that is
+//    only used that way never gets a register
+//  - addresses: adds, subtractions of a constant and multiplications by 2, 4
+//    or 8 (or shifts by 1 to 3) that fit base + index * scale + displacement
+//    become one lea, as do multiplications by 3, 5 and 9
+// Every tile has a cost, roughly its latency, and an address tile is only
+// taken when it is not more expensive than the instructions it covers.
+// Values in memory are used as memory operands by the lowering, which also
+// turns adds into lea when that saves a mov.
+
+enum Tile
+{
+    TILE_INSTRUCTION, // Its own instruction, maybe with an immediate
+    TILE_FOLDED, // Computed by the tile of `roots[value]`
+    TILE_ADDRESS, // lea of `addresses[value]`
+};
+
+// Value of base + index * scale + displacement, base and index are values or
+// SSA_NONE
+struct AddressTile
+{
+    uint32_t base;
+    uint32_t index;
+    uint8_t scale;
+    int32_t displacement;
+};
+
+struct Selection
+{
+    uint8_t* tiles; // Per value, enum Tile
+    struct AddressTile* addresses; // Per value, for TILE_ADDRESS
+    // Per value, bit per operand that is an immediate or folded into the tile
+    uint8_t* inline_operands;
+    uint32_t* roots; // Per value, for TILE_FOLDED, SSA_NONE otherwise
+};
+
+struct Selection select_tiles(struct SsaFunction const* function);
+void free_selection(struct Selection* selection);
+// What the allocator has to know: which reads need no location
+struct AllocationHints selection_hints(struct Selection const* selection);
+bool is_inline_operand(struct Selection const* selection, uint32_t value, size_t operand);
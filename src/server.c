@@ -0,0 +1,274 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "pipeline.h"
+#include "server.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+#define MAX_REQUEST_ARGUMENTS 256
+#define MAX_ARGUMENT_LENGTH PATH_MAX
+// For every send and receive on a client socket, requests and replies are
+// local and small next to it
+#define CLIENT_TIMEOUT_SECONDS 10
+
+struct Server
+{
+    int listen_fd;
+    atomic_bool stopping;
+    struct CompileCache* cache;
+};
+
+static bool send_all(int fd, void const* data, size_t size)
+{
+    char const* bytes = data;
+    while (size != 0)
+    {
+        ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        bytes += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static bool receive_all(int fd, void* data, size_t size)
+{
+    char* bytes = data;
+    while (size != 0)
+    {
+        ssize_t received = recv(fd, bytes, size, 0);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return false;
+        bytes += received;
+        size -= received;
+    }
+    return true;
+}
+
+static bool send_message(int fd, uint32_t status, char const* text, size_t length)
+{
+    uint32_t const header[2] = {status, length};
+    return send_all(fd, header, sizeof(header)) && send_all(fd, text, length);
+}
+
+// Arguments are added to `arguments`, false on a malformed request
+static bool receive_request(int fd, struct StringArray* arguments)
+{
+    uint32_t count;
+    if (!receive_all(fd, &count, sizeof(count)) || count > MAX_REQUEST_ARGUMENTS) return false;
+    char buffer[MAX_ARGUMENT_LENGTH + 1];
+    for (uint32_t idx = 0; idx < count; ++idx)
+    {
+        uint32_t length;
+        if (!receive_all(fd, &length, sizeof(length)) || length > MAX_ARGUMENT_LENGTH) return false;
+        if (!receive_all(fd, buffer, length)) return false;
+        buffer[length] = '\0';
+        add_string(arguments, buffer);
+    }
+    return true;
+}
+
+static int connect_to(char const* socket_path)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+    {
+        printf("Socket path is too long: %s\n", socket_path);
+        exit(1);
+    }
+    strcpy(address.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*) &address, sizeof(address)) != 0)
+    {
+        printf("Could not connect to %s: %s\n", socket_path, strerror(errno));
+        exit(1);
+    }
+    return fd;
+}
+
+static void serve_request(struct Server* server, int fd)
+{
+    struct StringArray arguments = new_string_array();
+    if (!receive_request(fd, &arguments))
+    {
+        free_string_array(&arguments);
+        return;
+    }
+    if (arguments.size == 1 && strcmp(arguments.data[0], "--shutdown") == 0)
+    {
+        atomic_store(&server->stopping, true);
+        // Wakes up every thread blocked in accept
+        shutdown(server->listen_fd, SHUT_RDWR);
+        send_message(fd, 0, "", 0);
+        free_string_array(&arguments);
+        return;
+    }
+
+    char const* path = NULL;
+    bool optimize = false;
+    char* error = NULL;
+    for (size_t idx = 0; idx < arguments.size && error == NULL; ++idx)
+    {
+        if (strcmp(arguments.data[idx], "-O") == 0) optimize = true;
+        else if (arguments.data[idx][0] == '-') error = format("Unsupported flag for the server: %s", arguments.data[idx]);
+        else if (path != NULL) error = format("The server compiles one input per request");
+        else path = arguments.data[idx];
+    }
+    if (error == NULL && path == NULL) error = format("Missing input file");
+
+    // The AST arena goes back to the shared block pool after every request,
+    // so a warm server does not allocate for the AST anymore
+    struct FileCompilation file = {
+        .path = path,
+        .cache = server->cache,
+        .optimize = optimize,
+        .arena = new_arena("ast")
+    };
+    if (error == NULL) error = run_guarded(compile_file, &file);
+    if (error != NULL)
+    {
+        send_message(fd, 1, error, strlen(error));
+        free(error);
+    }
+    else
+    {
+        size_t length = 0;
+        for (size_t idx = 0; idx < file.assembly.size; ++idx) length += strlen(file.assembly.data[idx]) + 1;
+        char* text = cc_malloc(length + 1);
+        char* end = text;
+        for (size_t idx = 0; idx < file.assembly.size; ++idx) end += sprintf(end, "%s\n", file.assembly.data[idx]);
+        send_message(fd, 0, text, length);
+        free(text);
+    }
+    release_file_compilation(&file);
+    free_string_array(&arguments);
+}
+
+static void accept_loop(void* context, size_t idx)
+{
+    UNUSED(idx);
+    struct Server* server = context;
+    while (!atomic_load(&server->stopping))
+    {
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break; // Shut down
+        }
+        // A client that stops sending or reading would hold this thread forever,
+        // after a timeout recv and send fail and the request is dropped
+        struct timeval const timeout = {.tv_sec = CLIENT_TIMEOUT_SECONDS};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        serve_request(server, fd);
+        close(fd);
+    }
+}
+
+// True if the path is free: nothing is there, or a socket left behind by a
+// server that did not shut down, which is removed. Anything else (a file, a
+// socket a server still listens on) is kept.
+static bool claim_socket_path(struct sockaddr_un const* address)
+{
+    struct stat status;
+    if (lstat(address->sun_path, &status) != 0) return errno == ENOENT;
+    if (!S_ISSOCK(status.st_mode)) return false;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    bool const stale = fd >= 0 && connect(fd, (struct sockaddr const*) address, sizeof(*address)) != 0
+        && errno == ECONNREFUSED;
+    if (fd >= 0) close(fd);
+    return stale && unlink(address->sun_path) == 0;
+}
+
+int run_server(char const* socket_path, size_t thread_count, struct CompileCache* cache)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+    {
+        printf("Socket path is too long: %s\n", socket_path);
+        return 1;
+    }
+    strcpy(address.sun_path, socket_path);
+    if (!claim_socket_path(&address))
+    {
+        printf("%s is already in use\n", socket_path);
+        return 1;
+    }
+    struct Server server = {.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0), .cache = cache};
+    if (server.listen_fd < 0
+        || bind(server.listen_fd, (struct sockaddr*) &address, sizeof(address)) != 0
+        || listen(server.listen_fd, 64) != 0)
+    {
+        printf("Could not listen on %s: %s\n", socket_path, strerror(errno));
+        return 1;
+    }
+    printf("Listening on %s with %zu threads\n", socket_path, thread_count);
+    fflush(stdout);
+
+    // Every thread of the pool runs one accept loop
+    struct ThreadPool* pool = new_thread_pool(thread_count);
+    thread_pool_for(pool, thread_count, accept_loop, &server);
+    free_thread_pool(pool);
+    close(server.listen_fd);
+    unlink(socket_path);
+    if (cache != NULL) print_cache_stats(cache);
+    return 0;
+}
+
+int send_request(char const* socket_path, int argc, char* const* argv, char** reply)
+{
+    int fd = connect_to(socket_path);
+    uint32_t const count = argc;
+    bool sent = send_all(fd, &count, sizeof(count));
+    for (int idx = 0; idx < argc && sent; ++idx)
+    {
+        // The server has its own working directory
+        char resolved[PATH_MAX];
+        char const* argument = argv[idx][0] != '-' && realpath(argv[idx], resolved) != NULL ? resolved : argv[idx];
+        uint32_t const length = strlen(argument);
+        sent = send_all(fd, &length, sizeof(length)) && send_all(fd, argument, length);
+    }
+
+    uint32_t header[2];
+    if (!sent || !receive_all(fd, header, sizeof(header)))
+    {
+        close(fd);
+        return -1;
+    }
+    char* text = cc_malloc(header[1] + 1);
+    bool received = receive_all(fd, text, header[1]);
+    close(fd);
+    if (!received)
+    {
+        free(text);
+        return -1;
+    }
+    *reply = text;
+    return header[0];
+}
+
+int run_client(char const* socket_path, int argc, char** argv)
+{
+    char* text;
+    int status = send_request(socket_path, argc, argv, &text);
+    if (status < 0)
+    {
+        printf("Lost connection to %s\n", socket_path);
+        return 1;
+    }
+    // Errors get a newline, like the ones printed by a local compile
+    printf(status == 0 ? "%s" : "%s\n", text);
+    free(text);
+    return status;
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <stddef.h>
+#include "cache.h"
+
+// Warm compiler process behind a Unix domain socket, so small compiles do not
+// pay for process startup and cold caches. One request per connection:
+//   request:  u32 argument count, then per argument u32 length + bytes
+//   response: u32 exit status, u32 length + bytes (assembly, or the error message)
+// Integers are in host byte order, both ends are on the same machine.
+// Arguments are the input path (absolute, the client resolves it) and -O.
+// The single argument "--shutdown" stops the server.
+
+// Serves requests on `thread_count` threads until shut down, returns the exit
+// code. Requests go through the cache if there is one.
+int run_server(char const* socket_path, size_t thread_count, struct CompileCache* cache);
+// Sends one request and prints the reply, returns the server's exit status
+int run_client(char const* socket_path, int argc, char** argv);
+// Same without printing: the reply (assembly or error message) goes to
+// `reply`, to be freed. Returns -1 if the connection was lost.
+int send_request(char const* socket_path, int argc, char* const* argv, char** reply);
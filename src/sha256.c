@@ -0,0 +1,93 @@
+#include <string.h>
+#include "sha256.h"
+
+static uint32_t const round_constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t rotate_right(uint32_t value, int bits)
+{
+    return (value >> bits) | (value << (32 - bits));
+}
+
+static void compress(uint32_t state[8], uint8_t const block[64])
+{
+    uint32_t w[64];
+    for (int idx = 0; idx < 16; ++idx)
+    {
+        w[idx] = (uint32_t) block[idx * 4] << 24 | (uint32_t) block[idx * 4 + 1] << 16
+            | (uint32_t) block[idx * 4 + 2] << 8 | block[idx * 4 + 3];
+    }
+    for (int idx = 16; idx < 64; ++idx)
+    {
+        uint32_t s0 = rotate_right(w[idx - 15], 7) ^ rotate_right(w[idx - 15], 18) ^ (w[idx - 15] >> 3);
+        uint32_t s1 = rotate_right(w[idx - 2], 17) ^ rotate_right(w[idx - 2], 19) ^ (w[idx - 2] >> 10);
+        w[idx] = w[idx - 16] + s0 + w[idx - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int idx = 0; idx < 64; ++idx)
+    {
+        uint32_t s1 = rotate_right(e, 6) ^ rotate_right(e, 11) ^ rotate_right(e, 25);
+        uint32_t choice = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + choice + round_constants[idx] + w[idx];
+        uint32_t s0 = rotate_right(a, 2) ^ rotate_right(a, 13) ^ rotate_right(a, 22);
+        uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + majority;
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+struct Sha256 sha256_begin()
+{
+    return (struct Sha256) {
+        .state = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19}
+    };
+}
+
+void sha256_update(struct Sha256* hash, void const* data, size_t size)
+{
+    uint8_t const* bytes = data;
+    size_t used = hash->length % 64;
+    hash->length += size;
+    if (used != 0)
+    {
+        size_t const take = size < 64 - used ? size : 64 - used;
+        memcpy(&hash->block[used], bytes, take);
+        bytes += take;
+        size -= take;
+        if (used + take < 64) return;
+        compress(hash->state, hash->block);
+    }
+    // Whole blocks straight from the input
+    for (; size >= 64; bytes += 64, size -= 64) compress(hash->state, bytes);
+    memcpy(hash->block, bytes, size);
+}
+
+void sha256_finish(struct Sha256* hash, uint8_t digest[32])
+{
+    uint64_t const bit_length = hash->length * 8;
+    size_t used = hash->length % 64;
+    hash->block[used++] = 0x80;
+    if (used > 56)
+    {
+        memset(&hash->block[used], 0, 64 - used);
+        compress(hash->state, hash->block);
+        used = 0;
+    }
+    memset(&hash->block[used], 0, 56 - used);
+    for (int idx = 0; idx < 8; ++idx) hash->block[56 + idx] = (uint8_t) (bit_length >> (56 - idx * 8));
+    compress(hash->state, hash->block);
+    for (int idx = 0; idx < 32; ++idx) digest[idx] = (uint8_t) (hash->state[idx / 4] >> (24 - idx % 4 * 8));
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// FIPS 180-4 SHA-256, for content addressing (not for anything secret)
+struct Sha256
+{
+    uint32_t state[8];
+    uint64_t length; // Bytes hashed so far
+    uint8_t block[64];
+};
+
+struct Sha256 sha256_begin();
+void sha256_update(struct Sha256* hash, void const* data, size_t size);
+void sha256_finish(struct Sha256* hash, uint8_t digest[32]);
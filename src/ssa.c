@@ -0,0 +1,1150 @@
+#include <stdio.h>
+#include <string.h>
+#include "ssa.h"
+#include "intern.h"
+
+IMPLEMENT_NEW_DYN_ARRAY(SsaInstructions, struct SsaInstruction, new_ssa_instructions, add_ssa_instruction);
+IMPLEMENT_NEW_DYN_ARRAY(SsaBlocks, struct SsaBlock, new_ssa_blocks, add_ssa_block);
+IMPLEMENT_NEW_DYN_ARRAY(SsaValues, uint32_t, new_ssa_values, add_ssa_value);
+
+static uint8_t const SSA_OPS[] = {
+    [NOT] = SSA_NOT,
+    [NEG] = SSA_NEG,
+    [BIT_NOT] = SSA_BIT_NOT,
+    [ADD] = SSA_ADD,
+    [SUB] = SSA_SUB,
+    [MUL] = SSA_MUL,
+    [DIV] = SSA_DIV,
+    [REM] = SSA_REM,
+    [LSHIFT] = SSA_LSHIFT,
+    [RSHIFT] = SSA_RSHIFT,
+    [BIT_AND] = SSA_BIT_AND,
+    [BIT_OR] = SSA_BIT_OR,
+    [BIT_XOR] = SSA_BIT_XOR,
+    [EQ] = SSA_EQ,
+    [NE] = SSA_NE,
+    [LT] = SSA_LT,
+    [LE] = SSA_LE,
+    [GT] = SSA_GT,
+    [GE] = SSA_GE,
+};
+
+static char const* const SSA_OP_NAMES[] = {
+    [SSA_CONST] = "const",
+    [SSA_UNDEF] = "undef",
+    [SSA_PHI] = "phi",
+    [SSA_NOT] = "not",
+    [SSA_NEG] = "neg",
+    [SSA_BIT_NOT] = "bit_not",
+    [SSA_ADD] = "add",
+    [SSA_SUB] = "sub",
+    [SSA_MUL] = "mul",
+    [SSA_DIV] = "div",
+    [SSA_REM] = "rem",
+    [SSA_LSHIFT] = "lshift",
+    [SSA_RSHIFT] = "rshift",
+    [SSA_BIT_AND] = "bit_and",
+    [SSA_BIT_OR] = "bit_or",
+    [SSA_BIT_XOR] = "bit_xor",
+    [SSA_EQ] = "eq",
+    [SSA_NE] = "ne",
+    [SSA_LT] = "lt",
+    [SSA_LE] = "le",
+    [SSA_GT] = "gt",
+    [SSA_GE] = "ge",
+};
+
+#define OP_COUNT (STORE_KEEP + 1)
+#define SSA_OP_COUNT (SSA_GE + 1)
+
+// Basic block of the tape, before the blocks are put in reverse post-order
+struct TapeBlock
+{
+    uint32_t start; // Tape positions [start, end)
+    uint32_t end;
+    uint8_t terminator; // enum SsaTerminator
+    bool returns_zero; // Falls off the end of the tape
+    uint32_t successors[2]; // Tape blocks
+    uint32_t order; // SSA block, SSA_NONE if unreachable
+};
+
+struct IncompletePhi
+{
+    uint32_t block;
+    uint32_t variable;
+    uint32_t phi;
+};
+
+// Construction follows Braun et al., "Simple and Efficient Construction of
+// Static Single Assignment Form": values are looked up backwards through the
+// predecessors on demand, and phis of blocks whose predecessors are not all
+// translated yet (back edges) are completed once they are.
+struct SsaBuilder
+{
+    struct VirtualMachineCode const* vm;
+    struct SsaFunction* function; // Blocks are final, instructions are appended in creation order
+    uint32_t frame_size; // Variables, operand stack slot `n` is variable frame_size + n
+    struct TapeBlock* tape_blocks;
+    size_t tape_block_count;
+    uint32_t* tape_block_of; // Per SSA block
+    uint32_t* entry_depths; // Operand stack depth at the start of every SSA block
+    uint32_t* stack;
+    struct HashMap* definitions; // Per block, variable + 1 -> value
+    bool* sealed; // All predecessors are translated
+    bool* filled; // Translated
+    // Per block, its first predecessors that are known to be translated, so
+    // that a join is not rescanned from the start for every predecessor
+    uint32_t* filled_predecessors;
+    struct IncompletePhi* incomplete;
+    size_t incomplete_count;
+    size_t incomplete_capacity;
+    struct SsaValues replacements; // Per value, itself unless it was a phi found to be trivial
+};
+
+static bool is_jump(enum BytecodeOp op)
+{
+    return op == JMP || op == JZ || op == JNZ;
+}
+
+static bool uses_variable(enum BytecodeOp op)
+{
+    return op == LOAD || op == STORE || op == LOAD_ADD || op == STORE_KEEP;
+}
+
+static size_t instruction_width(enum BytecodeOp op)
+{
+    return is_op_double_width(op) ? 2 : 1;
+}
+
+#define INSTRUCTION_START 1
+#define LEADER 2
+
+static char* split_blocks(struct SsaBuilder* builder)
+{
+    size_t const size = builder->vm->tape.size;
+    union Bytecode const* tape = builder->vm->tape.data;
+    uint8_t* kinds = cc_malloc(size + 1);
+    kinds[0] |= LEADER;
+    enum BytecodeOp last_op = JMP;
+    for (size_t position = 0; position < size; position += instruction_width(last_op))
+    {
+        last_op = tape[position].op;
+        kinds[position] |= INSTRUCTION_START;
+        if ((unsigned) last_op >= OP_COUNT)
+        {
+            free(kinds);
+            return format("unknown op %d at %zu", (int) last_op, position);
+        }
+        if (last_op == CALL || (is_op_double_width(last_op) && position + 1 == size))
+        {
+            free(kinds);
+            return format(last_op == CALL ? "calls are not supported" : "missing operand at the end");
+        }
+        int32_t const operand = is_op_double_width(last_op) ? tape[position + 1].value : 0;
+        if (uses_variable(last_op))
+        {
+            if (operand < 0 || operand % sizeof(int32_t) != 0)
+            {
+                free(kinds);
+                return format("bad variable offset %d", operand);
+            }
+            if ((uint32_t) operand / sizeof(int32_t) >= builder->frame_size)
+            {
+                builder->frame_size = operand / sizeof(int32_t) + 1;
+            }
+        }
+        if (is_jump(last_op) || last_op == RET) kinds[position + instruction_width(last_op)] |= LEADER;
+    }
+    // Falling off the end is an implicit return 0, like in main
+    if (last_op != JMP && last_op != RET) kinds[size] |= LEADER;
+
+    bool entry_is_target = false;
+    for (size_t position = 0; position < size; position += instruction_width(tape[position].op))
+    {
+        if (!is_jump(tape[position].op)) continue;
+        int32_t const target = tape[position + 1].value;
+        if (target < 0 || (size_t) target > size || (target != (int32_t) size && !(kinds[target] & INSTRUCTION_START)))
+        {
+            free(kinds);
+            return format("bad jump target %d", target);
+        }
+        kinds[target] |= LEADER;
+        entry_is_target |= target == 0;
+    }
+
+    // The entry block may not have predecessors, so a jump back to the start
+    // gets an empty block in front of it
+    size_t count = entry_is_target;
+    for (size_t position = 0; position <= size; ++position) count += (kinds[position] & LEADER) != 0;
+    builder->tape_blocks = cc_malloc(count * sizeof(struct TapeBlock));
+    uint32_t* block_at = cc_malloc((size + 1) * sizeof(uint32_t));
+    if (entry_is_target)
+    {
+        builder->tape_blocks[0] = (struct TapeBlock) {.terminator = SSA_JUMP, .successors = {1, SSA_NONE}};
+    }
+    size_t block = entry_is_target;
+    for (size_t position = 0; position <= size; ++position)
+    {
+        if (!(kinds[position] & LEADER)) continue;
+        if (block > entry_is_target) builder->tape_blocks[block - 1].end = position;
+        block_at[position] = block;
+        builder->tape_blocks[block++] = (struct TapeBlock) {.start = position, .end = size};
+    }
+    builder->tape_block_count = count;
+
+    for (block = entry_is_target; block < count; ++block)
+    {
+        struct TapeBlock* current = &builder->tape_blocks[block];
+        current->successors[0] = current->successors[1] = SSA_NONE;
+        if (current->start == current->end)
+        {
+            current->terminator = SSA_RETURN;
+            current->returns_zero = true;
+            continue;
+        }
+        size_t last = current->start;
+        while (last + instruction_width(tape[last].op) < current->end) last += instruction_width(tape[last].op);
+        enum BytecodeOp const op = tape[last].op;
+        uint32_t const target = is_jump(op) ? block_at[tape[last + 1].value] : SSA_NONE;
+        uint32_t const next = op == RET || op == JMP ? SSA_NONE : block_at[current->end];
+        current->terminator = op == RET ? SSA_RETURN : op == JZ || op == JNZ ? SSA_BRANCH : SSA_JUMP;
+        current->successors[0] = op == JNZ || op == JMP ? target : next;
+        current->successors[1] = op == JZ ? target : op == JNZ ? next : SSA_NONE;
+    }
+    free(block_at);
+    free(kinds);
+    return NULL;
+}
+
+// SSA blocks in reverse post-order, with their predecessors
+static void order_blocks(struct SsaBuilder* builder)
+{
+    size_t const count = builder->tape_block_count;
+    struct TapeBlock* blocks = builder->tape_blocks;
+    uint32_t* postorder = cc_malloc(count * sizeof(uint32_t));
+    uint32_t* path = cc_malloc(count * sizeof(uint32_t));
+    uint8_t* next_successor = cc_malloc(count);
+    bool* visited = cc_malloc(count * sizeof(bool));
+    size_t postorder_count = 0;
+    size_t depth = 0;
+    path[depth++] = 0;
+    visited[0] = true;
+    while (depth != 0)
+    {
+        uint32_t const block = path[depth - 1];
+        if (next_successor[block] == 2)
+        {
+            postorder[postorder_count++] = block;
+            --depth;
+            continue;
+        }
+        uint32_t const successor = blocks[block].successors[next_successor[block]++];
+        if (successor == SSA_NONE || visited[successor]) continue;
+        visited[successor] = true;
+        path[depth++] = successor;
+    }
+
+    struct SsaFunction* function = builder->function;
+    builder->tape_block_of = cc_malloc(postorder_count * sizeof(uint32_t));
+    for (size_t block = 0; block < count; ++block) blocks[block].order = SSA_NONE;
+    for (size_t idx = 0; idx < postorder_count; ++idx)
+    {
+        uint32_t const tape_block = postorder[postorder_count - 1 - idx];
+        blocks[tape_block].order = idx;
+        builder->tape_block_of[idx] = tape_block;
+    }
+    for (size_t idx = 0; idx < postorder_count; ++idx)
+    {
+        struct TapeBlock const* tape_block = &blocks[builder->tape_block_of[idx]];
+        struct SsaBlock block = {.terminator = tape_block->terminator, .value = SSA_NONE};
+        for (size_t successor = 0; successor < 2; ++successor)
+        {
+            uint32_t const target = tape_block->successors[successor];
+            block.successors[successor] = target == SSA_NONE ? SSA_NONE : blocks[target].order;
+        }
+        add_ssa_block(&function->blocks, &block);
+    }
+
+    // Grouped by block, in the order the edges are found
+    struct SsaBlock* ssa_blocks = function->blocks.data;
+    for (size_t idx = 0; idx < postorder_count; ++idx)
+    {
+        for (size_t successor = 0; successor < 2; ++successor)
+        {
+            if (ssa_blocks[idx].successors[successor] != SSA_NONE) ++ssa_blocks[ssa_blocks[idx].successors[successor]].predecessor_count;
+        }
+    }
+    uint32_t edges = 0;
+    for (size_t idx = 0; idx < postorder_count; ++idx)
+    {
+        ssa_blocks[idx].first_predecessor = edges;
+        edges += ssa_blocks[idx].predecessor_count;
+        ssa_blocks[idx].predecessor_count = 0;
+    }
+    function->predecessors = (struct SsaValues) {
+        .data = cc_malloc((edges + 1) * sizeof(uint32_t)),
+        .size = edges,
+        .max_capacity = edges + 1
+    };
+    for (size_t idx = 0; idx < postorder_count; ++idx)
+    {
+        for (size_t successor = 0; successor < 2; ++successor)
+        {
+            uint32_t const target = ssa_blocks[idx].successors[successor];
+            if (target == SSA_NONE) continue;
+            function->predecessors.data[ssa_blocks[target].first_predecessor + ssa_blocks[target].predecessor_count++] = idx;
+        }
+    }
+    free(postorder);
+    free(path);
+    free(next_successor);
+    free(visited);
+}
+
+// Operand stack depth at the start of every block, the same on all incoming edges
+static char* compute_depths(struct SsaBuilder* builder, size_t* max_depth)
+{
+    struct SsaFunction const* function = builder->function;
+    union Bytecode const* tape = builder->vm->tape.data;
+    size_t const count = function->blocks.size;
+    builder->entry_depths = cc_malloc(count * sizeof(uint32_t));
+    for (size_t block = 1; block < count; ++block) builder->entry_depths[block] = SSA_NONE;
+    *max_depth = 0;
+    // Every block after the entry has a predecessor before it in reverse post-order
+    for (size_t block = 0; block < count; ++block)
+    {
+        struct TapeBlock const* tape_block = &builder->tape_blocks[builder->tape_block_of[block]];
+        uint32_t depth = builder->entry_depths[block];
+        for (size_t position = tape_block->start; position < tape_block->end;
+            position += instruction_width(tape[position].op))
+        {
+            struct StackEffect const effect = op_stack_effect(tape[position].op);
+            if (depth < effect.pops) return format("operand stack underflow at %zu", position);
+            depth += effect.pushes - effect.pops;
+            if (depth > *max_depth) *max_depth = depth;
+        }
+        for (size_t successor = 0; successor < 2; ++successor)
+        {
+            uint32_t const target = function->blocks.data[block].successors[successor];
+            if (target == SSA_NONE) continue;
+            if (builder->entry_depths[target] == SSA_NONE) builder->entry_depths[target] = depth;
+            if (builder->entry_depths[target] != depth)
+            {
+                return format("operand stack depth differs at %u", builder->tape_blocks[builder->tape_block_of[target]].start);
+            }
+        }
+    }
+    return NULL;
+}
+
+static uint32_t add_instruction(struct SsaBuilder* builder, enum SsaOp op, uint32_t block, int32_t constant,
+    uint32_t left, uint32_t right)
+{
+    struct SsaInstruction instruction = {.op = op, .block = block, .constant = constant, .operands = {left, right}};
+    add_ssa_instruction(&builder->function->instructions, &instruction);
+    uint32_t const value = builder->function->instructions.size - 1;
+    add_ssa_value(&builder->replacements, &value);
+    return value;
+}
+
+static uint32_t add_phi(struct SsaBuilder* builder, uint32_t block)
+{
+    struct SsaFunction* function = builder->function;
+    uint32_t const phi = add_instruction(builder, SSA_PHI, block, function->phi_operands.size, SSA_NONE, SSA_NONE);
+    uint32_t const missing = SSA_NONE;
+    for (size_t idx = 0; idx < function->blocks.data[block].predecessor_count; ++idx)
+    {
+        add_ssa_value(&function->phi_operands, &missing);
+    }
+    return phi;
+}
+
+static uint32_t resolve(struct SsaBuilder* builder, uint32_t value)
+{
+    uint32_t* replacements = builder->replacements.data;
+    uint32_t root = value;
+    while (replacements[root] != root) root = replacements[root];
+    while (replacements[value] != root)
+    {
+        uint32_t const next = replacements[value];
+        replacements[value] = root;
+        value = next;
+    }
+    return root;
+}
+
+static void write_variable(struct SsaBuilder* builder, uint32_t variable, uint32_t block, uint32_t value)
+{
+    int32_t* definition = hashmap_find(&builder->definitions[block], variable + 1);
+    if (definition != NULL) *definition = value;
+    else hashmap_insert(&builder->definitions[block], variable + 1, value);
+}
+
+// A phi that only merges one value (and itself) is that value
+static uint32_t remove_trivial_phi(struct SsaBuilder* builder, uint32_t phi)
+{
+    struct SsaFunction* function = builder->function;
+    struct SsaInstruction const instruction = function->instructions.data[phi];
+    uint32_t const count = function->blocks.data[instruction.block].predecessor_count;
+    uint32_t same = SSA_NONE;
+    for (size_t idx = 0; idx < count; ++idx)
+    {
+        uint32_t const operand = resolve(builder, function->phi_operands.data[instruction.constant + idx]);
+        if (operand == same || operand == phi) continue;
+        if (same != SSA_NONE) return phi;
+        same = operand;
+    }
+    // Only reachable through itself
+    if (same == SSA_NONE) same = add_instruction(builder, SSA_UNDEF, 0, 0, SSA_NONE, SSA_NONE);
+    builder->replacements.data[phi] = same;
+    return same;
+}
+
+static uint32_t read_variable(struct SsaBuilder* builder, uint32_t variable, uint32_t block);
+
+static uint32_t add_phi_operands(struct SsaBuilder* builder, uint32_t variable, uint32_t phi)
+{
+    struct SsaFunction* function = builder->function;
+    struct SsaBlock const block = function->blocks.data[function->instructions.data[phi].block];
+    uint32_t const first_operand = function->instructions.data[phi].constant;
+    for (size_t idx = 0; idx < block.predecessor_count; ++idx)
+    {
+        uint32_t const predecessor = function->predecessors.data[block.first_predecessor + idx];
+        uint32_t const operand = read_variable(builder, variable, predecessor);
+        function->phi_operands.data[first_operand + idx] = operand;
+    }
+    return remove_trivial_phi(builder, phi);
+}
+
+static uint32_t read_variable(struct SsaBuilder* builder, uint32_t variable, uint32_t block)
+{
+    int32_t const* definition = hashmap_find(&builder->definitions[block], variable + 1);
+    if (definition != NULL) return resolve(builder, *definition);
+
+    struct SsaBlock const* ssa_block = &builder->function->blocks.data[block];
+    uint32_t value;
+    if (!builder->sealed[block])
+    {
+        value = add_phi(builder, block);
+        if (builder->incomplete_count == builder->incomplete_capacity)
+        {
+            builder->incomplete_capacity = builder->incomplete_capacity * 2 + 8;
+            builder->incomplete = realloc(builder->incomplete, builder->incomplete_capacity * sizeof(struct IncompletePhi));
+            assert(builder->incomplete);
+        }
+        builder->incomplete[builder->incomplete_count++] = (struct IncompletePhi) {block, variable, value};
+    }
+    else if (ssa_block->predecessor_count == 0)
+    {
+        // Only variables get here, the operand stack is empty at the entry
+        value = add_instruction(builder, SSA_UNDEF, block, 0, SSA_NONE, SSA_NONE);
+    }
+    else if (ssa_block->predecessor_count == 1)
+    {
+        value = read_variable(builder, variable, builder->function->predecessors.data[ssa_block->first_predecessor]);
+    }
+    else
+    {
+        // Written first, so that loops back to this block find the phi
+        uint32_t const phi = add_phi(builder, block);
+        write_variable(builder, variable, block, phi);
+        value = add_phi_operands(builder, variable, phi);
+    }
+    write_variable(builder, variable, block, value);
+    return value;
+}
+
+static void seal_if_ready(struct SsaBuilder* builder, uint32_t block)
+{
+    struct SsaBlock const* ssa_block = &builder->function->blocks.data[block];
+    if (builder->sealed[block]) return;
+    uint32_t* ready = &builder->filled_predecessors[block];
+    for (; *ready < ssa_block->predecessor_count; ++*ready)
+    {
+        if (!builder->filled[builder->function->predecessors.data[ssa_block->first_predecessor + *ready]]) return;
+    }
+    builder->sealed[block] = true;
+    for (size_t idx = 0; idx < builder->incomplete_count;)
+    {
+        struct IncompletePhi const phi = builder->incomplete[idx];
+        if (phi.block != block)
+        {
+            ++idx;
+            continue;
+        }
+        builder->incomplete[idx] = builder->incomplete[--builder->incomplete_count];
+        add_phi_operands(builder, phi.variable, phi.phi);
+    }
+}
+
+static void translate_block(struct SsaBuilder* builder, uint32_t block)
+{
+    seal_if_ready(builder, block);
+    struct TapeBlock const* tape_block = &builder->tape_blocks[builder->tape_block_of[block]];
+    union Bytecode const* tape = builder->vm->tape.data;
+    uint32_t* stack = builder->stack;
+    uint32_t const frame_size = builder->frame_size;
+    uint32_t depth = builder->entry_depths[block];
+    for (uint32_t slot = 0; slot < depth; ++slot) stack[slot] = read_variable(builder, frame_size + slot, block);
+
+    uint32_t result = SSA_NONE;
+    for (size_t position = tape_block->start; position < tape_block->end;
+        position += instruction_width(tape[position].op))
+    {
+        enum BytecodeOp const op = tape[position].op;
+        int32_t const operand = is_op_double_width(op) ? tape[position + 1].value : 0;
+        uint32_t const variable = operand / (int32_t) sizeof(int32_t);
+        switch (op)
+        {
+            case PUSH:
+                stack[depth++] = add_instruction(builder, SSA_CONST, block, operand, SSA_NONE, SSA_NONE);
+                break;
+            case POP:
+                --depth;
+                break;
+            case LOAD:
+                stack[depth++] = read_variable(builder, variable, block);
+                break;
+            case STORE:
+                write_variable(builder, variable, block, stack[--depth]);
+                break;
+            case STORE_KEEP:
+                write_variable(builder, variable, block, stack[depth - 1]);
+                break;
+            case NOT:
+            case NEG:
+            case BIT_NOT:
+                stack[depth - 1] = add_instruction(builder, SSA_OPS[op], block, 0, stack[depth - 1], SSA_NONE);
+                break;
+            case ADD_IMM:
+            {
+                uint32_t const constant = add_instruction(builder, SSA_CONST, block, operand, SSA_NONE, SSA_NONE);
+                stack[depth - 1] = add_instruction(builder, SSA_ADD, block, 0, stack[depth - 1], constant);
+                break;
+            }
+            case LOAD_ADD:
+            {
+                uint32_t const value = read_variable(builder, variable, block);
+                stack[depth - 1] = add_instruction(builder, SSA_ADD, block, 0, stack[depth - 1], value);
+                break;
+            }
+            case JZ:
+            case JNZ:
+            case RET:
+                result = stack[--depth];
+                break;
+            case JMP:
+            case CALL:
+                break;
+            default:
+            {
+                uint32_t const right = stack[--depth];
+                stack[depth - 1] = add_instruction(builder, SSA_OPS[op], block, 0, stack[depth - 1], right);
+                break;
+            }
+        }
+    }
+    if (tape_block->returns_zero) result = add_instruction(builder, SSA_CONST, block, 0, SSA_NONE, SSA_NONE);
+    struct SsaBlock* ssa_block = &builder->function->blocks.data[block];
+    ssa_block->value = result;
+    if (ssa_block->terminator != SSA_RETURN)
+    {
+        for (uint32_t slot = 0; slot < depth; ++slot) write_variable(builder, frame_size + slot, block, stack[slot]);
+    }
+    builder->filled[block] = true;
+    for (size_t successor = 0; successor < 2; ++successor)
+    {
+        if (ssa_block->successors[successor] != SSA_NONE) seal_if_ready(builder, ssa_block->successors[successor]);
+    }
+}
+
+// Sorts the instructions by block, phis first, leaves out the trivial phis
+// and renumbers the values
+static void compact(struct SsaBuilder* builder)
+{
+    struct SsaFunction* function = builder->function;
+    size_t const count = function->instructions.size;
+    size_t const block_count = function->blocks.size;
+    struct SsaInstruction const* instructions = function->instructions.data;
+    uint32_t* positions = cc_malloc((block_count * 2 + 1) * sizeof(uint32_t));
+    for (size_t value = 0; value < count; ++value)
+    {
+        if (builder->replacements.data[value] != value) continue;
+        ++positions[instructions[value].block * 2 + (instructions[value].op != SSA_PHI) + 1];
+    }
+    for (size_t key = 1; key <= block_count * 2; ++key) positions[key] += positions[key - 1];
+    size_t const live = positions[block_count * 2];
+    for (size_t block = 0; block < block_count; ++block)
+    {
+        function->blocks.data[block].first_instruction = positions[block * 2];
+        function->blocks.data[block].instruction_count = positions[block * 2 + 2] - positions[block * 2];
+    }
+
+    uint32_t* renumbered = cc_malloc(count * sizeof(uint32_t));
+    uint32_t* original = cc_malloc((live + 1) * sizeof(uint32_t));
+    for (size_t value = 0; value < count; ++value)
+    {
+        if (builder->replacements.data[value] != value) continue;
+        uint32_t const position = positions[instructions[value].block * 2 + (instructions[value].op != SSA_PHI)]++;
+        renumbered[value] = position;
+        original[position] = value;
+    }
+#define RENUMBER(value) ((value) == SSA_NONE ? SSA_NONE : renumbered[resolve(builder, (value))])
+    struct SsaInstructions result = {
+        .data = cc_malloc((live + 1) * sizeof(struct SsaInstruction)),
+        .size = live,
+        .max_capacity = live + 1
+    };
+    struct SsaValues phi_operands = new_ssa_values();
+    for (size_t value = 0; value < live; ++value)
+    {
+        struct SsaInstruction instruction = instructions[original[value]];
+        instruction.operands[0] = RENUMBER(instruction.operands[0]);
+        instruction.operands[1] = RENUMBER(instruction.operands[1]);
+        if (instruction.op == SSA_PHI)
+        {
+            uint32_t const first = phi_operands.size;
+            for (size_t idx = 0; idx < function->blocks.data[instruction.block].predecessor_count; ++idx)
+            {
+                uint32_t const operand = RENUMBER(function->phi_operands.data[instruction.constant + idx]);
+                add_ssa_value(&phi_operands, &operand);
+            }
+            instruction.constant = first;
+        }
+        result.data[value] = instruction;
+    }
+    for (size_t block = 0; block < block_count; ++block)
+    {
+        function->blocks.data[block].value = RENUMBER(function->blocks.data[block].value);
+    }
+#undef RENUMBER
+    free(function->instructions.data);
+    free(function->phi_operands.data);
+    function->instructions = result;
+    function->phi_operands = phi_operands;
+    free(positions);
+    free(renumbered);
+    free(original);
+}
+
+char* build_ssa(struct VirtualMachineCode const* vm, struct SsaFunction* function)
+{
+    *function = (struct SsaFunction) {
+        .symbol = vm->symbol,
+        .blocks = new_ssa_blocks(),
+        .instructions = new_ssa_instructions(),
+        .phi_operands = new_ssa_values()
+    };
+    struct SsaBuilder builder = {.vm = vm, .function = function, .replacements = new_ssa_values()};
+    char* error = split_blocks(&builder);
+    size_t max_depth = 0;
+    if (error == NULL)
+    {
+        order_blocks(&builder);
+        error = compute_depths(&builder, &max_depth);
+    }
+    if (error == NULL)
+    {
+        size_t const block_count = function->blocks.size;
+        builder.stack = cc_malloc((max_depth + 1) * sizeof(uint32_t));
+        builder.definitions = cc_malloc(block_count * sizeof(struct HashMap));
+        builder.sealed = cc_malloc(block_count * sizeof(bool));
+        builder.filled = cc_malloc(block_count * sizeof(bool));
+        builder.filled_predecessors = cc_malloc(block_count * sizeof(uint32_t));
+        for (size_t block = 0; block < block_count; ++block) builder.definitions[block] = new_hashmap();
+        for (size_t block = 0; block < block_count; ++block) translate_block(&builder, block);
+        assert(builder.incomplete_count == 0);
+        // Removing a phi can make the phis using it trivial
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (size_t value = 0; value < function->instructions.size; ++value)
+            {
+                if (function->instructions.data[value].op != SSA_PHI || builder.replacements.data[value] != value) continue;
+                changed |= remove_trivial_phi(&builder, value) != value;
+            }
+        }
+        compact(&builder);
+        for (size_t block = 0; block < block_count; ++block) free(builder.definitions[block].data);
+    }
+    free(builder.tape_blocks);
+    free(builder.tape_block_of);
+    free(builder.entry_depths);
+    free(builder.stack);
+    free(builder.definitions);
+    free(builder.sealed);
+    free(builder.filled);
+    free(builder.filled_predecessors);
+    free(builder.incomplete);
+    free(builder.replacements.data);
+    if (error == NULL) return NULL;
+
+    char* message = format("Can not build SSA of %s: %s", symbol_name(vm->symbol), error);
+    free(error);
+    free_ssa_function(function);
+    return message;
+}
+
+void free_ssa_function(struct SsaFunction* function)
+{
+    free(function->blocks.data);
+    free(function->instructions.data);
+    free(function->phi_operands.data);
+    free(function->predecessors.data);
+    *function = (struct SsaFunction) {0};
+}
+
+size_t ssa_operand_count(enum SsaOp op)
+{
+    if (op == SSA_CONST || op == SSA_UNDEF || op == SSA_PHI) return 0;
+    return op == SSA_NOT || op == SSA_NEG || op == SSA_BIT_NOT ? 1 : 2;
+}
+
+struct ExpressionOrder
+{
+    struct SsaFunction const* function;
+    bool* subtrees; // Per value: has a single use, by an instruction in its own block
+    uint32_t* needs; // Per value, registers it takes to compute it with its subtrees
+    uint32_t* order; // Old value at each new position
+    size_t count;
+    uint32_t* stack; // Values shifted left, the low bit set once their operands are placed
+};
+
+// Operands first, the one that needs more registers before the other. Trees
+// can be as deep as the expressions in the source, so no recursion.
+static void place_tree(struct ExpressionOrder* ordering, uint32_t root)
+{
+    uint32_t const* needs = ordering->needs;
+    size_t depth = 0;
+    ordering->stack[depth++] = root << 1;
+    while (depth != 0)
+    {
+        uint32_t const entry = ordering->stack[--depth];
+        uint32_t const value = entry >> 1;
+        if (entry & 1)
+        {
+            ordering->order[ordering->count++] = value;
+            continue;
+        }
+        ordering->stack[depth++] = entry | 1;
+        struct SsaInstruction const* instruction = &ordering->function->instructions.data[value];
+        size_t const operand_count = ssa_operand_count(instruction->op);
+        size_t const first = operand_count == 2 && needs[instruction->operands[1]] > needs[instruction->operands[0]];
+        // Pushed in reverse, so the first one comes off first
+        for (size_t idx = operand_count; idx-- > 0;)
+        {
+            uint32_t const operand = instruction->operands[(first + idx) % operand_count];
+            if (ordering->subtrees[operand]) ordering->stack[depth++] = operand << 1;
+        }
+    }
+}
+
+void order_by_register_need(struct SsaFunction* function)
+{
+    size_t const count = function->instructions.size;
+    struct SsaInstruction const* instructions = function->instructions.data;
+    struct ExpressionOrder ordering = {
+        .function = function,
+        .subtrees = cc_malloc(count + 1),
+        .needs = cc_malloc((count + 1) * sizeof(uint32_t)),
+        .order = cc_malloc((count + 1) * sizeof(uint32_t)),
+        .stack = cc_malloc((count + 1) * sizeof(uint32_t))
+    };
+    // Values read by phis and terminators are no subtree, their use count
+    // is pushed past 1
+    uint32_t* uses = cc_malloc((count + 1) * sizeof(uint32_t));
+    for (size_t value = 0; value < count; ++value)
+    {
+        for (size_t operand = 0; operand < ssa_operand_count(instructions[value].op); ++operand)
+        {
+            uint32_t const source = instructions[value].operands[operand];
+            ++uses[source];
+            ordering.subtrees[source] = instructions[source].block == instructions[value].block;
+        }
+    }
+    for (size_t idx = 0; idx < function->phi_operands.size; ++idx) uses[function->phi_operands.data[idx]] += 2;
+    for (size_t block = 0; block < function->blocks.size; ++block)
+    {
+        if (function->blocks.data[block].value != SSA_NONE) uses[function->blocks.data[block].value] += 2;
+    }
+    for (size_t value = 0; value < count; ++value)
+    {
+        ordering.subtrees[value] &= uses[value] == 1 && instructions[value].op != SSA_PHI;
+        // Sethi-Ullman numbers, values computed elsewhere are already in a
+        // location and constants mostly end up in the instruction
+        uint32_t need[2] = {0, 0};
+        for (size_t operand = 0; operand < ssa_operand_count(instructions[value].op); ++operand)
+        {
+            uint32_t const source = instructions[value].operands[operand];
+            if (ordering.subtrees[source]) need[operand] = ordering.needs[source];
+        }
+        ordering.needs[value] = need[0] == need[1] ? need[0] + 1 : need[0] > need[1] ? need[0] : need[1];
+        if (instructions[value].op == SSA_CONST) ordering.needs[value] = 0;
+    }
+    free(uses);
+
+    // Every tree goes where its root was, so roots keep their order
+    for (size_t block = 0; block < function->blocks.size; ++block)
+    {
+        struct SsaBlock const* current = &function->blocks.data[block];
+        for (uint32_t value = current->first_instruction; value < current->first_instruction + current->instruction_count; ++value)
+        {
+            if (!ordering.subtrees[value]) place_tree(&ordering, value);
+        }
+    }
+    assert(ordering.count == count);
+
+    uint32_t* renumbered = cc_malloc((count + 1) * sizeof(uint32_t));
+    for (size_t position = 0; position < count; ++position) renumbered[ordering.order[position]] = position;
+    struct SsaInstruction* reordered = cc_malloc((count + 1) * sizeof(struct SsaInstruction));
+    for (size_t position = 0; position < count; ++position)
+    {
+        struct SsaInstruction instruction = instructions[ordering.order[position]];
+        for (size_t operand = 0; operand < ssa_operand_count(instruction.op); ++operand)
+        {
+            instruction.operands[operand] = renumbered[instruction.operands[operand]];
+        }
+        reordered[position] = instruction;
+    }
+    for (size_t idx = 0; idx < function->phi_operands.size; ++idx)
+    {
+        function->phi_operands.data[idx] = renumbered[function->phi_operands.data[idx]];
+    }
+    for (size_t block = 0; block < function->blocks.size; ++block)
+    {
+        uint32_t* value = &function->blocks.data[block].value;
+        if (*value != SSA_NONE) *value = renumbered[*value];
+    }
+    free(function->instructions.data);
+    function->instructions.data = reordered;
+    function->instructions.max_capacity = count + 1;
+    free(renumbered);
+    free(ordering.subtrees);
+    free(ordering.needs);
+    free(ordering.order);
+    free(ordering.stack);
+}
+
+static char* check_structure(struct SsaFunction const* function)
+{
+    size_t const block_count = function->blocks.size;
+    size_t const value_count = function->instructions.size;
+    struct SsaBlock const* blocks = function->blocks.data;
+    if (block_count == 0) return format("no blocks");
+    if (blocks[0].predecessor_count != 0) return format("the entry block has predecessors");
+
+    size_t expected = 0;
+    for (size_t block = 0; block < block_count; ++block)
+    {
+        struct SsaBlock const* current = &blocks[block];
+        if (current->first_instruction != expected) return format("instructions of b%zu are not after the previous block", block);
+        expected += current->instruction_count;
+        if (expected > value_count) return format("instructions of b%zu are out of range", block);
+        if ((size_t) current->first_predecessor + current->predecessor_count > function->predecessors.size)
+        {
+            return format("predecessors of b%zu are out of range", block);
+        }
+        if (block != 0 && current->predecessor_count == 0) return format("b%zu has no predecessors", block);
+
+        bool const has_value = current->terminator != SSA_JUMP;
+        size_t const successor_count = current->terminator == SSA_RETURN ? 0 : current->terminator == SSA_JUMP ? 1 : 2;
+        if (current->terminator > SSA_BRANCH) return format("unknown terminator of b%zu", block);
+        if (has_value != (current->value < value_count) || (!has_value && current->value != SSA_NONE))
+        {
+            return format("bad terminator value of b%zu", block);
+        }
+        for (size_t successor = 0; successor < 2; ++successor)
+        {
+            uint32_t const target = current->successors[successor];
+            if (successor < successor_count ? target >= block_count : target != SSA_NONE)
+            {
+                return format("bad successor of b%zu", block);
+            }
+        }
+
+        bool body = false;
+        for (size_t value = current->first_instruction; value < expected; ++value)
+        {
+            struct SsaInstruction const* instruction = &function->instructions.data[value];
+            if (instruction->block != block) return format("v%zu is in b%zu but says b%u", value, block, instruction->block);
+            if (instruction->op >= SSA_OP_COUNT) return format("v%zu has an unknown op", value);
+            body |= instruction->op != SSA_PHI;
+            if (body && instruction->op == SSA_PHI) return format("phi v%zu is not at the start of b%zu", value, block);
+            if (instruction->op == SSA_PHI && (instruction->constant < 0
+                || (size_t) instruction->constant + current->predecessor_count > function->phi_operands.size))
+            {
+                return format("operands of phi v%zu are out of range", value);
+            }
+            for (size_t operand = 0; operand < 2; ++operand)
+            {
+                uint32_t const used = instruction->operands[operand];
+                if (operand < ssa_operand_count(instruction->op) ? used >= value_count : used != SSA_NONE)
+                {
+                    return format("bad operand %zu of v%zu", operand, value);
+                }
+            }
+        }
+    }
+    if (expected != value_count) return format("instructions after the last block");
+
+    // Every edge appears once in the successors and once in the predecessors.
+    // Counted per block and successor in one pass, joins can have thousands
+    // of predecessors.
+    uint32_t* found = cc_malloc((block_count * 2 + 1) * sizeof(uint32_t));
+    for (size_t block = 0; block < block_count; ++block)
+    {
+        for (size_t idx = 0; idx < blocks[block].predecessor_count; ++idx)
+        {
+            uint32_t const predecessor = function->predecessors.data[blocks[block].first_predecessor + idx];
+            if (predecessor >= block_count
+                || (blocks[predecessor].successors[0] != block && blocks[predecessor].successors[1] != block))
+            {
+                free(found);
+                return format("b%zu lists b%u as a predecessor without an edge", block, predecessor);
+            }
+            ++found[predecessor * 2 + (blocks[predecessor].successors[0] == block ? 0 : 1)];
+        }
+    }
+    char* error = NULL;
+    for (size_t block = 0; block < block_count && error == NULL; ++block)
+    {
+        for (size_t successor = 0; successor < 2 && error == NULL; ++successor)
+        {
+            uint32_t const target = blocks[block].successors[successor];
+            // Both edges to the same block are counted with the first one
+            if (target == SSA_NONE || (successor == 1 && target == blocks[block].successors[0])) continue;
+            size_t edges = (blocks[block].successors[0] == target) + (blocks[block].successors[1] == target);
+            if (found[block * 2 + successor] != edges)
+            {
+                error = format("edge b%zu -> b%u does not match the predecessors of b%u", block, target, target);
+            }
+        }
+    }
+    free(found);
+    if (error != NULL) return error;
+    for (size_t idx = 0; idx < function->phi_operands.size; ++idx)
+    {
+        if (function->phi_operands.data[idx] >= value_count) return format("bad phi operand %zu", idx);
+    }
+    return NULL;
+}
+
+// Dominator tree numbered in depth-first order, a block dominates the blocks
+// numbered from its own number up to the last one in its subtree
+struct DominatorTree
+{
+    uint32_t* first;
+    uint32_t* last;
+};
+
+static bool dominates(struct DominatorTree const* tree, uint32_t dominator, uint32_t block)
+{
+    return tree->first[dominator] <= tree->first[block] && tree->first[block] <= tree->last[dominator];
+}
+
+// Constant time queries, walking up the tree costs its depth for every use
+// and a chain of joins is as deep as it is long
+static struct DominatorTree number_dominator_tree(uint32_t const* dominators, uint32_t const* by_order, size_t block_count)
+{
+    struct DominatorTree tree = {
+        .first = cc_malloc(block_count * sizeof(uint32_t)),
+        .last = cc_malloc(block_count * sizeof(uint32_t))
+    };
+    // Subtree sizes first, children come after their dominator in reverse post-order
+    for (size_t idx = block_count; idx-- > 0;)
+    {
+        uint32_t const block = by_order[idx];
+        ++tree.last[block];
+        if (idx != 0) tree.last[dominators[block]] += tree.last[block];
+    }
+    // Where the next child of every block starts
+    uint32_t* next = cc_malloc(block_count * sizeof(uint32_t));
+    for (size_t idx = 0; idx < block_count; ++idx)
+    {
+        uint32_t const block = by_order[idx];
+        if (idx != 0)
+        {
+            tree.first[block] = next[dominators[block]];
+            next[dominators[block]] += tree.last[block];
+        }
+        next[block] = tree.first[block] + 1;
+        tree.last[block] += tree.first[block] - 1;
+    }
+    free(next);
+    return tree;
+}
+
+// Immediate dominators with Cooper, Harvey and Kennedy's "A Simple, Fast
+// Dominance Algorithm", then every use is checked against its definition
+static char* check_dominance(struct SsaFunction const* function)
+{
+    size_t const block_count = function->blocks.size;
+    struct SsaBlock const* blocks = function->blocks.data;
+    // Reverse post-order numbers, not trusting the block order
+    uint32_t* order = cc_malloc(block_count * sizeof(uint32_t));
+    uint32_t* by_order = cc_malloc(block_count * sizeof(uint32_t));
+    uint32_t* path = cc_malloc(block_count * sizeof(uint32_t));
+    uint8_t* next_successor = cc_malloc(block_count);
+    bool* visited = cc_malloc(block_count * sizeof(bool));
+    size_t numbered = block_count;
+    size_t depth = 0;
+    path[depth++] = 0;
+    visited[0] = true;
+    while (depth != 0)
+    {
+        uint32_t const block = path[depth - 1];
+        if (next_successor[block] == 2)
+        {
+            order[block] = --numbered;
+            by_order[numbered] = block;
+            --depth;
+            continue;
+        }
+        uint32_t const successor = blocks[block].successors[next_successor[block]++];
+        if (successor == SSA_NONE || visited[successor]) continue;
+        visited[successor] = true;
+        path[depth++] = successor;
+    }
+    free(path);
+    free(next_successor);
+    char* error = NULL;
+    for (size_t block = 0; block < block_count && error == NULL; ++block)
+    {
+        if (!visited[block]) error = format("b%zu is unreachable", block);
+    }
+    free(visited);
+    if (error != NULL)
+    {
+        free(order);
+        free(by_order);
+        return error;
+    }
+
+    uint32_t* dominators = cc_malloc(block_count * sizeof(uint32_t));
+    dominators[0] = 0;
+    for (size_t block = 1; block < block_count; ++block) dominators[block] = SSA_NONE;
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t idx = 1; idx < block_count; ++idx)
+        {
+            uint32_t const block = by_order[idx];
+            uint32_t dominator = SSA_NONE;
+            for (size_t edge = 0; edge < blocks[block].predecessor_count; ++edge)
+            {
+                uint32_t candidate = function->predecessors.data[blocks[block].first_predecessor + edge];
+                if (dominators[candidate] == SSA_NONE) continue;
+                while (dominator != SSA_NONE && candidate != dominator)
+                {
+                    while (order[candidate] > order[dominator]) candidate = dominators[candidate];
+                    while (order[dominator] > order[candidate]) dominator = dominators[dominator];
+                }
+                dominator = candidate;
+            }
+            if (dominators[block] != dominator)
+            {
+                dominators[block] = dominator;
+                changed = true;
+            }
+        }
+    }
+
+    struct DominatorTree const tree = number_dominator_tree(dominators, by_order, block_count);
+    struct SsaInstruction const* instructions = function->instructions.data;
+    for (size_t value = 0; value < function->instructions.size && error == NULL; ++value)
+    {
+        struct SsaInstruction const* instruction = &instructions[value];
+        struct SsaBlock const* block = &blocks[instruction->block];
+        if (instruction->op == SSA_PHI)
+        {
+            // Has to be available at the end of the predecessor
+            for (size_t edge = 0; edge < block->predecessor_count && error == NULL; ++edge)
+            {
+                uint32_t const used = function->phi_operands.data[instruction->constant + edge];
+                uint32_t const predecessor = function->predecessors.data[block->first_predecessor + edge];
+                if (!dominates(&tree, instructions[used].block, predecessor))
+                {
+                    error = format("v%u does not reach phi v%zu from b%u", used, value, predecessor);
+                }
+            }
+            continue;
+        }
+        for (size_t operand = 0; operand < ssa_operand_count(instruction->op) && error == NULL; ++operand)
+        {
+            uint32_t const used = instruction->operands[operand];
+            bool const available = instructions[used].block == instruction->block
+                ? used < value : dominates(&tree, instructions[used].block, instruction->block);
+            if (!available) error = format("v%u is used by v%zu before it is defined on every path", used, value);
+        }
+    }
+    for (size_t block = 0; block < block_count && error == NULL; ++block)
+    {
+        uint32_t const used = blocks[block].value;
+        if (used != SSA_NONE && !dominates(&tree, instructions[used].block, block))
+        {
+            error = format("v%u is used by the terminator of b%zu before it is defined on every path", used, block);
+        }
+    }
+    free(tree.first);
+    free(tree.last);
+    free(order);
+    free(by_order);
+    free(dominators);
+    return error;
+}
+
+char* verify_ssa(struct SsaFunction const* function)
+{
+    char* error = check_structure(function);
+    if (error == NULL) error = check_dominance(function);
+    if (error == NULL) return NULL;
+
+    char* message = format("Invalid SSA of %s: %s", symbol_name(function->symbol), error);
+    free(error);
+    return message;
+}
+
+void print_ssa(struct SsaFunction const* function)
+{
+    printf("%s:\n", symbol_name(function->symbol));
+    for (size_t idx = 0; idx < function->blocks.size; ++idx)
+    {
+        struct SsaBlock const* block = &function->blocks.data[idx];
+        printf("b%zu:", idx);
+        for (size_t edge = 0; edge < block->predecessor_count; ++edge)
+        {
+            printf("%s b%u", edge == 0 ? " ; from" : ",", function->predecessors.data[block->first_predecessor + edge]);
+        }
+        printf("\n");
+        for (size_t value = block->first_instruction; value < block->first_instruction + block->instruction_count; ++value)
+        {
+            struct SsaInstruction const* instruction = &function->instructions.data[value];
+            printf("\tv%zu = %s", value, SSA_OP_NAMES[instruction->op]);
+            if (instruction->op == SSA_CONST) printf(" %d", instruction->constant);
+            for (size_t edge = 0; instruction->op == SSA_PHI && edge < block->predecessor_count; ++edge)
+            {
+                printf("%s [v%u, b%u]", edge == 0 ? "" : ",", function->phi_operands.data[instruction->constant + edge],
+                    function->predecessors.data[block->first_predecessor + edge]);
+            }
+            for (size_t operand = 0; operand < ssa_operand_count(instruction->op); ++operand)
+            {
+                printf("%s v%u", operand == 0 ? "" : ",", instruction->operands[operand]);
+            }
+            printf("\n");
+        }
+        switch (block->terminator)
+        {
+            case SSA_RETURN:
+                printf("\tret v%u\n", block->value);
+                break;
+            case SSA_JUMP:
+                printf("\tjmp b%u\n", block->successors[0]);
+                break;
+            case SSA_BRANCH:
+                printf("\tbr v%u, b%u, b%u\n", block->value, block->successors[0], block->successors[1]);
+                break;
+        }
+    }
+}
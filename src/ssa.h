@@ -0,0 +1,101 @@
+#pragma once
+#include <stdint.h>
+#include "bytecode.h"
+
+// Register based form of a function. Every value is defined exactly once, by
+// the instruction with the same index, and values that meet at a join point
+// go through phi instructions. Built from the bytecode tape: variables and
+// operand stack slots both become values, so passes see explicit data flow
+// instead of LOAD/STORE and an implicit stack.
+//
+// Blocks are in reverse post-order, the entry is block 0. Each one owns a
+// contiguous range of instructions, phis first, and ends with a terminator,
+// which is not an instruction and defines no value. Blocks the tape can not
+// reach are dropped.
+
+#define SSA_NONE UINT32_MAX
+
+enum SsaOp
+{
+    SSA_CONST, // `constant`
+    SSA_UNDEF, // Variable read before any assignment, any value will do
+    SSA_PHI, // One operand per predecessor, in the order of the block's predecessors
+    // operands[0]
+    SSA_NOT,
+    SSA_NEG,
+    SSA_BIT_NOT,
+    // operands[0], operands[1], same meaning as on the tape
+    SSA_ADD,
+    SSA_SUB,
+    SSA_MUL,
+    SSA_DIV,
+    SSA_REM,
+    SSA_LSHIFT,
+    SSA_RSHIFT,
+    SSA_BIT_AND,
+    SSA_BIT_OR,
+    SSA_BIT_XOR,
+    SSA_EQ,
+    SSA_NE,
+    SSA_LT,
+    SSA_LE,
+    SSA_GT,
+    SSA_GE,
+};
+
+struct SsaInstruction
+{
+    uint8_t op; // enum SsaOp
+    uint32_t block;
+    // SSA_CONST: the value, SSA_PHI: index of the first operand in phi_operands
+    int32_t constant;
+    uint32_t operands[2]; // Values, SSA_NONE if unused
+};
+
+enum SsaTerminator
+{
+    SSA_RETURN, // `value`
+    SSA_JUMP, // To successors[0]
+    SSA_BRANCH, // To successors[0] if `value` is not 0, to successors[1] otherwise
+};
+
+struct SsaBlock
+{
+    uint32_t first_instruction;
+    uint32_t instruction_count;
+    uint32_t first_predecessor; // Index into predecessors, one entry per incoming edge
+    uint32_t predecessor_count;
+    uint8_t terminator; // enum SsaTerminator
+    uint32_t value;
+    uint32_t successors[2]; // SSA_NONE if unused
+};
+
+DEFINE_NEW_DYN_ARRAY(SsaInstructions, struct SsaInstruction, new_ssa_instructions, add_ssa_instruction);
+DEFINE_NEW_DYN_ARRAY(SsaBlocks, struct SsaBlock, new_ssa_blocks, add_ssa_block);
+DEFINE_NEW_DYN_ARRAY(SsaValues, uint32_t, new_ssa_values, add_ssa_value);
+
+struct SsaFunction
+{
+    uint32_t symbol; // Interned function name
+    struct SsaBlocks blocks;
+    struct SsaInstructions instructions;
+    struct SsaValues phi_operands;
+    struct SsaValues predecessors; // Blocks
+};
+
+// Values in `operands`, phis have theirs in phi_operands
+size_t ssa_operand_count(enum SsaOp op);
+// Returns NULL, or a message (to be freed) if the tape is malformed
+char* build_ssa(struct VirtualMachineCode const* vm, struct SsaFunction* function);
+void free_ssa_function(struct SsaFunction* function);
+// Sethi-Ullman order: a value with a single use by an instruction of its own
+// block is a subtree of that instruction. Every block is reordered so that
+// each tree is computed right before its root, and of two operand subtrees
+// the one that needs more registers goes first, which keeps fewer values
+// live at once. Values are renumbered.
+void order_by_register_need(struct SsaFunction* function);
+// Checks the structure described above and that every value is defined on all
+// paths to its uses (the definition dominates them). Returns NULL if it holds,
+// a message (to be freed) otherwise.
+char* verify_ssa(struct SsaFunction const* function);
+void print_ssa(struct SsaFunction const* function);
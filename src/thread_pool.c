@@ -0,0 +1,207 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "thread_pool.h"
+#include "utils.h"
+
+// Remaining part of one thread's share of the loop, [begin, end)
+struct WorkRange
+{
+    pthread_mutex_t lock;
+    size_t begin;
+    size_t end;
+};
+
+struct ThreadPool
+{
+    size_t thread_count; // Including the thread calling thread_pool_for
+    pthread_t* threads;
+    struct WorkRange* ranges;
+
+    pthread_mutex_t lock;
+    pthread_cond_t job_ready;
+    pthread_cond_t job_done;
+    uint64_t generation; // Bumped for every loop
+    size_t busy_workers;
+    bool stopping;
+
+    void (*task)(void* context, size_t idx);
+    void* context;
+};
+
+struct WorkerStart
+{
+    struct ThreadPool* pool;
+    size_t worker_idx;
+};
+
+static bool take_own(struct WorkRange* range, size_t* idx)
+{
+    pthread_mutex_lock(&range->lock);
+    bool const found = range->begin < range->end;
+    if (found) *idx = range->begin++;
+    pthread_mutex_unlock(&range->lock);
+    return found;
+}
+
+// Moves the back half of a victim's range (at least one item) into our own
+static bool steal(struct ThreadPool* pool, size_t thief)
+{
+    for (size_t offset = 1; offset < pool->thread_count; ++offset)
+    {
+        struct WorkRange* victim = &pool->ranges[(thief + offset) % pool->thread_count];
+        pthread_mutex_lock(&victim->lock);
+        size_t const left = victim->end - victim->begin;
+        if (victim->begin >= victim->end)
+        {
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+        size_t const stolen_begin = victim->end - (left + 1) / 2;
+        size_t const stolen_end = victim->end;
+        victim->end = stolen_begin;
+        pthread_mutex_unlock(&victim->lock);
+
+        struct WorkRange* own = &pool->ranges[thief];
+        pthread_mutex_lock(&own->lock);
+        own->begin = stolen_begin;
+        own->end = stolen_end;
+        pthread_mutex_unlock(&own->lock);
+        return true;
+    }
+    return false;
+}
+
+static void run_loop(struct ThreadPool* pool, size_t worker_idx)
+{
+    for (;;)
+    {
+        size_t idx;
+        if (take_own(&pool->ranges[worker_idx], &idx))
+        {
+            pool->task(pool->context, idx);
+        }
+        else if (!steal(pool, worker_idx))
+        {
+            // Everything left is already being worked on
+            return;
+        }
+    }
+}
+
+static void* worker_main(void* argument)
+{
+    struct WorkerStart start = *(struct WorkerStart*) argument;
+    free(argument);
+    struct ThreadPool* pool = start.pool;
+    uint64_t seen_generation = 0;
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->generation == seen_generation && !pool->stopping)
+        {
+            pthread_cond_wait(&pool->job_ready, &pool->lock);
+        }
+        if (pool->stopping)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen_generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_loop(pool, start.worker_idx);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy_workers == 0) pthread_cond_signal(&pool->job_done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+struct ThreadPool* new_thread_pool(size_t thread_count)
+{
+    assert(thread_count != 0);
+    struct ThreadPool* pool = cc_malloc(sizeof(struct ThreadPool));
+    pool->thread_count = thread_count;
+    pool->threads = cc_malloc(thread_count * sizeof(pthread_t));
+    pool->ranges = cc_malloc(thread_count * sizeof(struct WorkRange));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->job_ready, NULL);
+    pthread_cond_init(&pool->job_done, NULL);
+    for (size_t idx = 0; idx < thread_count; ++idx)
+    {
+        pthread_mutex_init(&pool->ranges[idx].lock, NULL);
+    }
+    // Worker 0 is whoever calls thread_pool_for
+    for (size_t idx = 1; idx < thread_count; ++idx)
+    {
+        struct WorkerStart* start = cc_malloc(sizeof(struct WorkerStart));
+        *start = (struct WorkerStart) {pool, idx};
+        if (pthread_create(&pool->threads[idx], NULL, worker_main, start) != 0)
+        {
+            printf("Failed to start worker thread %zu\n", idx);
+            exit(1);
+        }
+    }
+    return pool;
+}
+
+void free_thread_pool(struct ThreadPool* pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->job_ready);
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t idx = 1; idx < pool->thread_count; ++idx)
+    {
+        pthread_join(pool->threads[idx], NULL);
+    }
+    for (size_t idx = 0; idx < pool->thread_count; ++idx)
+    {
+        pthread_mutex_destroy(&pool->ranges[idx].lock);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->job_ready);
+    pthread_cond_destroy(&pool->job_done);
+    free(pool->ranges);
+    free(pool->threads);
+    free(pool);
+}
+
+size_t thread_pool_size(struct ThreadPool const* pool)
+{
+    return pool->thread_count;
+}
+
+void thread_pool_for(struct ThreadPool* pool, size_t count, void (*task)(void* context, size_t idx), void* context)
+{
+    if (count == 0) return;
+    pool->task = task;
+    pool->context = context;
+    // Contiguous, equal shares to start with
+    for (size_t idx = 0; idx < pool->thread_count; ++idx)
+    {
+        pthread_mutex_lock(&pool->ranges[idx].lock);
+        pool->ranges[idx].begin = count * idx / pool->thread_count;
+        pool->ranges[idx].end = count * (idx + 1) / pool->thread_count;
+        pthread_mutex_unlock(&pool->ranges[idx].lock);
+    }
+    if (pool->thread_count == 1)
+    {
+        run_loop(pool, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->busy_workers = pool->thread_count - 1;
+    ++pool->generation;
+    pthread_cond_broadcast(&pool->job_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_loop(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy_workers != 0) pthread_cond_wait(&pool->job_done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <stddef.h>
+
+// Fixed set of worker threads running parallel loops. Every thread owns a
+// range of the loop and takes items from its front, a thread that runs out
+// steals the back half of someone else's range. The calling thread works too,
+// so a pool of 1 thread runs everything inline.
+struct ThreadPool;
+
+struct ThreadPool* new_thread_pool(size_t thread_count);
+void free_thread_pool(struct ThreadPool* pool);
+size_t thread_pool_size(struct ThreadPool const* pool);
+
+// Calls task(context, idx) for every idx in [0, count) and returns when all
+// of them finished. Items run in no particular order and on any thread, so
+// tasks should write their results into per-index slots. Not reentrant:
+// a task must not start another loop on the same pool.
+void thread_pool_for(struct ThreadPool* pool, size_t count, void (*task)(void* context, size_t idx), void* context);
@@ -1,7 +1,11 @@
 #include "utils.h"
+#include <pthread.h>
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 
 void* cc_malloc(size_t sz)
 {
@@ -10,6 +14,130 @@ void* cc_malloc(size_t sz)
     return alloc;
 }
 
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGNMENT 16
+
+struct ArenaBlock
+{
+    struct ArenaBlock* previous;
+    size_t size;
+    size_t used;
+    _Alignas(ARENA_ALIGNMENT) char data[];
+};
+
+// Standard sized blocks of released arenas are kept for the next arena, so
+// compiling many inputs in one process does not go back to malloc for every
+// AST. Shared by all threads.
+#define BLOCK_POOL_LIMIT 1024
+
+static struct BlockPool
+{
+    pthread_mutex_t lock;
+    struct ArenaBlock* free_blocks; // Linked through `previous`
+    size_t count;
+    size_t reused;
+} block_pool = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static struct ArenaBlock* new_block(size_t size)
+{
+    struct ArenaBlock* block = NULL;
+    if (size == ARENA_BLOCK_SIZE)
+    {
+        pthread_mutex_lock(&block_pool.lock);
+        block = block_pool.free_blocks;
+        if (block != NULL)
+        {
+            block_pool.free_blocks = block->previous;
+            --block_pool.count;
+            ++block_pool.reused;
+        }
+        pthread_mutex_unlock(&block_pool.lock);
+    }
+    if (block == NULL) block = cc_malloc(sizeof(struct ArenaBlock) + size);
+    block->size = size;
+    return block;
+}
+
+static void recycle_block(struct ArenaBlock* block)
+{
+    if (block->size == ARENA_BLOCK_SIZE)
+    {
+        // Arena memory is handed out zeroed
+        memset(block->data, 0, block->used);
+        block->used = 0;
+        pthread_mutex_lock(&block_pool.lock);
+        bool const keep = block_pool.count < BLOCK_POOL_LIMIT;
+        if (keep)
+        {
+            block->previous = block_pool.free_blocks;
+            block_pool.free_blocks = block;
+            ++block_pool.count;
+        }
+        pthread_mutex_unlock(&block_pool.lock);
+        if (keep) return;
+    }
+    free(block);
+}
+
+size_t arena_blocks_reused()
+{
+    pthread_mutex_lock(&block_pool.lock);
+    size_t reused = block_pool.reused;
+    pthread_mutex_unlock(&block_pool.lock);
+    return reused;
+}
+
+struct Arena new_arena(char const* name)
+{
+    return (struct Arena) {.name = name};
+}
+
+void* arena_alloc(struct Arena* arena, size_t sz)
+{
+    sz = (sz + ARENA_ALIGNMENT - 1) & ~(size_t) (ARENA_ALIGNMENT - 1);
+    struct ArenaBlock* block = arena->current;
+    if (block == NULL || block->used + sz > block->size)
+    {
+        size_t block_size = sz > ARENA_BLOCK_SIZE ? sz : ARENA_BLOCK_SIZE;
+        block = new_block(block_size);
+        block->previous = arena->current;
+        arena->current = block;
+        arena->bytes_reserved += block_size;
+        ++arena->block_count;
+    }
+    void* allocation = block->data + block->used;
+    block->used += sz;
+    arena->bytes_used += sz;
+    ++arena->allocation_count;
+    return allocation;
+}
+
+void* arena_grow(struct Arena* arena, void* data, size_t old_sz, size_t new_sz)
+{
+    assert(new_sz >= old_sz);
+    void* allocation = arena_alloc(arena, new_sz);
+    if (old_sz != 0) memcpy(allocation, data, old_sz);
+    return allocation;
+}
+
+void arena_release(struct Arena* arena)
+{
+    struct ArenaBlock* block = arena->current;
+    while (block != NULL)
+    {
+        struct ArenaBlock* previous = block->previous;
+        recycle_block(block);
+        block = previous;
+    }
+    *arena = new_arena(arena->name);
+}
+
+void print_arena_stats(struct Arena const* arena)
+{
+    printf("  %-10s %10zu allocations %12zu bytes used %12zu bytes reserved %6zu blocks\n",
+        arena->name, arena->allocation_count, arena->bytes_used, arena->bytes_reserved, arena->block_count);
+}
+
 struct StringArray new_string_array()
 {
     return (struct StringArray) {
@@ -31,30 +159,46 @@ void add_string(struct StringArray* arr, char const* string)
     ++arr->size;
 }
 
-// Hashing function implemantions from: https://stackoverflow.com/questions/7666509/hash-function-for-string
-static uint32_t murmurOAAT32(const char* key)
+void free_string_array(struct StringArray* arr)
+{
+    for (size_t idx = 0; idx < arr->size; ++idx) free(arr->data[idx]);
+    free(arr->data);
+    *arr = (struct StringArray) {0};
+}
+
+// Word at a time multiply-xorshift hash, the identifier hash is computed only
+// once (when interning), so it mostly has to be cheap for short strings
+uint32_t hash_bytes(char const* data, size_t length)
+{
+    uint64_t h = 525201411107845655ull ^ (length * 0x5bd1e9955bd1e995ull);
+    while (length >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        h = (h ^ word) * 0x5bd1e9955bd1e995ull;
+        h ^= h >> 47;
+        data += 8;
+        length -= 8;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, data, length);
+    h = (h ^ tail) * 0x5bd1e9955bd1e995ull;
+    h ^= h >> 47;
+    return (uint32_t) (h ^ (h >> 32));
+}
+
+bool string_view_equal(struct StringView left, struct StringView right)
 {
-  uint32_t h = 3323198485ul;
-  for (;*key;++key) {
-    h ^= *key;
-    h *= 0x5bd1e995;
-    h ^= h >> 15;
-  }
-  return h;
+    return left.length == right.length && memcmp(left.data, right.data, left.length) == 0;
 }
 
-// static uint64_t murmurOAAT64(const char* key)
-// {
-//   uint64_t h = 525201411107845655ull;
-//   for (;*key;++key) {
-//     h ^= *key;
-//     h *= 0x5bd1e9955bd1e995;
-//     h ^= h >> 47;
-//   }
-//   return h;
-// }
+// Fibonacci hashing, keys are small dense integers (interned symbols)
+static size_t hash_key(uint32_t key, size_t capacity)
+{
+    return (key * 2654435769u) & (capacity - 1);
+}
 
-static const int INITAL_HASHMAP_SIZE = 32;
+static const int INITAL_HASHMAP_SIZE = 32; // Has to be a power of 2
 
 struct HashMap new_hashmap()
 {
@@ -72,9 +216,9 @@ static void reallocate_hashmap(struct HashMap* map, size_t new_capacity)
     for (size_t idx = 0; idx < map->capacity; ++idx)
     {
         struct HashmapElem* item = &map->data[idx];
-        if (item->key == NULL) continue;
-        size_t new_index = murmurOAAT32(item->key) % new_capacity;
-        while (new_data[new_index].key != NULL) new_index = (new_index + 1) % new_capacity;
+        if (item->key == 0) continue;
+        size_t new_index = hash_key(item->key, new_capacity);
+        while (new_data[new_index].key != 0) new_index = (new_index + 1) & (new_capacity - 1);
         new_data[new_index] = *item;
     }
     free(map->data);
@@ -82,29 +226,31 @@ static void reallocate_hashmap(struct HashMap* map, size_t new_capacity)
     map->capacity = new_capacity;
 }
 
-void hashmap_insert(struct HashMap* map, const char* key, int32_t value)
+void hashmap_insert(struct HashMap* map, uint32_t key, int32_t value)
 {
-    float load_factor = (float) map->size / map->capacity;
+    assert(key != 0 && "Key 0 marks empty slots");
+    float load_factor = (float) (map->size + 1) / map->capacity;
     if (load_factor > 0.7)
     {
-        reallocate_hashmap(map, map->size * 1.4);
+        reallocate_hashmap(map, map->capacity * 2);
     }
-    size_t index = murmurOAAT32(key) % map->capacity;
-    while (map->data[index].key != NULL) index = (index + 1) % map->capacity;
-    map->data[index] = (struct HashmapElem){ .key = strdup(key), .value = value};
+    size_t index = hash_key(key, map->capacity);
+    while (map->data[index].key != 0) index = (index + 1) & (map->capacity - 1);
+    map->data[index] = (struct HashmapElem){ .key = key, .value = value};
+    ++map->size;
 }
 
-int32_t* hashmap_find(struct HashMap* map, const char* key)
+int32_t* hashmap_find(struct HashMap* map, uint32_t key)
 {
-    size_t index = murmurOAAT32(key) % map->capacity;
-    while (map->data[index].key != NULL)
+    size_t index = hash_key(key, map->capacity);
+    while (map->data[index].key != 0)
     {
         struct HashmapElem* elem = &map->data[index];
-        if (strcmp(elem->key, key) == 0)
+        if (elem->key == key)
         {
             return &elem->value;
         }
-        index = (index + 1) % map->capacity;
+        index = (index + 1) & (map->capacity - 1);
     }
     return NULL;
 }
@@ -125,3 +271,89 @@ char* format(char const* format, ...)
     return message;
 }
 
+
+double now_seconds()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+// Size and modification time of the executable, any relink makes a new build
+static char build_id[96] = "real_c_compiler";
+static pthread_once_t build_id_once = PTHREAD_ONCE_INIT;
+
+static void read_build_id()
+{
+    struct stat status;
+    if (stat("/proc/self/exe", &status) != 0) return;
+    snprintf(build_id, sizeof(build_id), "real_c_compiler %lld %lld.%09ld", (long long) status.st_size,
+        (long long) status.st_mtim.tv_sec, status.st_mtim.tv_nsec);
+}
+
+char const* compiler_build()
+{
+    pthread_once(&build_id_once, read_build_id);
+    return build_id;
+}
+
+struct ErrorGuard
+{
+    jmp_buf resume;
+    char* message;
+    struct ErrorCleanup* cleanups; // Innermost first
+};
+
+static _Thread_local struct ErrorGuard* error_guard = NULL;
+
+void compile_error(char const* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    size_t const size = vsnprintf(NULL, 0, format, args) + 1;
+    va_end(args);
+    char* message = cc_malloc(size);
+    va_start(args, format);
+    vsnprintf(message, size, format, args);
+    va_end(args);
+
+    if (error_guard != NULL)
+    {
+        // The message is complete, its arguments may point into memory they release
+        for (struct ErrorCleanup* cleanup = error_guard->cleanups; cleanup != NULL; cleanup = cleanup->next)
+        {
+            cleanup->release(cleanup->context);
+        }
+        error_guard->message = message;
+        longjmp(error_guard->resume, 1);
+    }
+    printf("%s\n", message);
+    exit(1);
+}
+
+char* run_guarded(void (*body)(void* context), void* context)
+{
+    struct ErrorGuard guard = {.message = NULL, .cleanups = NULL};
+    struct ErrorGuard* volatile outer = error_guard;
+    error_guard = &guard;
+    if (setjmp(guard.resume) == 0)
+    {
+        body(context);
+    }
+    error_guard = outer;
+    return guard.message;
+}
+
+void push_error_cleanup(struct ErrorCleanup* cleanup)
+{
+    if (error_guard == NULL) return;
+    cleanup->next = error_guard->cleanups;
+    error_guard->cleanups = cleanup;
+}
+
+void pop_error_cleanup(struct ErrorCleanup* cleanup)
+{
+    if (error_guard == NULL) return;
+    assert(error_guard->cleanups == cleanup);
+    error_guard->cleanups = cleanup->next;
+}
@@ -1,11 +1,37 @@
 #pragma once
 #include <assert.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 
 void* cc_malloc(size_t sz);
 
+// Bump pointer allocator for data that dies together (e.g. the AST of a
+// compilation unit). Memory is zeroed like cc_malloc and is only released in
+// one shot with arena_release.
+struct ArenaBlock;
+
+struct Arena
+{
+    char const* name; // For statistics
+    struct ArenaBlock* current;
+    size_t allocation_count;
+    size_t bytes_used;
+    size_t bytes_reserved;
+    size_t block_count;
+};
+
+struct Arena new_arena(char const* name);
+void* arena_alloc(struct Arena* arena, size_t sz);
+// Copies the old allocation into a bigger one, the old memory stays in the arena
+void* arena_grow(struct Arena* arena, void* data, size_t old_sz, size_t new_sz);
+// Blocks go back to a pool shared by all arenas
+void arena_release(struct Arena* arena);
+// Blocks taken from that pool instead of malloc, for statistics
+size_t arena_blocks_reused();
+void print_arena_stats(struct Arena const* arena);
+
 struct StringArray 
 {
     char** data;
@@ -16,6 +42,7 @@ struct StringArray
 struct StringArray new_string_array();
 
 void add_string(struct StringArray* arr, char const* string);
+void free_string_array(struct StringArray* arr);
 
 
 
@@ -48,9 +75,24 @@ void ADD_FUNC_NAME(struct ARRAY_NAME* arr, TYPE const* value) \
     ++arr->size; \
 }
 
+// Non-owning, not null terminated piece of a longer string (usually the source buffer)
+struct StringView
+{
+    char const* data;
+    uint32_t length;
+};
+
+// printf("Name: " SV_FMT, SV_ARG(view))
+#define SV_FMT "%.*s"
+#define SV_ARG(view) (int) (view).length, (view).data
+
+bool string_view_equal(struct StringView left, struct StringView right);
+uint32_t hash_bytes(char const* data, size_t length);
+
+// Maps interned symbols (see intern.h) to values
 struct HashmapElem
 {
-    const char* key;
+    uint32_t key; // 0 for empty slots
     int32_t value;
 };
 
@@ -62,13 +104,43 @@ struct HashMap
 };
 
 struct HashMap new_hashmap();
-void hashmap_insert(struct HashMap* map, const char* key, int32_t value);
+void hashmap_insert(struct HashMap* map, uint32_t key, int32_t value);
 // May return null
-int32_t* hashmap_find(struct HashMap* map, const char* key);
-// void hashmap_erase(struct HashMap* map, const char* key);
+int32_t* hashmap_find(struct HashMap* map, uint32_t key);
+// void hashmap_erase(struct HashMap* map, uint32_t key);
 
 __attribute__((format(printf, 1, 2)))
 char* format(char const* format, ...);
 
 #define UNUSED(value) ((void) value)
 
+// Monotonic clock, for throughput numbers
+double now_seconds();
+// Changes with every build, results persisted by another build are not reused
+char const* compiler_build();
+
+// Reports an error in the compiled program. Inside run_guarded the message is
+// kept and control goes back to run_guarded, otherwise it is printed and the
+// process exits.
+__attribute__((noreturn, format(printf, 1, 2)))
+void compile_error(char const* format, ...);
+// Runs body(context) on the calling thread, returns NULL if it finished or the
+// message of the compile_error that stopped it (to be freed by the caller).
+// Memory owned by the interrupted body is only released through cleanups.
+char* run_guarded(void (*body)(void* context), void* context);
+
+// Releases what the code between push and pop owns if a compile_error stops
+// it, so that a long running process (--server) does not leak on failing
+// inputs. Cleanups live on the stack of their owner and nest: the innermost
+// one runs first. Without run_guarded compile_error exits and none of them run.
+struct ErrorCleanup
+{
+    void (*release)(void* context);
+    void* context;
+    struct ErrorCleanup* next;
+};
+
+void push_error_cleanup(struct ErrorCleanup* cleanup);
+// Has to be the last one pushed
+void pop_error_cleanup(struct ErrorCleanup* cleanup);
+
@@ -1,18 +1,694 @@
+#include <stdio.h>
+#include <string.h>
 #include "x86.h"
+#include "intern.h"
+#include "select.h"
 
+IMPLEMENT_NEW_DYN_ARRAY(X86Code, struct X86Instruction, new_x86_code, add_x86_instruction);
 
-void codegen_function(struct VirtualMachineCode const* tape)
+uint8_t const x86_allocatable_registers[X86_ALLOCATABLE_COUNT] = {
+    RSI, RDI, R8, R9, R10, R11, RBX, R12, R13, R14, R15
+};
+
+static uint8_t const callee_saved_registers[] = {RBX, R12, R13, R14, R15};
+
+// Parallel copy on a control flow edge
+struct Move
+{
+    struct X86Operand destination;
+    struct X86Operand source;
+};
+
+// Branch edge whose moves can go neither at the end of its source nor at the
+// start of its target, it gets a block of its own after the function
+struct EdgeStub
+{
+    uint32_t label;
+    uint32_t from;
+    uint32_t to;
+};
+
+struct Lowering
+{
+    struct SsaFunction const* ssa;
+    struct Selection const* selection;
+    struct Allocation const* allocation;
+    struct MachineFunction* machine;
+    int32_t saved_bytes; // Callee saved registers pushed right below rbp
+    int32_t frame_bytes; // Spill slots, below the saved registers
+    struct Move* moves; // Scratch for one edge
+    // Per block and successor, the index of the edge among the predecessors of
+    // the target, joins can have thousands of them
+    uint32_t* edges;
+    struct EdgeStub* stubs;
+    size_t stub_count;
+    size_t stub_capacity;
+};
+
+static struct X86Operand x86_register(uint8_t reg)
+{
+    return (struct X86Operand) {.kind = X86_REGISTER, .value = reg};
+}
+
+static struct X86Operand x86_immediate(int32_t value)
+{
+    return (struct X86Operand) {.kind = X86_IMMEDIATE, .value = value};
+}
+
+static struct X86Operand x86_label(uint32_t label)
+{
+    return (struct X86Operand) {.kind = X86_LABEL, .value = label};
+}
+
+static bool same_operand(struct X86Operand left, struct X86Operand right)
+{
+    return left.kind == right.kind && left.value == right.value;
+}
+
+static void emit(struct Lowering* lowering, enum X86Op op, struct X86Operand destination, struct X86Operand source)
+{
+    struct X86Instruction instruction = {.op = op, .destination = destination, .source = source};
+    add_x86_instruction(&lowering->machine->code, &instruction);
+}
+
+static void emit_wide(struct Lowering* lowering, enum X86Op op, struct X86Operand destination, struct X86Operand source)
+{
+    struct X86Instruction instruction = {.op = op, .wide = true, .destination = destination, .source = source};
+    add_x86_instruction(&lowering->machine->code, &instruction);
+}
+
+static void emit_condition(struct Lowering* lowering, enum X86Op op, enum X86Condition condition,
+    struct X86Operand destination)
+{
+    struct X86Instruction instruction = {.op = op, .condition = condition, .destination = destination};
+    add_x86_instruction(&lowering->machine->code, &instruction);
+}
+
+static struct X86Operand slot_operand(struct Lowering const* lowering, uint32_t value)
+{
+    assert(lowering->allocation->slots[value] != SSA_NONE);
+    int32_t const offset = lowering->saved_bytes + 4 * (int32_t) (lowering->allocation->slots[value] + 1);
+    return (struct X86Operand) {.kind = X86_FRAME, .value = offset};
+}
+
+static struct X86Operand location(struct Lowering const* lowering, uint32_t value, uint32_t position)
+{
+    uint8_t const reg = register_at(lowering->allocation, value, position);
+    return reg != NO_REGISTER ? x86_register(reg) : slot_operand(lowering, value);
+}
+
+// Constants reach phis and return values as immediates
+static struct X86Operand value_location(struct Lowering const* lowering, uint32_t value, uint32_t position)
+{
+    struct SsaInstruction const* instruction = &lowering->ssa->instructions.data[value];
+    if (instruction->op == SSA_CONST) return x86_immediate(instruction->constant);
+    return location(lowering, value, position);
+}
+
+static struct X86Operand operand_location(struct Lowering const* lowering, uint32_t value, size_t operand,
+    uint32_t position)
+{
+    uint32_t const source = lowering->ssa->instructions.data[value].operands[operand];
+    if (is_inline_operand(lowering->selection, value, operand))
+    {
+        return x86_immediate(lowering->ssa->instructions.data[source].constant);
+    }
+    return location(lowering, source, position);
+}
+
+// There is no memory to memory mov, those go through ecx
+static void emit_move(struct Lowering* lowering, struct X86Operand destination, struct X86Operand source)
+{
+    if (same_operand(destination, source)) return;
+    if (destination.kind == X86_FRAME && source.kind == X86_FRAME)
+    {
+        emit(lowering, X86_MOV, x86_register(RCX), source);
+        source = x86_register(RCX);
+    }
+    emit(lowering, X86_MOV, destination, source);
+}
+
+// Every move reads its source before any of them writes, cycles are broken
+// by parking one of the values in eax
+static void emit_parallel_moves(struct Lowering* lowering, struct Move* moves, size_t count)
+{
+    while (count != 0)
+    {
+        size_t ready = count;
+        for (size_t idx = 0; idx < count && ready == count; ++idx)
+        {
+            bool blocked = false;
+            for (size_t other = 0; other < count && !blocked; ++other)
+            {
+                blocked = other != idx && same_operand(moves[other].source, moves[idx].destination);
+            }
+            if (!blocked) ready = idx;
+        }
+        if (ready != count)
+        {
+            emit_move(lowering, moves[ready].destination, moves[ready].source);
+            moves[ready] = moves[--count];
+            continue;
+        }
+        struct X86Operand const parked = moves[0].destination;
+        emit_move(lowering, x86_register(RAX), parked);
+        for (size_t idx = 0; idx < count; ++idx)
+        {
+            if (same_operand(moves[idx].source, parked)) moves[idx].source = x86_register(RAX);
+        }
+    }
+}
+
+// Phi copies, and reloads of the values that are in a register at the start
+// of `to` but only in their slot at the end of `from`
+static size_t collect_edge_moves(struct Lowering* lowering, uint32_t from, uint32_t to)
+{
+    struct SsaFunction const* ssa = lowering->ssa;
+    struct Allocation const* allocation = lowering->allocation;
+    struct SsaBlock const* target = &ssa->blocks.data[to];
+    uint32_t const from_end = allocation->block_ends[from];
+    uint32_t const to_start = allocation->block_starts[to];
+    size_t const edge = lowering->edges[from * 2 + (ssa->blocks.data[from].successors[0] == to ? 0 : 1)];
+
+    size_t count = 0;
+    for (uint32_t phi = target->first_instruction;
+        phi < target->first_instruction + target->instruction_count && ssa->instructions.data[phi].op == SSA_PHI; ++phi)
+    {
+        if (!needs_location(allocation, phi)) continue;
+        uint32_t const operand = ssa->phi_operands.data[ssa->instructions.data[phi].constant + edge];
+        struct Move const move = {location(lowering, phi, to_start), value_location(lowering, operand, from_end)};
+        if (!same_operand(move.destination, move.source)) lowering->moves[count++] = move;
+    }
+    for (uint32_t idx = allocation->live_in_offsets[to]; idx < allocation->live_in_offsets[to + 1]; ++idx)
+    {
+        uint32_t const value = allocation->live_in[idx];
+        if (register_at(allocation, value, to_start) == NO_REGISTER) continue;
+        struct Move const move = {location(lowering, value, to_start), location(lowering, value, from_end)};
+        if (!same_operand(move.destination, move.source)) lowering->moves[count++] = move;
+    }
+    return count;
+}
+
+static void emit_edge_moves(struct Lowering* lowering, uint32_t from, uint32_t to)
+{
+    emit_parallel_moves(lowering, lowering->moves, collect_edge_moves(lowering, from, to));
+}
+
+static uint32_t branch_label(struct Lowering* lowering, uint32_t from, uint32_t to)
+{
+    if (lowering->ssa->blocks.data[to].predecessor_count == 1 || collect_edge_moves(lowering, from, to) == 0) return to;
+    if (lowering->stub_count == lowering->stub_capacity)
+    {
+        lowering->stub_capacity = lowering->stub_capacity * 2 + 4;
+        lowering->stubs = realloc(lowering->stubs, lowering->stub_capacity * sizeof(struct EdgeStub));
+        assert(lowering->stubs);
+    }
+    uint32_t const label = lowering->machine->label_count++;
+    lowering->stubs[lowering->stub_count++] = (struct EdgeStub) {label, from, to};
+    return label;
+}
+
+static void emit_prologue(struct Lowering* lowering)
+{
+    emit_wide(lowering, X86_PUSH, x86_register(RBP), (struct X86Operand) {0});
+    emit_wide(lowering, X86_MOV, x86_register(RBP), x86_register(RSP));
+    for (size_t idx = 0; idx < sizeof(callee_saved_registers); ++idx)
+    {
+        uint8_t const reg = callee_saved_registers[idx];
+        if (lowering->allocation->used_registers & (1u << reg)) emit_wide(lowering, X86_PUSH, x86_register(reg), (struct X86Operand) {0});
+    }
+    if (lowering->frame_bytes != 0) emit_wide(lowering, X86_SUB, x86_register(RSP), x86_immediate(lowering->frame_bytes));
+}
+
+static void emit_epilogue(struct Lowering* lowering)
+{
+    if (lowering->frame_bytes != 0) emit_wide(lowering, X86_ADD, x86_register(RSP), x86_immediate(lowering->frame_bytes));
+    for (size_t idx = sizeof(callee_saved_registers); idx-- > 0;)
+    {
+        uint8_t const reg = callee_saved_registers[idx];
+        if (lowering->allocation->used_registers & (1u << reg)) emit_wide(lowering, X86_POP, x86_register(reg), (struct X86Operand) {0});
+    }
+    emit_wide(lowering, X86_POP, x86_register(RBP), (struct X86Operand) {0});
+    emit(lowering, X86_RET, (struct X86Operand) {0}, (struct X86Operand) {0});
+}
+
+// 0 or 1 from the flags into `destination`
+static void emit_set(struct Lowering* lowering, enum X86Condition condition, struct X86Operand destination)
+{
+    emit_condition(lowering, X86_SETCC, condition, x86_register(RAX));
+    struct X86Operand const widened = destination.kind == X86_REGISTER ? destination : x86_register(RAX);
+    emit(lowering, X86_MOVZX, widened, x86_register(RAX));
+    emit_move(lowering, destination, widened);
+}
+
+static enum X86Op const ALU_OPS[] = {
+    [SSA_ADD] = X86_ADD,
+    [SSA_SUB] = X86_SUB,
+    [SSA_MUL] = X86_IMUL,
+    [SSA_BIT_AND] = X86_AND,
+    [SSA_BIT_OR] = X86_OR,
+    [SSA_BIT_XOR] = X86_XOR,
+};
+
+static enum X86Condition const CONDITIONS[] = {
+    [SSA_EQ] = CC_E,
+    [SSA_NE] = CC_NE,
+    [SSA_LT] = CC_L,
+    [SSA_LE] = CC_LE,
+    [SSA_GT] = CC_G,
+    [SSA_GE] = CC_GE,
+};
+
+// Both operands of a compare trade places
+static enum X86Condition const SWAPPED_CONDITIONS[] = {
+    [CC_E] = CC_E,
+    [CC_NE] = CC_NE,
+    [CC_L] = CC_G,
+    [CC_LE] = CC_GE,
+    [CC_G] = CC_L,
+    [CC_GE] = CC_LE,
+};
+
+static struct X86Operand x86_address(uint8_t base, uint8_t index, uint8_t scale, int32_t displacement)
+{
+    return (struct X86Operand) {.kind = X86_ADDRESS, .base = base, .index = index, .scale = scale, .value = displacement};
+}
+
+// lea only takes registers, values in memory are loaded into `scratch`
+static uint8_t address_register(struct Lowering* lowering, uint32_t value, uint32_t position, uint8_t scratch)
+{
+    if (value == SSA_NONE) return NO_REGISTER;
+    struct X86Operand const operand = location(lowering, value, position);
+    if (operand.kind == X86_REGISTER) return operand.value;
+    emit(lowering, X86_MOV, x86_register(scratch), operand);
+    return scratch;
+}
+
+static void lower_address(struct Lowering* lowering, uint32_t value, struct X86Operand work)
+{
+    struct AddressTile const* tile = &lowering->selection->addresses[value];
+    uint32_t const position = lowering->allocation->positions[value];
+    uint8_t const base = address_register(lowering, tile->base, position, RAX);
+    uint8_t const index = tile->index == tile->base ? base : address_register(lowering, tile->index, position, RCX);
+    emit(lowering, X86_LEA, work, x86_address(base, index, tile->scale, tile->displacement));
+}
+
+// Into a register that is neither operand, lea adds without the mov
+static bool emit_three_operand_add(struct Lowering* lowering, enum SsaOp op, struct X86Operand work,
+    struct X86Operand left, struct X86Operand right)
+{
+    if (left.kind != X86_REGISTER || same_operand(work, left) || same_operand(work, right)) return false;
+    if (op == SSA_ADD && right.kind == X86_REGISTER)
+    {
+        emit(lowering, X86_LEA, work, x86_address(left.value, right.value, 1, 0));
+        return true;
+    }
+    if ((op != SSA_ADD && op != SSA_SUB) || right.kind != X86_IMMEDIATE) return false;
+    uint32_t const displacement = op == SSA_ADD ? (uint32_t) right.value : 0u - (uint32_t) right.value;
+    emit(lowering, X86_LEA, work, x86_address(left.value, NO_REGISTER, 1, displacement));
+    return true;
+}
+
+// Powers of two are shifts, other factors take the three operand imul
+static void emit_multiply(struct Lowering* lowering, struct X86Operand work, struct X86Operand left, int32_t factor)
+{
+    uint32_t const magnitude = factor;
+    if (magnitude != 0 && (magnitude & (magnitude - 1)) == 0)
+    {
+        emit_move(lowering, work, left);
+        if (magnitude != 1) emit(lowering, X86_SHL, work, x86_immediate(__builtin_ctz(magnitude)));
+        return;
+    }
+    struct X86Instruction const instruction = {
+        .op = X86_IMUL_IMMEDIATE,
+        .destination = work,
+        .source = left,
+        .immediate = factor
+    };
+    add_x86_instruction(&lowering->machine->code, &instruction);
+}
+
+static void lower_operation(struct Lowering* lowering, uint32_t value, struct X86Operand destination,
+    struct X86Operand work)
+{
+    struct SsaInstruction const* instruction = &lowering->ssa->instructions.data[value];
+    uint32_t const position = lowering->allocation->positions[value];
+    struct X86Operand left = {0};
+    struct X86Operand right = {0};
+    if (ssa_operand_count(instruction->op) > 0) left = operand_location(lowering, value, 0, position);
+    if (ssa_operand_count(instruction->op) > 1) right = operand_location(lowering, value, 1, position);
+    // Only operations whose operands can trade places get an immediate on the left
+    bool const swap = left.kind == X86_IMMEDIATE;
+    if (swap)
+    {
+        struct X86Operand const immediate = left;
+        left = right;
+        right = immediate;
+    }
+    switch ((enum SsaOp) instruction->op)
+    {
+        case SSA_CONST:
+        case SSA_UNDEF:
+            // Undefined reads give 0, like they do in the interpreter
+            emit(lowering, X86_MOV, destination, x86_immediate(instruction->constant));
+            break;
+        case SSA_PHI:
+            // Phis are written by the moves on the incoming edges
+            break;
+        case SSA_NOT:
+            if (left.kind == X86_REGISTER) emit(lowering, X86_TEST, left, left);
+            else emit(lowering, X86_CMP, left, x86_immediate(0));
+            emit_set(lowering, CC_E, destination);
+            break;
+        case SSA_NEG:
+        case SSA_BIT_NOT:
+            emit_move(lowering, work, left);
+            emit(lowering, instruction->op == SSA_NEG ? X86_NEG : X86_NOT, work, (struct X86Operand) {0});
+            emit_move(lowering, destination, work);
+            break;
+        case SSA_ADD:
+        case SSA_SUB:
+        case SSA_MUL:
+        case SSA_BIT_AND:
+        case SSA_BIT_OR:
+        case SSA_BIT_XOR:
+            if (instruction->op == SSA_MUL && right.kind == X86_IMMEDIATE) emit_multiply(lowering, work, left, right.value);
+            else if (!emit_three_operand_add(lowering, instruction->op, work, left, right))
+            {
+                // Two address form, `work` must not be the right operand
+                if (same_operand(work, right) && !same_operand(work, left))
+                {
+                    if (instruction->op != SSA_SUB)
+                    {
+                        right = left;
+                        left = work;
+                    }
+                    else work = x86_register(RAX);
+                }
+                emit_move(lowering, work, left);
+                emit(lowering, ALU_OPS[instruction->op], work, right);
+            }
+            emit_move(lowering, destination, work);
+            break;
+        case SSA_DIV:
+        case SSA_REM:
+            emit_move(lowering, x86_register(RAX), left);
+            emit(lowering, X86_CDQ, (struct X86Operand) {0}, (struct X86Operand) {0});
+            emit(lowering, X86_IDIV, right, (struct X86Operand) {0});
+            emit_move(lowering, destination, x86_register(instruction->op == SSA_DIV ? RAX : RDX));
+            break;
+        case SSA_LSHIFT:
+        case SSA_RSHIFT:
+            // The count is masked to 5 bits, like the interpreter does
+            if (right.kind == X86_IMMEDIATE) right.value &= 31;
+            else
+            {
+                emit_move(lowering, x86_register(RCX), right);
+                right = x86_register(RCX);
+            }
+            emit_move(lowering, work, left);
+            if (right.kind != X86_IMMEDIATE || right.value != 0)
+            {
+                emit(lowering, instruction->op == SSA_LSHIFT ? X86_SHL : X86_SAR, work, right);
+            }
+            emit_move(lowering, destination, work);
+            break;
+        case SSA_EQ:
+        case SSA_NE:
+        case SSA_LT:
+        case SSA_LE:
+        case SSA_GT:
+        case SSA_GE:
+            // Either operand may be in memory, not both
+            if (left.kind == X86_FRAME && right.kind == X86_FRAME)
+            {
+                emit_move(lowering, x86_register(RAX), left);
+                left = x86_register(RAX);
+            }
+            emit(lowering, X86_CMP, left, right);
+            emit_set(lowering, swap ? SWAPPED_CONDITIONS[CONDITIONS[instruction->op]] : CONDITIONS[instruction->op],
+                destination);
+            break;
+    }
+}
+
+static void lower_instruction(struct Lowering* lowering, uint32_t value)
+{
+    struct Allocation const* allocation = lowering->allocation;
+    if (!needs_location(allocation, value)) return;
+    struct X86Operand const destination = location(lowering, value, allocation->positions[value]);
+    // Results are computed in their register, or in eax if they live in memory
+    struct X86Operand const work = destination.kind == X86_REGISTER ? destination : x86_register(RAX);
+    if (lowering->selection->tiles[value] != TILE_ADDRESS) lower_operation(lowering, value, destination, work);
+    else
+    {
+        lower_address(lowering, value, work);
+        emit_move(lowering, destination, work);
+    }
+    // The slot has to be current wherever the value is split off its register
+    if (allocation->slots[value] != SSA_NONE && destination.kind == X86_REGISTER)
+    {
+        emit(lowering, X86_MOV, slot_operand(lowering, value), destination);
+    }
+}
+
+static void lower_terminator(struct Lowering* lowering, uint32_t block)
+{
+    struct SsaBlock const* current = &lowering->ssa->blocks.data[block];
+    uint32_t const position = lowering->allocation->block_ends[block];
+    switch ((enum SsaTerminator) current->terminator)
+    {
+        case SSA_RETURN:
+            emit_move(lowering, x86_register(RAX), value_location(lowering, current->value, position));
+            emit_epilogue(lowering);
+            break;
+        case SSA_JUMP:
+            emit_edge_moves(lowering, block, current->successors[0]);
+            if (current->successors[0] != block + 1) emit(lowering, X86_JMP, x86_label(current->successors[0]), (struct X86Operand) {0});
+            break;
+        case SSA_BRANCH:
+        {
+            struct X86Operand const condition = location(lowering, current->value, position);
+            if (condition.kind == X86_REGISTER) emit(lowering, X86_TEST, condition, condition);
+            else emit(lowering, X86_CMP, condition, x86_immediate(0));
+            uint32_t const if_true = branch_label(lowering, block, current->successors[0]);
+            uint32_t const if_false = branch_label(lowering, block, current->successors[1]);
+            if (if_true == block + 1)
+            {
+                emit_condition(lowering, X86_JCC, CC_E, x86_label(if_false));
+                break;
+            }
+            emit_condition(lowering, X86_JCC, CC_NE, x86_label(if_true));
+            if (if_false != block + 1) emit(lowering, X86_JMP, x86_label(if_false), (struct X86Operand) {0});
+            break;
+        }
+    }
+}
+
+struct MachineFunction lower_function(struct SsaFunction const* function, size_t register_count)
+{
+    assert(register_count >= 1 && register_count <= X86_ALLOCATABLE_COUNT);
+    struct Selection selection = select_tiles(function);
+    struct AllocationHints const hints = selection_hints(&selection);
+    struct Allocation allocation = allocate_registers(function, &hints, x86_allocatable_registers, register_count);
+    struct MachineFunction machine = {
+        .symbol = function->symbol,
+        .code = new_x86_code(),
+        .label_count = function->blocks.size,
+        .allocation = allocation.stats
+    };
+    struct Lowering lowering = {
+        .ssa = function,
+        .selection = &selection,
+        .allocation = &allocation,
+        .machine = &machine,
+        .frame_bytes = (allocation.slot_count * 4 + 15) / 16 * 16,
+        .moves = cc_malloc((function->instructions.size + 1) * sizeof(struct Move)),
+        .edges = cc_malloc((function->blocks.size * 2 + 1) * sizeof(uint32_t))
+    };
+    memset(lowering.edges, 0xFF, function->blocks.size * 2 * sizeof(uint32_t));
+    for (uint32_t block = 0; block < function->blocks.size; ++block)
+    {
+        struct SsaBlock const* current = &function->blocks.data[block];
+        for (uint32_t edge = 0; edge < current->predecessor_count; ++edge)
+        {
+            uint32_t const predecessor = function->predecessors.data[current->first_predecessor + edge];
+            uint32_t* slot = &lowering.edges[predecessor * 2 + (function->blocks.data[predecessor].successors[0] == block ? 0 : 1)];
+            // Both successors can be the same block, the first edge is the one taken
+            if (*slot == SSA_NONE) *slot = edge;
+        }
+    }
+    for (size_t idx = 0; idx < sizeof(callee_saved_registers); ++idx)
+    {
+        if (allocation.used_registers & (1u << callee_saved_registers[idx])) lowering.saved_bytes += 8;
+    }
+
+    emit_prologue(&lowering);
+    for (uint32_t block = 0; block < function->blocks.size; ++block)
+    {
+        struct SsaBlock const* current = &function->blocks.data[block];
+        emit(&lowering, X86_LABEL_HERE, x86_label(block), (struct X86Operand) {0});
+        if (current->predecessor_count == 1)
+        {
+            // Moves of a branch edge go to the start of a target with no other way in
+            uint32_t const predecessor = function->predecessors.data[current->first_predecessor];
+            if (function->blocks.data[predecessor].terminator == SSA_BRANCH) emit_edge_moves(&lowering, predecessor, block);
+        }
+        for (uint32_t value = current->first_instruction; value < current->first_instruction + current->instruction_count; ++value)
+        {
+            if (function->instructions.data[value].op != SSA_PHI) lower_instruction(&lowering, value);
+            else if (allocation.slots[value] != SSA_NONE && register_at(&allocation, value, allocation.block_starts[block]) != NO_REGISTER)
+            {
+                emit(&lowering, X86_MOV, slot_operand(&lowering, value), location(&lowering, value, allocation.block_starts[block]));
+            }
+        }
+        lower_terminator(&lowering, block);
+    }
+    for (size_t idx = 0; idx < lowering.stub_count; ++idx)
+    {
+        struct EdgeStub const* stub = &lowering.stubs[idx];
+        emit(&lowering, X86_LABEL_HERE, x86_label(stub->label), (struct X86Operand) {0});
+        emit_edge_moves(&lowering, stub->from, stub->to);
+        emit(&lowering, X86_JMP, x86_label(stub->to), (struct X86Operand) {0});
+    }
+    free(lowering.moves);
+    free(lowering.edges);
+    free(lowering.stubs);
+    free_allocation(&allocation);
+    free_selection(&selection);
+    return machine;
+}
+
+void free_machine_function(struct MachineFunction* function)
+{
+    free(function->code.data);
+    *function = (struct MachineFunction) {0};
+}
+
+static char const* const REGISTER_NAMES_64[] = {
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+};
+static char const* const REGISTER_NAMES_32[] = {
+    "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi", "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"
+};
+static char const* const REGISTER_NAMES_8[] = {
+    "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil", "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"
+};
+static char const* const CONDITION_NAMES[] = {
+    [CC_E] = "e", [CC_NE] = "ne", [CC_L] = "l", [CC_LE] = "le", [CC_G] = "g", [CC_GE] = "ge"
+};
+static char const* const OP_NAMES[] = {
+    [X86_MOV] = "mov", [X86_ADD] = "add", [X86_SUB] = "sub", [X86_IMUL] = "imul", [X86_IMUL_IMMEDIATE] = "imul",
+    [X86_LEA] = "lea", [X86_AND] = "and",
+    [X86_OR] = "or", [X86_XOR] = "xor", [X86_CMP] = "cmp", [X86_TEST] = "test", [X86_NEG] = "neg",
+    [X86_NOT] = "not", [X86_SHL] = "shl", [X86_SAR] = "sar", [X86_CDQ] = "cdq", [X86_IDIV] = "idiv",
+    [X86_SETCC] = "set", [X86_MOVZX] = "movzx", [X86_JMP] = "jmp", [X86_JCC] = "j", [X86_PUSH] = "push",
+    [X86_POP] = "pop", [X86_RET] = "ret",
+};
+
+static void print_operand(char* buffer, size_t size, struct X86Operand operand, char const* const* register_names)
+{
+    switch ((enum X86OperandKind) operand.kind)
+    {
+        case X86_NONE:
+            buffer[0] = '\0';
+            break;
+        case X86_REGISTER:
+            snprintf(buffer, size, "%s", register_names[operand.value]);
+            break;
+        case X86_IMMEDIATE:
+            snprintf(buffer, size, "%d", operand.value);
+            break;
+        case X86_FRAME:
+            snprintf(buffer, size, "dword [rbp - %d]", operand.value);
+            break;
+        case X86_LABEL:
+            snprintf(buffer, size, ".L%d", operand.value);
+            break;
+        case X86_ADDRESS:
+        {
+            // Always 64 bit registers
+            int length = snprintf(buffer, size, "[%s", REGISTER_NAMES_64[operand.base != NO_REGISTER ? operand.base : operand.index]);
+            if (operand.base != NO_REGISTER && operand.index != NO_REGISTER)
+            {
+                length += snprintf(buffer + length, size - length, " + %s", REGISTER_NAMES_64[operand.index]);
+            }
+            if (operand.scale != 1) length += snprintf(buffer + length, size - length, "*%d", operand.scale);
+            if (operand.value > 0) length += snprintf(buffer + length, size - length, " + %d", operand.value);
+            if (operand.value < 0) length += snprintf(buffer + length, size - length, " - %u", 0u - (uint32_t) operand.value);
+            snprintf(buffer + length, size - length, "]");
+            break;
+        }
+    }
+}
+
+struct StringArray print_machine_function(struct MachineFunction const* function)
+{
+    struct StringArray lines = new_string_array();
+    char* label = format("%s:", symbol_name(function->symbol));
+    add_string(&lines, label);
+    free(label);
+    for (size_t idx = 0; idx < function->code.size; ++idx)
+    {
+        struct X86Instruction const* instruction = &function->code.data[idx];
+        char const* const* names = instruction->wide ? REGISTER_NAMES_64 : REGISTER_NAMES_32;
+        char destination[32];
+        char source[32];
+        print_operand(destination, sizeof(destination), instruction->destination,
+            instruction->op == X86_SETCC ? REGISTER_NAMES_8 : names);
+        bool const byte_source = instruction->op == X86_MOVZX || instruction->op == X86_SHL || instruction->op == X86_SAR;
+        print_operand(source, sizeof(source), instruction->source, byte_source ? REGISTER_NAMES_8 : names);
+        char* line;
+        if (instruction->op == X86_LABEL_HERE) line = format("%s:", destination);
+        else if (instruction->op == X86_SETCC || instruction->op == X86_JCC)
+        {
+            line = format("    %s%s %s", OP_NAMES[instruction->op], CONDITION_NAMES[instruction->condition], destination);
+        }
+        else if (instruction->op == X86_IMUL_IMMEDIATE)
+        {
+            line = format("    %s %s, %s, %d", OP_NAMES[instruction->op], destination, source, instruction->immediate);
+        }
+        else if (instruction->source.kind != X86_NONE)
+        {
+            line = format("    %s %s, %s", OP_NAMES[instruction->op], destination, source);
+        }
+        else if (instruction->destination.kind != X86_NONE) line = format("    %s %s", OP_NAMES[instruction->op], destination);
+        else line = format("    %s", OP_NAMES[instruction->op]);
+        add_string(&lines, line);
+        free(line);
+    }
+    return lines;
+}
+
+struct MachineFunction codegen_function(struct VirtualMachineCode const* tape)
 {
-    UNUSED(tape);
+    struct SsaFunction ssa;
+    char* error = build_ssa(tape, &ssa);
+    if (error != NULL)
+    {
+        struct ErrorCleanup cleanup = {.release = free, .context = error};
+        push_error_cleanup(&cleanup);
+        compile_error("%s", error);
+    }
+    order_by_register_need(&ssa);
+    struct MachineFunction machine = lower_function(&ssa, X86_ALLOCATABLE_COUNT);
+    free_ssa_function(&ssa);
+    return machine;
 }
 
-struct StringArray codegen(struct VirtualMachineCode const* tape)
+struct StringArray codegen(struct StringArray const* functions, size_t function_count)
 {
     struct StringArray arr = new_string_array();
     add_string(&arr, "section .text");
     add_string(&arr, "global main");
 
-    codegen_function(tape);
+    for (size_t function = 0; function < function_count; ++function)
+    {
+        for (size_t line = 0; line < functions[function].size; ++line)
+        {
+            add_string(&arr, functions[function].data[line]);
+        }
+    }
     char const* security_note =  "\nsection .note.GNU-stack noalloc noexec nowrite progbits";
     add_string(&arr, security_note);
     return arr;
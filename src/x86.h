@@ -1,4 +1,110 @@
 #pragma once
 #include "bytecode.h"
+#include "regalloc.h"
+#include "ssa.h"
 
-struct StringArray codegen(struct VirtualMachineCode const* tape);
+// In encoding order
+enum X86Register
+{
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+enum X86OperandKind
+{
+    X86_NONE,
+    X86_REGISTER,
+    X86_IMMEDIATE,
+    X86_FRAME, // dword [rbp - value]
+    X86_LABEL,
+    X86_ADDRESS, // [base + index * scale + value] of 64 bit registers, for lea
+};
+
+struct X86Operand
+{
+    uint8_t kind; // enum X86OperandKind
+    uint8_t base; // X86_ADDRESS, NO_REGISTER if there is none
+    uint8_t index; // X86_ADDRESS, NO_REGISTER if there is none
+    uint8_t scale; // X86_ADDRESS: 1, 2, 4 or 8
+    int32_t value;
+};
+
+enum X86Op
+{
+    // 32 bit unless the instruction is wide, destination first
+    X86_MOV,
+    X86_ADD,
+    X86_SUB,
+    X86_IMUL,
+    X86_IMUL_IMMEDIATE, // destination = source * immediate
+    X86_LEA, // Of an X86_ADDRESS source
+    X86_AND,
+    X86_OR,
+    X86_XOR,
+    X86_CMP,
+    X86_TEST,
+    X86_NEG,
+    X86_NOT,
+    X86_SHL, // By cl or an immediate
+    X86_SAR, // By cl or an immediate
+    X86_CDQ,
+    X86_IDIV, // edx:eax by the operand
+    X86_SETCC, // Low byte of the register
+    X86_MOVZX, // From the low byte of the source register
+    X86_JMP,
+    X86_JCC,
+    X86_PUSH, // 64 bit
+    X86_POP, // 64 bit
+    X86_RET,
+    X86_LABEL_HERE, // Not an instruction, defines the label in `destination`
+};
+
+enum X86Condition
+{
+    CC_E,
+    CC_NE,
+    CC_L,
+    CC_LE,
+    CC_G,
+    CC_GE,
+};
+
+struct X86Instruction
+{
+    uint8_t op; // enum X86Op
+    uint8_t condition; // enum X86Condition, SETCC and JCC
+    bool wide; // 64 bit operands
+    struct X86Operand destination;
+    struct X86Operand source;
+    int32_t immediate; // X86_IMUL_IMMEDIATE
+};
+
+DEFINE_NEW_DYN_ARRAY(X86Code, struct X86Instruction, new_x86_code, add_x86_instruction);
+
+// Lowered function, blocks get the labels with their index
+struct MachineFunction
+{
+    uint32_t symbol;
+    struct X86Code code;
+    uint32_t label_count;
+    struct AllocationStats allocation;
+};
+
+// Registers the allocator hands out: the ones a leaf function may clobber
+// first, then the callee saved ones. rax, rcx and rdx are kept for idiv,
+// shift counts, the return value and moving spilled values around.
+#define X86_ALLOCATABLE_COUNT 11
+extern uint8_t const x86_allocatable_registers[X86_ALLOCATABLE_COUNT];
+
+// Instruction selection (see select.h), register allocation and lowering. Only
+// the first `register_count` allocatable registers are used (for testing the
+// spill paths).
+struct MachineFunction lower_function(struct SsaFunction const* function, size_t register_count);
+void free_machine_function(struct MachineFunction* function);
+// NASM syntax, one line per instruction
+struct StringArray print_machine_function(struct MachineFunction const* function);
+
+// SSA construction and lowering of one function, independent from the others
+struct MachineFunction codegen_function(struct VirtualMachineCode const* tape);
+// Whole file, functions in the given order
+struct StringArray codegen(struct StringArray const* functions, size_t function_count);
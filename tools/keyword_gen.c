@@ -0,0 +1,80 @@
+// Generates src/keyword_table.h: a perfect hash table over src/keywords.def,
+// so the lexer classifies identifiers with one hash and a single memcmp.
+// Usage: keyword_gen > src/keyword_table.h
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "../src/keyword_hash.h"
+
+struct Keyword
+{
+    char const* text;
+    char const* token;
+};
+
+static struct Keyword const keywords[] = {
+#define KEYWORD(text, token) {#text, #token},
+#include "../src/keywords.def"
+#undef KEYWORD
+};
+
+#define KEYWORD_COUNT (sizeof(keywords) / sizeof(struct Keyword))
+#define MAX_BITS 10
+#define SEEDS_PER_SIZE (1u << 22)
+
+static bool is_collision_free(uint32_t seed, unsigned bits)
+{
+    static uint32_t used_in_round[1 << MAX_BITS];
+    static uint32_t round = 0;
+    ++round;
+    for (size_t idx = 0; idx < KEYWORD_COUNT; ++idx)
+    {
+        uint32_t slot = keyword_hash(keywords[idx].text, strlen(keywords[idx].text), seed, bits);
+        if (used_in_round[slot] == round) return false;
+        used_in_round[slot] = round;
+    }
+    return true;
+}
+
+int main()
+{
+    for (size_t idx = 0; idx < KEYWORD_COUNT; ++idx)
+    {
+        size_t length = strlen(keywords[idx].text);
+        if (length < KEYWORD_MIN_LENGTH || length > KEYWORD_MAX_LENGTH)
+        {
+            fprintf(stderr, "Keyword %s is outside of the supported length range\n", keywords[idx].text);
+            return 1;
+        }
+    }
+
+    // Smallest table first, seeds come from a fixed LCG so the output is reproducible
+    for (unsigned bits = 6; bits <= MAX_BITS; ++bits)
+    {
+        if ((1u << bits) < KEYWORD_COUNT) continue;
+        uint32_t state = 0x9E3779B9u;
+        for (uint32_t attempt = 0; attempt < SEEDS_PER_SIZE; ++attempt)
+        {
+            state = state * 1664525u + 1013904223u;
+            uint32_t seed = state | 1;
+            if (!is_collision_free(seed, bits)) continue;
+
+            printf("// Generated by tools/keyword_gen.c from src/keywords.def, do not edit\n");
+            printf("#pragma once\n\n");
+            printf("#define KEYWORD_HASH_SEED 0x%08Xu\n", seed);
+            printf("#define KEYWORD_HASH_BITS %u\n\n", bits);
+            printf("static struct KeywordMapElem const keyword_table[1 << KEYWORD_HASH_BITS] = {\n");
+            for (size_t idx = 0; idx < KEYWORD_COUNT; ++idx)
+            {
+                size_t length = strlen(keywords[idx].text);
+                printf("    [%u] = {\"%s\", %zu, %s},\n",
+                    keyword_hash(keywords[idx].text, length, seed, bits),
+                    keywords[idx].text, length, keywords[idx].token);
+            }
+            printf("};\n");
+            return 0;
+        }
+    }
+    fprintf(stderr, "No perfect hash seed found for %zu keywords\n", KEYWORD_COUNT);
+    return 1;
+}